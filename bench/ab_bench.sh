@@ -0,0 +1,47 @@
+#!/bin/sh
+# runs loopback_bench from two builds in turn and prints the median, min
+# and max of one of its CSV columns for each, so a change can be compared
+# with the tree without it on a noisy machine
+#
+# usage: bench/ab_bench.sh other_tree runs column [loopback_bench options]
+#
+# other_tree is a second checkout with its own loopback_bench built, e.g. a
+# git worktree with the change reverted; the one in the current directory
+# is the other side. column is a name from the CSV header, packets_per_s
+# or mb_per_s say. Each of the runs runs both builds once, alternating so
+# that drift on the machine hits both alike. -o csv is added to the options
+
+if [ $# -lt 3 ]; then
+    echo "usage: $0 other_tree runs column [loopback_bench options]" >&2
+    exit 1
+fi
+other=$1
+runs=$2
+column=$3
+shift 3
+
+out=$(mktemp) || exit 1
+trap 'rm -f "$out"' EXIT
+
+i=0
+while [ $i -lt "$runs" ]; do
+    for tree in "$other" .; do
+        "$tree/loopback_bench" -o csv "$@" |
+            awk -F, -v tree="$tree" -v column="$column" '
+                NR == 1 { for (i = 1; i <= NF; i++) if ($i == column) c = i }
+                NR > 1 && c { print tree, $c }' >> "$out" || exit 1
+    done
+    i=$((i + 1))
+done
+
+for tree in "$other" .; do
+    awk -v tree="$tree" '$1 == tree { print $2 }' "$out" | sort -g |
+        awk -v tree="$tree" -v column="$column" '
+            { v[NR] = $1 }
+            END {
+                if (NR == 0) { print tree ": no runs" > "/dev/stderr"; exit 1 }
+                m = NR % 2 ? v[(NR + 1) / 2] : (v[NR / 2] + v[NR / 2 + 1]) / 2
+                printf "%-24s %s median %g min %g max %g runs %d\n",
+                       tree, column, m, v[1], v[NR], NR
+            }'
+done
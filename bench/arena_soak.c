@@ -0,0 +1,463 @@
+#include <libssh/callbacks.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+#include <libssh/arena.h>
+
+#include <malloc.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// soak test for the packet arena: a client and a server session of the
+// hosted libssh, joined by ssh_pair_new(), push channel data of varying
+// size at each other for as long as asked, and every interval the harness
+// prints the arena counters of the server session next to what the heap
+// went through
+//
+// usage: arena_soak -L hostkey [-D seconds] [-i interval] [-b max write]
+//                   [-c writes per channel] [-R reconnect seconds]
+//                   [-o json|csv]
+//
+// every channel takes -c writes of 1 to -b bytes, then is closed and the
+// next one opened, and with -R the whole pair is torn down and handshaken
+// again that often, the way the device reconnects. heap_allocs and
+// heap_frees count the malloc family calls made by libssh and this file,
+// through the --wrap options in the Makefile; the crypto libraries
+// allocate on their own and are not in them. heap_in_use, heap_free and
+// fragmentation come from mallinfo2() for the whole process:
+// fragmentation is the part of the heap glibc holds that is free, so a
+// heap that keeps growing around holes shows up as a rising figure. Build
+// with -DSSH_PACKET_ARENA_SIZE=0 -DSSH_PACKET_ARENA_MAX_SIZE=0 for the
+// numbers without the arena: every string then goes to the heap
+
+#define MAX_WRITE (32 * 1024)
+
+static const char *host_key = NULL;
+static long duration = 60;
+static long interval = 10;
+static size_t max_write = 16 * 1024;
+static long channel_writes = 1000;
+static long reconnect = 0;
+static int csv = 0;
+
+static uint8_t payload[MAX_WRITE];
+
+// malloc family and strdup calls, through the --wrap options in the Makefile
+static uint64_t heap_allocs;
+static uint64_t heap_frees;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+void __real_free(void *ptr);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+// a realloc that moves the block counts as one of each
+void *__wrap_realloc(void *ptr, size_t size) {
+    void *p = __real_realloc(ptr, size);
+
+    if (p != ptr) {
+        __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+        if (ptr != NULL) {
+            __atomic_fetch_add(&heap_frees, 1, __ATOMIC_RELAXED);
+        }
+    }
+    return p;
+}
+
+char *__wrap_strdup(const char *s) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strndup(s, n);
+}
+
+void __wrap_free(void *ptr) {
+    if (ptr != NULL) {
+        __atomic_fetch_add(&heap_frees, 1, __ATOMIC_RELAXED);
+    }
+    __real_free(ptr);
+}
+
+struct conn {
+    ssh_session client;
+    ssh_session server;
+    ssh_bind bind;
+    ssh_pair pair;
+    ssh_channel server_channel;
+    struct ssh_server_callbacks_struct server_cb;
+    struct ssh_channel_callbacks_struct channel_cb;
+    struct ssh_counter_struct raw;
+};
+
+// what the sessions torn down so far added up to, so the totals go on
+// across reconnects
+struct totals {
+    uint64_t bytes;
+    uint64_t packets;
+    uint64_t channels;
+    uint64_t sessions;
+    struct ssh_arena_stats arena;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int server_auth_password(ssh_session session, const char *user,
+                                const char *password, void *userdata) {
+    (void)session;
+    (void)user;
+    (void)password;
+    (void)userdata;
+    return SSH_AUTH_SUCCESS;
+}
+
+static int server_discard(ssh_session session, ssh_channel channel,
+                          void *data, uint32_t len, int is_stderr,
+                          void *userdata) {
+    (void)session;
+    (void)channel;
+    (void)data;
+    (void)is_stderr;
+    (void)userdata;
+    return len;
+}
+
+static void server_eof(ssh_session session, ssh_channel channel,
+                       void *userdata) {
+    (void)session;
+    (void)userdata;
+    ssh_channel_request_send_exit_status(channel, 0);
+    ssh_channel_send_eof(channel);
+    ssh_channel_close(channel);
+}
+
+static int server_exec(ssh_session session, ssh_channel channel,
+                       const char *command, void *userdata) {
+    (void)session;
+    (void)channel;
+    (void)command;
+    (void)userdata;
+    return 0;
+}
+
+static ssh_channel server_channel_open(ssh_session session, void *userdata) {
+    struct conn *c = userdata;
+
+    // the previous channel is closed by the time the client opens the next
+    if (c->server_channel != NULL) {
+        ssh_channel_free(c->server_channel);
+    }
+    c->server_channel = ssh_channel_new(session);
+    if (c->server_channel == NULL) {
+        return NULL;
+    }
+    c->channel_cb.userdata = c;
+    c->channel_cb.channel_data_function = server_discard;
+    c->channel_cb.channel_exec_request_function = server_exec;
+    c->channel_cb.channel_eof_function = server_eof;
+    ssh_callbacks_init(&c->channel_cb);
+    ssh_set_channel_callbacks(c->server_channel, &c->channel_cb);
+    return c->server_channel;
+}
+
+static int client_auth(void *userdata) {
+    struct conn *c = userdata;
+
+    switch (ssh_userauth_password(c->client, NULL, "soak")) {
+    case SSH_AUTH_SUCCESS:
+        return SSH_OK;
+    case SSH_AUTH_AGAIN:
+        return SSH_AGAIN;
+    default:
+        return SSH_ERROR;
+    }
+}
+
+static void close_conn(struct conn *c) {
+    if (c->client != NULL) {
+        ssh_disconnect(c->client);
+    }
+    if (c->server_channel != NULL) {
+        ssh_channel_free(c->server_channel);
+    }
+    ssh_pair_free(c->pair);
+    if (c->server != NULL) {
+        ssh_free(c->server);
+    }
+    if (c->bind != NULL) {
+        ssh_bind_free(c->bind);
+    }
+    if (c->client != NULL) {
+        ssh_free(c->client);
+    }
+    memset(c, 0, sizeof(*c));
+}
+
+// handshake and auth run on the pair without blocking, after that the
+// client is blocking again and its polls serve the server as well
+static int open_conn(struct conn *c) {
+    memset(c, 0, sizeof(*c));
+    c->client = ssh_new();
+    c->server = ssh_new();
+    c->bind = ssh_bind_new();
+    if (c->client == NULL || c->server == NULL || c->bind == NULL) {
+        goto error;
+    }
+    ssh_set_counters(c->client, NULL, &c->raw);
+    ssh_bind_options_set(c->bind, SSH_BIND_OPTIONS_HOSTKEY, host_key);
+    c->pair = ssh_pair_new(c->bind, c->client, c->server);
+    if (c->pair == NULL) {
+        fprintf(stderr, "pair: %s\n", ssh_get_error(c->bind));
+        goto error;
+    }
+    ssh_set_auth_methods(c->server, SSH_AUTH_METHOD_PASSWORD);
+    c->server_cb.userdata = c;
+    c->server_cb.auth_password_function = server_auth_password;
+    c->server_cb.channel_open_request_session_function = server_channel_open;
+    ssh_callbacks_init(&c->server_cb);
+    ssh_set_server_callbacks(c->server, &c->server_cb);
+
+    if (ssh_pair_handshake(c->pair) != SSH_OK ||
+        ssh_pair_run(c->pair, client_auth, c) != SSH_OK) {
+        fprintf(stderr, "connect: %s\n", ssh_get_error(c->client));
+        goto error;
+    }
+    ssh_set_blocking(c->client, 1);
+    return 0;
+
+error:
+    close_conn(c);
+    return -1;
+}
+
+// one channel: -c writes of varying size, then EOF and the exit status
+static int run_channel(struct conn *c, uint32_t *seed, uint64_t *bytes) {
+    ssh_channel channel = ssh_channel_new(c->client);
+    uint32_t len;
+    char buf[64];
+    long i;
+    int rc = -1;
+
+    if (channel == NULL) {
+        return -1;
+    }
+    if (ssh_channel_open_session(channel) != SSH_OK ||
+        ssh_channel_request_exec(channel, "soak") != SSH_OK) {
+        goto out;
+    }
+    for (i = 0; i < channel_writes; i++) {
+        *seed = *seed * 1103515245 + 12345;
+        len = 1 + (*seed >> 8) % max_write;
+        if (ssh_channel_write(channel, payload, len) != (int)len) {
+            goto out;
+        }
+        *bytes += len;
+    }
+    if (ssh_channel_send_eof(channel) != SSH_OK) {
+        goto out;
+    }
+    while (!ssh_channel_is_eof(channel)) {
+        if (ssh_channel_read(channel, buf, sizeof(buf), 0) < 0) {
+            goto out;
+        }
+    }
+    rc = 0;
+
+out:
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+    return rc;
+}
+
+static void add_arena(struct ssh_arena_stats *sum,
+                      const struct ssh_arena_stats *s) {
+    sum->allocs += s->allocs;
+    sum->overflows += s->overflows;
+    sum->resets += s->resets;
+    sum->size = s->size;
+    if (s->peak > sum->peak) {
+        sum->peak = s->peak;
+    }
+}
+
+static void print_header(void) {
+    if (csv) {
+        printf("seconds,sessions,channels,bytes,packets,arena_allocs,"
+               "arena_overflows,arena_resets,arena_size,arena_peak,"
+               "heap_allocs,heap_frees,heap_allocs_per_packet,heap_in_use,"
+               "heap_free,fragmentation\n");
+    }
+}
+
+// s holds the totals with the live session's counters already added
+static void print_report(double seconds, const struct totals *s,
+                         uint64_t allocs, uint64_t frees,
+                         double allocs_per_packet) {
+    struct mallinfo2 mi = mallinfo2();
+    double frag = mi.arena > 0 ? (double)mi.fordblks / mi.arena : 0;
+
+    if (csv) {
+        printf("%.0f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%zu,%zu,%llu,%llu,"
+               "%.3f,%zu,%zu,%.3f\n",
+               seconds, (unsigned long long)s->sessions,
+               (unsigned long long)s->channels,
+               (unsigned long long)s->bytes,
+               (unsigned long long)s->packets,
+               (unsigned long long)s->arena.allocs,
+               (unsigned long long)s->arena.overflows,
+               (unsigned long long)s->arena.resets, s->arena.size,
+               s->arena.peak, (unsigned long long)allocs,
+               (unsigned long long)frees, allocs_per_packet,
+               mi.uordblks + mi.hblkhd, mi.fordblks, frag);
+    } else {
+        printf("{\"seconds\":%.0f,\"sessions\":%llu,\"channels\":%llu,"
+               "\"bytes\":%llu,\"packets\":%llu,\"arena_allocs\":%llu,"
+               "\"arena_overflows\":%llu,\"arena_resets\":%llu,"
+               "\"arena_size\":%zu,\"arena_peak\":%zu,\"heap_allocs\":%llu,"
+               "\"heap_frees\":%llu,\"heap_allocs_per_packet\":%.3f,"
+               "\"heap_in_use\":%zu,\"heap_free\":%zu,"
+               "\"fragmentation\":%.3f}\n",
+               seconds, (unsigned long long)s->sessions,
+               (unsigned long long)s->channels,
+               (unsigned long long)s->bytes,
+               (unsigned long long)s->packets,
+               (unsigned long long)s->arena.allocs,
+               (unsigned long long)s->arena.overflows,
+               (unsigned long long)s->arena.resets, s->arena.size,
+               s->arena.peak, (unsigned long long)allocs,
+               (unsigned long long)frees, allocs_per_packet,
+               mi.uordblks + mi.hblkhd, mi.fordblks, frag);
+    }
+    fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+    struct totals done = {0};
+    struct totals live;
+    struct ssh_arena_stats arena;
+    struct conn c;
+    uint64_t bytes = 0;
+    uint64_t last_allocs = 0, last_packets = 0, allocs, packets;
+    uint32_t seed = 1;
+    double start, last_report, opened, t;
+    int opt;
+    int rc = 1;
+
+    while ((opt = getopt(argc, argv, "L:D:i:b:c:R:o:")) != -1) {
+        switch (opt) {
+        case 'L':
+            host_key = optarg;
+            break;
+        case 'D':
+            duration = atol(optarg);
+            break;
+        case 'i':
+            interval = atol(optarg);
+            break;
+        case 'b':
+            max_write = strtoul(optarg, NULL, 0);
+            if (max_write == 0 || max_write > MAX_WRITE) {
+                fprintf(stderr, "max write must be 1..%d\n", MAX_WRITE);
+                return 1;
+            }
+            break;
+        case 'c':
+            channel_writes = atol(optarg);
+            break;
+        case 'R':
+            reconnect = atol(optarg);
+            break;
+        case 'o':
+            csv = strcmp(optarg, "csv") == 0;
+            break;
+        default:
+            host_key = NULL;
+            break;
+        }
+    }
+    if (host_key == NULL || interval < 1 || channel_writes < 1) {
+        fprintf(stderr, "usage: %s -L hostkey [-D seconds] [-i interval] "
+                        "[-b max write] [-c writes per channel] "
+                        "[-R reconnect seconds] [-o json|csv]\n", argv[0]);
+        return 1;
+    }
+    memset(payload, 'x', sizeof(payload));
+
+    ssh_init();
+    print_header();
+    if (open_conn(&c) != 0) {
+        goto out;
+    }
+    done.sessions = 1;
+    start = last_report = opened = now();
+    for (;;) {
+        if (run_channel(&c, &seed, &bytes) != 0) {
+            fprintf(stderr, "channel: %s\n", ssh_get_error(c.client));
+            goto out;
+        }
+        done.channels++;
+
+        t = now();
+        if (reconnect > 0 && t - opened >= reconnect && t - start < duration) {
+            ssh_get_packet_arena_stats(c.server, &arena);
+            add_arena(&done.arena, &arena);
+            done.packets += c.raw.in_packets + c.raw.out_packets;
+            close_conn(&c);
+            if (open_conn(&c) != 0) {
+                goto out;
+            }
+            done.sessions++;
+            opened = t;
+        }
+        if (t - last_report < interval && t - start < duration) {
+            continue;
+        }
+
+        live = done;
+        live.bytes = bytes;
+        live.packets += c.raw.in_packets + c.raw.out_packets;
+        ssh_get_packet_arena_stats(c.server, &arena);
+        add_arena(&live.arena, &arena);
+        allocs = __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+        packets = live.packets;
+        print_report(t - start, &live, allocs,
+                     __atomic_load_n(&heap_frees, __ATOMIC_RELAXED),
+                     packets > last_packets
+                         ? (double)(allocs - last_allocs) /
+                               (packets - last_packets)
+                         : 0);
+        last_allocs = allocs;
+        last_packets = packets;
+        last_report = t;
+        if (t - start >= duration) {
+            break;
+        }
+    }
+    rc = 0;
+
+out:
+    close_conn(&c);
+    ssh_finalize();
+    return rc;
+}
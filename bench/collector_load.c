@@ -0,0 +1,189 @@
+#include <libssh/libssh.h>
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// load generator for the collector: every client thread plays one logger
+// after another, each a fresh session that authenticates, pushes one file
+// with scp and disconnects
+//
+// usage: collector_load [-h host] [-p port] [-u user] [-P password]
+//                       [-c clients] [-n sessions per client] [-s file size]
+
+#define CHUNK_SIZE 32768
+
+const char *ssh_host = "localhost";
+int ssh_port = 2222;
+const char *ssh_user = "username";
+const char *ssh_password = "password";
+
+static int clients = 16;
+static int sessions_per_client = 50;
+static size_t file_size = 256 * 1024;
+
+static uint8_t payload[CHUNK_SIZE];
+
+struct client {
+    pthread_t thread;
+    int index;
+    int ok;
+    int failed;
+    uint64_t bytes;
+    double connect_time;  // connect + kex + auth, summed over sessions
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int upload(struct client *cl, int n) {
+    ssh_session session = ssh_new();
+    ssh_scp scp = NULL;
+    char name[64];
+    size_t off;
+    double t0;
+    int rc = -1;
+
+    if (session == NULL) {
+        return -1;
+    }
+    ssh_options_set(session, SSH_OPTIONS_HOST, ssh_host);
+    ssh_options_set(session, SSH_OPTIONS_PORT, &ssh_port);
+    ssh_options_set(session, SSH_OPTIONS_USER, ssh_user);
+
+    t0 = now();
+    if (ssh_connect(session) != SSH_OK ||
+        ssh_userauth_password(session, NULL, ssh_password) !=
+            SSH_AUTH_SUCCESS) {
+        fprintf(stderr, "client %d: %s\n", cl->index, ssh_get_error(session));
+        goto out;
+    }
+    cl->connect_time += now() - t0;
+
+    scp = ssh_scp_new(session, SSH_SCP_WRITE, ".");
+    if (scp == NULL || ssh_scp_init(scp) != SSH_OK) {
+        goto out;
+    }
+
+    snprintf(name, sizeof(name), "load-%d-%d.log", cl->index, n);
+    if (ssh_scp_push_file(scp, name, file_size, S_IRUSR | S_IWUSR) !=
+        SSH_OK) {
+        goto out;
+    }
+    for (off = 0; off < file_size; off += CHUNK_SIZE) {
+        size_t len = file_size - off < CHUNK_SIZE ? file_size - off
+                                                  : CHUNK_SIZE;
+        if (ssh_scp_write(scp, payload, len) != SSH_OK) {
+            goto out;
+        }
+    }
+    cl->bytes += file_size;
+    rc = 0;
+
+out:
+    if (rc != 0) {
+        fprintf(stderr, "client %d: %s\n", cl->index, ssh_get_error(session));
+    }
+    if (scp != NULL) {
+        ssh_scp_close(scp);
+        ssh_scp_free(scp);
+    }
+    ssh_disconnect(session);
+    ssh_free(session);
+    return rc;
+}
+
+static void *client_main(void *arg) {
+    struct client *cl = arg;
+    int i;
+
+    for (i = 0; i < sessions_per_client; i++) {
+        if (upload(cl, i) == 0) {
+            cl->ok++;
+        } else {
+            cl->failed++;
+        }
+    }
+    return NULL;
+}
+
+int main(int argc, char **argv) {
+    struct client *cls;
+    uint64_t bytes = 0;
+    double connect_time = 0;
+    double t0, elapsed;
+    int ok = 0, failed = 0;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "h:p:u:P:c:n:s:")) != -1) {
+        switch (opt) {
+        case 'h':
+            ssh_host = optarg;
+            break;
+        case 'p':
+            ssh_port = atoi(optarg);
+            break;
+        case 'u':
+            ssh_user = optarg;
+            break;
+        case 'P':
+            ssh_password = optarg;
+            break;
+        case 'c':
+            clients = atoi(optarg);
+            break;
+        case 'n':
+            sessions_per_client = atoi(optarg);
+            break;
+        case 's':
+            file_size = strtoul(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-u user] "
+                            "[-P password] [-c clients] [-n sessions] "
+                            "[-s size]\n", argv[0]);
+            return 1;
+        }
+    }
+
+    cls = calloc(clients, sizeof(*cls));
+    if (cls == NULL) {
+        return 1;
+    }
+    for (i = 0; i < CHUNK_SIZE; i++) {
+        payload[i] = "0123456789,=.\r\n"[i % 15];
+    }
+
+    ssh_init();
+    t0 = now();
+    for (i = 0; i < clients; i++) {
+        cls[i].index = i;
+        pthread_create(&cls[i].thread, NULL, client_main, &cls[i]);
+    }
+    for (i = 0; i < clients; i++) {
+        pthread_join(cls[i].thread, NULL);
+        ok += cls[i].ok;
+        failed += cls[i].failed;
+        bytes += cls[i].bytes;
+        connect_time += cls[i].connect_time;
+    }
+    elapsed = now() - t0;
+    ssh_finalize();
+
+    printf("%d clients, %d sessions ok, %d failed, %zu bytes each\n",
+           clients, ok, failed, file_size);
+    printf("%.1f sessions/s, %.2f MB/s, connect %.1f ms avg\n",
+           ok / elapsed, bytes / elapsed / 1e6,
+           ok > 0 ? connect_time / ok * 1e3 : 0.0);
+
+    free(cls);
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,210 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "segment_compress.h"
+
+// hosted ratio/throughput benchmark for the segment compressor
+//
+// usage: compress_bench [-o out.lz4] [log files...]
+// with no files it generates a synthetic log in the shape of what the
+// Mega sends over serial
+
+#define SYNTHETIC_LINES 20000
+#define ROUNDS 20
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static uint32_t lcg(uint32_t *state) {
+    *state = *state * 1103515245U + 12345U;
+    return *state >> 16;
+}
+
+static uint8_t *synthetic_log(size_t *len) {
+    size_t cap = SYNTHETIC_LINES * 128;
+    uint8_t *buf = malloc(cap);
+    uint32_t seed = 311;
+    long t = 1681000000;
+    int batt = 1261, panel = 1820, temp = 234, irr = 612;
+    size_t off = 0;
+    int i;
+
+    if (buf == NULL) {
+        return NULL;
+    }
+
+    for (i = 0; i < SYNTHETIC_LINES; i++) {
+        batt += (int)(lcg(&seed) % 5) - 2;
+        panel += (int)(lcg(&seed) % 21) - 10;
+        temp += (int)(lcg(&seed) % 3) - 1;
+        irr += (int)(lcg(&seed) % 41) - 20;
+        off += snprintf((char *)buf + off, cap - off,
+                        "%ld,batt_v=%d.%02d,panel_v=%d.%02d,temp_c=%d.%d,"
+                        "irr=%d,status=OK\r\n",
+                        t + i, batt / 100, batt % 100, panel / 100,
+                        panel % 100, temp / 10, temp % 10, irr);
+    }
+
+    *len = off;
+    return buf;
+}
+
+static uint8_t *read_file(const char *path, size_t *len) {
+    FILE *f = fopen(path, "rb");
+    uint8_t *buf;
+    long size;
+
+    if (f == NULL) {
+        return NULL;
+    }
+    fseek(f, 0, SEEK_END);
+    size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+    buf = malloc(size > 0 ? size : 1);
+    if (buf != NULL && fread(buf, 1, size, f) != (size_t)size) {
+        free(buf);
+        buf = NULL;
+    }
+    fclose(f);
+    *len = size;
+    return buf;
+}
+
+// compresses the whole input as one frame, returns the frame length
+static size_t compress_frame(struct segment_compressor *c, const uint8_t *src,
+                             size_t len, uint8_t *dst) {
+    size_t out = segment_frame_header(dst);
+    size_t off;
+
+    for (off = 0; off < len; off += SEGMENT_BLOCK_SIZE) {
+        size_t n = len - off < SEGMENT_BLOCK_SIZE ? len - off : SEGMENT_BLOCK_SIZE;
+        out += segment_compress_block(c, src + off, n, dst + out);
+    }
+    return out + segment_frame_footer(dst + out);
+}
+
+static int decompress_frame(const uint8_t *src, size_t len, uint8_t *dst,
+                            size_t cap) {
+    size_t ip = SEGMENT_FRAME_HEADER_SIZE;
+    size_t op = 0;
+
+    while (ip + 4 <= len) {
+        uint32_t size = src[ip] | src[ip + 1] << 8 | src[ip + 2] << 16 |
+                        (uint32_t)src[ip + 3] << 24;
+        ip += 4;
+        if (size == 0) {
+            return (int)op;
+        }
+        if (size & 0x80000000U) {
+            size &= 0x7fffffffU;
+            memcpy(dst + op, src + ip, size);
+            op += size;
+        } else {
+            long n = segment_decompress_block(src + ip, size, dst + op, cap - op);
+            if (n < 0) {
+                return -1;
+            }
+            op += n;
+        }
+        ip += size;
+    }
+    return -1;
+}
+
+static int bench(const char *name, const uint8_t *src, size_t len,
+                 const char *out_path) {
+    struct segment_compressor c;
+    size_t bound = len / SEGMENT_BLOCK_SIZE * SEGMENT_BLOCK_BOUND(SEGMENT_BLOCK_SIZE) +
+                   SEGMENT_BLOCK_BOUND(SEGMENT_BLOCK_SIZE) +
+                   SEGMENT_FRAME_HEADER_SIZE + SEGMENT_FRAME_FOOTER_SIZE;
+    uint8_t *frame = malloc(bound);
+    uint8_t *check = malloc(len + 1);
+    size_t frame_len = 0;
+    double t0, t_comp, t_decomp;
+    int i, n = 0;
+
+    if (frame == NULL || check == NULL) {
+        fprintf(stderr, "out of memory\n");
+        return -1;
+    }
+
+    t0 = now();
+    for (i = 0; i < ROUNDS; i++) {
+        frame_len = compress_frame(&c, src, len, frame);
+    }
+    t_comp = (now() - t0) / ROUNDS;
+
+    t0 = now();
+    for (i = 0; i < ROUNDS; i++) {
+        n = decompress_frame(frame, frame_len, check, len + 1);
+    }
+    t_decomp = (now() - t0) / ROUNDS;
+
+    if (n != (int)len || memcmp(src, check, len) != 0) {
+        fprintf(stderr, "%s: round trip mismatch\n", name);
+        return -1;
+    }
+
+    printf("%s: %zu -> %zu bytes, ratio %.2f, compress %.1f MB/s, "
+           "decompress %.1f MB/s\n",
+           name, len, frame_len, (double)len / frame_len, len / t_comp / 1e6,
+           len / t_decomp / 1e6);
+
+    if (out_path != NULL) {
+        FILE *f = fopen(out_path, "wb");
+        if (f == NULL || fwrite(frame, 1, frame_len, f) != frame_len) {
+            fprintf(stderr, "failed to write %s\n", out_path);
+        }
+        if (f != NULL) {
+            fclose(f);
+        }
+    }
+
+    free(frame);
+    free(check);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    const char *out_path = NULL;
+    uint8_t *buf;
+    size_t len;
+    int rc = 0;
+    int i = 1;
+
+    if (argc > 2 && strcmp(argv[1], "-o") == 0) {
+        out_path = argv[2];
+        i = 3;
+    }
+
+    printf("block size %d, match table %d entries\n", SEGMENT_BLOCK_SIZE,
+           SEGMENT_HASH_SIZE);
+
+    if (i == argc) {
+        buf = synthetic_log(&len);
+        if (buf == NULL) {
+            return 1;
+        }
+        rc = bench("synthetic", buf, len, out_path);
+        free(buf);
+        return rc ? 1 : 0;
+    }
+
+    for (; i < argc; i++) {
+        buf = read_file(argv[i], &len);
+        if (buf == NULL) {
+            fprintf(stderr, "failed to read %s\n", argv[i]);
+            rc = -1;
+            continue;
+        }
+        rc |= bench(argv[i], buf, len, out_path);
+        free(buf);
+    }
+    return rc ? 1 : 0;
+}
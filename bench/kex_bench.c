@@ -0,0 +1,335 @@
+#include "libssh/priv.h"
+#include "libssh/callbacks.h"
+#include "libssh/crypto.h"
+#include "libssh/kex.h"
+#include "libssh/server.h"
+#include "libssh/session.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// CPU time and heap allocations of the key exchange in the hosted libssh:
+// the algorithm negotiation on its own, and whole handshakes between a
+// client and a server session joined by ssh_pair_new()
+//
+// usage: kex_bench -L hostkey [-n negotiations] [-c handshakes]
+//                  [-o json|csv]
+//
+// negotiate is what a client does with a KEXINIT on every connect and
+// rekey: ssh_set_client_kex() builds its proposal, host key types from a
+// known_hosts entry for the server first, and ssh_kex_select_methods()
+// matches it with the proposal of an OpenSSH 9 server. handshake is the
+// whole connect with password auth, so the DH and the signatures, for both
+// ends. cpu_us is process CPU time per operation; heap_allocs counts the
+// malloc family and strdup calls made by libssh and this file, through
+// the --wrap options in the Makefile, not those inside the crypto
+// libraries. Prints one line per case
+
+// what "ssh -Q" lists for an OpenSSH 9.2 server, in its order
+static const char *server_methods[SSH_KEX_METHODS] = {
+    "sntrup761x25519-sha512@openssh.com,curve25519-sha256,"
+    "curve25519-sha256@libssh.org,ecdh-sha2-nistp256,ecdh-sha2-nistp384,"
+    "ecdh-sha2-nistp521,diffie-hellman-group-exchange-sha256,"
+    "diffie-hellman-group16-sha512,diffie-hellman-group18-sha512,"
+    "diffie-hellman-group14-sha256",
+    "rsa-sha2-512,rsa-sha2-256,ecdsa-sha2-nistp256,ssh-ed25519",
+    "chacha20-poly1305@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr,"
+    "aes128-gcm@openssh.com,aes256-gcm@openssh.com",
+    "chacha20-poly1305@openssh.com,aes128-ctr,aes192-ctr,aes256-ctr,"
+    "aes128-gcm@openssh.com,aes256-gcm@openssh.com",
+    "umac-64-etm@openssh.com,umac-128-etm@openssh.com,"
+    "hmac-sha2-256-etm@openssh.com,hmac-sha2-512-etm@openssh.com,"
+    "hmac-sha1-etm@openssh.com,umac-64@openssh.com,umac-128@openssh.com,"
+    "hmac-sha2-256,hmac-sha2-512,hmac-sha1",
+    "umac-64-etm@openssh.com,umac-128-etm@openssh.com,"
+    "hmac-sha2-256-etm@openssh.com,hmac-sha2-512-etm@openssh.com,"
+    "hmac-sha1-etm@openssh.com,umac-64@openssh.com,umac-128@openssh.com,"
+    "hmac-sha2-256,hmac-sha2-512,hmac-sha1",
+    "none,zlib@openssh.com",
+    "none,zlib@openssh.com",
+    "",
+    "",
+};
+
+static const char *host_key = NULL;
+static long negotiations = 20000;
+static long handshakes = 200;
+static int csv = 0;
+
+static char known_hosts[] = "/tmp/kex_bench.XXXXXX";
+
+// malloc family and strdup calls, through the --wrap options in the Makefile
+static uint64_t heap_allocs;
+
+void *__real_malloc(size_t size);
+void *__real_calloc(size_t n, size_t size);
+void *__real_realloc(void *ptr, size_t size);
+char *__real_strdup(const char *s);
+char *__real_strndup(const char *s, size_t n);
+
+void *__wrap_malloc(size_t size) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_malloc(size);
+}
+
+void *__wrap_calloc(size_t n, size_t size) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_calloc(n, size);
+}
+
+void *__wrap_realloc(void *ptr, size_t size) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_realloc(ptr, size);
+}
+
+char *__wrap_strdup(const char *s) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strdup(s);
+}
+
+char *__wrap_strndup(const char *s, size_t n) {
+    __atomic_fetch_add(&heap_allocs, 1, __ATOMIC_RELAXED);
+    return __real_strndup(s, n);
+}
+
+struct pair {
+    ssh_session client;
+    ssh_session server;
+    ssh_bind bind;
+    ssh_pair pair;
+    struct ssh_server_callbacks_struct server_cb;
+};
+
+static double cpu_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void print_result(const char *name, long n, double seconds,
+                         uint64_t allocs) {
+    if (csv) {
+        printf("%s,%ld,%.2f,%.1f\n", name, n, seconds / n * 1e6,
+               (double)allocs / n);
+    } else {
+        printf("{\"case\":\"%s\",\"count\":%ld,\"cpu_us\":%.2f,"
+               "\"heap_allocs\":%.1f}\n",
+               name, n, seconds / n * 1e6, (double)allocs / n);
+    }
+    fflush(stdout);
+}
+
+// a known_hosts file with the bench key for host "bench", so the host key
+// types are reordered the way they are for a known server
+static int write_known_hosts(void) {
+    ssh_key key = NULL;
+    char *b64 = NULL;
+    FILE *file = NULL;
+    int fd;
+    int rc = -1;
+
+    fd = mkstemp(known_hosts);
+    if (fd < 0) {
+        perror("mkstemp");
+        return -1;
+    }
+    file = fdopen(fd, "w");
+    if (file == NULL) {
+        close(fd);
+        return -1;
+    }
+    if (ssh_pki_import_privkey_file(host_key, NULL, NULL, NULL, &key) !=
+            SSH_OK ||
+        ssh_pki_export_pubkey_base64(key, &b64) != SSH_OK) {
+        fprintf(stderr, "can't read %s\n", host_key);
+        goto out;
+    }
+    fprintf(file, "bench %s %s\n", ssh_key_type_to_char(ssh_key_type(key)),
+            b64);
+    rc = 0;
+
+out:
+    fclose(file);
+    SSH_STRING_FREE_CHAR(b64);
+    ssh_key_free(key);
+    return rc;
+}
+
+static void set_known_hosts(ssh_session session) {
+    ssh_options_set(session, SSH_OPTIONS_HOST, "bench");
+    ssh_options_set(session, SSH_OPTIONS_KNOWNHOSTS, known_hosts);
+    ssh_options_set(session, SSH_OPTIONS_GLOBAL_KNOWNHOSTS, "/dev/null");
+}
+
+static int bench_negotiate(void) {
+    struct ssh_crypto_struct *crypto;
+    ssh_session session;
+    uint64_t allocs;
+    double t0;
+    long n;
+    int i;
+    int rc = -1;
+
+    session = ssh_new();
+    if (session == NULL) {
+        return -1;
+    }
+    set_known_hosts(session);
+    crypto = session->next_crypto;
+    for (i = 0; i < SSH_KEX_METHODS; i++) {
+        crypto->server_kex.methods[i] = strdup(server_methods[i]);
+    }
+
+    allocs = __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+    t0 = cpu_now();
+    for (n = 0; n < negotiations; n++) {
+        if (ssh_set_client_kex(session) != SSH_OK ||
+            ssh_kex_select_methods(session) != SSH_OK) {
+            fprintf(stderr, "negotiate: %s\n", ssh_get_error(session));
+            goto out;
+        }
+        for (i = 0; i < SSH_KEX_METHODS; i++) {
+            SAFE_FREE(crypto->client_kex.methods[i]);
+            SAFE_FREE(crypto->kex_methods[i]);
+        }
+    }
+    print_result("negotiate", negotiations, cpu_now() - t0,
+                 __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED) - allocs);
+    rc = 0;
+
+out:
+    ssh_free(session);
+    return rc;
+}
+
+static int server_auth_password(ssh_session session, const char *user,
+                                const char *password, void *userdata) {
+    (void)session;
+    (void)user;
+    (void)password;
+    (void)userdata;
+    return SSH_AUTH_SUCCESS;
+}
+
+static int client_auth(void *userdata) {
+    struct pair *p = userdata;
+
+    switch (ssh_userauth_password(p->client, NULL, "bench")) {
+    case SSH_AUTH_SUCCESS:
+        return SSH_OK;
+    case SSH_AUTH_AGAIN:
+        return SSH_AGAIN;
+    default:
+        return SSH_ERROR;
+    }
+}
+
+static void close_pair(struct pair *p) {
+    ssh_pair_free(p->pair);
+    if (p->server != NULL) {
+        ssh_free(p->server);
+    }
+    if (p->bind != NULL) {
+        ssh_bind_free(p->bind);
+    }
+    if (p->client != NULL) {
+        ssh_free(p->client);
+    }
+    memset(p, 0, sizeof(*p));
+}
+
+static int handshake(struct pair *p) {
+    memset(p, 0, sizeof(*p));
+    p->client = ssh_new();
+    p->server = ssh_new();
+    p->bind = ssh_bind_new();
+    if (p->client == NULL || p->server == NULL || p->bind == NULL) {
+        return -1;
+    }
+    set_known_hosts(p->client);
+    ssh_bind_options_set(p->bind, SSH_BIND_OPTIONS_HOSTKEY, host_key);
+    p->pair = ssh_pair_new(p->bind, p->client, p->server);
+    if (p->pair == NULL) {
+        fprintf(stderr, "pair: %s\n", ssh_get_error(p->bind));
+        return -1;
+    }
+    ssh_set_auth_methods(p->server, SSH_AUTH_METHOD_PASSWORD);
+    p->server_cb.auth_password_function = server_auth_password;
+    ssh_callbacks_init(&p->server_cb);
+    ssh_set_server_callbacks(p->server, &p->server_cb);
+    if (ssh_pair_handshake(p->pair) != SSH_OK ||
+        ssh_pair_run(p->pair, client_auth, p) != SSH_OK) {
+        fprintf(stderr, "handshake: %s\n", ssh_get_error(p->client));
+        return -1;
+    }
+    return 0;
+}
+
+static int bench_handshake(void) {
+    struct pair p;
+    uint64_t allocs;
+    double t0;
+    long n;
+
+    allocs = __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED);
+    t0 = cpu_now();
+    for (n = 0; n < handshakes; n++) {
+        if (handshake(&p) != 0) {
+            close_pair(&p);
+            return -1;
+        }
+        close_pair(&p);
+    }
+    print_result("handshake", handshakes, cpu_now() - t0,
+                 __atomic_load_n(&heap_allocs, __ATOMIC_RELAXED) - allocs);
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    int opt;
+    int failed = 0;
+
+    while ((opt = getopt(argc, argv, "L:n:c:o:")) != -1) {
+        switch (opt) {
+        case 'L':
+            host_key = optarg;
+            break;
+        case 'n':
+            negotiations = atol(optarg);
+            break;
+        case 'c':
+            handshakes = atol(optarg);
+            break;
+        case 'o':
+            csv = strcmp(optarg, "csv") == 0;
+            break;
+        default:
+            host_key = NULL;
+            break;
+        }
+    }
+    if (host_key == NULL || negotiations < 1 || handshakes < 1) {
+        fprintf(stderr, "usage: %s -L hostkey [-n negotiations] "
+                        "[-c handshakes] [-o json|csv]\n", argv[0]);
+        return 1;
+    }
+
+    ssh_init();
+    if (write_known_hosts() != 0) {
+        ssh_finalize();
+        return 1;
+    }
+    if (csv) {
+        printf("case,count,cpu_us,heap_allocs\n");
+    }
+    failed += bench_negotiate() != 0;
+    failed += bench_handshake() != 0;
+    unlink(known_hosts);
+    ssh_finalize();
+
+    return failed ? 1 : 0;
+}
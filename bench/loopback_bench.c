@@ -0,0 +1,1004 @@
+#include <libssh/callbacks.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <time.h>
+#include <unistd.h>
+
+// throughput benchmark for the libssh in this tree against a local sshd
+// over loopback: connect latency, ssh_channel_write with and without zlib,
+// small writes for the packet rate, scp push and scp read, swept over
+// ciphers, write sizes and receive windows. Every run prints one line, JSON
+// by default or CSV with -o csv, meant to be kept and diffed between builds
+//
+// usage: loopback_bench [-h host] [-p port] [-u user] [-P password]
+//                       [-d remote dir] [-C ciphers] [-b write sizes]
+//                       [-w windows] [-t sessions] [-s bytes per session]
+//                       [-n connects] [-r rekey bytes] [-o json|csv]
+//                       [-L hostkey] [-T tests] [-k dispatch packets]
+//                       [-x pattern|text|random] [-l link bytes/s]
+//
+// lists are comma separated. Without -P the client authenticates with its
+// keys. A window of 0 keeps the library default; the window only matters
+// for data coming in, so for scp read. With -t every throughput run uses
+// that many sessions in parallel, one thread each, and reports the sum; it
+// needs a libssh built with HAVE_PTHREAD. -r lowers the rekey limit so the
+// stall per rekey shows up in the output
+//
+// -T picks the tests, all of them by default: connect, channel_write,
+// channel_zlib (channel_write with zlib@openssh.com both ways), dispatch
+// (-k writes of DISPATCH_PAYLOAD bytes, one CHANNEL_DATA packet each),
+// scp_push and scp_read. Besides MB/s every run reports the packets the
+// client sent and received per second, the bytes on the wire, and the
+// socket syscalls (send, recv, sendmsg, writev and poll, counted by
+// wrapping them at link time, see the Makefile) per MB of payload. With -L
+// the syscalls of the server side are in that count as well.
+// copies_per_byte is what libssh moved with memcpy() and memmove(), wrapped
+// the same way, per byte of payload; copies the compiler inlines and those
+// inside the crypto libraries are not in it, and with -L the receiving
+// side's copies are
+//
+// -x picks what is written: a short repeating pattern (the default), text
+// telemetry (log lines of a sensor node with varying readings, about what
+// the device sends) or random bytes, which zlib can't shrink. -l holds every
+// send, sendmsg and writev for as long as its bytes take on a link of that
+// many bytes per second, so a run shows what a slow uplink like the
+// device's WiFi does to it, and what compression gets back
+//
+// with -L there is no sshd: each session gets a server session of its own
+// with the given host key, joined to it by ssh_pair_new() and polled from
+// the same thread. The numbers then cover both ends of the library and no
+// TCP. The server discards channel data and receives scp uploads into -d
+// with the scp sink; it has no scp source, so scp read is skipped. Its
+// channels keep the library's 8000 byte window, so a channel write waits
+// for a window adjust after every packet or two and never has more than
+// that in flight to send at once
+
+#define MAX_LIST 16
+#define MAX_PAYLOAD (256 * 1024)
+#define DISPATCH_PAYLOAD 64
+
+const char *ssh_host = "127.0.0.1";
+int ssh_port = 22;
+const char *ssh_user = NULL;
+const char *ssh_password = NULL;
+
+static const char *remote_dir = "/tmp";
+static const char *ciphers[MAX_LIST];
+static int n_ciphers;
+static size_t payloads[MAX_LIST];
+static int n_payloads;
+static uint32_t windows[MAX_LIST];
+static int n_windows;
+static int threads = 1;
+static uint64_t session_bytes = 64 * 1024 * 1024;
+static int connects = 20;
+static uint64_t rekey_bytes = 0;
+static int csv = 0;
+static const char *local_host_key = NULL;
+static uint64_t dispatch_packets = 200000;
+static const char *payload_kind = "pattern";
+static uint64_t link_rate = 0;
+
+static uint8_t payload[MAX_PAYLOAD];
+
+enum bench_test {
+    TEST_CONNECT,
+    TEST_CHANNEL,
+    TEST_CHANNEL_ZLIB,
+    TEST_DISPATCH,
+    TEST_SCP_PUSH,
+    TEST_SCP_READ,
+    NUM_TESTS
+};
+
+static const char *test_names[] = {
+    "connect", "channel_write", "channel_zlib", "dispatch", "scp_push",
+    "scp_read",
+};
+
+static int tests[NUM_TESTS] = {1, 1, 1, 1, 1, 1};
+
+struct run {
+    enum bench_test test;
+    const char *cipher;
+    size_t payload;
+    uint32_t window;
+    pthread_barrier_t start;
+};
+
+// socket syscalls of all threads, through the --wrap options in the
+// Makefile
+static uint64_t syscalls;
+
+// bytes moved by memcpy() and memmove(), wrapped the same way
+static uint64_t copied;
+
+ssize_t __real_send(int fd, const void *buf, size_t len, int flags);
+ssize_t __real_recv(int fd, void *buf, size_t len, int flags);
+ssize_t __real_sendmsg(int fd, const struct msghdr *msg, int flags);
+ssize_t __real_writev(int fd, const struct iovec *iov, int iovcnt);
+int __real_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+void *__real_memcpy(void *dest, const void *src, size_t n);
+void *__real_memmove(void *dest, const void *src, size_t n);
+
+// the time n bytes take on the -l link
+static void link_delay(ssize_t n) {
+    if (link_rate > 0 && n > 0) {
+        usleep(n * 1000000ULL / link_rate);
+    }
+}
+
+ssize_t __wrap_send(int fd, const void *buf, size_t len, int flags) {
+    ssize_t n;
+
+    __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+    n = __real_send(fd, buf, len, flags);
+    link_delay(n);
+    return n;
+}
+
+ssize_t __wrap_recv(int fd, void *buf, size_t len, int flags) {
+    __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+    return __real_recv(fd, buf, len, flags);
+}
+
+ssize_t __wrap_sendmsg(int fd, const struct msghdr *msg, int flags) {
+    ssize_t n;
+
+    __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+    n = __real_sendmsg(fd, msg, flags);
+    link_delay(n);
+    return n;
+}
+
+ssize_t __wrap_writev(int fd, const struct iovec *iov, int iovcnt) {
+    ssize_t n;
+
+    __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+    n = __real_writev(fd, iov, iovcnt);
+    link_delay(n);
+    return n;
+}
+
+int __wrap_poll(struct pollfd *fds, nfds_t nfds, int timeout) {
+    __atomic_fetch_add(&syscalls, 1, __ATOMIC_RELAXED);
+    return __real_poll(fds, nfds, timeout);
+}
+
+void *__wrap_memcpy(void *dest, const void *src, size_t n) {
+    __atomic_fetch_add(&copied, n, __ATOMIC_RELAXED);
+    return __real_memcpy(dest, src, n);
+}
+
+void *__wrap_memmove(void *dest, const void *src, size_t n) {
+    __atomic_fetch_add(&copied, n, __ATOMIC_RELAXED);
+    return __real_memmove(dest, src, n);
+}
+
+struct conn {
+    ssh_session session;
+
+    // the in-process server, with -L only
+    ssh_bind bind;
+    ssh_session server;
+    ssh_pair pair;
+    ssh_channel channel;
+    ssh_scp_sink sink;
+    struct ssh_server_callbacks_struct server_cb;
+    struct ssh_channel_callbacks_struct channel_cb;
+    struct ssh_channel_callbacks_struct discard_cb;
+
+    // bytes on the wire and packets of the client session
+    struct ssh_counter_struct wire;
+    struct ssh_counter_struct raw;
+};
+
+struct worker {
+    pthread_t thread;
+    struct run *run;
+    int index;
+    int failed;
+    uint64_t bytes;
+    double connect_time;
+    struct ssh_rekey_stats rekey;
+    uint64_t packets;
+    uint64_t wire_bytes;
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int local_auth_password(ssh_session session, const char *user,
+                               const char *password, void *userdata) {
+    (void)session;
+    (void)user;
+    (void)password;
+    (void)userdata;
+    return SSH_AUTH_SUCCESS;
+}
+
+static int local_discard(ssh_session session, ssh_channel channel,
+                         void *data, uint32_t len, int is_stderr,
+                         void *userdata) {
+    (void)session;
+    (void)channel;
+    (void)data;
+    (void)is_stderr;
+    (void)userdata;
+    return len;
+}
+
+static int local_exec(ssh_session session, ssh_channel channel,
+                      const char *command, void *userdata) {
+    struct conn *c = userdata;
+
+    (void)session;
+
+    if (strncmp(command, "scp ", 4) != 0) {
+        // anything else is taken for the "cat > /dev/null" of the channel
+        // test
+        c->discard_cb.userdata = c;
+        c->discard_cb.channel_data_function = local_discard;
+        ssh_callbacks_init(&c->discard_cb);
+        return ssh_add_channel_callbacks(channel, &c->discard_cb) == SSH_OK
+                   ? 0 : 1;
+    }
+    if (c->sink != NULL) {
+        return 1;
+    }
+    c->sink = ssh_scp_sink_new(channel, remote_dir);
+    if (c->sink == NULL || ssh_scp_sink_start(c->sink, command) != SSH_OK) {
+        return 1;
+    }
+    return 0;
+}
+
+static void local_eof(ssh_session session, ssh_channel channel,
+                      void *userdata) {
+    struct conn *c = userdata;
+    int status = 0;
+
+    (void)session;
+    if (c->sink != NULL && ssh_scp_sink_get_status(c->sink) != SSH_OK) {
+        status = 1;
+    }
+    ssh_channel_request_send_exit_status(channel, status);
+    ssh_channel_send_eof(channel);
+    ssh_channel_close(channel);
+}
+
+static ssh_channel local_channel_open(ssh_session session, void *userdata) {
+    struct conn *c = userdata;
+
+    // one channel at a time, the previous one is gone once it is closed
+    if (c->channel != NULL) {
+        if (!ssh_channel_is_closed(c->channel)) {
+            return NULL;
+        }
+        ssh_channel_free(c->channel);
+        if (c->sink != NULL) {
+            ssh_scp_sink_free(c->sink);
+            c->sink = NULL;
+        }
+    }
+
+    c->channel = ssh_channel_new(session);
+    if (c->channel == NULL) {
+        return NULL;
+    }
+    c->channel_cb.userdata = c;
+    c->channel_cb.channel_exec_request_function = local_exec;
+    c->channel_cb.channel_eof_function = local_eof;
+    ssh_callbacks_init(&c->channel_cb);
+    ssh_set_channel_callbacks(c->channel, &c->channel_cb);
+
+    return c->channel;
+}
+
+static int local_auth(void *userdata) {
+    struct conn *c = userdata;
+
+    switch (ssh_userauth_password(c->session, NULL, "bench")) {
+    case SSH_AUTH_SUCCESS:
+        return SSH_OK;
+    case SSH_AUTH_AGAIN:
+        return SSH_AGAIN;
+    default:
+        return SSH_ERROR;
+    }
+}
+
+// handshake and auth run on the pair without blocking, after that the
+// client is blocking again; its polls serve the server session as well
+static int connect_local(struct conn *c, int compress) {
+    c->bind = ssh_bind_new();
+    c->server = ssh_new();
+    if (c->bind == NULL || c->server == NULL) {
+        return -1;
+    }
+    ssh_bind_options_set(c->bind, SSH_BIND_OPTIONS_HOSTKEY, local_host_key);
+
+    c->pair = ssh_pair_new(c->bind, c->session, c->server);
+    if (c->pair == NULL) {
+        fprintf(stderr, "pair: %s\n", ssh_get_error(c->bind));
+        return -1;
+    }
+    if (compress) {
+        ssh_options_set(c->server, SSH_OPTIONS_COMPRESSION, "yes");
+    }
+    ssh_set_auth_methods(c->server, SSH_AUTH_METHOD_PASSWORD);
+    c->server_cb.userdata = c;
+    c->server_cb.auth_password_function = local_auth_password;
+    c->server_cb.channel_open_request_session_function = local_channel_open;
+    ssh_callbacks_init(&c->server_cb);
+    ssh_set_server_callbacks(c->server, &c->server_cb);
+
+    if (ssh_pair_handshake(c->pair) != SSH_OK ||
+        ssh_pair_run(c->pair, local_auth, c) != SSH_OK) {
+        return -1;
+    }
+    ssh_set_blocking(c->session, 1);
+    return 0;
+}
+
+static void close_session(struct conn *c) {
+    if (c->session != NULL) {
+        ssh_disconnect(c->session);
+    }
+    if (c->sink != NULL) {
+        ssh_scp_sink_free(c->sink);
+    }
+    if (c->channel != NULL) {
+        ssh_channel_free(c->channel);
+    }
+    ssh_pair_free(c->pair);
+    if (c->server != NULL) {
+        ssh_free(c->server);
+    }
+    if (c->bind != NULL) {
+        ssh_bind_free(c->bind);
+    }
+    if (c->session != NULL) {
+        ssh_free(c->session);
+    }
+    memset(c, 0, sizeof(*c));
+}
+
+static int open_session(struct run *run, struct conn *c,
+                        double *connect_time) {
+    int compress = run->test == TEST_CHANNEL_ZLIB;
+    double t0;
+    int rc;
+
+    memset(c, 0, sizeof(*c));
+    c->session = ssh_new();
+    if (c->session == NULL) {
+        return -1;
+    }
+    ssh_set_counters(c->session, &c->wire, &c->raw);
+    if (local_host_key == NULL) {
+        ssh_options_set(c->session, SSH_OPTIONS_HOST, ssh_host);
+        ssh_options_set(c->session, SSH_OPTIONS_PORT, &ssh_port);
+    }
+    if (ssh_user != NULL) {
+        ssh_options_set(c->session, SSH_OPTIONS_USER, ssh_user);
+    }
+    ssh_options_set(c->session, SSH_OPTIONS_CIPHERS_C_S, run->cipher);
+    ssh_options_set(c->session, SSH_OPTIONS_CIPHERS_S_C, run->cipher);
+    ssh_options_set(c->session, SSH_OPTIONS_CHANNEL_WINDOW, &run->window);
+    if (rekey_bytes > 0) {
+        ssh_options_set(c->session, SSH_OPTIONS_REKEY_DATA, &rekey_bytes);
+    }
+    if (compress) {
+        ssh_options_set(c->session, SSH_OPTIONS_COMPRESSION,
+                        "zlib@openssh.com");
+    }
+
+    t0 = now();
+    if (local_host_key != NULL) {
+        if (connect_local(c, compress) != 0) {
+            goto error;
+        }
+    } else {
+        if (ssh_connect(c->session) != SSH_OK) {
+            goto error;
+        }
+        if (ssh_password != NULL) {
+            rc = ssh_userauth_password(c->session, NULL, ssh_password);
+        } else {
+            rc = ssh_userauth_publickey_auto(c->session, NULL, NULL);
+        }
+        if (rc != SSH_AUTH_SUCCESS) {
+            goto error;
+        }
+    }
+    *connect_time += now() - t0;
+    return 0;
+
+error:
+    fprintf(stderr, "%s: %s\n", run->cipher, ssh_get_error(c->session));
+    close_session(c);
+    return -1;
+}
+
+static int run_command(ssh_session session, const char *command) {
+    ssh_channel channel = ssh_channel_new(session);
+    char buf[256];
+    int rc = -1;
+
+    if (channel == NULL) {
+        return -1;
+    }
+    if (ssh_channel_open_session(channel) != SSH_OK ||
+        ssh_channel_request_exec(channel, command) != SSH_OK) {
+        goto out;
+    }
+    while (!ssh_channel_is_eof(channel)) {
+        if (ssh_channel_read(channel, buf, sizeof(buf), 0) < 0) {
+            goto out;
+        }
+    }
+    rc = 0;
+
+out:
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+    return rc;
+}
+
+static void remote_path(char *path, size_t len, int index) {
+    snprintf(path, len, "%s/loopback-bench-%d-%d.bin", remote_dir,
+             (int)getpid(), index);
+}
+
+// the bytes are only counted once the remote cat has exited, so nothing is
+// left sitting in a buffer when the clock stops
+static int bench_channel(ssh_session session, struct worker *w) {
+    ssh_channel channel = ssh_channel_new(session);
+    size_t chunk = w->run->payload;
+    uint64_t total = session_bytes;
+    uint64_t off;
+    char buf[256];
+    int rc = -1;
+
+    if (channel == NULL) {
+        return -1;
+    }
+    if (ssh_channel_open_session(channel) != SSH_OK ||
+        ssh_channel_request_exec(channel, "cat > /dev/null") != SSH_OK) {
+        goto out;
+    }
+    if (w->run->test == TEST_DISPATCH) {
+        total = dispatch_packets * chunk;
+    }
+    for (off = 0; off < total; off += chunk) {
+        uint32_t len = total - off < chunk ? total - off : chunk;
+        if (ssh_channel_write(channel, payload, len) != (int)len) {
+            goto out;
+        }
+    }
+    if (ssh_channel_send_eof(channel) != SSH_OK) {
+        goto out;
+    }
+    while (!ssh_channel_is_eof(channel)) {
+        if (ssh_channel_read(channel, buf, sizeof(buf), 0) < 0) {
+            goto out;
+        }
+    }
+    w->bytes += total;
+    rc = 0;
+
+out:
+    ssh_channel_close(channel);
+    ssh_channel_free(channel);
+    return rc;
+}
+
+static int push_file(ssh_session session, struct worker *w, size_t chunk) {
+    char path[256];
+    ssh_scp scp;
+    uint64_t off;
+    int rc = -1;
+
+    scp = ssh_scp_new(session, SSH_SCP_WRITE, remote_dir);
+    if (scp == NULL || ssh_scp_init(scp) != SSH_OK) {
+        goto out;
+    }
+    remote_path(path, sizeof(path), w->index);
+    if (ssh_scp_push_file64(scp, strrchr(path, '/') + 1, session_bytes,
+                            S_IRUSR | S_IWUSR) != SSH_OK) {
+        goto out;
+    }
+    for (off = 0; off < session_bytes; off += chunk) {
+        size_t len = session_bytes - off < chunk ? session_bytes - off
+                                                 : chunk;
+        if (ssh_scp_write(scp, payload, len) != SSH_OK) {
+            goto out;
+        }
+    }
+    rc = 0;
+
+out:
+    if (scp != NULL) {
+        ssh_scp_close(scp);
+        ssh_scp_free(scp);
+    }
+    return rc;
+}
+
+static int bench_scp_push(ssh_session session, struct worker *w) {
+    if (push_file(session, w, w->run->payload) != 0) {
+        return -1;
+    }
+    w->bytes += session_bytes;
+    return 0;
+}
+
+static int bench_scp_read(ssh_session session, struct worker *w) {
+    static __thread uint8_t buf[MAX_PAYLOAD];
+    size_t chunk = w->run->payload;
+    char path[256];
+    ssh_scp scp;
+    uint64_t size, got = 0;
+    int rc = -1;
+    int n;
+
+    remote_path(path, sizeof(path), w->index);
+    scp = ssh_scp_new(session, SSH_SCP_READ, path);
+    if (scp == NULL || ssh_scp_init(scp) != SSH_OK ||
+        ssh_scp_pull_request(scp) != SSH_SCP_REQUEST_NEWFILE) {
+        goto out;
+    }
+    size = ssh_scp_request_get_size64(scp);
+    if (ssh_scp_accept_request(scp) != SSH_OK) {
+        goto out;
+    }
+    while (got < size) {
+        n = ssh_scp_read(scp, buf, size - got < chunk ? size - got : chunk);
+        if (n <= 0) {
+            goto out;
+        }
+        got += n;
+    }
+    w->bytes += got;
+    rc = 0;
+
+out:
+    if (scp != NULL) {
+        ssh_scp_close(scp);
+        ssh_scp_free(scp);
+    }
+    return rc;
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+    struct run *run = w->run;
+    struct conn c;
+    ssh_session session = NULL;
+    char path[256];
+    char command[300];
+    int rc = -1;
+
+    if (open_session(run, &c, &w->connect_time) == 0) {
+        session = c.session;
+    }
+    // the file to read back is pushed before the clock starts
+    if (session != NULL && run->test == TEST_SCP_READ &&
+        push_file(session, w, MAX_PAYLOAD) != 0) {
+        fprintf(stderr, "%s: %s\n", run->cipher, ssh_get_error(session));
+        close_session(&c);
+        session = NULL;
+    }
+
+    // only what the measured part sends and receives is counted
+    memset(&c.wire, 0, sizeof(c.wire));
+    memset(&c.raw, 0, sizeof(c.raw));
+
+    pthread_barrier_wait(&run->start);
+    if (session == NULL) {
+        w->failed = 1;
+        return NULL;
+    }
+
+    switch (run->test) {
+    case TEST_CHANNEL:
+    case TEST_CHANNEL_ZLIB:
+    case TEST_DISPATCH:
+        rc = bench_channel(session, w);
+        break;
+    case TEST_SCP_PUSH:
+        rc = bench_scp_push(session, w);
+        break;
+    case TEST_SCP_READ:
+        rc = bench_scp_read(session, w);
+        break;
+    case TEST_CONNECT:
+    case NUM_TESTS:
+        break;
+    }
+    w->packets = c.raw.out_packets + c.raw.in_packets;
+    w->wire_bytes = c.wire.out_bytes + c.wire.in_bytes;
+    if (rc != 0) {
+        fprintf(stderr, "%s %s: %s\n", test_names[run->test], run->cipher,
+                ssh_get_error(session));
+        w->failed = 1;
+    }
+    ssh_get_rekey_stats(session, &w->rekey);
+
+    if (run->test != TEST_CHANNEL) {
+        remote_path(path, sizeof(path), w->index);
+        if (local_host_key != NULL) {
+            unlink(path);
+        } else {
+            snprintf(command, sizeof(command), "rm -f %s", path);
+            run_command(session, command);
+        }
+    }
+    close_session(&c);
+    return NULL;
+}
+
+// what a run adds up over its sessions
+struct result {
+    int sessions;
+    uint64_t bytes;
+    double seconds;
+    double connect_ms;
+    uint64_t packets;
+    uint64_t wire_bytes;
+    uint64_t syscalls;
+    uint64_t copied;
+    struct ssh_rekey_stats rekey;
+    int failed;
+};
+
+static void print_header(void) {
+    if (csv) {
+        printf("test,cipher,payload,window,sessions,bytes,seconds,mb_per_s,"
+               "connect_ms,packets_per_s,wire_bytes,syscalls_per_mb,"
+               "copies_per_byte,rekeys,stall_max_ms,failed\n");
+    }
+}
+
+static void print_result(struct run *run, const struct result *r) {
+    double mbps = r->seconds > 0 ? r->bytes / r->seconds / 1e6 : 0;
+    double pps = r->seconds > 0 ? r->packets / r->seconds : 0;
+    double spmb = r->bytes > 0 ? r->syscalls / (r->bytes / 1e6) : 0;
+    double cpb = r->bytes > 0 ? (double)r->copied / r->bytes : 0;
+
+    if (csv) {
+        printf("%s,%s,%zu,%u,%d,%llu,%.6f,%.2f,%.3f,%.0f,%llu,%.1f,%.2f,%u,"
+               "%u,%d\n",
+               test_names[run->test], run->cipher, run->payload, run->window,
+               r->sessions, (unsigned long long)r->bytes, r->seconds, mbps,
+               r->connect_ms, pps, (unsigned long long)r->wire_bytes, spmb,
+               cpb, r->rekey.rekeys, r->rekey.stall_max, r->failed);
+    } else {
+        printf("{\"test\":\"%s\",\"cipher\":\"%s\",\"payload\":%zu,"
+               "\"window\":%u,\"sessions\":%d,\"bytes\":%llu,"
+               "\"seconds\":%.6f,\"mb_per_s\":%.2f,\"connect_ms\":%.3f,"
+               "\"packets_per_s\":%.0f,\"wire_bytes\":%llu,"
+               "\"syscalls_per_mb\":%.1f,\"copies_per_byte\":%.2f,"
+               "\"rekeys\":%u,\"stall_max_ms\":%u,\"failed\":%d}\n",
+               test_names[run->test], run->cipher, run->payload, run->window,
+               r->sessions, (unsigned long long)r->bytes, r->seconds, mbps,
+               r->connect_ms, pps, (unsigned long long)r->wire_bytes, spmb,
+               cpb, r->rekey.rekeys, r->rekey.stall_max, r->failed);
+    }
+    fflush(stdout);
+}
+
+// connect + kex + auth, one session after the other
+static int bench_connect(struct run *run) {
+    struct result r = {0};
+    double connect_time = 0;
+    struct conn c;
+    int ok = 0, i;
+
+    for (i = 0; i < connects; i++) {
+        if (open_session(run, &c, &connect_time) == 0) {
+            close_session(&c);
+            ok++;
+        }
+    }
+    r.sessions = 1;
+    r.seconds = connect_time;
+    r.connect_ms = ok > 0 ? connect_time / ok * 1e3 : 0.0;
+    r.failed = connects - ok;
+    print_result(run, &r);
+    return ok == connects ? 0 : -1;
+}
+
+static int bench_throughput(struct run *run) {
+    struct worker *ws;
+    struct result r = {0};
+    double connect_time = 0;
+    uint64_t calls, bytes;
+    double t0;
+    int i;
+
+    ws = calloc(threads, sizeof(*ws));
+    if (ws == NULL) {
+        return -1;
+    }
+    pthread_barrier_init(&run->start, NULL, threads + 1);
+    for (i = 0; i < threads; i++) {
+        ws[i].run = run;
+        ws[i].index = i;
+        pthread_create(&ws[i].thread, NULL, worker_main, &ws[i]);
+    }
+    pthread_barrier_wait(&run->start);
+    calls = __atomic_load_n(&syscalls, __ATOMIC_RELAXED);
+    bytes = __atomic_load_n(&copied, __ATOMIC_RELAXED);
+    t0 = now();
+    for (i = 0; i < threads; i++) {
+        pthread_join(ws[i].thread, NULL);
+    }
+    r.seconds = now() - t0;
+    // includes the teardown of the sessions, a handful of calls
+    r.syscalls = __atomic_load_n(&syscalls, __ATOMIC_RELAXED) - calls;
+    r.copied = __atomic_load_n(&copied, __ATOMIC_RELAXED) - bytes;
+    pthread_barrier_destroy(&run->start);
+
+    r.sessions = threads;
+    for (i = 0; i < threads; i++) {
+        r.failed += ws[i].failed;
+        r.bytes += ws[i].bytes;
+        r.packets += ws[i].packets;
+        r.wire_bytes += ws[i].wire_bytes;
+        connect_time += ws[i].connect_time;
+        r.rekey.rekeys += ws[i].rekey.rekeys;
+        if (ws[i].rekey.stall_max > r.rekey.stall_max) {
+            r.rekey.stall_max = ws[i].rekey.stall_max;
+        }
+    }
+    r.connect_ms = threads > r.failed
+                       ? connect_time / (threads - r.failed) * 1e3
+                       : 0.0;
+    print_result(run, &r);
+    free(ws);
+    return r.failed ? -1 : 0;
+}
+
+static int split(char *list, char **items) {
+    char *save = NULL;
+    char *item;
+    int n = 0;
+
+    for (item = strtok_r(list, ",", &save); item != NULL && n < MAX_LIST;
+         item = strtok_r(NULL, ",", &save)) {
+        items[n++] = item;
+    }
+    return n;
+}
+
+// fills payload with what -x asked for
+static int fill_payload(const char *kind) {
+    uint32_t x = 12345;
+    size_t off = 0;
+    char line[160];
+    int n, i;
+
+    if (strcmp(kind, "pattern") == 0) {
+        for (i = 0; i < MAX_PAYLOAD; i++) {
+            payload[i] = "0123456789,=.\r\n"[i % 15];
+        }
+        return 0;
+    }
+    if (strcmp(kind, "random") == 0) {
+        for (i = 0; i < MAX_PAYLOAD; i++) {
+            x = x * 1103515245 + 12345;
+            payload[i] = x >> 23;
+        }
+        return 0;
+    }
+    if (strcmp(kind, "text") != 0) {
+        return -1;
+    }
+    for (i = 0; off < MAX_PAYLOAD; i++) {
+        x = x * 1103515245 + 12345;
+        n = snprintf(line, sizeof(line),
+                     "2026-10-19T04:%02d:%02d.%03dZ node=esp32-%02u seq=%d "
+                     "temp_c=%u.%02u rh=%u.%u vbat=3.%02u rssi=-%u "
+                     "heap_free=%u\n",
+                     i / 600 % 60, i / 10 % 60, i % 10 * 100,
+                     x >> 28, i, 18 + (x >> 8) % 10, (x >> 12) % 100,
+                     40 + (x >> 16) % 20, (x >> 20) % 10,
+                     70 + (x >> 4) % 30, 50 + (x >> 24) % 40,
+                     140000 + (x >> 9) % 8000);
+        if (off + n > MAX_PAYLOAD) {
+            n = MAX_PAYLOAD - off;
+        }
+        memcpy(payload + off, line, n);
+        off += n;
+    }
+    return 0;
+}
+
+int main(int argc, char **argv) {
+    char *items[MAX_LIST];
+    struct run run;
+    int opt, c, p, w, i, n, t;
+    int failed = 0;
+
+    ciphers[0] = "aes128-ctr";
+    ciphers[1] = "aes256-gcm@openssh.com";
+    ciphers[2] = "chacha20-poly1305@openssh.com";
+    n_ciphers = 3;
+    payloads[0] = 1024;
+    payloads[1] = 8192;
+    payloads[2] = 32768;
+    n_payloads = 3;
+    windows[0] = 0;
+    windows[1] = 1024 * 1024;
+    n_windows = 2;
+
+    while ((opt = getopt(argc, argv, "h:p:u:P:d:C:b:w:t:s:n:r:o:L:T:k:x:l:")) !=
+           -1) {
+        switch (opt) {
+        case 'h':
+            ssh_host = optarg;
+            break;
+        case 'p':
+            ssh_port = atoi(optarg);
+            break;
+        case 'u':
+            ssh_user = optarg;
+            break;
+        case 'P':
+            ssh_password = optarg;
+            break;
+        case 'd':
+            remote_dir = optarg;
+            break;
+        case 'C':
+            n_ciphers = split(optarg, items);
+            for (i = 0; i < n_ciphers; i++) {
+                ciphers[i] = items[i];
+            }
+            break;
+        case 'b':
+            n_payloads = split(optarg, items);
+            for (i = 0; i < n_payloads; i++) {
+                payloads[i] = strtoul(items[i], NULL, 0);
+                if (payloads[i] == 0 || payloads[i] > MAX_PAYLOAD) {
+                    fprintf(stderr, "write size must be 1..%d\n",
+                            MAX_PAYLOAD);
+                    return 1;
+                }
+            }
+            break;
+        case 'w':
+            n_windows = split(optarg, items);
+            for (i = 0; i < n_windows; i++) {
+                windows[i] = strtoul(items[i], NULL, 0);
+            }
+            break;
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 's':
+            session_bytes = strtoull(optarg, NULL, 0);
+            break;
+        case 'n':
+            connects = atoi(optarg);
+            break;
+        case 'r':
+            rekey_bytes = strtoull(optarg, NULL, 0);
+            break;
+        case 'o':
+            csv = strcmp(optarg, "csv") == 0;
+            break;
+        case 'L':
+            local_host_key = optarg;
+            break;
+        case 'T':
+            memset(tests, 0, sizeof(tests));
+            n = split(optarg, items);
+            for (i = 0; i < n; i++) {
+                for (t = 0; t < NUM_TESTS; t++) {
+                    if (strcmp(items[i], test_names[t]) == 0) {
+                        tests[t] = 1;
+                        break;
+                    }
+                }
+                if (t == NUM_TESTS) {
+                    fprintf(stderr, "unknown test %s\n", items[i]);
+                    return 1;
+                }
+            }
+            break;
+        case 'k':
+            dispatch_packets = strtoull(optarg, NULL, 0);
+            break;
+        case 'x':
+            payload_kind = optarg;
+            break;
+        case 'l':
+            link_rate = strtoull(optarg, NULL, 0);
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-h host] [-p port] [-u user] "
+                            "[-P password] [-d dir] [-C ciphers] "
+                            "[-b sizes] [-w windows] [-t sessions] "
+                            "[-s bytes] [-n connects] [-r rekey bytes] "
+                            "[-o json|csv] [-L hostkey] [-T tests] "
+                            "[-k dispatch packets] "
+                            "[-x pattern|text|random] "
+                            "[-l link bytes/s]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (threads < 1) {
+        threads = 1;
+    }
+    // without HAVE_PTHREAD the library's mutexes do nothing and all
+    // sessions draw from one DRBG
+    if (threads > 1 &&
+        strcmp(ssh_threads_get_default()->type, "threads_pthread") != 0) {
+        fprintf(stderr, "-t needs a libssh built with HAVE_PTHREAD\n");
+        return 1;
+    }
+    // on fewer cores the sessions take turns and the sum stays flat, so the
+    // result says nothing about how the library scales
+    if (threads > sysconf(_SC_NPROCESSORS_ONLN)) {
+        fprintf(stderr, "-t %d: only %ld cpus online, the sum won't scale\n",
+                threads, sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+    if (fill_payload(payload_kind) != 0) {
+        fprintf(stderr, "unknown payload %s\n", payload_kind);
+        return 1;
+    }
+
+    ssh_init();
+    print_header();
+    for (c = 0; c < n_ciphers; c++) {
+        memset(&run, 0, sizeof(run));
+        run.cipher = ciphers[c];
+        if (tests[TEST_CONNECT]) {
+            run.test = TEST_CONNECT;
+            failed += bench_connect(&run) != 0;
+        }
+        if (tests[TEST_DISPATCH]) {
+            run.payload = DISPATCH_PAYLOAD;
+            run.test = TEST_DISPATCH;
+            failed += bench_throughput(&run) != 0;
+        }
+        for (p = 0; p < n_payloads; p++) {
+            run.payload = payloads[p];
+            run.window = 0;
+            for (t = TEST_CHANNEL; t <= TEST_SCP_PUSH; t++) {
+                if (tests[t] && t != TEST_DISPATCH) {
+                    run.test = t;
+                    failed += bench_throughput(&run) != 0;
+                }
+            }
+            if (!tests[TEST_SCP_READ] || local_host_key != NULL) {
+                continue;  // no scp source in process
+            }
+            for (w = 0; w < n_windows; w++) {
+                run.window = windows[w];
+                run.test = TEST_SCP_READ;
+                failed += bench_throughput(&run) != 0;
+            }
+        }
+    }
+    ssh_finalize();
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,228 @@
+#include "libssh/priv.h"
+#include "libssh/buffer.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// times the fixed-layout packers in buffer.h against ssh_buffer_pack() and
+// ssh_buffer_unpack() with the same formats, on the messages they build for
+// every channel packet
+//
+// usage: pack_bench [-n iterations] [-b data sizes] [-o json|csv]
+//
+// each case packs one message into a buffer that is emptied before the
+// next, the way packet.c reuses out_buffer, so the allocation is
+// amortized and what is left is the format walk and the per-field
+// appends. Sizes are comma separated and only matter for the cases with a
+// P field. Prints one line per case and path, with the nanoseconds per
+// message
+
+#define MAX_LIST 16
+// a buffer holds at most 16 KiB in this tree (BUFFER_SIZE_MAX in buffer.c)
+// and grows in powers of two, so a message has to fit in 8 KiB and change
+#define MAX_DATA 8192
+// the unpack case reads channel ids from a buffer refilled with this many
+#define UNPACK_IDS 2048
+
+static long iterations = 5000000;
+static size_t sizes[MAX_LIST];
+static int n_sizes;
+static int csv = 0;
+
+static uint8_t data[MAX_DATA];
+static uint8_t ids[UNPACK_IDS * 4];
+
+enum pack_case {
+    CASE_BD,       // SSH2_MSG_CHANNEL_EOF/CLOSE, UNIMPLEMENTED
+    CASE_BDD,      // SSH2_MSG_CHANNEL_WINDOW_ADJUST
+    CASE_BDDP,     // SSH2_MSG_CHANNEL_DATA
+    CASE_BDDDP,    // SSH2_MSG_CHANNEL_EXTENDED_DATA
+    CASE_UNPACK_D, // the recipient channel of every incoming channel packet
+    NUM_CASES
+};
+
+static const char *case_names[] = {
+    "bd", "bdd", "bddP", "bdddP", "unpack_d",
+};
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int pack_one(ssh_buffer buffer, enum pack_case c, int varargs,
+                    uint32_t len) {
+    switch (c) {
+    case CASE_BD:
+        if (varargs) {
+            return ssh_buffer_pack(buffer, "bd", 97, 1);
+        }
+        return ssh_buffer_pack_bd(buffer, 97, 1);
+    case CASE_BDD:
+        if (varargs) {
+            return ssh_buffer_pack(buffer, "bdd", 93, 1, 1048576);
+        }
+        return ssh_buffer_pack_bdd(buffer, 93, 1, 1048576);
+    case CASE_BDDP:
+        if (varargs) {
+            return ssh_buffer_pack(buffer, "bddP", 94, 1, len, (size_t)len,
+                                   data);
+        }
+        return ssh_buffer_pack_bddP(buffer, 94, 1, len, len, data);
+    case CASE_BDDDP:
+        if (varargs) {
+            return ssh_buffer_pack(buffer, "bdddP", 95, 1, 1, len,
+                                   (size_t)len, data);
+        }
+        return ssh_buffer_pack_bdddP(buffer, 95, 1, 1, len, len, data);
+    case CASE_UNPACK_D:
+    case NUM_CASES:
+        break;
+    }
+    return SSH_ERROR;
+}
+
+// nanoseconds per message, or a negative value if a call failed
+static double time_case(ssh_buffer buffer, enum pack_case c, int varargs,
+                        uint32_t len) {
+    uint32_t channel, sum = 0;
+    double t0;
+    long i;
+
+    t0 = now();
+    for (i = 0; i < iterations; i++) {
+        if (c == CASE_UNPACK_D) {
+            // one refill every UNPACK_IDS messages, the same for both paths
+            if (ssh_buffer_get_len(buffer) == 0) {
+                ssh_buffer_reinit(buffer);
+                ssh_buffer_add_data(buffer, ids, sizeof(ids));
+            }
+            if (varargs) {
+                if (ssh_buffer_unpack(buffer, "d", &channel) != SSH_OK) {
+                    return -1;
+                }
+            } else if (ssh_buffer_unpack_d(buffer, &channel) != SSH_OK) {
+                return -1;
+            }
+            sum += channel;
+            continue;
+        }
+        ssh_buffer_reinit(buffer);
+        if (pack_one(buffer, c, varargs, len) != SSH_OK) {
+            return -1;
+        }
+    }
+    if (c == CASE_UNPACK_D && sum != (uint32_t)iterations * 42) {
+        return -1;
+    }
+    return (now() - t0) / iterations * 1e9;
+}
+
+static void print_result(enum pack_case c, uint32_t len, double varargs_ns,
+                         double packer_ns) {
+    double speedup = packer_ns > 0 ? varargs_ns / packer_ns : 0;
+
+    if (csv) {
+        printf("%s,%u,%ld,%.1f,%.1f,%.2f\n", case_names[c], len, iterations,
+               varargs_ns, packer_ns, speedup);
+    } else {
+        printf("{\"format\":\"%s\",\"data\":%u,\"iterations\":%ld,"
+               "\"varargs_ns\":%.1f,\"packer_ns\":%.1f,\"speedup\":%.2f}\n",
+               case_names[c], len, iterations, varargs_ns, packer_ns,
+               speedup);
+    }
+    fflush(stdout);
+}
+
+static int run_case(enum pack_case c, uint32_t len) {
+    ssh_buffer buffer = ssh_buffer_new();
+    double varargs_ns, packer_ns;
+    int rc = -1;
+
+    if (buffer == NULL) {
+        return -1;
+    }
+    // once untimed so both paths start from a buffer of the final size
+    if (c != CASE_UNPACK_D && pack_one(buffer, c, 1, len) != SSH_OK) {
+        goto out;
+    }
+    varargs_ns = time_case(buffer, c, 1, len);
+    packer_ns = time_case(buffer, c, 0, len);
+    if (varargs_ns < 0 || packer_ns < 0) {
+        fprintf(stderr, "%s: pack failed\n", case_names[c]);
+        goto out;
+    }
+    print_result(c, len, varargs_ns, packer_ns);
+    rc = 0;
+
+out:
+    SSH_BUFFER_FREE(buffer);
+    return rc;
+}
+
+int main(int argc, char **argv) {
+    char *save = NULL;
+    char *item;
+    int opt, c, s;
+    int failed = 0;
+
+    sizes[0] = 64;
+    sizes[1] = 1024;
+    sizes[2] = 8192;
+    n_sizes = 3;
+
+    while ((opt = getopt(argc, argv, "n:b:o:")) != -1) {
+        switch (opt) {
+        case 'n':
+            iterations = atol(optarg);
+            break;
+        case 'b':
+            n_sizes = 0;
+            for (item = strtok_r(optarg, ",", &save);
+                 item != NULL && n_sizes < MAX_LIST;
+                 item = strtok_r(NULL, ",", &save)) {
+                sizes[n_sizes] = strtoul(item, NULL, 0);
+                if (sizes[n_sizes] > MAX_DATA) {
+                    fprintf(stderr, "data size must be 0..%d\n", MAX_DATA);
+                    return 1;
+                }
+                n_sizes++;
+            }
+            break;
+        case 'o':
+            csv = strcmp(optarg, "csv") == 0;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-n iterations] [-b data sizes] "
+                            "[-o json|csv]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (iterations < 1) {
+        iterations = 1;
+    }
+    memset(data, 'x', sizeof(data));
+    for (s = 0; s < UNPACK_IDS; s++) {
+        PUSH_BE_U32(ids, s * 4, 42);
+    }
+
+    if (csv) {
+        printf("format,data,iterations,varargs_ns,packer_ns,speedup\n");
+    }
+    for (c = 0; c < NUM_CASES; c++) {
+        if (c != CASE_BDDP && c != CASE_BDDDP) {
+            failed += run_case(c, 0) != 0;
+            continue;
+        }
+        for (s = 0; s < n_sizes; s++) {
+            failed += run_case(c, sizes[s]) != 0;
+        }
+    }
+
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,644 @@
+#define _GNU_SOURCE
+
+#include <libssh/callbacks.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+// hosted collection endpoint the ESP32 loggers upload to with scp
+//
+// usage: collector [-p port] [-k hostkey] [-d dir] [-u user] [-P password]
+//                  [-t workers] [-R]
+//
+// each worker thread serves its share of the loggers from its own ssh_event
+// and ssh_bind, nothing is shared between workers once a connection is
+// handed over. By default the main thread accepts and deals connections out
+// round-robin over a pipe per worker; with -R every worker listens on the
+// port itself with SO_REUSEPORT and the kernel spreads the connects. Either
+// way the listening socket is drained from an epoll set, so a burst of
+// connects doesn't wait behind session traffic
+//
+// each run writes below a directory of its own in -d, named after the time
+// it started, and each session below that in a directory named after its
+// id, so a restart never writes over the files of an earlier run
+//
+// uploads go through the scp sink of the libssh in this tree
+// (ssh_scp_sink_*), which the stock libssh doesn't have
+
+#define MAX_EPOLL_EVENTS 16
+#define POLL_TIMEOUT_MS 100
+#define MAX_WORKERS 256
+#define MAX_RUN_DIRS 100
+
+int ssh_port = 2222;
+const char *host_key = "ssh_host_ed25519_key";
+const char *out_dir = ".";
+char run_dir[4096];
+const char *ssh_user = "username";
+const char *ssh_password = "password";
+int num_workers = 0;  // one per online cpu
+int reuseport = 0;
+
+struct conn {
+    ssh_session session;
+    ssh_channel channel;
+    struct ssh_server_callbacks_struct server_cb;
+    struct ssh_channel_callbacks_struct channel_cb;
+    int done;
+    unsigned long id;
+    ssh_scp_sink sink;
+
+    struct conn *next;
+};
+
+struct worker {
+    int index;
+    pthread_t thread;
+    ssh_bind bind;
+    ssh_event event;
+    int lfd;      // own listening socket with -R, else -1
+    int epfd;     // epoll set holding lfd
+    int pipe[2];  // accepted fds from the main thread without -R
+    struct conn *conns;
+    unsigned long next_id;
+
+    unsigned long active;
+    unsigned long sessions;
+    // received by the sessions that are already freed
+    uint64_t files;
+    uint64_t bytes;
+
+    // copies of the counters above for the main thread's progress line
+    unsigned long pub_active;
+    unsigned long pub_sessions;
+    uint64_t pub_files;
+    uint64_t pub_bytes;
+};
+
+static volatile sig_atomic_t stop;
+
+// makes run_dir, out_dir/<start time>. Two runs started in the same second
+// get a suffix rather than sharing it
+static int make_run_dir(void) {
+    char stamp[32];
+    time_t t = time(NULL);
+    int i;
+
+    strftime(stamp, sizeof(stamp), "%Y%m%d-%H%M%S", localtime(&t));
+    for (i = 0; i < MAX_RUN_DIRS; i++) {
+        if (i == 0) {
+            snprintf(run_dir, sizeof(run_dir), "%s/%s", out_dir, stamp);
+        } else {
+            snprintf(run_dir, sizeof(run_dir), "%s/%s.%d", out_dir, stamp, i);
+        }
+        if (mkdir(run_dir, 0755) == 0) {
+            return 0;
+        }
+        if (errno != EEXIST) {
+            break;
+        }
+    }
+    fprintf(stderr, "can't create %s: %s\n", run_dir, strerror(errno));
+    return -1;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void on_signal(int sig) {
+    (void)sig;
+    stop = 1;
+}
+
+static int auth_password(ssh_session session, const char *user,
+                         const char *password, void *userdata) {
+    (void)session;
+    (void)userdata;
+
+    if (strcmp(user, ssh_user) == 0 && strcmp(password, ssh_password) == 0) {
+        return SSH_AUTH_SUCCESS;
+    }
+    return SSH_AUTH_DENIED;
+}
+
+static int on_channel_exec(ssh_session session, ssh_channel channel,
+                           const char *command, void *userdata) {
+    struct conn *c = userdata;
+    char dir[sizeof(run_dir) + 32];
+
+    (void)session;
+
+    if (c->sink != NULL) {
+        return 1;
+    }
+
+    // every session gets its own directory, the path the client asked for
+    // is ignored. Ids are unique within the run, so one that exists already
+    // isn't reused
+    snprintf(dir, sizeof(dir), "%s/%lu", run_dir, c->id);
+    if (mkdir(dir, 0755) < 0) {
+        fprintf(stderr, "session %lu: can't create %s: %s\n", c->id, dir,
+                strerror(errno));
+        return 1;
+    }
+
+    c->sink = ssh_scp_sink_new(channel, dir);
+    if (c->sink == NULL) {
+        return 1;
+    }
+    if (ssh_scp_sink_start(c->sink, command) != SSH_OK) {
+        ssh_scp_sink_free(c->sink);
+        c->sink = NULL;
+        return 1;
+    }
+    return 0;
+}
+
+static void on_channel_eof(ssh_session session, ssh_channel channel,
+                           void *userdata) {
+    struct conn *c = userdata;
+
+    (void)session;
+    ssh_channel_request_send_exit_status(
+        channel, ssh_scp_sink_get_status(c->sink) == SSH_OK ? 0 : 1);
+    ssh_channel_send_eof(channel);
+    ssh_channel_close(channel);
+}
+
+static void on_channel_close(ssh_session session, ssh_channel channel,
+                             void *userdata) {
+    struct conn *c = userdata;
+
+    (void)session;
+    (void)channel;
+    c->done = 1;
+}
+
+static ssh_channel on_channel_open(ssh_session session, void *userdata) {
+    struct conn *c = userdata;
+
+    if (c->channel != NULL) {
+        return NULL;
+    }
+
+    c->channel = ssh_channel_new(session);
+    if (c->channel == NULL) {
+        return NULL;
+    }
+
+    c->channel_cb.userdata = c;
+    c->channel_cb.channel_exec_request_function = on_channel_exec;
+    c->channel_cb.channel_eof_function = on_channel_eof;
+    c->channel_cb.channel_close_function = on_channel_close;
+    ssh_callbacks_init(&c->channel_cb);
+    ssh_set_channel_callbacks(c->channel, &c->channel_cb);
+
+    return c->channel;
+}
+
+static void conn_free(struct worker *w, struct conn *c) {
+    if (c->sink != NULL) {
+        w->files += ssh_scp_sink_get_files(c->sink);
+        w->bytes += ssh_scp_sink_get_bytes(c->sink);
+        ssh_scp_sink_free(c->sink);
+    }
+    ssh_event_remove_session(w->event, c->session);
+    ssh_disconnect(c->session);
+    ssh_free(c->session);
+    free(c);
+    w->active--;
+}
+
+// makes the counters, including what open sessions received so far,
+// visible to the main thread
+static void publish(struct worker *w) {
+    uint64_t files = w->files;
+    uint64_t bytes = w->bytes;
+    struct conn *c;
+
+    for (c = w->conns; c != NULL; c = c->next) {
+        files += ssh_scp_sink_get_files(c->sink);
+        bytes += ssh_scp_sink_get_bytes(c->sink);
+    }
+    __atomic_store_n(&w->pub_active, w->active, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->pub_sessions, w->sessions, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->pub_files, files, __ATOMIC_RELAXED);
+    __atomic_store_n(&w->pub_bytes, bytes, __ATOMIC_RELAXED);
+}
+
+static void accept_one(struct worker *w, int fd) {
+    struct conn *c = calloc(1, sizeof(*c));
+    int rc;
+
+    if (c == NULL) {
+        close(fd);
+        return;
+    }
+    // unique across workers so the upload directories don't collide
+    c->id = w->next_id++ * num_workers + w->index;
+
+    c->session = ssh_new();
+    if (c->session == NULL) {
+        free(c);
+        close(fd);
+        return;
+    }
+
+    rc = ssh_bind_accept_fd(w->bind, c->session, fd);
+    if (rc != SSH_OK) {
+        fprintf(stderr, "accept failed: %s\n", ssh_get_error(w->bind));
+        ssh_free(c->session);
+        free(c);
+        close(fd);
+        return;
+    }
+
+    ssh_set_blocking(c->session, 0);
+    ssh_set_auth_methods(c->session, SSH_AUTH_METHOD_PASSWORD);
+
+    c->server_cb.userdata = c;
+    c->server_cb.auth_password_function = auth_password;
+    c->server_cb.channel_open_request_session_function = on_channel_open;
+    ssh_callbacks_init(&c->server_cb);
+    ssh_set_server_callbacks(c->session, &c->server_cb);
+
+    // only starts the key exchange, the worker's ssh_event carries it on.
+    // Calling this again later would poll the whole event, where any other
+    // session hanging up is returned as an error of this one
+    rc = ssh_handle_key_exchange(c->session);
+    if (rc == SSH_ERROR) {
+        fprintf(stderr, "key exchange failed: %s\n",
+                ssh_get_error(c->session));
+        ssh_free(c->session);
+        free(c);
+        return;
+    }
+
+    ssh_event_add_session(w->event, c->session);
+    c->next = w->conns;
+    w->conns = c;
+    w->active++;
+    w->sessions++;
+}
+
+// accepts everything pending on the listening sockets in the epoll set,
+// calls deliver for each connection
+static void drain_backlog(int epfd, void (*deliver)(void *, int),
+                          void *arg) {
+    struct epoll_event events[MAX_EPOLL_EVENTS];
+    int n, i;
+
+    n = epoll_wait(epfd, events, MAX_EPOLL_EVENTS, 0);
+    for (i = 0; i < n; i++) {
+        for (;;) {
+            int cfd = accept4(events[i].data.fd, NULL, NULL,
+                              SOCK_NONBLOCK | SOCK_CLOEXEC);
+            if (cfd < 0) {
+                break;
+            }
+            deliver(arg, cfd);
+        }
+    }
+}
+
+static void deliver_local(void *arg, int fd) {
+    accept_one(arg, fd);
+}
+
+// the epoll fd is readable while the backlog has connections in it
+static int accept_ready(socket_t fd, int revents, void *userdata) {
+    (void)revents;
+    drain_backlog(fd, deliver_local, userdata);
+    return 0;
+}
+
+// fds handed over by the main thread
+static int handoff_ready(socket_t fd, int revents, void *userdata) {
+    int cfd;
+
+    (void)revents;
+    while (read(fd, &cfd, sizeof(cfd)) == sizeof(cfd)) {
+        accept_one(userdata, cfd);
+    }
+    return 0;
+}
+
+// frees sessions that are over
+static void reap(struct worker *w) {
+    struct conn **pc = &w->conns;
+
+    while (*pc != NULL) {
+        struct conn *c = *pc;
+        int status;
+
+        status = ssh_get_status(c->session);
+        if (c->done || (status & (SSH_CLOSED | SSH_CLOSED_ERROR))) {
+            *pc = c->next;
+            conn_free(w, c);
+            continue;
+        }
+        pc = &c->next;
+    }
+}
+
+static int listen_socket(void) {
+    struct sockaddr_in addr;
+    int one = 1;
+    int fd;
+
+    fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd < 0) {
+        return -1;
+    }
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+    if (reuseport &&
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &one, sizeof(one)) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(ssh_port);
+    addr.sin_addr.s_addr = htonl(INADDR_ANY);
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 ||
+        listen(fd, SOMAXCONN) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+static int epoll_with(int fd) {
+    struct epoll_event ev;
+    int epfd;
+
+    epfd = epoll_create1(EPOLL_CLOEXEC);
+    if (epfd < 0) {
+        return -1;
+    }
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0) {
+        close(epfd);
+        return -1;
+    }
+    return epfd;
+}
+
+static int worker_init(struct worker *w, int index) {
+    memset(w, 0, sizeof(*w));
+    w->index = index;
+    w->lfd = -1;
+    w->epfd = -1;
+    w->pipe[0] = w->pipe[1] = -1;
+
+    // never listens, ssh_bind_accept_fd loads the host key on first use
+    w->bind = ssh_bind_new();
+    if (w->bind == NULL) {
+        return -1;
+    }
+    ssh_bind_options_set(w->bind, SSH_BIND_OPTIONS_HOSTKEY, host_key);
+
+    w->event = ssh_event_new();
+    if (w->event == NULL) {
+        return -1;
+    }
+
+    if (reuseport) {
+        w->lfd = listen_socket();
+        if (w->lfd < 0) {
+            fprintf(stderr, "listen failed: %s\n", strerror(errno));
+            return -1;
+        }
+        w->epfd = epoll_with(w->lfd);
+        if (w->epfd < 0) {
+            return -1;
+        }
+        return ssh_event_add_fd(w->event, w->epfd, POLLIN, accept_ready, w);
+    }
+
+    if (pipe2(w->pipe, O_NONBLOCK | O_CLOEXEC) < 0) {
+        return -1;
+    }
+    return ssh_event_add_fd(w->event, w->pipe[0], POLLIN, handoff_ready, w);
+}
+
+static void worker_free(struct worker *w) {
+    while (w->conns != NULL) {
+        struct conn *c = w->conns;
+        w->conns = c->next;
+        conn_free(w, c);
+    }
+    publish(w);
+    if (w->event != NULL) {
+        if (w->epfd >= 0) {
+            ssh_event_remove_fd(w->event, w->epfd);
+        }
+        if (w->pipe[0] >= 0) {
+            ssh_event_remove_fd(w->event, w->pipe[0]);
+        }
+        ssh_event_free(w->event);
+    }
+    if (w->epfd >= 0) {
+        close(w->epfd);
+    }
+    if (w->lfd >= 0) {
+        close(w->lfd);
+    }
+    if (w->pipe[0] >= 0) {
+        close(w->pipe[0]);
+        close(w->pipe[1]);
+    }
+    if (w->bind != NULL) {
+        ssh_bind_free(w->bind);
+    }
+}
+
+static void *worker_main(void *arg) {
+    struct worker *w = arg;
+
+    while (!stop) {
+        ssh_event_dopoll(w->event, POLL_TIMEOUT_MS);
+        reap(w);
+        publish(w);
+    }
+    return NULL;
+}
+
+// round-robin mode: hands each accepted fd to the next worker
+static void deliver_round_robin(void *arg, int fd) {
+    static unsigned int next;
+    struct worker *workers = arg;
+    struct worker *w = &workers[next++ % num_workers];
+
+    if (write(w->pipe[1], &fd, sizeof(fd)) != sizeof(fd)) {
+        close(fd);
+    }
+}
+
+static void totals(struct worker *workers, unsigned long *active,
+                   unsigned long *sessions, uint64_t *files,
+                   uint64_t *bytes) {
+    int i;
+
+    *active = *sessions = 0;
+    *files = *bytes = 0;
+    for (i = 0; i < num_workers; i++) {
+        struct worker *w = &workers[i];
+
+        *active += __atomic_load_n(&w->pub_active, __ATOMIC_RELAXED);
+        *sessions += __atomic_load_n(&w->pub_sessions, __ATOMIC_RELAXED);
+        *files += __atomic_load_n(&w->pub_files, __ATOMIC_RELAXED);
+        *bytes += __atomic_load_n(&w->pub_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+int main(int argc, char **argv) {
+    struct worker *workers;
+    unsigned long active, sessions;
+    uint64_t files, bytes;
+    unsigned long last_sessions = 0;
+    uint64_t last_bytes = 0;
+    int lfd = -1, epfd = -1;
+    double last;
+    int opt, i;
+
+    while ((opt = getopt(argc, argv, "p:k:d:u:P:t:R")) != -1) {
+        switch (opt) {
+        case 'p':
+            ssh_port = atoi(optarg);
+            break;
+        case 'k':
+            host_key = optarg;
+            break;
+        case 'd':
+            out_dir = optarg;
+            break;
+        case 'u':
+            ssh_user = optarg;
+            break;
+        case 'P':
+            ssh_password = optarg;
+            break;
+        case 't':
+            num_workers = atoi(optarg);
+            break;
+        case 'R':
+            reuseport = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-p port] [-k hostkey] [-d dir] "
+                            "[-u user] [-P password] [-t workers] [-R]\n",
+                    argv[0]);
+            return 1;
+        }
+    }
+    if (num_workers <= 0) {
+        num_workers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+    if (num_workers <= 0 || num_workers > MAX_WORKERS) {
+        num_workers = num_workers <= 0 ? 1 : MAX_WORKERS;
+    }
+    // more workers than cpus take turns, handshakes/s won't grow with them
+    if (num_workers > sysconf(_SC_NPROCESSORS_ONLN)) {
+        fprintf(stderr, "%d workers on %ld cpus online\n", num_workers,
+                sysconf(_SC_NPROCESSORS_ONLN));
+    }
+
+    signal(SIGINT, on_signal);
+    signal(SIGTERM, on_signal);
+    signal(SIGPIPE, SIG_IGN);
+
+    workers = calloc(num_workers, sizeof(*workers));
+    if (workers == NULL) {
+        return 1;
+    }
+
+    if (make_run_dir() < 0) {
+        return 1;
+    }
+
+    ssh_init();
+    for (i = 0; i < num_workers; i++) {
+        if (worker_init(&workers[i], i) < 0) {
+            return 1;
+        }
+    }
+    if (!reuseport) {
+        lfd = listen_socket();
+        epfd = lfd >= 0 ? epoll_with(lfd) : -1;
+        if (epfd < 0) {
+            fprintf(stderr, "listen failed: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+    for (i = 0; i < num_workers; i++) {
+        pthread_create(&workers[i].thread, NULL, worker_main, &workers[i]);
+    }
+    printf("listening on port %d with %d workers (%s), writing to %s\n",
+           ssh_port, num_workers, reuseport ? "SO_REUSEPORT" : "round-robin",
+           run_dir);
+
+    last = now();
+    while (!stop) {
+        double t;
+
+        if (epfd >= 0) {
+            struct epoll_event ev;
+            if (epoll_wait(epfd, &ev, 1, POLL_TIMEOUT_MS) > 0) {
+                drain_backlog(epfd, deliver_round_robin, workers);
+            }
+        } else {
+            poll(NULL, 0, POLL_TIMEOUT_MS);
+        }
+
+        t = now();
+        if (t - last < 1.0) {
+            continue;
+        }
+        totals(workers, &active, &sessions, &files, &bytes);
+        printf("%lu active, %.1f sessions/s, %.2f MB/s, %llu files\n", active,
+               (sessions - last_sessions) / (t - last),
+               (bytes - last_bytes) / (t - last) / 1e6,
+               (unsigned long long)files);
+        fflush(stdout);
+        last_sessions = sessions;
+        last_bytes = bytes;
+        last = t;
+    }
+
+    for (i = 0; i < num_workers; i++) {
+        pthread_join(workers[i].thread, NULL);
+        worker_free(&workers[i]);
+    }
+    if (epfd >= 0) {
+        close(epfd);
+        close(lfd);
+    }
+    ssh_finalize();
+
+    totals(workers, &active, &sessions, &files, &bytes);
+    printf("%lu sessions, %llu files, %llu bytes\n", sessions,
+           (unsigned long long)files, (unsigned long long)bytes);
+    free(workers);
+    return 0;
+}
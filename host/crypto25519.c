@@ -0,0 +1,155 @@
+#include <stdint.h>
+#include <string.h>
+
+#include <openssl/evp.h>
+
+#include "libssh/curve25519.h"
+#include "libssh/ed25519.h"
+
+// the hosted build of test/lib takes curve25519 and ed25519 from OpenSSL.
+// Upstream libssh carries reference implementations of both under
+// src/external which the ESP32 tree doesn't vendor, only their declarations
+//
+// the functions keep the NaCl conventions libssh calls them with: 0 on
+// success, an ed25519 secret key is the 32 byte seed followed by the public
+// key, and a signed message is the signature followed by the message
+
+static int raw_public(EVP_PKEY *key, unsigned char *out) {
+    size_t len = 32;
+
+    if (EVP_PKEY_get_raw_public_key(key, out, &len) != 1 || len != 32) {
+        return -1;
+    }
+    return 0;
+}
+
+int crypto_scalarmult_base(unsigned char *q, const unsigned char *n) {
+    EVP_PKEY *key;
+    int rc;
+
+    key = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, n,
+                                       CURVE25519_PRIVKEY_SIZE);
+    if (key == NULL) {
+        return -1;
+    }
+    rc = raw_public(key, q);
+    EVP_PKEY_free(key);
+    return rc;
+}
+
+int crypto_scalarmult(unsigned char *q, const unsigned char *n,
+                      const unsigned char *p) {
+    EVP_PKEY *key = NULL, *peer = NULL;
+    EVP_PKEY_CTX *ctx = NULL;
+    size_t len = CURVE25519_PUBKEY_SIZE;
+    int rc = -1;
+
+    key = EVP_PKEY_new_raw_private_key(EVP_PKEY_X25519, NULL, n,
+                                       CURVE25519_PRIVKEY_SIZE);
+    peer = EVP_PKEY_new_raw_public_key(EVP_PKEY_X25519, NULL, p,
+                                       CURVE25519_PUBKEY_SIZE);
+    if (key == NULL || peer == NULL) {
+        goto out;
+    }
+    ctx = EVP_PKEY_CTX_new(key, NULL);
+    if (ctx == NULL ||
+        EVP_PKEY_derive_init(ctx) != 1 ||
+        EVP_PKEY_derive_set_peer(ctx, peer) != 1 ||
+        EVP_PKEY_derive(ctx, q, &len) != 1 ||
+        len != CURVE25519_PUBKEY_SIZE) {
+        goto out;
+    }
+    rc = 0;
+
+out:
+    EVP_PKEY_CTX_free(ctx);
+    EVP_PKEY_free(peer);
+    EVP_PKEY_free(key);
+    return rc;
+}
+
+int crypto_sign_ed25519_keypair(ed25519_pubkey pk, ed25519_privkey sk) {
+    EVP_PKEY_CTX *ctx;
+    EVP_PKEY *key = NULL;
+    size_t len = 32;
+    int rc = -1;
+
+    ctx = EVP_PKEY_CTX_new_id(EVP_PKEY_ED25519, NULL);
+    if (ctx == NULL ||
+        EVP_PKEY_keygen_init(ctx) != 1 ||
+        EVP_PKEY_keygen(ctx, &key) != 1) {
+        goto out;
+    }
+    if (EVP_PKEY_get_raw_private_key(key, sk, &len) != 1 || len != 32 ||
+        raw_public(key, pk) != 0) {
+        goto out;
+    }
+    memcpy(sk + 32, pk, ED25519_PK_LEN);
+    rc = 0;
+
+out:
+    EVP_PKEY_free(key);
+    EVP_PKEY_CTX_free(ctx);
+    return rc;
+}
+
+int crypto_sign_ed25519(unsigned char *sm, uint64_t *smlen,
+                        const unsigned char *m, uint64_t mlen,
+                        const ed25519_privkey sk) {
+    EVP_MD_CTX *ctx = NULL;
+    EVP_PKEY *key;
+    size_t len = ED25519_SIG_LEN;
+    int rc = -1;
+
+    key = EVP_PKEY_new_raw_private_key(EVP_PKEY_ED25519, NULL, sk, 32);
+    if (key == NULL) {
+        return -1;
+    }
+    ctx = EVP_MD_CTX_new();
+    if (ctx == NULL ||
+        EVP_DigestSignInit(ctx, NULL, NULL, NULL, key) != 1 ||
+        EVP_DigestSign(ctx, sm, &len, m, mlen) != 1 ||
+        len != ED25519_SIG_LEN) {
+        goto out;
+    }
+    memmove(sm + ED25519_SIG_LEN, m, mlen);
+    *smlen = mlen + ED25519_SIG_LEN;
+    rc = 0;
+
+out:
+    EVP_MD_CTX_free(ctx);
+    EVP_PKEY_free(key);
+    return rc;
+}
+
+int crypto_sign_ed25519_open(unsigned char *m, uint64_t *mlen,
+                             const unsigned char *sm, uint64_t smlen,
+                             const ed25519_pubkey pk) {
+    EVP_MD_CTX *ctx = NULL;
+    EVP_PKEY *key;
+    int rc = -1;
+
+    if (smlen < ED25519_SIG_LEN) {
+        return -1;
+    }
+    key = EVP_PKEY_new_raw_public_key(EVP_PKEY_ED25519, NULL, pk,
+                                      ED25519_PK_LEN);
+    if (key == NULL) {
+        return -1;
+    }
+    ctx = EVP_MD_CTX_new();
+    if (ctx == NULL ||
+        EVP_DigestVerifyInit(ctx, NULL, NULL, NULL, key) != 1 ||
+        EVP_DigestVerify(ctx, sm, ED25519_SIG_LEN, sm + ED25519_SIG_LEN,
+                         smlen - ED25519_SIG_LEN) != 1) {
+        goto out;
+    }
+    memmove(m, sm + ED25519_SIG_LEN, smlen - ED25519_SIG_LEN);
+    *mlen = smlen - ED25519_SIG_LEN;
+    rc = 0;
+
+out:
+    EVP_MD_CTX_free(ctx);
+    EVP_PKEY_free(key);
+    return rc;
+}
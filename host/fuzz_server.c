@@ -0,0 +1,92 @@
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+// feeds arbitrary bytes to the server side of the hosted libssh as if they
+// came from a client: banner, key exchange and whatever packets follow.
+// The bytes are written to one end of a socketpair and the server session
+// is accepted on the other, the way ssh_pair_new() joins a pair
+//
+// built with clang -fsanitize=fuzzer this is a libFuzzer target. Built with
+// -DFUZZ_STANDALONE it runs each file given on the command line once, to
+// replay a crash or check the corpus in host/fuzz_corpus without clang
+//
+// usage: fuzz_server file...
+
+// a socketpair buffers at least this much, so the write never blocks
+#define MAX_INPUT (64 * 1024)
+
+// one bind for all runs, each accepted session gets a copy of its key
+static ssh_bind sshbind = NULL;
+
+int LLVMFuzzerTestOneInput(const uint8_t *data, size_t size) {
+    ssh_session server;
+    ssh_key key = NULL;
+    int fds[2];
+
+    if (size > MAX_INPUT) {
+        return 0;
+    }
+    if (sshbind == NULL) {
+        ssh_init();
+        sshbind = ssh_bind_new();
+        // the bind takes the key
+        if (sshbind == NULL ||
+            ssh_pki_generate(SSH_KEYTYPE_ECDSA, 256, &key) != SSH_OK ||
+            ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_IMPORT_KEY, key) !=
+                SSH_OK) {
+            abort();
+        }
+    }
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+        abort();
+    }
+    if (write(fds[0], data, size) != (ssize_t)size) {
+        abort();
+    }
+    // the server sees the end of the input as the client hanging up
+    shutdown(fds[0], SHUT_WR);
+
+    server = ssh_new();
+    if (server == NULL) {
+        abort();
+    }
+
+    if (ssh_bind_accept_fd(sshbind, server, fds[1]) == SSH_OK) {
+        ssh_handle_key_exchange(server);
+    } else {
+        close(fds[1]);
+    }
+
+    ssh_free(server);
+    close(fds[0]);
+    return 0;
+}
+
+#ifdef FUZZ_STANDALONE
+int main(int argc, char **argv) {
+    static uint8_t buf[MAX_INPUT];
+    FILE *file;
+    size_t len;
+    int i;
+
+    for (i = 1; i < argc; i++) {
+        file = fopen(argv[i], "rb");
+        if (file == NULL) {
+            perror(argv[i]);
+            return 1;
+        }
+        len = fread(buf, 1, sizeof(buf), file);
+        fclose(file);
+        LLVMFuzzerTestOneInput(buf, len);
+        printf("%s: %zu bytes\n", argv[i], len);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,3 @@
+// stands in for the ESP-IDF version header in the hosted build of test/lib,
+// a hosted libc has everything the compat shims for IDF 3 add
+#define ESP_IDF_VERSION_MAJOR 4
@@ -0,0 +1,4 @@
+// lwIP's socket headers for the hosted build of test/lib, the BSD ones
+// have the same names
+#include <arpa/inet.h>
+#include <netinet/in.h>
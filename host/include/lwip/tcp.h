@@ -0,0 +1,2 @@
+// lwIP's tcp header for the hosted build of test/lib
+#include <netinet/tcp.h>
@@ -0,0 +1,325 @@
+#include <libssh/callbacks.h>
+#include <libssh/crypto_provider.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// installs a mock accelerated crypto provider in the hosted libssh and
+// checks which packets end up on it
+//
+// usage: test_crypto_provider
+//
+// the mock passes every call on to mbedTLS and counts it. A client and a
+// server session are joined with ssh_pair_new() and run the handshake and
+// password auth, the packets after NEWKEYS go through the provider. Prints
+// one line per case and exits non-zero if any failed
+
+struct mock_calls {
+    uint64_t hmac_finish;
+    uint64_t cipher_update;
+    uint64_t gcm;
+};
+
+static struct mock_calls calls;
+
+int failures = 0;
+
+static int mock_hmac_update(mbedtls_md_context_t *ctx,
+                            const unsigned char *input, size_t ilen) {
+    return mbedtls_md_hmac_update(ctx, input, ilen);
+}
+
+static int mock_hmac_finish(mbedtls_md_context_t *ctx,
+                            unsigned char *output) {
+    calls.hmac_finish++;
+    return mbedtls_md_hmac_finish(ctx, output);
+}
+
+static int mock_cipher_update(mbedtls_cipher_context_t *ctx,
+                              const unsigned char *input, size_t ilen,
+                              unsigned char *output, size_t *olen) {
+    calls.cipher_update++;
+    return mbedtls_cipher_update(ctx, input, ilen, output, olen);
+}
+
+static int mock_cipher_finish(mbedtls_cipher_context_t *ctx,
+                              unsigned char *output, size_t *olen) {
+    return mbedtls_cipher_finish(ctx, output, olen);
+}
+
+static int mock_gcm_crypt_and_tag(mbedtls_gcm_context *ctx, int mode,
+                                  size_t length, const unsigned char *iv,
+                                  size_t iv_len, const unsigned char *add,
+                                  size_t add_len, const unsigned char *input,
+                                  unsigned char *output, size_t tag_len,
+                                  unsigned char *tag) {
+    calls.gcm++;
+    return mbedtls_gcm_crypt_and_tag(ctx, mode, length, iv, iv_len, add,
+                                     add_len, input, output, tag_len, tag);
+}
+
+static int mock_gcm_auth_decrypt(mbedtls_gcm_context *ctx, size_t length,
+                                 const unsigned char *iv, size_t iv_len,
+                                 const unsigned char *add, size_t add_len,
+                                 const unsigned char *tag, size_t tag_len,
+                                 const unsigned char *input,
+                                 unsigned char *output) {
+    calls.gcm++;
+    return mbedtls_gcm_auth_decrypt(ctx, length, iv, iv_len, add, add_len,
+                                    tag, tag_len, input, output);
+}
+
+static struct ssh_crypto_provider_struct mock = {
+    .name = "mock",
+    .hmac_update = mock_hmac_update,
+    .hmac_finish = mock_hmac_finish,
+    .cipher_update = mock_cipher_update,
+    .cipher_finish = mock_cipher_finish,
+    .gcm_crypt_and_tag = mock_gcm_crypt_and_tag,
+    .gcm_auth_decrypt = mock_gcm_auth_decrypt,
+};
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            goto out; \
+        } \
+    } while (0)
+
+static int auth_password(ssh_session session, const char *user,
+                         const char *password, void *userdata) {
+    (void)session;
+    (void)user;
+    (void)userdata;
+    return strcmp(password, "secret") == 0 ? SSH_AUTH_SUCCESS
+                                           : SSH_AUTH_DENIED;
+}
+
+static int auth_step(void *userdata) {
+    switch (ssh_userauth_password(userdata, NULL, "secret")) {
+    case SSH_AUTH_SUCCESS:
+        return SSH_OK;
+    case SSH_AUTH_AGAIN:
+        return SSH_AGAIN;
+    default:
+        return SSH_ERROR;
+    }
+}
+
+// handshake and auth between two sessions, cipher and hmac both ways
+static int run_pair(const char *cipher, const char *hmac) {
+    struct ssh_server_callbacks_struct server_cb;
+    ssh_session client, server;
+    ssh_bind sshbind;
+    ssh_key key = NULL;
+    ssh_pair pair = NULL;
+    int rc = -1;
+
+    client = ssh_new();
+    server = ssh_new();
+    sshbind = ssh_bind_new();
+    CHECK(client != NULL && server != NULL && sshbind != NULL, "allocating");
+    CHECK(ssh_pki_generate(SSH_KEYTYPE_ECDSA, 256, &key) == SSH_OK, "key");
+    // the bind takes the key
+    CHECK(ssh_bind_options_set(sshbind, SSH_BIND_OPTIONS_IMPORT_KEY, key) ==
+              SSH_OK,
+          "%s", ssh_get_error(sshbind));
+    CHECK(ssh_options_set(client, SSH_OPTIONS_CIPHERS_C_S, cipher) == SSH_OK &&
+              ssh_options_set(client, SSH_OPTIONS_CIPHERS_S_C, cipher) ==
+                  SSH_OK &&
+              ssh_options_set(client, SSH_OPTIONS_HMAC_C_S, hmac) == SSH_OK &&
+              ssh_options_set(client, SSH_OPTIONS_HMAC_S_C, hmac) == SSH_OK,
+          "%s", ssh_get_error(client));
+
+    pair = ssh_pair_new(sshbind, client, server);
+    CHECK(pair != NULL, "pair: %s", ssh_get_error(sshbind));
+    memset(&server_cb, 0, sizeof(server_cb));
+    ssh_set_auth_methods(server, SSH_AUTH_METHOD_PASSWORD);
+    server_cb.auth_password_function = auth_password;
+    ssh_callbacks_init(&server_cb);
+    ssh_set_server_callbacks(server, &server_cb);
+
+    CHECK(ssh_pair_handshake(pair) == SSH_OK, "handshake: %s",
+          ssh_get_error(client));
+    CHECK(ssh_pair_run(pair, auth_step, client) == SSH_OK, "auth: %s",
+          ssh_get_error(client));
+    rc = 0;
+
+out:
+    ssh_pair_free(pair);
+    if (client != NULL) {
+        ssh_disconnect(client);
+        ssh_free(client);
+    }
+    if (server != NULL) {
+        ssh_free(server);
+    }
+    if (sshbind != NULL) {
+        ssh_bind_free(sshbind);
+    }
+    return rc;
+}
+
+// the provider counters since the last call
+static void stats_delta(int accelerated, struct ssh_crypto_provider_stats *d) {
+    static struct ssh_crypto_provider_stats last[2];
+    struct ssh_crypto_provider_stats now;
+
+    memset(&now, 0, sizeof(now));
+    ssh_crypto_provider_get_stats(accelerated, &now);
+    d->hmac_packets = now.hmac_packets - last[accelerated].hmac_packets;
+    d->cipher_calls = now.cipher_calls - last[accelerated].cipher_calls;
+    d->aead_packets = now.aead_packets - last[accelerated].aead_packets;
+    d->bytes = now.bytes - last[accelerated].bytes;
+    last[accelerated] = now;
+}
+
+static void reset(uint32_t mock_caps, uint32_t enabled_caps) {
+    struct ssh_crypto_provider_stats d;
+
+    mock.caps = mock_caps;
+    ssh_crypto_provider_register(&mock);
+    ssh_crypto_provider_set_caps(enabled_caps);
+    memset(&calls, 0, sizeof(calls));
+    stats_delta(0, &d);
+    stats_delta(1, &d);
+}
+
+static int test_hmac_cipher(void) {
+    struct ssh_crypto_provider_stats soft, accel;
+    int rc = -1;
+
+    reset(SSH_CRYPTO_CAP_SHA256 | SSH_CRYPTO_CAP_AES, SSH_CRYPTO_CAP_ALL);
+    CHECK(run_pair("aes128-ctr", "hmac-sha2-256") == 0, "session");
+    stats_delta(0, &soft);
+    stats_delta(1, &accel);
+    CHECK(calls.hmac_finish > 0 && calls.cipher_update > 0,
+          "mock saw %llu hmac, %llu cipher",
+          (unsigned long long)calls.hmac_finish,
+          (unsigned long long)calls.cipher_update);
+    CHECK(accel.hmac_packets == calls.hmac_finish &&
+              accel.cipher_calls == calls.cipher_update,
+          "mock stats %llu hmac, %llu cipher",
+          (unsigned long long)accel.hmac_packets,
+          (unsigned long long)accel.cipher_calls);
+    CHECK(accel.bytes > 0, "no bytes counted");
+    CHECK(soft.hmac_packets == 0 && soft.cipher_calls == 0,
+          "software served %llu hmac, %llu cipher",
+          (unsigned long long)soft.hmac_packets,
+          (unsigned long long)soft.cipher_calls);
+    rc = 0;
+
+out:
+    return rc;
+}
+
+// a capability masked off with ssh_crypto_provider_set_caps() goes to the
+// software provider, the others stay on the mock
+static int test_masked(void) {
+    struct ssh_crypto_provider_stats soft, accel;
+    int rc = -1;
+
+    reset(SSH_CRYPTO_CAP_SHA256 | SSH_CRYPTO_CAP_AES,
+          SSH_CRYPTO_CAP_ALL & ~SSH_CRYPTO_CAP_AES);
+    CHECK(run_pair("aes128-ctr", "hmac-sha2-256") == 0, "session");
+    stats_delta(0, &soft);
+    stats_delta(1, &accel);
+    CHECK(calls.cipher_update == 0 && accel.cipher_calls == 0,
+          "mock got %llu cipher calls",
+          (unsigned long long)calls.cipher_update);
+    CHECK(soft.cipher_calls > 0, "software got no cipher calls");
+    CHECK(calls.hmac_finish > 0 && accel.hmac_packets == calls.hmac_finish,
+          "mock hmac %llu, stats %llu",
+          (unsigned long long)calls.hmac_finish,
+          (unsigned long long)accel.hmac_packets);
+    rc = 0;
+
+out:
+    return rc;
+}
+
+static int test_gcm(void) {
+    struct ssh_crypto_provider_stats accel;
+    int rc = -1;
+
+    reset(SSH_CRYPTO_CAP_AES_GCM, SSH_CRYPTO_CAP_ALL);
+    CHECK(run_pair("aes256-gcm@openssh.com", "hmac-sha2-256") == 0,
+          "session");
+    stats_delta(1, &accel);
+    CHECK(calls.gcm > 0 && accel.aead_packets == calls.gcm,
+          "mock gcm %llu, stats %llu", (unsigned long long)calls.gcm,
+          (unsigned long long)accel.aead_packets);
+    CHECK(calls.hmac_finish == 0, "hmac with an AEAD cipher");
+    rc = 0;
+
+out:
+    return rc;
+}
+
+// hashed known_hosts names are HMAC-SHA1 as well, but not packets
+static int test_known_hosts_hash(void) {
+    static const char line[] =
+        "|1|F1E1KeoE/eEWhi10WpGv4OdiO6Y=|3988QV0VE8wmZL7suNrYQLITLCg= "
+        "ssh-ed25519 AAAAC3NzaC1lZDI1NTE5AAAAIDoGHBgNYNkPC0+CybsV1UUtG7Z3Rm"
+        "WMo5kU8ph5bP3k";
+    struct ssh_knownhosts_entry *entry = NULL;
+    struct ssh_crypto_provider_stats accel;
+    int rc = -1;
+
+    reset(SSH_CRYPTO_CAP_SHA1, SSH_CRYPTO_CAP_ALL);
+    ssh_known_hosts_parse_line("collector.example", line, &entry);
+    ssh_knownhosts_entry_free(entry);
+    stats_delta(1, &accel);
+    CHECK(calls.hmac_finish == 1, "mock hmac %llu",
+          (unsigned long long)calls.hmac_finish);
+    CHECK(accel.hmac_packets == 0 && accel.bytes == 0,
+          "counted as %llu packets, %llu bytes",
+          (unsigned long long)accel.hmac_packets,
+          (unsigned long long)accel.bytes);
+    rc = 0;
+
+out:
+    return rc;
+}
+
+static int test_unregistered(void) {
+    struct ssh_crypto_provider_stats stats;
+    int rc = -1;
+
+    ssh_crypto_provider_register(NULL);
+    CHECK(ssh_crypto_provider_get(1) == NULL, "provider left installed");
+    CHECK(ssh_crypto_provider_get_stats(1, &stats) == SSH_ERROR,
+          "stats of no provider");
+    CHECK(ssh_crypto_provider_get_stats(0, &stats) == SSH_OK,
+          "software stats");
+    rc = 0;
+
+out:
+    return rc;
+}
+
+static void report(const char *name, int rc) {
+    printf("%-40s %s\n", name, rc == 0 ? "ok" : "FAILED");
+    if (rc != 0) {
+        failures++;
+    }
+}
+
+int main(void) {
+    ssh_init();
+    report("hmac and cipher on the mock", test_hmac_cipher());
+    report("masked capability", test_masked());
+    report("aes-gcm on the mock", test_gcm());
+    report("known_hosts hash isn't a packet", test_known_hosts_hash());
+    report("no provider installed", test_unregistered());
+    ssh_finalize();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,363 @@
+#include <libssh/callbacks.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <unistd.h>
+
+// runs client and server sessions of the hosted libssh against each other
+// over ssh_pair_new(), no sshd and no TCP
+//
+// usage: test_pair
+//
+// for each host key type and key exchange: handshake, password auth, an
+// exec channel the client writes to, and the hash of that data and the exit
+// status the server sends back at EOF. Then a blocking read while poll()
+// fails on the event the pair shares. Prints one line per case and exits
+// non-zero if any failed
+
+#define DATA_BYTES (256 * 1024)
+#define DATA_CHUNK 4096
+
+#define FNV_BASIS 0xcbf29ce484222325ULL
+
+struct side {
+    ssh_session client;
+    ssh_session server;
+    ssh_bind bind;
+    ssh_pair pair;
+    ssh_channel server_channel;
+    struct ssh_server_callbacks_struct server_cb;
+    struct ssh_channel_callbacks_struct channel_cb;
+    uint64_t received;
+    uint64_t hash;
+    int exec_seen;
+};
+
+static uint8_t sent[DATA_BYTES];
+
+int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            return -1; \
+        } \
+    } while (0)
+
+static int auth_password(ssh_session session, const char *user,
+                         const char *password, void *userdata) {
+    (void)session;
+    (void)user;
+    (void)userdata;
+    return strcmp(password, "secret") == 0 ? SSH_AUTH_SUCCESS
+                                           : SSH_AUTH_DENIED;
+}
+
+// FNV-1a
+static uint64_t hash_add(uint64_t hash, const uint8_t *data, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        hash = (hash ^ data[i]) * 0x100000001b3ULL;
+    }
+    return hash;
+}
+
+static int hash_data(ssh_session session, ssh_channel channel, void *data,
+                     uint32_t len, int is_stderr, void *userdata) {
+    struct side *s = userdata;
+
+    (void)session;
+    (void)channel;
+    (void)is_stderr;
+    s->hash = hash_add(s->hash, data, len);
+    s->received += len;
+    return len;
+}
+
+static int exec_request(ssh_session session, ssh_channel channel,
+                        const char *command, void *userdata) {
+    struct side *s = userdata;
+
+    (void)session;
+    (void)channel;
+    s->exec_seen = strcmp(command, "hash") == 0;
+    return s->exec_seen ? 0 : 1;
+}
+
+static void channel_eof(ssh_session session, ssh_channel channel,
+                        void *userdata) {
+    struct side *s = userdata;
+
+    (void)session;
+    ssh_channel_write(channel, &s->hash, sizeof(s->hash));
+    ssh_channel_request_send_exit_status(channel, 7);
+    ssh_channel_send_eof(channel);
+    ssh_channel_close(channel);
+}
+
+static ssh_channel channel_open(ssh_session session, void *userdata) {
+    struct side *s = userdata;
+
+    if (s->server_channel != NULL) {
+        return NULL;
+    }
+    s->server_channel = ssh_channel_new(session);
+    if (s->server_channel == NULL) {
+        return NULL;
+    }
+    s->channel_cb.userdata = s;
+    s->channel_cb.channel_data_function = hash_data;
+    s->channel_cb.channel_exec_request_function = exec_request;
+    s->channel_cb.channel_eof_function = channel_eof;
+    ssh_callbacks_init(&s->channel_cb);
+    ssh_set_channel_callbacks(s->server_channel, &s->channel_cb);
+    return s->server_channel;
+}
+
+static int auth_step(void *userdata) {
+    struct side *s = userdata;
+
+    switch (ssh_userauth_password(s->client, NULL, "secret")) {
+    case SSH_AUTH_SUCCESS:
+        return SSH_OK;
+    case SSH_AUTH_AGAIN:
+        return SSH_AGAIN;
+    default:
+        return SSH_ERROR;
+    }
+}
+
+static int never_done(void *userdata) {
+    (void)userdata;
+    return SSH_AGAIN;
+}
+
+static void side_free(struct side *s) {
+    if (s->client != NULL) {
+        ssh_disconnect(s->client);
+    }
+    if (s->server_channel != NULL) {
+        ssh_channel_free(s->server_channel);
+    }
+    ssh_pair_free(s->pair);
+    if (s->server != NULL) {
+        ssh_free(s->server);
+    }
+    if (s->bind != NULL) {
+        ssh_bind_free(s->bind);
+    }
+    if (s->client != NULL) {
+        ssh_free(s->client);
+    }
+}
+
+static int side_connect(struct side *s, enum ssh_keytypes_e type, int bits,
+                        const char *kex) {
+    ssh_key key = NULL;
+
+    memset(s, 0, sizeof(*s));
+    s->hash = FNV_BASIS;
+    s->client = ssh_new();
+    s->server = ssh_new();
+    s->bind = ssh_bind_new();
+    CHECK(s->client != NULL && s->server != NULL && s->bind != NULL,
+          "allocating sessions");
+
+    CHECK(ssh_pki_generate(type, bits, &key) == SSH_OK, "generating key");
+    // the bind takes the key
+    CHECK(ssh_bind_options_set(s->bind, SSH_BIND_OPTIONS_IMPORT_KEY,
+                               key) == SSH_OK,
+          "%s", ssh_get_error(s->bind));
+    CHECK(ssh_options_set(s->client, SSH_OPTIONS_KEY_EXCHANGE, kex) == SSH_OK,
+          "%s", ssh_get_error(s->client));
+
+    s->pair = ssh_pair_new(s->bind, s->client, s->server);
+    CHECK(s->pair != NULL, "pair: %s", ssh_get_error(s->bind));
+    ssh_set_auth_methods(s->server, SSH_AUTH_METHOD_PASSWORD);
+    s->server_cb.userdata = s;
+    s->server_cb.auth_password_function = auth_password;
+    s->server_cb.channel_open_request_session_function = channel_open;
+    ssh_callbacks_init(&s->server_cb);
+    ssh_set_server_callbacks(s->server, &s->server_cb);
+
+    CHECK(ssh_pair_handshake(s->pair) == SSH_OK, "handshake: %s",
+          ssh_get_error(s->client));
+    CHECK(ssh_pair_run(s->pair, auth_step, s) == SSH_OK, "auth: %s",
+          ssh_get_error(s->client));
+    return 0;
+}
+
+static int test_data(enum ssh_keytypes_e type, int bits, const char *kex) {
+    struct side s;
+    ssh_channel channel = NULL;
+    uint64_t hash = 0;
+    uint32_t off, got = 0;
+    char buf[256];
+    int n, rc = -1;
+
+    if (side_connect(&s, type, bits, kex) != 0) {
+        goto out;
+    }
+    // blocking from here on, the client's polls serve the server as well
+    ssh_set_blocking(s.client, 1);
+
+    channel = ssh_channel_new(s.client);
+    if (channel == NULL ||
+        ssh_channel_open_session(channel) != SSH_OK ||
+        ssh_channel_request_exec(channel, "hash") != SSH_OK) {
+        fprintf(stderr, "channel: %s\n", ssh_get_error(s.client));
+        goto out;
+    }
+    for (off = 0; off < DATA_BYTES; off += DATA_CHUNK) {
+        if (ssh_channel_write(channel, sent + off, DATA_CHUNK) !=
+            DATA_CHUNK) {
+            fprintf(stderr, "write: %s\n", ssh_get_error(s.client));
+            goto out;
+        }
+    }
+    ssh_channel_send_eof(channel);
+    while (!ssh_channel_is_eof(channel)) {
+        n = ssh_channel_read(channel, buf, sizeof(buf), 0);
+        if (n < 0) {
+            fprintf(stderr, "read: %s\n", ssh_get_error(s.client));
+            goto out;
+        }
+        if (got + n <= sizeof(hash)) {
+            memcpy((uint8_t *)&hash + got, buf, n);
+        }
+        got += n;
+    }
+    if (!s.exec_seen || s.received != DATA_BYTES || got != sizeof(hash) ||
+        hash != hash_add(FNV_BASIS, sent, DATA_BYTES) ||
+        ssh_channel_get_exit_status(channel) != 7) {
+        fprintf(stderr, "exec %d, received %llu, %u bytes back, "
+                "exit status %d\n", s.exec_seen,
+                (unsigned long long)s.received, got,
+                ssh_channel_get_exit_status(channel));
+        goto out;
+    }
+    rc = 0;
+
+out:
+    if (channel != NULL) {
+        ssh_channel_close(channel);
+        ssh_channel_free(channel);
+    }
+    side_free(&s);
+    return rc;
+}
+
+// nothing is in flight after auth, so a step that never finishes has to be
+// reported as a stall instead of spinning
+static int test_stall(void) {
+    struct side s;
+    int rc = -1;
+
+    if (side_connect(&s, SSH_KEYTYPE_ECDSA, 256, "ecdh-sha2-nistp256") == 0 &&
+        ssh_pair_run(s.pair, never_done, NULL) == SSH_ERROR) {
+        rc = 0;
+    }
+    side_free(&s);
+    return rc;
+}
+
+static void read_spins(int sig) {
+    (void)sig;
+    // only async-signal-safe calls here
+    static const char msg[] = "poll failure: the read is still waiting\n";
+    if (write(2, msg, sizeof(msg) - 1) < 0) {
+        _exit(1);
+    }
+    _exit(1);
+}
+
+// with RLIMIT_NOFILE below the number of fds on the pair's event, poll()
+// fails with EINVAL, and keeps failing. A blocking read has to give up with
+// an error instead of retrying it forever
+static int test_poll_failure(void) {
+    struct side s;
+    ssh_channel channel = NULL;
+    struct rlimit saved, low;
+    char buf[16];
+    int n = 0;
+    int rc = -1;
+
+    if (side_connect(&s, SSH_KEYTYPE_ED25519, 0, "curve25519-sha256") != 0) {
+        goto out;
+    }
+    ssh_set_blocking(s.client, 1);
+    channel = ssh_channel_new(s.client);
+    if (channel == NULL ||
+        ssh_channel_open_session(channel) != SSH_OK ||
+        ssh_channel_request_exec(channel, "hash") != SSH_OK) {
+        fprintf(stderr, "channel: %s\n", ssh_get_error(s.client));
+        goto out;
+    }
+
+    if (getrlimit(RLIMIT_NOFILE, &saved) != 0) {
+        goto out;
+    }
+    low = saved;
+    low.rlim_cur = 1;
+    signal(SIGALRM, read_spins);
+    alarm(10);
+    if (setrlimit(RLIMIT_NOFILE, &low) == 0) {
+        n = ssh_channel_read(channel, buf, sizeof(buf), 0);
+        setrlimit(RLIMIT_NOFILE, &saved);
+    }
+    alarm(0);
+    if (n != SSH_ERROR ||
+        !(ssh_get_status(s.client) & SSH_CLOSED_ERROR)) {
+        fprintf(stderr, "read returned %d, status %d\n", n,
+                ssh_get_status(s.client));
+        goto out;
+    }
+    rc = 0;
+
+out:
+    if (channel != NULL) {
+        ssh_channel_free(channel);
+    }
+    side_free(&s);
+    return rc;
+}
+
+static void report(const char *name, int rc) {
+    printf("%-40s %s\n", name, rc == 0 ? "ok" : "FAILED");
+    fflush(stdout);
+    if (rc != 0) {
+        failures++;
+    }
+}
+
+int main(void) {
+    size_t i;
+
+    for (i = 0; i < sizeof(sent); i++) {
+        sent[i] = (uint8_t)(i * 31 + (i >> 8));
+    }
+
+    ssh_init();
+    report("ed25519 curve25519-sha256",
+           test_data(SSH_KEYTYPE_ED25519, 0, "curve25519-sha256"));
+    report("ecdsa ecdh-sha2-nistp256",
+           test_data(SSH_KEYTYPE_ECDSA, 256, "ecdh-sha2-nistp256"));
+    report("rsa diffie-hellman-group14-sha256",
+           test_data(SSH_KEYTYPE_RSA, 2048,
+                     "diffie-hellman-group14-sha256"));
+    report("stalled pair", test_stall());
+    report("poll failure on a shared event", test_poll_failure());
+    ssh_finalize();
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,356 @@
+#include <libssh/callbacks.h>
+#include <libssh/libssh.h>
+#include <libssh/pcap.h>
+#include <libssh/server.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// writes pcap files with the capture of a libssh built with WITH_PCAP and
+// parses them back
+//
+// usage: test_pcap
+//
+// the Makefile links it with libssh_hosted_pcap.a, the hosted libssh with
+// WITH_PCAP defined, since the session struct has the capture context only
+// then. A handshake over ssh_pair_new() is captured from the client and
+// every record is checked: lengths, the IPv4 header checksum, the IP ids
+// and the TCP sequence and ack numbers of both directions. Then packets go
+// straight to a capture context: one larger than a segment, which is split
+// and whose first record is larger than the file's buffer, so it is
+// written past it, and one that was only partly captured. Prints one line
+// per case and exits non-zero if any failed
+
+#define PCAP_HEADER_LEN 24
+#define PCAP_RECORD_HEADER_LEN 16
+#define IP_HEADER_LEN 20
+#define TCP_HEADER_LEN 20
+#define SEGMENT_MAX (0xffff - IP_HEADER_LEN - TCP_HEADER_LEN)
+
+#define BIG_PACKET 70000
+#define SMALL_PACKET 100
+
+struct record {
+    const uint8_t *ip;
+    uint32_t caplen;
+    uint32_t origlen;
+    uint32_t payload;
+    int out;
+    uint16_t id;
+    uint32_t seq;
+    uint32_t ack;
+};
+
+struct capture {
+    uint8_t *data;
+    size_t len;
+    size_t off;
+};
+
+static char path[] = "/tmp/test_pcap.XXXXXX";
+
+static uint8_t big[BIG_PACKET];
+
+int failures = 0;
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            return -1; \
+        } \
+    } while (0)
+
+static uint32_t be32(const uint8_t *p) {
+    return (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 |
+           (uint32_t)p[2] << 8 | p[3];
+}
+
+static uint16_t be16(const uint8_t *p) {
+    return (uint16_t)(p[0] << 8 | p[1]);
+}
+
+static int capture_load(struct capture *c) {
+    FILE *file;
+    long size;
+
+    memset(c, 0, sizeof(*c));
+    file = fopen(path, "rb");
+    CHECK(file != NULL, "can't open %s", path);
+    fseek(file, 0, SEEK_END);
+    size = ftell(file);
+    rewind(file);
+    c->data = malloc(size > 0 ? size : 1);
+    c->len = size;
+    if (c->data == NULL || fread(c->data, 1, c->len, file) != c->len) {
+        fclose(file);
+        CHECK(0, "can't read %s", path);
+    }
+    fclose(file);
+
+    CHECK(c->len >= PCAP_HEADER_LEN, "%zu bytes, no file header", c->len);
+    CHECK(be32(c->data) == 0xa1b2c3d4, "magic %08x", be32(c->data));
+    CHECK(be16(c->data + 4) == 2 && be16(c->data + 6) == 4, "version %u.%u",
+          be16(c->data + 4), be16(c->data + 6));
+    CHECK(be32(c->data + 20) == 12, "link type %u, not raw IP",
+          be32(c->data + 20));
+    c->off = PCAP_HEADER_LEN;
+    return 0;
+}
+
+// the next record, with its IPv4 and TCP headers checked; 1 at the end
+static int capture_next(struct capture *c, struct record *r) {
+    const uint8_t *p;
+    uint32_t sum = 0;
+    int i;
+
+    if (c->off == c->len) {
+        return 1;
+    }
+    CHECK(c->len - c->off >= PCAP_RECORD_HEADER_LEN, "truncated record");
+    p = c->data + c->off;
+    r->caplen = be32(p + 8);
+    r->origlen = be32(p + 12);
+    CHECK(c->len - c->off - PCAP_RECORD_HEADER_LEN >= r->caplen,
+          "record of %u bytes past the end", r->caplen);
+    CHECK(r->caplen >= IP_HEADER_LEN + TCP_HEADER_LEN &&
+          r->origlen >= r->caplen, "lengths %u of %u", r->caplen,
+          r->origlen);
+    r->ip = p + PCAP_RECORD_HEADER_LEN;
+    c->off += PCAP_RECORD_HEADER_LEN + r->caplen;
+
+    CHECK(r->ip[0] == 0x45 && r->ip[9] == 6, "not IPv4/TCP");
+    CHECK(be16(r->ip + 2) == r->origlen, "IP length %u, record %u",
+          be16(r->ip + 2), r->origlen);
+    for (i = 0; i < IP_HEADER_LEN; i += 2) {
+        sum += be16(r->ip + i);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+    CHECK(sum == 0xffff, "IP checksum %04x is off", be16(r->ip + 10));
+
+    // the capture makes the client 127.0.0.1 when the socket isn't IPv4
+    r->out = r->ip[15] == 1;
+    r->id = be16(r->ip + 4);
+    r->seq = be32(r->ip + IP_HEADER_LEN + 4);
+    r->ack = be32(r->ip + IP_HEADER_LEN + 8);
+    r->payload = r->origlen - IP_HEADER_LEN - TCP_HEADER_LEN;
+    return 0;
+}
+
+static int auth_password(ssh_session session, const char *user,
+                         const char *password, void *userdata) {
+    (void)session;
+    (void)user;
+    (void)password;
+    (void)userdata;
+    return SSH_AUTH_SUCCESS;
+}
+
+static int auth_step(void *userdata) {
+    switch (ssh_userauth_password(userdata, NULL, "secret")) {
+    case SSH_AUTH_SUCCESS:
+        return SSH_OK;
+    case SSH_AUTH_AGAIN:
+        return SSH_AGAIN;
+    default:
+        return SSH_ERROR;
+    }
+}
+
+static int run_pair(ssh_pcap_file pcap) {
+    struct ssh_server_callbacks_struct server_cb;
+    ssh_session client = ssh_new();
+    ssh_session server = ssh_new();
+    ssh_bind bind = ssh_bind_new();
+    ssh_pair pair = NULL;
+    ssh_key key = NULL;
+    int rc = -1;
+
+    if (client == NULL || server == NULL || bind == NULL ||
+        ssh_pki_generate(SSH_KEYTYPE_ED25519, 0, &key) != SSH_OK ||
+        ssh_bind_options_set(bind, SSH_BIND_OPTIONS_IMPORT_KEY, key) !=
+            SSH_OK ||
+        ssh_set_pcap_file(client, pcap) != SSH_OK) {
+        fprintf(stderr, "setup failed\n");
+        goto out;
+    }
+    pair = ssh_pair_new(bind, client, server);
+    if (pair == NULL) {
+        fprintf(stderr, "pair: %s\n", ssh_get_error(bind));
+        goto out;
+    }
+    memset(&server_cb, 0, sizeof(server_cb));
+    server_cb.auth_password_function = auth_password;
+    ssh_callbacks_init(&server_cb);
+    ssh_set_server_callbacks(server, &server_cb);
+    ssh_set_auth_methods(server, SSH_AUTH_METHOD_PASSWORD);
+    if (ssh_pair_handshake(pair) != SSH_OK ||
+        ssh_pair_run(pair, auth_step, client) != SSH_OK) {
+        fprintf(stderr, "handshake: %s\n", ssh_get_error(client));
+        goto out;
+    }
+    rc = 0;
+
+out:
+    ssh_pair_free(pair);
+    if (server != NULL) {
+        ssh_free(server);
+    }
+    if (bind != NULL) {
+        ssh_bind_free(bind);
+    }
+    if (client != NULL) {
+        ssh_free(client);
+    }
+    return rc;
+}
+
+// handshake and auth of the client: the banners and every packet both
+// ways, one record each
+static int test_session(void) {
+    struct capture c;
+    struct record r;
+    ssh_pcap_file pcap = ssh_pcap_file_new();
+    uint32_t next[2] = {1, 1};
+    uint16_t id = 0;
+    int records[2] = {0, 0};
+    int n = 0;
+    int rc;
+
+    CHECK(pcap != NULL && ssh_pcap_file_open(pcap, path) == SSH_OK,
+          "can't open the capture");
+    rc = run_pair(pcap);
+    // the sessions are gone, the file can be closed
+    CHECK(ssh_pcap_file_close(pcap) == SSH_OK && rc == 0, "capture failed");
+    ssh_pcap_file_free(pcap);
+
+    if (capture_load(&c) != 0) {
+        free(c.data);
+        return -1;
+    }
+    while ((rc = capture_next(&c, &r)) == 0) {
+        if (r.caplen != r.origlen || r.id != id ||
+            r.seq != next[r.out] || r.ack != next[!r.out]) {
+            fprintf(stderr, "record %d: %u of %u bytes, id %u, seq %u, "
+                    "ack %u, expected id %u, seq %u, ack %u\n", n,
+                    r.caplen, r.origlen, r.id, r.seq, r.ack, id,
+                    next[r.out], next[!r.out]);
+            rc = -1;
+            break;
+        }
+        next[r.out] += r.payload;
+        records[r.out]++;
+        id++;
+        n++;
+    }
+    free(c.data);
+    CHECK(rc == 1, "bad record");
+    // banner, KEXINIT, the key exchange and NEWKEYS, service request and
+    // auth at least
+    CHECK(records[0] >= 5 && records[1] >= 5, "%d records in, %d out",
+          records[0], records[1]);
+    return 0;
+}
+
+// a packet larger than a segment, one that fits and one cut short
+static int test_segments(void) {
+    static const uint32_t expect_len[] = {
+        SEGMENT_MAX, BIG_PACKET - SEGMENT_MAX, SMALL_PACKET, SMALL_PACKET,
+    };
+    static const uint32_t expect_orig[] = {
+        SEGMENT_MAX, BIG_PACKET - SEGMENT_MAX, SMALL_PACKET,
+        2 * SMALL_PACKET,
+    };
+    struct capture c;
+    struct record r;
+    ssh_pcap_file pcap = ssh_pcap_file_new();
+    ssh_pcap_context ctx = NULL;
+    ssh_session session = ssh_new();
+    uint32_t seq = 1;
+    size_t off = 0;
+    int n = 0;
+    int rc = 0;
+
+    CHECK(pcap != NULL && session != NULL &&
+          ssh_pcap_file_open(pcap, path) == SSH_OK,
+          "can't open the capture");
+    ctx = ssh_pcap_context_new(session);
+    CHECK(ctx != NULL, "no context");
+    ssh_pcap_context_set_file(ctx, pcap);
+    // the first segment's record is larger than the 64 KiB buffer of the
+    // file, it is written past it after what the buffer holds
+    rc |= ssh_pcap_context_write(ctx, SSH_PCAP_DIR_OUT, big, BIG_PACKET,
+                                 BIG_PACKET);
+    rc |= ssh_pcap_context_write(ctx, SSH_PCAP_DIR_OUT, big, SMALL_PACKET,
+                                 SMALL_PACKET);
+    rc |= ssh_pcap_context_write(ctx, SSH_PCAP_DIR_OUT, big, SMALL_PACKET,
+                                 2 * SMALL_PACKET);
+    ssh_pcap_context_free(ctx);
+    ssh_free(session);
+    CHECK(ssh_pcap_file_close(pcap) == SSH_OK && rc == SSH_OK,
+          "write failed");
+    ssh_pcap_file_free(pcap);
+
+    if (capture_load(&c) != 0) {
+        free(c.data);
+        return -1;
+    }
+    while ((rc = capture_next(&c, &r)) == 0 && n < 4) {
+        const uint8_t *data = r.ip + IP_HEADER_LEN + TCP_HEADER_LEN;
+        uint32_t len = r.caplen - IP_HEADER_LEN - TCP_HEADER_LEN;
+
+        if (!r.out || r.id != n || r.seq != seq || len != expect_len[n] ||
+            r.payload != expect_orig[n] ||
+            memcmp(data, big + off, len) != 0) {
+            fprintf(stderr, "record %d: %u of %u bytes, id %u, seq %u, "
+                    "expected %u of %u, seq %u\n", n, len, r.payload, r.id,
+                    r.seq, expect_len[n], expect_orig[n], seq);
+            rc = -1;
+            break;
+        }
+        seq += r.payload;
+        off = n == 0 ? SEGMENT_MAX : 0;
+        n++;
+    }
+    free(c.data);
+    CHECK(rc == 1 && n == 4, "%d good records", n);
+    return 0;
+}
+
+static void report(const char *name, int rc) {
+    printf("%-40s %s\n", name, rc == 0 ? "ok" : "FAILED");
+    fflush(stdout);
+    if (rc != 0) {
+        failures++;
+    }
+}
+
+int main(void) {
+    size_t i;
+    int fd;
+
+    for (i = 0; i < sizeof(big); i++) {
+        big[i] = (uint8_t)(i * 7 + (i >> 9));
+    }
+    fd = mkstemp(path);
+    if (fd < 0) {
+        perror("mkstemp");
+        return 1;
+    }
+    close(fd);
+
+    ssh_init();
+    report("handshake capture", test_session());
+    report("split and partial segments", test_segments());
+    ssh_finalize();
+    unlink(path);
+
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,277 @@
+#define _XOPEN_SOURCE 700
+
+#include <libssh/callbacks.h>
+#include <libssh/libssh.h>
+#include <libssh/server.h>
+
+#include <errno.h>
+#include <ftw.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+// runs the scp sink of the hosted libssh against a stub channel: the test
+// feeds it what "scp -t" would receive and checks the replies and the files
+// it leaves in a temporary directory
+//
+// usage: test_scp_sink
+//
+// the sink only talks to its channel through ssh_add_channel_callbacks(),
+// ssh_remove_channel_callbacks() and ssh_channel_write(). The Makefile links
+// with --wrap for those, so the functions below get the callbacks and the
+// replies and no session is needed. Prints one line per case and exits
+// non-zero if any failed
+
+// never dereferenced, the wrapped functions are all the sink calls with it
+static ssh_channel stub = (ssh_channel)&stub;
+
+static ssh_channel_callbacks stub_cb = NULL;
+static char replies[1024];
+static size_t replies_len = 0;
+
+static char dir[] = "/tmp/test_scp_sink.XXXXXX";
+
+int failures = 0;
+
+int __wrap_ssh_add_channel_callbacks(ssh_channel channel,
+                                     ssh_channel_callbacks cb) {
+    if (channel != stub) {
+        return SSH_ERROR;
+    }
+    stub_cb = cb;
+    return SSH_OK;
+}
+
+int __wrap_ssh_remove_channel_callbacks(ssh_channel channel,
+                                        ssh_channel_callbacks cb) {
+    (void)channel;
+    if (cb != stub_cb) {
+        return SSH_ERROR;
+    }
+    stub_cb = NULL;
+    return SSH_OK;
+}
+
+int __wrap_ssh_channel_write(ssh_channel channel, const void *data,
+                             uint32_t len) {
+    if (channel != stub || replies_len + len > sizeof(replies)) {
+        return SSH_ERROR;
+    }
+    memcpy(replies + replies_len, data, len);
+    replies_len += len;
+    return len;
+}
+
+#define CHECK(cond, ...) \
+    do { \
+        if (!(cond)) { \
+            fprintf(stderr, "%s:%d: ", __FILE__, __LINE__); \
+            fprintf(stderr, __VA_ARGS__); \
+            fprintf(stderr, "\n"); \
+            goto out; \
+        } \
+    } while (0)
+
+// hands data to the sink step bytes at a time, the way packets would
+static void feed(const void *data, size_t len, size_t step) {
+    const char *p = data;
+    size_t n;
+
+    while (len > 0 && stub_cb != NULL) {
+        n = len < step ? len : step;
+        stub_cb->channel_data_function(NULL, stub, (void *)p, n, 0,
+                                       stub_cb->userdata);
+        p += n;
+        len -= n;
+    }
+}
+
+static void feed_str(const char *s) {
+    feed(s, strlen(s), strlen(s));
+}
+
+static ssh_scp_sink sink_start(const char *command) {
+    ssh_scp_sink sink;
+
+    replies_len = 0;
+    sink = ssh_scp_sink_new(stub, dir);
+    if (sink != NULL && ssh_scp_sink_start(sink, command) != SSH_OK) {
+        ssh_scp_sink_free(sink);
+        return NULL;
+    }
+    return sink;
+}
+
+static int file_is(const char *name, const char *contents) {
+    char path[256], buf[256];
+    FILE *file;
+    size_t len;
+
+    snprintf(path, sizeof(path), "%s/%s", dir, name);
+    file = fopen(path, "rb");
+    if (file == NULL) {
+        return 0;
+    }
+    len = fread(buf, 1, sizeof(buf), file);
+    fclose(file);
+    return len == strlen(contents) && memcmp(buf, contents, len) == 0;
+}
+
+static int replies_are(const char *expected, size_t len) {
+    return replies_len == len && memcmp(replies, expected, len) == 0;
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag,
+                        struct FTW *ftw) {
+    (void)st;
+    (void)flag;
+    return ftw->level > 0 ? remove(path) : 0;
+}
+
+// empties dir between cases
+static void clean_dir(void) {
+    nftw(dir, remove_entry, 8, FTW_DEPTH | FTW_PHYS);
+}
+
+static int test_file(size_t step) {
+    static const char upload[] = "C0644 5 a.txt\nhello";
+    ssh_scp_sink sink;
+    int rc = -1;
+
+    sink = sink_start("scp -t /ignored");
+    CHECK(sink != NULL, "start");
+    feed(upload, sizeof(upload), step);
+    CHECK(replies_are("\0\0\0", 3), "%zu reply bytes", replies_len);
+    CHECK(ssh_scp_sink_get_status(sink) == SSH_OK, "status");
+    CHECK(ssh_scp_sink_get_files(sink) == 1, "files");
+    CHECK(ssh_scp_sink_get_bytes(sink) == 5, "bytes");
+    CHECK(file_is("a.txt", "hello"), "contents");
+    rc = 0;
+
+out:
+    ssh_scp_sink_free(sink);
+    if (stub_cb != NULL) {
+        fprintf(stderr, "callbacks left on the channel\n");
+        rc = -1;
+    }
+    clean_dir();
+    return rc;
+}
+
+// a file that can't be created gets status 1, the client skips it and the
+// next one goes through
+static int test_open_failure(void) {
+    static const char expected[] = "\0\1scp: blocked: Is a directory\n\0\0";
+    static const char next[] = "C0644 2 ok\nhi";
+    char path[256];
+    ssh_scp_sink sink = NULL;
+    int rc = -1;
+
+    snprintf(path, sizeof(path), "%s/blocked", dir);
+    CHECK(mkdir(path, 0700) == 0, "mkdir: %s", strerror(errno));
+    sink = sink_start("scp -t .");
+    CHECK(sink != NULL, "start");
+    feed_str("C0644 3 blocked\n");
+    feed(next, sizeof(next), sizeof(next));
+    CHECK(replies_are(expected, sizeof(expected) - 1), "replies %.*s",
+          (int)replies_len, replies);
+    CHECK(ssh_scp_sink_get_status(sink) == SSH_OK, "status");
+    CHECK(ssh_scp_sink_get_files(sink) == 1, "files");
+    CHECK(file_is("ok", "hi"), "contents");
+    rc = 0;
+
+out:
+    ssh_scp_sink_free(sink);
+    clean_dir();
+    return rc;
+}
+
+static int test_recursive_preserve(void) {
+    static const char upload[] =
+        "D0755 0 sub\nT1000000000 0 1000000001 0\nC0600 1 x\ny\0E\n";
+    char path[256];
+    struct stat st;
+    ssh_scp_sink sink;
+    int rc = -1;
+
+    sink = sink_start("scp -r -p -t .");
+    CHECK(sink != NULL, "start");
+    feed(upload, sizeof(upload) - 1, 3);
+    CHECK(replies_are("\0\0\0\0\0\0", 6), "%zu reply bytes", replies_len);
+    // before reading it, which may move the access time
+    snprintf(path, sizeof(path), "%s/sub/x", dir);
+    CHECK(stat(path, &st) == 0, "stat: %s", strerror(errno));
+    CHECK((st.st_mode & 0777) == 0600, "mode %o", st.st_mode & 0777);
+    CHECK(st.st_mtime == 1000000000 && st.st_atime == 1000000001,
+          "times %ld %ld", (long)st.st_mtime, (long)st.st_atime);
+    CHECK(file_is("sub/x", "y"), "contents");
+    rc = 0;
+
+out:
+    ssh_scp_sink_free(sink);
+    clean_dir();
+    return rc;
+}
+
+// names that leave the directory end the transfer
+static int test_escape(void) {
+    ssh_scp_sink sink;
+    int rc = -1;
+
+    sink = sink_start("scp -t .");
+    CHECK(sink != NULL, "start");
+    feed_str("C0644 1 ..\n");
+    CHECK(replies_len > 1 && replies[1] == 2, "no fatal error");
+    CHECK(ssh_scp_sink_get_status(sink) == SSH_ERROR, "status");
+    feed_str("C0644 1 a\nz");
+    CHECK(ssh_scp_sink_get_files(sink) == 0, "files after the error");
+    rc = 0;
+
+out:
+    ssh_scp_sink_free(sink);
+    clean_dir();
+    return rc;
+}
+
+static int test_not_scp(void) {
+    ssh_scp_sink sink;
+    int rc = -1;
+
+    sink = ssh_scp_sink_new(stub, dir);
+    CHECK(sink != NULL, "new");
+    CHECK(ssh_scp_sink_start(sink, "scp -f file") == SSH_ERROR, "scp -f");
+    CHECK(ssh_scp_sink_start(sink, "cat") == SSH_ERROR, "cat");
+    CHECK(stub_cb == NULL, "callbacks added");
+    rc = 0;
+
+out:
+    ssh_scp_sink_free(sink);
+    return rc;
+}
+
+static void report(const char *name, int rc) {
+    printf("%-40s %s\n", name, rc == 0 ? "ok" : "FAILED");
+    if (rc != 0) {
+        failures++;
+    }
+}
+
+int main(void) {
+    if (mkdtemp(dir) == NULL) {
+        perror("mkdtemp");
+        return 1;
+    }
+
+    report("file in one piece", test_file(SIZE_MAX));
+    report("file a byte at a time", test_file(1));
+    report("open failure", test_open_failure());
+    report("directory and times", test_recursive_preserve());
+    report("name escaping the directory", test_escape());
+    report("not an upload", test_not_scp());
+
+    rmdir(dir);
+    return failures ? 1 : 0;
+}
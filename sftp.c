@@ -7,6 +7,8 @@
 const char *ssh_host = "localhost";
 const char *ssh_user = "username";
 const char *ssh_password = "password";
+// tried before the password; parsed once, reused by later connects
+const char *ssh_identity = "id_ed25519";
 int ssh_port = 22;
 
 const char *remote_path = "\\";
@@ -76,8 +78,18 @@ ssh_session ssh_setup(int *rc, const char *ssh_host, int ssh_port) {
 
 int ssh_authenticate(ssh_session *session, const char *host, const char *user,
                      const char *password) {
+    ssh_key key = NULL;
     int rc;
 
+    if (ssh_pki_import_privkey_file_cached(ssh_identity, NULL, NULL, NULL,
+                                           &key) == SSH_OK) {
+        rc = ssh_userauth_publickey(*session, user, key);
+        ssh_key_free(key);
+        if (rc == SSH_AUTH_SUCCESS) {
+            return 0;
+        }
+    }
+
     rc = ssh_userauth_password(*session, user, password);
     if (rc != SSH_OK) {
         printf("Error authenticating to %s: %s\n", host,
@@ -0,0 +1,56 @@
+#ifndef SEGMENT_COMPRESS_H
+#define SEGMENT_COMPRESS_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// log segments are compressed once at rest, in LZ4 frame format with
+// independent blocks so the server can unpack them with a stock `lz4 -d`
+
+// bytes of input per block; this is also the match window, so keep it small
+// enough that the block buffers fit comfortably in the ESP32 heap
+#ifndef SEGMENT_BLOCK_SIZE
+#define SEGMENT_BLOCK_SIZE 4096
+#endif
+
+// log2 of the number of match table entries (2 bytes each)
+#ifndef SEGMENT_HASH_LOG
+#define SEGMENT_HASH_LOG 10
+#endif
+
+#define SEGMENT_HASH_SIZE (1 << SEGMENT_HASH_LOG)
+
+// worst case size of a compressed block, including its 4 byte length prefix
+#define SEGMENT_BLOCK_BOUND(len) (4 + (len) + (len) / 255 + 16)
+
+#define SEGMENT_FRAME_HEADER_SIZE 7
+#define SEGMENT_FRAME_FOOTER_SIZE 4
+
+// scratch state for one compressor, allocate it once and reuse it
+struct segment_compressor {
+    uint16_t table[SEGMENT_HASH_SIZE];
+};
+
+size_t segment_frame_header(uint8_t *dst);
+size_t segment_frame_footer(uint8_t *dst);
+
+// compresses up to SEGMENT_BLOCK_SIZE bytes of src into dst as one framed
+// block; dst must hold SEGMENT_BLOCK_BOUND(len) bytes. blocks that don't
+// shrink are stored as-is. returns the number of bytes written to dst
+size_t segment_compress_block(struct segment_compressor *c, const uint8_t *src,
+                              size_t len, uint8_t *dst);
+
+// decodes the raw LZ4 sequences of a single block (without its length
+// prefix). returns the decoded length, or -1 if the input is malformed
+long segment_decompress_block(const uint8_t *src, size_t len, uint8_t *dst,
+                              size_t cap);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SEGMENT_COMPRESS_H */
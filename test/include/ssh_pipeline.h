@@ -0,0 +1,74 @@
+#ifndef SSH_PIPELINE_H
+#define SSH_PIPELINE_H
+
+#include "libssh/libssh.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// drives connect -> password or public key auth -> scp open without
+// blocking, so the caller's loop keeps running (and ingesting UART data)
+// during the handshake
+
+enum ssh_pipeline_state {
+    SSH_PIPELINE_CONNECTING,
+    SSH_PIPELINE_AUTHENTICATING,
+    SSH_PIPELINE_OPENING_SCP,
+    SSH_PIPELINE_READY,
+    SSH_PIPELINE_FAILED
+};
+
+struct ssh_pipeline;
+
+struct ssh_pipeline_callbacks {
+    void *userdata;
+    // each is optional and called once, when its stage completes
+    void (*connected)(struct ssh_pipeline *p, void *userdata);
+    void (*authenticated)(struct ssh_pipeline *p, void *userdata);
+    // the session is blocking again from here on, so the scp handle can be
+    // used with ssh_scp_push_file()/ssh_scp_write() as usual
+    void (*scp_ready)(struct ssh_pipeline *p, ssh_scp scp, void *userdata);
+    // failed_state is the stage that failed, see ssh_get_error() for why
+    void (*failed)(struct ssh_pipeline *p,
+                   enum ssh_pipeline_state failed_state, void *userdata);
+};
+
+struct ssh_pipeline {
+    ssh_session session;
+    ssh_scp scp;
+    ssh_event event;
+    enum ssh_pipeline_state state;
+    const char *password;
+    ssh_key privkey;
+    const char *scp_path;
+    int scp_mode;
+    struct ssh_pipeline_callbacks *callbacks;
+};
+
+// session must already have its host/port/user options set
+int ssh_pipeline_start(struct ssh_pipeline *p, ssh_session session,
+                       const char *password, const char *scp_path,
+                       int scp_mode, struct ssh_pipeline_callbacks *callbacks);
+
+// same, authenticating with privkey first. If the server turns the key down
+// the password is tried instead, unless it's NULL. The key stays with the
+// caller and has to outlive the pipeline
+int ssh_pipeline_start_publickey(struct ssh_pipeline *p, ssh_session session,
+                                 ssh_key privkey, const char *password,
+                                 const char *scp_path, int scp_mode,
+                                 struct ssh_pipeline_callbacks *callbacks);
+
+// waits at most timeout_ms for socket activity, then advances the pipeline
+// as far as it can. returns the current state
+enum ssh_pipeline_state ssh_pipeline_poll(struct ssh_pipeline *p,
+                                          int timeout_ms);
+
+// releases the event loop; the session and scp handle stay with the caller
+void ssh_pipeline_free(struct ssh_pipeline *p);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SSH_PIPELINE_H */
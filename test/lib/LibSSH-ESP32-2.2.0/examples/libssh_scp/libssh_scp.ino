@@ -214,27 +214,20 @@ int authenticate_kbdint(ssh_session session, const char *password)
 static int auth_keyfile(ssh_session session, char* keyfile)
 {
     ssh_key key = NULL;
-    char pubkey[132] = {0}; // +".pub"
     int rc;
 
-    snprintf(pubkey, sizeof(pubkey), "%s.pub", keyfile);
-
-    rc = ssh_pki_import_pubkey_file( pubkey, &key);
+    // parsed on the first connect only, later ones get the kept key
+    rc = ssh_pki_import_privkey_file_cached(keyfile, NULL, NULL, NULL, &key);
 
     if (rc != SSH_OK)
         return SSH_AUTH_DENIED;
 
     rc = ssh_userauth_try_publickey(session, NULL, key);
 
-    ssh_key_free(key);
-
-    if (rc!=SSH_AUTH_SUCCESS)
-        return SSH_AUTH_DENIED;
-
-    rc = ssh_pki_import_privkey_file(keyfile, NULL, NULL, NULL, &key);
-
-    if (rc != SSH_OK)
+    if (rc!=SSH_AUTH_SUCCESS) {
+        ssh_key_free(key);
         return SSH_AUTH_DENIED;
+    }
 
     rc = ssh_userauth_publickey(session, NULL, key);
 
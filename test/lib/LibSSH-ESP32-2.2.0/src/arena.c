@@ -0,0 +1,223 @@
+/*
+ * arena.c - per packet bump allocator
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "libssh_esp32_config.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifndef _WIN32
+#include <netinet/in.h>
+#include <lwip/inet.h>
+#endif
+
+#include "libssh/priv.h"
+#include "libssh/arena.h"
+#include "libssh/buffer.h"
+#include "libssh/session.h"
+#include "libssh/string.h"
+
+/*
+ * The arena starts at SSH_PACKET_ARENA_SIZE bytes and grows to fit the
+ * largest packet seen, up to SSH_PACKET_ARENA_MAX_SIZE. Packets asking for
+ * more than that are served from the heap every time.
+ */
+#ifndef SSH_PACKET_ARENA_SIZE
+#define SSH_PACKET_ARENA_SIZE 1024
+#endif
+
+#ifndef SSH_PACKET_ARENA_MAX_SIZE
+#define SSH_PACKET_ARENA_MAX_SIZE 36864
+#endif
+
+#define ARENA_ALIGN 8
+#define ARENA_GROW_STEP 1024
+
+struct ssh_arena_block {
+    struct ssh_arena_block *next;
+    size_t len;
+};
+
+static size_t arena_round(size_t len, size_t step)
+{
+    return (len + step - 1) & ~(step - 1);
+}
+
+void ssh_arena_init(struct ssh_arena_struct *arena)
+{
+    ZERO_STRUCTP(arena);
+}
+
+void *ssh_arena_alloc(struct ssh_arena_struct *arena, size_t len)
+{
+    struct ssh_arena_block *block = NULL;
+    size_t aligned;
+    void *ptr = NULL;
+
+    aligned = arena_round(len, ARENA_ALIGN);
+    if (aligned < len || aligned > SIZE_MAX - sizeof(struct ssh_arena_block)) {
+        return NULL;
+    }
+
+    if (arena->data == NULL && arena->size == 0) {
+        arena->data = malloc(SSH_PACKET_ARENA_SIZE);
+        if (arena->data != NULL) {
+            arena->size = SSH_PACKET_ARENA_SIZE;
+            arena->stats.size = arena->size;
+        }
+    }
+
+    arena->demand += aligned;
+
+    if (arena->size - arena->used >= aligned) {
+        ptr = arena->data + arena->used;
+        arena->used += aligned;
+        arena->stats.allocs++;
+        return ptr;
+    }
+
+    /* spill to the heap, the block is released with the arena */
+    block = malloc(sizeof(struct ssh_arena_block) + aligned);
+    if (block == NULL) {
+        return NULL;
+    }
+    block->next = arena->overflow;
+    block->len = aligned;
+    arena->overflow = block;
+    arena->stats.overflows++;
+
+    return block + 1;
+}
+
+/* Wipe what was allocated for this packet on reset, for key material */
+void ssh_arena_set_secure(struct ssh_arena_struct *arena)
+{
+    arena->secure = 1;
+}
+
+void ssh_arena_reset(struct ssh_arena_struct *arena)
+{
+    struct ssh_arena_block *block = NULL;
+    size_t size;
+    uint8_t *data = NULL;
+
+    while (arena->overflow != NULL) {
+        block = arena->overflow;
+        arena->overflow = block->next;
+        if (arena->secure) {
+            explicit_bzero(block + 1, block->len);
+        }
+        free(block);
+    }
+
+    if (arena->secure && arena->used > 0) {
+        explicit_bzero(arena->data, arena->used);
+    }
+
+    if (arena->demand > arena->stats.peak) {
+        arena->stats.peak = arena->demand;
+    }
+
+    /*
+     * Grow once so a packet like this one fits next time. The contents are
+     * dead, so the old block is dropped rather than reallocated.
+     */
+    if (arena->demand > arena->size &&
+        arena->demand <= SSH_PACKET_ARENA_MAX_SIZE) {
+        size = arena_round(arena->demand, ARENA_GROW_STEP);
+        SAFE_FREE(arena->data);
+        arena->size = 0;
+        data = malloc(size);
+        if (data != NULL) {
+            arena->data = data;
+            arena->size = size;
+        }
+        arena->stats.size = arena->size;
+    }
+
+    arena->used = 0;
+    arena->demand = 0;
+    arena->secure = 0;
+    arena->stats.resets++;
+}
+
+void ssh_arena_free(struct ssh_arena_struct *arena)
+{
+    arena->depth = 0;
+    ssh_arena_reset(arena);
+    SAFE_FREE(arena->data);
+    arena->size = 0;
+    arena->stats.size = 0;
+}
+
+ssh_string ssh_arena_get_ssh_string(struct ssh_arena_struct *arena,
+                                    ssh_buffer buffer)
+{
+    struct ssh_string_struct *str = NULL;
+    uint32_t stringlen;
+    uint32_t hostlen;
+    int rc;
+
+    rc = ssh_buffer_get_u32(buffer, &stringlen);
+    if (rc == 0) {
+        return NULL;
+    }
+    hostlen = ntohl(stringlen);
+    rc = ssh_buffer_validate_length(buffer, hostlen);
+    if (rc != SSH_OK) {
+        return NULL;
+    }
+
+    str = ssh_arena_alloc(arena, sizeof(struct ssh_string_struct) + hostlen);
+    if (str == NULL) {
+        return NULL;
+    }
+    str->size = stringlen;
+    str->data[0] = 0;
+
+    if (ssh_buffer_get_data(buffer, str->data, hostlen) != hostlen) {
+        /* should never happen, the length was validated */
+        return NULL;
+    }
+
+    return str;
+}
+
+/**
+ * @brief Get the allocation counters of the session's packet arena.
+ *
+ * @param[in]  session  The SSH session.
+ *
+ * @param[out] stats    Where to copy the counters.
+ *
+ * @return              SSH_OK, or SSH_ERROR on invalid arguments.
+ */
+int ssh_get_packet_arena_stats(ssh_session session,
+                               struct ssh_arena_stats *stats)
+{
+    if (session == NULL || stats == NULL) {
+        return SSH_ERROR;
+    }
+
+    *stats = session->packet_arena.stats;
+
+    return SSH_OK;
+}
@@ -1553,7 +1553,7 @@ static int ssh_userauth_kbdint_send(ssh_session session)
         ssh_set_error_invalid(session);
         return SSH_ERROR;
     }
-    rc = ssh_buffer_pack(session->out_buffer, "bd",
+    rc = ssh_buffer_pack_bd(session->out_buffer,
             SSH2_MSG_USERAUTH_INFO_RESPONSE,
             session->kbdint->nprompts);
     if (rc < 0) {
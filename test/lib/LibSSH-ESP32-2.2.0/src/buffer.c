@@ -513,6 +513,41 @@ int ssh_buffer_add_u8(struct ssh_buffer_struct *buffer,uint8_t data)
     return 0;
 }
 
+/**
+ * @internal
+ *
+ * @brief Leave room at the head of an empty buffer.
+ *
+ * A later ssh_buffer_prepend_data() of up to len bytes then fills the room
+ * instead of moving the contents.
+ *
+ * @param[in]  buffer   The empty buffer.
+ *
+ * @param[in]  len      The room to leave.
+ *
+ * @return              0 on success, -1 on error.
+ */
+int ssh_buffer_reserve_head(struct ssh_buffer_struct *buffer, uint32_t len)
+{
+    buffer_verify(buffer);
+
+    if (buffer->used != buffer->pos) {
+        return -1;
+    }
+
+    if (buffer->allocated < len) {
+        if (realloc_buffer(buffer, len) < 0) {
+            return -1;
+        }
+    }
+    buffer->used = len;
+    buffer->pos = len;
+
+    buffer_verify(buffer);
+
+    return 0;
+}
+
 /**
  * @internal
  *
@@ -47,12 +47,12 @@
 #include "libssh/session.h"
 #include "libssh/misc.h"
 #include "libssh/messages.h"
+#include "libssh/trace.h"
 #if WITH_SERVER
 #include "libssh/server.h"
 #endif
 
 #define WINDOWBEGIN 8000
-#define WINDOWLIMIT (WINDOWBEGIN/2)
 
 /*
  * All implementations MUST be able to process packets with an
@@ -62,6 +62,9 @@
 #define CHANNEL_MAX_PACKET 32768
 #define CHANNEL_INITIAL_WINDOW 250
 
+/* Buckets of the local id index, doubled whenever it gets full */
+#define CHANNEL_INDEX_INITIAL_SIZE 8
+
 /**
  * @defgroup libssh_channel The SSH channel functions
  * @ingroup libssh
@@ -151,6 +154,101 @@ uint32_t ssh_channel_new_id(ssh_session session) {
   return ++(session->maxchannel);
 }
 
+/*
+ * Local ids are handed out sequentially, so their low bits alone spread the
+ * channels evenly over a power of two number of buckets.
+ */
+static ssh_channel *channel_index_bucket(ssh_session session, uint32_t id)
+{
+    return &session->channel_index[id & (session->channel_index_size - 1)];
+}
+
+static int channel_index_grow(ssh_session session)
+{
+    ssh_channel *old = session->channel_index;
+    uint32_t old_size = session->channel_index_size;
+    uint32_t size;
+    uint32_t i;
+
+    size = old_size ? old_size * 2 : CHANNEL_INDEX_INITIAL_SIZE;
+    session->channel_index = calloc(size, sizeof(ssh_channel));
+    if (session->channel_index == NULL) {
+        session->channel_index = old;
+        return SSH_ERROR;
+    }
+    session->channel_index_size = size;
+
+    for (i = 0; i < old_size; i++) {
+        ssh_channel channel = old[i];
+
+        while (channel != NULL) {
+            ssh_channel next = channel->index_next;
+            ssh_channel *bucket = channel_index_bucket(session,
+                                                       channel->local_channel);
+
+            channel->index_next = *bucket;
+            *bucket = channel;
+            channel = next;
+        }
+    }
+    SAFE_FREE(old);
+
+    return SSH_OK;
+}
+
+/**
+ * @internal
+ *
+ * @brief Make a channel findable by ssh_channel_from_local() once its local
+ * id has been assigned.
+ *
+ * @param[in]  channel  The channel to index.
+ *
+ * @return              SSH_OK on success, SSH_ERROR if out of memory.
+ */
+int ssh_channel_index_add(ssh_channel channel)
+{
+    ssh_session session = channel->session;
+    ssh_channel *bucket = NULL;
+    int rc;
+
+    if (session->channel_index_count >= session->channel_index_size) {
+        rc = channel_index_grow(session);
+        if (rc != SSH_OK) {
+            ssh_set_error_oom(session);
+            return SSH_ERROR;
+        }
+    }
+
+    bucket = channel_index_bucket(session, channel->local_channel);
+    channel->index_next = *bucket;
+    *bucket = channel;
+    session->channel_index_count++;
+
+    return SSH_OK;
+}
+
+static void channel_index_remove(ssh_channel channel)
+{
+    ssh_session session = channel->session;
+    ssh_channel *p = NULL;
+
+    if (session->channel_index == NULL) {
+        return;
+    }
+
+    for (p = channel_index_bucket(session, channel->local_channel);
+         *p != NULL;
+         p = &(*p)->index_next) {
+        if (*p == channel) {
+            *p = channel->index_next;
+            channel->index_next = NULL;
+            session->channel_index_count--;
+            return;
+        }
+    }
+}
+
 /**
  * @internal
  *
@@ -343,6 +441,14 @@ channel_open(ssh_channel channel,
             return err;
         }
     }
+
+    /* Only index the channel once the open is queued, a failed attempt
+     * leaves it out of the index and a retry starts over with a new id */
+    rc = ssh_channel_index_add(channel);
+    if (rc != SSH_OK) {
+        ssh_buffer_reinit(session->out_buffer);
+        return err;
+    }
     channel->state = SSH_CHANNEL_STATE_OPENING;
     if (ssh_packet_send(session) == SSH_ERROR) {
         return err;
@@ -378,14 +484,15 @@ end:
 
 /* return channel with corresponding local id, or NULL if not found */
 ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id) {
-  struct ssh_iterator *it;
   ssh_channel channel;
 
-  for (it = ssh_list_get_iterator(session->channels); it != NULL ; it=it->next) {
-    channel = ssh_iterator_value(ssh_channel, it);
-    if (channel == NULL) {
-      continue;
-    }
+  if (session->channel_index == NULL) {
+    return NULL;
+  }
+
+  for (channel = *channel_index_bucket(session, id);
+       channel != NULL;
+       channel = channel->index_next) {
     if (channel->local_channel == id) {
       return channel;
     }
@@ -394,6 +501,18 @@ ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id) {
   return NULL;
 }
 
+static uint32_t channel_window(ssh_session session)
+{
+  return session->opts.channel_window != 0 ? session->opts.channel_window
+                                           : WINDOWBEGIN;
+}
+
+/* the window is topped up once it falls below this */
+static uint32_t channel_window_limit(ssh_session session)
+{
+  return channel_window(session) / 2;
+}
+
 /**
  * @internal
  * @brief grows the local window and send a packet to the other party
@@ -406,7 +525,8 @@ static int grow_window(ssh_session session,
                        ssh_channel channel,
                        uint32_t minimumsize)
 {
-  uint32_t new_window = minimumsize > WINDOWBEGIN ? minimumsize : WINDOWBEGIN;
+  uint32_t window = channel_window(session);
+  uint32_t new_window = minimumsize > window ? minimumsize : window;
   int rc;
 
   if(new_window <= channel->local_window){
@@ -420,11 +540,10 @@ static int grow_window(ssh_session session,
   /* WINDOW_ADJUST packet needs a relative increment rather than an absolute
    * value, so we give here the missing bytes needed to reach new_window
    */
-  rc = ssh_buffer_pack(session->out_buffer,
-                       "bdd",
-                       SSH2_MSG_CHANNEL_WINDOW_ADJUST,
-                       channel->remote_channel,
-                       new_window - channel->local_window);
+  rc = ssh_buffer_pack_bdd(session->out_buffer,
+                           SSH2_MSG_CHANNEL_WINDOW_ADJUST,
+                           channel->remote_channel,
+                           new_window - channel->local_window);
   if (rc != SSH_OK) {
     ssh_set_error_oom(session);
     goto error;
@@ -467,7 +586,7 @@ static ssh_channel channel_from_msg(ssh_session session, ssh_buffer packet) {
   uint32_t chan;
   int rc;
 
-  rc = ssh_buffer_unpack(packet,"d",&chan);
+  rc = ssh_buffer_unpack_d(packet, &chan);
   if (rc != SSH_OK) {
     ssh_set_error(session, SSH_FATAL,
         "Getting channel from message: short read");
@@ -496,7 +615,7 @@ SSH_PACKET_CALLBACK(channel_rcv_change_window) {
     SSH_LOG(SSH_LOG_FUNCTIONS, "%s", ssh_get_error(session));
   }
 
-  rc = ssh_buffer_unpack(packet, "d", &bytes);
+  rc = ssh_buffer_unpack_d(packet, &bytes);
   if (channel == NULL || rc != SSH_OK) {
     SSH_LOG(SSH_LOG_PACKET,
         "Error getting a window adjust message: invalid packet");
@@ -504,7 +623,9 @@ SSH_PACKET_CALLBACK(channel_rcv_change_window) {
     return SSH_PACKET_USED;
   }
 
-  SSH_LOG(SSH_LOG_PROTOCOL,
+  SSH_TRACE_LOG(SSH_TRACE_CHANNEL_WINDOW_ADJUST,
+      channel->local_channel, bytes, channel->remote_window,
+      SSH_LOG_PROTOCOL,
       "Adding %d bytes to channel (%d:%d) (from %d bytes)",
       bytes,
       channel->local_channel,
@@ -516,14 +637,52 @@ SSH_PACKET_CALLBACK(channel_rcv_change_window) {
   return SSH_PACKET_USED;
 }
 
+/*
+ * Offers data to the data callbacks of the channel, each one getting what
+ * the previous ones left. Returns the number of bytes they consumed.
+ */
+static size_t channel_callbacks_consume(ssh_channel channel,
+                                        uint8_t *data,
+                                        size_t len,
+                                        int is_stderr)
+{
+    size_t used = 0;
+    int rest;
+
+    ssh_callbacks_iterate(channel->callbacks,
+                          ssh_channel_callbacks,
+                          channel_data_function) {
+        if (used == len) {
+            break;
+        }
+        rest = ssh_callbacks_iterate_exec(channel_data_function,
+                                          channel->session,
+                                          channel,
+                                          data + used,
+                                          len - used,
+                                          is_stderr);
+        if (rest > 0) {
+            if (channel->counter != NULL) {
+                channel->counter->in_bytes += rest;
+            }
+            used += rest;
+        }
+    }
+    ssh_callbacks_iterate_end();
+
+    return used;
+}
+
 /* is_stderr is set to 1 if the data are extended, ie stderr */
 SSH_PACKET_CALLBACK(channel_rcv_data){
   ssh_channel channel;
   ssh_string str;
   ssh_buffer buf;
+  uint8_t *data;
   size_t len;
+  size_t used = 0;
   int is_stderr;
-  int rest;
+  int direct;
   (void)user;
 
   if(type==SSH2_MSG_CHANNEL_DATA)
@@ -545,7 +704,7 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
     ssh_buffer_get_u32(packet, &ignore);
   }
 
-  str = ssh_buffer_get_ssh_string(packet);
+  str = ssh_arena_get_ssh_string(&session->packet_arena, packet);
   if (str == NULL) {
     SSH_LOG(SSH_LOG_PACKET, "Invalid data packet!");
 
@@ -553,7 +712,9 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
   }
   len = ssh_string_len(str);
 
-  SSH_LOG(SSH_LOG_PACKET,
+  SSH_TRACE_LOG(SSH_TRACE_CHANNEL_DATA_IN,
+      channel->local_channel, len, channel->local_window,
+      SSH_LOG_PACKET,
       "Channel receiving %zu bytes data in %d (local win=%d remote win=%d)",
       len,
       is_stderr,
@@ -568,10 +729,22 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
         channel->local_window);
   }
 
-  if (channel_default_bufferize(channel, ssh_string_data(str), len,
-        is_stderr) < 0) {
-    SSH_STRING_FREE(str);
+  data = ssh_string_data(str);
+  buf = is_stderr ? channel->stderr_buffer : channel->stdout_buffer;
 
+  /*
+   * With nothing queued ahead of this packet the callbacks read the arena
+   * copy of the payload directly, and only the unconsumed rest is copied
+   * into the channel buffer.
+   */
+  direct = buf == NULL || ssh_buffer_get_len(buf) == 0;
+  if (direct) {
+    used = channel_callbacks_consume(channel, data, len, is_stderr);
+  }
+
+  if (used < len &&
+      channel_default_bufferize(channel, data + used, len - used,
+        is_stderr) < 0) {
     return SSH_PACKET_USED;
   }
 
@@ -586,36 +759,24 @@ SSH_PACKET_CALLBACK(channel_rcv_data){
       channel->local_window,
       channel->remote_window);
 
-  SSH_STRING_FREE(str);
-
   if (is_stderr) {
       buf = channel->stderr_buffer;
   } else {
       buf = channel->stdout_buffer;
   }
 
-  ssh_callbacks_iterate(channel->callbacks,
-                        ssh_channel_callbacks,
-                        channel_data_function) {
-      if (ssh_buffer_get(buf) == NULL) {
-          break;
-      }
-      rest = ssh_callbacks_iterate_exec(channel_data_function,
-                                        channel->session,
-                                        channel,
-                                        ssh_buffer_get(buf),
-                                        ssh_buffer_get_len(buf),
-                                        is_stderr);
-      if (rest > 0) {
-          if (channel->counter != NULL) {
-              channel->counter->in_bytes += rest;
-          }
-          ssh_buffer_pass_bytes(buf, rest);
-      }
+  /* the callbacks already saw the payload if it was offered directly */
+  if (!direct && buf != NULL) {
+      used = channel_callbacks_consume(channel,
+                                       ssh_buffer_get(buf),
+                                       ssh_buffer_get_len(buf),
+                                       is_stderr);
+      ssh_buffer_pass_bytes(buf, used);
   }
-  ssh_callbacks_iterate_end();
 
-  if (channel->local_window + ssh_buffer_get_len(buf) < WINDOWLIMIT) {
+  if (channel->local_window +
+      (buf != NULL ? ssh_buffer_get_len(buf) : 0) <
+      channel_window_limit(session)) {
       if (grow_window(session, channel, 0) < 0) {
           return -1;
       }
@@ -825,10 +986,9 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
 	  SAFE_FREE(request);
 	  SSH_LOG(SSH_LOG_PROTOCOL,"Responding to Openssh's keepalive");
 
-      rc = ssh_buffer_pack(session->out_buffer,
-                           "bd",
-                           SSH2_MSG_CHANNEL_FAILURE,
-                           channel->remote_channel);
+      rc = ssh_buffer_pack_bd(session->out_buffer,
+                              SSH2_MSG_CHANNEL_FAILURE,
+                              channel->remote_channel);
       if (rc != SSH_OK) {
           return SSH_PACKET_USED;
       }
@@ -857,10 +1017,9 @@ SSH_PACKET_CALLBACK(channel_rcv_request) {
     ssh_callbacks_iterate_end();
 
     if (want_reply) {
-        rc = ssh_buffer_pack(session->out_buffer,
-                             "bd",
-                             status,
-                             channel->remote_channel);
+        rc = ssh_buffer_pack_bd(session->out_buffer,
+                                status,
+                                channel->remote_channel);
         if (rc != SSH_OK) {
             return SSH_PACKET_USED;
         }
@@ -1226,6 +1385,7 @@ void ssh_channel_do_free(ssh_channel channel)
     if (it != NULL) {
         ssh_list_remove(session->channels, it);
     }
+    channel_index_remove(channel);
 
     SSH_BUFFER_FREE(channel->stdout_buffer);
     SSH_BUFFER_FREE(channel->stderr_buffer);
@@ -1284,10 +1444,9 @@ int ssh_channel_send_eof(ssh_channel channel)
 
     session = channel->session;
 
-    err = ssh_buffer_pack(session->out_buffer,
-                          "bd",
-                          SSH2_MSG_CHANNEL_EOF,
-                          channel->remote_channel);
+    err = ssh_buffer_pack_bd(session->out_buffer,
+                             SSH2_MSG_CHANNEL_EOF,
+                             channel->remote_channel);
     if (err != SSH_OK) {
         ssh_set_error_oom(session);
         goto error;
@@ -1349,10 +1508,9 @@ int ssh_channel_close(ssh_channel channel)
         return rc;
     }
 
-    rc = ssh_buffer_pack(session->out_buffer,
-                         "bd",
-                         SSH2_MSG_CHANNEL_CLOSE,
-                         channel->remote_channel);
+    rc = ssh_buffer_pack_bd(session->out_buffer,
+                            SSH2_MSG_CHANNEL_CLOSE,
+                            channel->remote_channel);
     if (rc != SSH_OK) {
         ssh_set_error_oom(session);
         goto error;
@@ -1468,6 +1626,12 @@ static int channel_write_common(ssh_channel channel,
     return SSH_ERROR;
   }
 
+  /*
+   * The chunks are encrypted back to back and flushed together, waiting
+   * for the window in between flushes what was written so far
+   */
+  ssh_socket_cork(session->socket);
+
   if (ssh_waitsession_unblocked(session) == 0){
     rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
             ssh_waitsession_unblocked, session);
@@ -1483,7 +1647,9 @@ static int channel_write_common(ssh_channel channel,
       /* What happens when the channel window is zero? */
       if(channel->remote_window == 0) {
           /* nothing can be written */
-          SSH_LOG(SSH_LOG_PROTOCOL,
+          SSH_TRACE_LOG(SSH_TRACE_CHANNEL_WINDOW_WAIT,
+                channel->local_channel, len, 0,
+                SSH_LOG_PROTOCOL,
                 "Wait for a growing window message...");
           rc = ssh_handle_packets_termination(session, SSH_TIMEOUT_DEFAULT,
               ssh_channel_waitwindow_termination,channel);
@@ -1501,31 +1667,21 @@ static int channel_write_common(ssh_channel channel,
 
     effectivelen = MIN(effectivelen, maxpacketlen);;
 
-    rc = ssh_buffer_pack(session->out_buffer,
-                         "bd",
-                         is_stderr ? SSH2_MSG_CHANNEL_EXTENDED_DATA : SSH2_MSG_CHANNEL_DATA,
-                         channel->remote_channel);
-    if (rc != SSH_OK) {
-        ssh_set_error_oom(session);
-        goto error;
-    }
-
-    /* stderr message has an extra field */
+    /* the whole message is reserved once, stderr has an extra field */
     if (is_stderr) {
-        rc = ssh_buffer_pack(session->out_buffer,
-                             "d",
-                             SSH2_EXTENDED_DATA_STDERR);
-        if (rc != SSH_OK) {
-            ssh_set_error_oom(session);
-            goto error;
-        }
+        rc = ssh_buffer_pack_bdddP(session->out_buffer,
+                                   SSH2_MSG_CHANNEL_EXTENDED_DATA,
+                                   channel->remote_channel,
+                                   SSH2_EXTENDED_DATA_STDERR,
+                                   effectivelen,
+                                   effectivelen, data);
+    } else {
+        rc = ssh_buffer_pack_bddP(session->out_buffer,
+                                  SSH2_MSG_CHANNEL_DATA,
+                                  channel->remote_channel,
+                                  effectivelen,
+                                  effectivelen, data);
     }
-
-    /* append payload data */
-    rc = ssh_buffer_pack(session->out_buffer,
-                         "dP",
-                         effectivelen,
-                         (size_t)effectivelen, data);
     if (rc != SSH_OK) {
         ssh_set_error_oom(session);
         goto error;
@@ -1533,13 +1689,15 @@ static int channel_write_common(ssh_channel channel,
 
     rc = ssh_packet_send(session);
     if (rc == SSH_ERROR) {
+        ssh_socket_uncork(session->socket);
         return SSH_ERROR;
     }
 
-    SSH_LOG(SSH_LOG_PACKET,
-        "channel_write wrote %ld bytes", (long int) effectivelen);
-
     channel->remote_window -= effectivelen;
+    SSH_TRACE_LOG(SSH_TRACE_CHANNEL_DATA_OUT,
+        channel->local_channel, effectivelen, channel->remote_window,
+        SSH_LOG_PACKET,
+        "channel_write wrote %ld bytes", (long int) effectivelen);
     len -= effectivelen;
     data = ((uint8_t*)data + effectivelen);
     if (channel->counter != NULL) {
@@ -1548,15 +1706,23 @@ static int channel_write_common(ssh_channel channel,
   }
 
   /* it's a good idea to flush the socket now */
-  rc = ssh_channel_flush(channel);
+  rc = ssh_socket_uncork(session->socket);
+  if (rc != SSH_ERROR) {
+      rc = ssh_channel_flush(channel);
+  }
   if (rc == SSH_ERROR) {
-      goto error;
+      ssh_buffer_reinit(session->out_buffer);
+      return SSH_ERROR;
   }
 
+  return (int)(origlen - len);
+
 out:
+  ssh_socket_uncork(session->socket);
   return (int)(origlen - len);
 
 error:
+  ssh_socket_uncork(session->socket);
   ssh_buffer_reinit(session->out_buffer);
 
   return SSH_ERROR;
@@ -3008,7 +3174,7 @@ int ssh_channel_read_timeout(ssh_channel channel,
       channel->state = SSH_CHANNEL_STATE_CLOSED;
   }
   /* Authorize some buffering while userapp is busy */
-  if (channel->local_window < WINDOWLIMIT) {
+  if (channel->local_window < channel_window_limit(session)) {
     if (grow_window(session, channel, 0) < 0) {
       return -1;
     }
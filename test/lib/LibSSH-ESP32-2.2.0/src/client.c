@@ -726,9 +726,9 @@ error:
     session->session_state = SSH_SESSION_STATE_DISCONNECTED;
     session->pending_call_state = SSH_PENDING_CALL_NONE;
 
+    /* ssh_channel_do_free() takes the channel off the list */
     while ((it = ssh_list_get_iterator(session->channels)) != NULL) {
         ssh_channel_do_free(ssh_iterator_value(ssh_channel, it));
-        ssh_list_remove(session->channels, it);
     }
     if (session->current_crypto) {
       crypto_free(session->current_crypto);
@@ -771,6 +771,7 @@ error:
     if (session->packet_callbacks) {
         ssh_list_free(session->packet_callbacks);
         session->packet_callbacks = NULL;
+        session->packet_dispatch_valid = 0;
     }
 }
 
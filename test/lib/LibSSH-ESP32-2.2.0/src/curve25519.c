@@ -59,6 +59,12 @@ static struct ssh_packet_callbacks_struct ssh_curve25519_client_callbacks = {
 static int ssh_curve25519_init(ssh_session session)
 {
     int rc;
+
+    if (session->next_crypto->curve25519_ready) {
+        session->next_crypto->curve25519_ready = false;
+        return SSH_OK;
+    }
+
 #ifdef HAVE_OPENSSL_X25519
     EVP_PKEY_CTX *pctx = NULL;
     EVP_PKEY *pkey = NULL;
@@ -141,6 +147,28 @@ static int ssh_curve25519_init(ssh_session session)
     return SSH_OK;
 }
 
+/** @internal
+ * @brief Makes our keypair for the next curve25519 key exchange now
+ *
+ * The exchange that follows uses it instead of making one when the peer's
+ * message arrives, which shortens the time packets are held by a rekey.
+ */
+int ssh_curve25519_precompute(ssh_session session)
+{
+    int rc;
+
+    if (session->next_crypto->curve25519_ready) {
+        return SSH_OK;
+    }
+
+    rc = ssh_curve25519_init(session);
+    if (rc == SSH_OK) {
+        session->next_crypto->curve25519_ready = true;
+    }
+
+    return rc;
+}
+
 /** @internal
  * @brief Starts curve25519-sha256@libssh.org / curve25519-sha256 key exchange
  */
@@ -0,0 +1,251 @@
+/*
+ * gzip.c - hooks for compression of packets
+ *
+ * This file is part of the SSH Library
+ *
+ * Copyright (c) 2003      by Aris Adamantiadis
+ * Copyright (c) 2009      by Andreas Schneider <asn@cryptomilk.org>
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "libssh_esp32_config.h"
+
+#ifdef WITH_ZLIB
+
+#include <string.h>
+#include <stdlib.h>
+#include <zlib.h>
+
+#include "libssh/priv.h"
+#include "libssh/buffer.h"
+#include "libssh/crypto.h"
+#include "libssh/session.h"
+
+/*
+ * Memory used by the deflate stream is roughly
+ * (1 << (SSH_ZLIB_WINDOW_BITS + 2)) + (1 << (SSH_ZLIB_MEM_LEVEL + 9)) bytes,
+ * 16KiB with the defaults below instead of the 256KiB zlib would pick. The
+ * window only bounds how far back our own matches reach, so any value is
+ * understood by the peer.
+ */
+#ifndef SSH_ZLIB_WINDOW_BITS
+#define SSH_ZLIB_WINDOW_BITS 11
+#endif
+
+#ifndef SSH_ZLIB_MEM_LEVEL
+#define SSH_ZLIB_MEM_LEVEL 4
+#endif
+
+/*
+ * The inflate window has to be at least as large as the one the peer
+ * deflates with, and OpenSSH always uses the zlib default of 15 bits (about
+ * 32KiB plus 7KiB of tables). Only lower this for peers known to use less.
+ */
+#ifndef SSH_ZLIB_INFLATE_WINDOW_BITS
+#define SSH_ZLIB_INFLATE_WINDOW_BITS 15
+#endif
+
+/* Output is produced straight into the destination buffer in these steps */
+#define BLOCKSIZE 4092
+
+static z_stream *initcompress(ssh_session session, int level)
+{
+    z_stream *stream = NULL;
+    int status;
+
+    stream = calloc(1, sizeof(z_stream));
+    if (stream == NULL) {
+        ssh_set_error_oom(session);
+        return NULL;
+    }
+
+    status = deflateInit2(stream,
+                          level,
+                          Z_DEFLATED,
+                          SSH_ZLIB_WINDOW_BITS,
+                          SSH_ZLIB_MEM_LEVEL,
+                          Z_DEFAULT_STRATEGY);
+    if (status != Z_OK) {
+        SAFE_FREE(stream);
+        ssh_set_error(session, SSH_FATAL,
+                      "status %d inititalising zlib deflate", status);
+        return NULL;
+    }
+
+    return stream;
+}
+
+static z_stream *initdecompress(ssh_session session)
+{
+    z_stream *stream = NULL;
+    int status;
+
+    stream = calloc(1, sizeof(z_stream));
+    if (stream == NULL) {
+        ssh_set_error_oom(session);
+        return NULL;
+    }
+
+    status = inflateInit2(stream, SSH_ZLIB_INFLATE_WINDOW_BITS);
+    if (status != Z_OK) {
+        SAFE_FREE(stream);
+        ssh_set_error(session, SSH_FATAL,
+                      "status %d inititalising zlib inflate", status);
+        return NULL;
+    }
+
+    return stream;
+}
+
+/*
+ * Replaces the contents of buf with dest. The destination was grown in
+ * BLOCKSIZE steps so its unused tail is trimmed first.
+ */
+static int gzip_replace(ssh_buffer buf, ssh_buffer dest, uint32_t unused)
+{
+    int rc;
+
+    ssh_buffer_pass_bytes_end(dest, unused);
+
+    rc = ssh_buffer_reinit(buf);
+    if (rc < 0) {
+        return -1;
+    }
+
+    return ssh_buffer_add_data(buf,
+                               ssh_buffer_get(dest),
+                               ssh_buffer_get_len(dest));
+}
+
+int compress_buffer(ssh_session session, ssh_buffer buf)
+{
+    struct ssh_crypto_struct *crypto = NULL;
+    z_stream *zout = NULL;
+    ssh_buffer dest = NULL;
+    uint8_t *out = NULL;
+    int status;
+    int rc = -1;
+
+    crypto = ssh_packet_get_current_crypto(session, SSH_DIRECTION_OUT);
+    if (crypto == NULL) {
+        return -1;
+    }
+
+    zout = crypto->compress_out_ctx;
+    if (zout == NULL) {
+        zout = initcompress(session, session->opts.compressionlevel);
+        if (zout == NULL) {
+            return -1;
+        }
+        crypto->compress_out_ctx = zout;
+    }
+
+    dest = ssh_buffer_new();
+    if (dest == NULL) {
+        ssh_set_error_oom(session);
+        return -1;
+    }
+
+    zout->next_in = ssh_buffer_get(buf);
+    zout->avail_in = ssh_buffer_get_len(buf);
+    do {
+        out = ssh_buffer_allocate(dest, BLOCKSIZE);
+        if (out == NULL) {
+            ssh_set_error_oom(session);
+            goto out;
+        }
+        zout->next_out = out;
+        zout->avail_out = BLOCKSIZE;
+
+        status = deflate(zout, Z_PARTIAL_FLUSH);
+        if (status != Z_OK) {
+            ssh_set_error(session, SSH_FATAL,
+                          "status %d deflating zlib packet", status);
+            goto out;
+        }
+    } while (zout->avail_out == 0);
+
+    rc = gzip_replace(buf, dest, zout->avail_out);
+
+out:
+    SSH_BUFFER_FREE(dest);
+    return rc;
+}
+
+int decompress_buffer(ssh_session session, ssh_buffer buf, size_t maxlen)
+{
+    struct ssh_crypto_struct *crypto = NULL;
+    z_stream *zin = NULL;
+    ssh_buffer dest = NULL;
+    uint8_t *out = NULL;
+    int status;
+    int rc = -1;
+
+    crypto = ssh_packet_get_current_crypto(session, SSH_DIRECTION_IN);
+    if (crypto == NULL) {
+        return -1;
+    }
+
+    zin = crypto->compress_in_ctx;
+    if (zin == NULL) {
+        zin = initdecompress(session);
+        if (zin == NULL) {
+            return -1;
+        }
+        crypto->compress_in_ctx = zin;
+    }
+
+    dest = ssh_buffer_new();
+    if (dest == NULL) {
+        ssh_set_error_oom(session);
+        return -1;
+    }
+
+    zin->next_in = ssh_buffer_get(buf);
+    zin->avail_in = ssh_buffer_get_len(buf);
+    do {
+        out = ssh_buffer_allocate(dest, BLOCKSIZE);
+        if (out == NULL) {
+            ssh_set_error_oom(session);
+            goto out;
+        }
+        zin->next_out = out;
+        zin->avail_out = BLOCKSIZE;
+
+        status = inflate(zin, Z_PARTIAL_FLUSH);
+        if (status != Z_OK && status != Z_BUF_ERROR) {
+            ssh_set_error(session, SSH_FATAL,
+                          "status %d inflating zlib packet", status);
+            goto out;
+        }
+
+        if (ssh_buffer_get_len(dest) - zin->avail_out > maxlen) {
+            /* Size of packet exceeded, avoid a denial of service attack */
+            ssh_set_error(session, SSH_FATAL,
+                          "Decompressed packet exceeds %zu bytes", maxlen);
+            goto out;
+        }
+    } while (zin->avail_out == 0);
+
+    rc = gzip_replace(buf, dest, zin->avail_out);
+
+out:
+    SSH_BUFFER_FREE(dest);
+    return rc;
+}
+
+#endif /* WITH_ZLIB */
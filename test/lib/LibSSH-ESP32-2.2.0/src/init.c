@@ -25,6 +25,8 @@
 #include "libssh/priv.h"
 #include "libssh/socket.h"
 #include "libssh/dh.h"
+#include "libssh/kex.h"
+#include "libssh/knownhosts.h"
 #include "libssh/poll.h"
 #include "libssh/threads.h"
 
@@ -86,6 +88,8 @@ static int _ssh_init(unsigned constructor) {
         goto _ret;
     }
 
+    ssh_kex_registry_init();
+
     rc = ssh_socket_init();
     if (rc) {
         goto _ret;
@@ -173,6 +177,8 @@ static int _ssh_finalize(unsigned destructor) {
 
     /* If the counter reaches zero or it is the destructor calling, finalize */
     ssh_dh_finalize();
+    ssh_known_hosts_cache_flush();
+    ssh_pki_key_cache_flush();
     ssh_crypto_finalize();
     ssh_socket_cleanup();
     /* It is important to finalize threading after CRYPTO because
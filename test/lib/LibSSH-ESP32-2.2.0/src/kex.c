@@ -300,6 +300,224 @@ const char *ssh_kex_get_fips_methods(uint32_t algo) {
   return fips_methods[algo];
 }
 
+/*
+ * Algorithm registry. Every name in supported_methods gets a small id within
+ * its method slot, in the order of that list, so a proposal can be held as
+ * an ordered array of ids plus a bitmask. Names point into the string
+ * literals above and nothing is allocated. Lists are parsed into ids once at
+ * the wire or option boundary and negotiation compares bits instead of
+ * tokenizing and comparing strings.
+ */
+#define KEX_MAX_ALGOS 64
+
+struct kex_algo {
+    const char *name;
+    size_t len;
+};
+
+struct kex_registry {
+    struct kex_algo algos[KEX_MAX_ALGOS];
+    size_t count;
+    /* algorithms allowed in FIPS mode */
+    uint64_t fips;
+    /* host key types without certificates, SSH_HOSTKEYS only */
+    uint64_t plain;
+};
+
+struct kex_algo_list {
+    uint8_t ids[KEX_MAX_ALGOS];
+    size_t count;
+    uint64_t mask;
+};
+
+static struct kex_registry kex_registry[SSH_LANG_C_S];
+static int kex_registry_ready;
+
+/* Returns the next comma separated name of *p and its length, or NULL */
+static const char *kex_next_name(const char **p, size_t *len)
+{
+    const char *name = *p;
+    const char *comma = NULL;
+
+    while (*name == ',') {
+        name++;
+    }
+    if (*name == '\0') {
+        return NULL;
+    }
+
+    comma = strchr(name, ',');
+    *len = comma != NULL ? (size_t)(comma - name) : strlen(name);
+    *p = name + *len;
+
+    return name;
+}
+
+static int kex_algo_id(const struct kex_registry *r,
+                       const char *name,
+                       size_t len)
+{
+    size_t i;
+
+    for (i = 0; i < r->count; i++) {
+        if (r->algos[i].len == len && memcmp(r->algos[i].name, name, len) == 0) {
+            return (int)i;
+        }
+    }
+
+    return -1;
+}
+
+/* Parses a name list into ids in list order. Unknown names and repeats are
+ * dropped, we could never negotiate them. */
+static void kex_algo_list_parse(const struct kex_registry *r,
+                                const char *list,
+                                struct kex_algo_list *out)
+{
+    const char *p = list;
+    const char *name = NULL;
+    size_t len;
+    int id;
+
+    out->count = 0;
+    out->mask = 0;
+    if (list == NULL) {
+        return;
+    }
+
+    while ((name = kex_next_name(&p, &len)) != NULL) {
+        id = kex_algo_id(r, name, len);
+        if (id < 0 || (out->mask & ((uint64_t)1 << id))) {
+            continue;
+        }
+        out->ids[out->count++] = (uint8_t)id;
+        out->mask |= (uint64_t)1 << id;
+    }
+}
+
+static uint64_t kex_algo_mask(const struct kex_registry *r, const char *list)
+{
+    struct kex_algo_list parsed;
+
+    kex_algo_list_parse(r, list, &parsed);
+
+    return parsed.mask;
+}
+
+/* Joins the ids of list found in keep, in list order, with one allocation */
+static char *kex_algo_list_join(const struct kex_registry *r,
+                                const struct kex_algo_list *list,
+                                uint64_t keep)
+{
+    size_t len = 0;
+    size_t i;
+    char *ret = NULL;
+    char *p = NULL;
+
+    for (i = 0; i < list->count; i++) {
+        if (keep & ((uint64_t)1 << list->ids[i])) {
+            len += r->algos[list->ids[i]].len + 1;
+        }
+    }
+    if (len == 0) {
+        return NULL;
+    }
+
+    ret = malloc(len);
+    if (ret == NULL) {
+        return NULL;
+    }
+
+    p = ret;
+    for (i = 0; i < list->count; i++) {
+        const struct kex_algo *algo = &r->algos[list->ids[i]];
+
+        if (!(keep & ((uint64_t)1 << list->ids[i]))) {
+            continue;
+        }
+        if (p != ret) {
+            *p++ = ',';
+        }
+        memcpy(p, algo->name, algo->len);
+        p += algo->len;
+    }
+    *p = '\0';
+
+    return ret;
+}
+
+/**
+ * @internal
+ *
+ * @brief Build the algorithm registry from the supported method lists. Called
+ * once from ssh_init().
+ */
+void ssh_kex_registry_init(void)
+{
+    const char *p = NULL;
+    const char *name = NULL;
+    size_t len;
+    int i;
+
+    if (kex_registry_ready) {
+        return;
+    }
+
+    for (i = 0; i < SSH_LANG_C_S; i++) {
+        struct kex_registry *r = &kex_registry[i];
+
+        r->count = 0;
+        p = supported_methods[i];
+        while ((name = kex_next_name(&p, &len)) != NULL) {
+            if (kex_algo_id(r, name, len) >= 0) {
+                continue;
+            }
+            if (r->count == KEX_MAX_ALGOS) {
+                SSH_LOG(SSH_LOG_WARN,
+                        "Too many algorithms for %s, ignoring the rest",
+                        ssh_kex_descriptions[i]);
+                break;
+            }
+            r->algos[r->count].name = name;
+            r->algos[r->count].len = len;
+            r->count++;
+        }
+        r->fips = kex_algo_mask(r, fips_methods[i]);
+    }
+    kex_registry[SSH_HOSTKEYS].plain =
+        kex_algo_mask(&kex_registry[SSH_HOSTKEYS], HOSTKEYS);
+
+    kex_registry_ready = 1;
+}
+
+/*
+ * Returns a copy of the first algorithm of the client list that the server
+ * list also has, the way ssh_find_matching(server, client) does.
+ */
+static char *kex_match(int slot, const char *server, const char *client)
+{
+    const struct kex_registry *r = &kex_registry[slot];
+    struct kex_algo_list client_algos;
+    uint64_t server_mask;
+    size_t i;
+
+    if (server == NULL || client == NULL) {
+        return NULL;
+    }
+
+    server_mask = kex_algo_mask(r, server);
+    kex_algo_list_parse(r, client, &client_algos);
+    for (i = 0; i < client_algos.count; i++) {
+        if (server_mask & ((uint64_t)1 << client_algos.ids[i])) {
+            const struct kex_algo *algo = &r->algos[client_algos.ids[i]];
+
+            return strndup(algo->name, algo->len);
+        }
+    }
+
+    return NULL;
+}
+
 /**
  * @internal
  * @brief returns whether the first client key exchange algorithm or
@@ -582,12 +800,15 @@ void ssh_list_kex(struct ssh_kex_struct *kex) {
  */
 char *ssh_client_select_hostkeys(ssh_session session)
 {
+    const struct kex_registry *r = NULL;
+    struct kex_algo_list wanted_algos;
+    struct kex_algo_list ordered;
     const char *wanted = NULL;
-    char *wanted_without_certs = NULL;
     char *known_hosts_algorithms = NULL;
-    char *known_hosts_ordered = NULL;
     char *new_hostkeys = NULL;
-    char *fips_hostkeys = NULL;
+    uint64_t known_hosts_mask;
+    uint64_t keep;
+    size_t i;
 
     wanted = session->opts.wanted_methods[SSH_HOSTKEYS];
     if (wanted == NULL) {
@@ -598,68 +819,63 @@ char *ssh_client_select_hostkeys(ssh_session session)
         }
     }
 
+    ssh_kex_registry_init();
+    r = &kex_registry[SSH_HOSTKEYS];
+
     /* This removes the certificate types, unsupported for now */
-    wanted_without_certs = ssh_find_all_matching(HOSTKEYS, wanted);
-    if (wanted_without_certs == NULL) {
+    kex_algo_list_parse(r, wanted, &wanted_algos);
+    keep = wanted_algos.mask & r->plain;
+    if (keep == 0) {
         SSH_LOG(SSH_LOG_WARNING,
                 "List of allowed host key algorithms is empty or contains only "
                 "unsupported algorithms");
         return NULL;
     }
 
-    SSH_LOG(SSH_LOG_DEBUG,
-            "Order of wanted host keys: \"%s\"",
-            wanted_without_certs);
-
     known_hosts_algorithms = ssh_known_hosts_get_algorithms_names(session);
-    if (known_hosts_algorithms == NULL) {
+    if (known_hosts_algorithms != NULL) {
         SSH_LOG(SSH_LOG_DEBUG,
-                "No key found in known_hosts; "
-                "changing host key method to \"%s\"",
-                wanted_without_certs);
-
-        return wanted_without_certs;
+                "Algorithms found in known_hosts files: \"%s\"",
+                known_hosts_algorithms);
     }
-
-    SSH_LOG(SSH_LOG_DEBUG,
-            "Algorithms found in known_hosts files: \"%s\"",
-            known_hosts_algorithms);
-
-    /* Filter and order the keys from known_hosts according to wanted list */
-    known_hosts_ordered = ssh_find_all_matching(known_hosts_algorithms,
-                                                wanted_without_certs);
+    known_hosts_mask = kex_algo_mask(r, known_hosts_algorithms);
     SAFE_FREE(known_hosts_algorithms);
-    if (known_hosts_ordered == NULL) {
+    if ((known_hosts_mask & keep) == 0) {
         SSH_LOG(SSH_LOG_DEBUG,
-                "No key found in known_hosts is allowed; "
-                "changing host key method to \"%s\"",
-                wanted_without_certs);
-
-        return wanted_without_certs;
+                "No key found in known_hosts is allowed, "
+                "keeping the wanted host key order");
     }
 
-    /* Append the other supported keys after the preferred ones
-     * This function tolerates NULL pointers in parameters */
-    new_hostkeys = ssh_append_without_duplicates(known_hosts_ordered,
-                                                 wanted_without_certs);
-    SAFE_FREE(known_hosts_ordered);
-    SAFE_FREE(wanted_without_certs);
-    if (new_hostkeys == NULL) {
-        ssh_set_error_oom(session);
-        return NULL;
+    /* Keys present in known_hosts first, then the other wanted ones, both in
+     * order of preference */
+    ordered.count = 0;
+    ordered.mask = wanted_algos.mask;
+    for (i = 0; i < wanted_algos.count; i++) {
+        if (known_hosts_mask & ((uint64_t)1 << wanted_algos.ids[i])) {
+            ordered.ids[ordered.count++] = wanted_algos.ids[i];
+        }
+    }
+    for (i = 0; i < wanted_algos.count; i++) {
+        if (!(known_hosts_mask & ((uint64_t)1 << wanted_algos.ids[i]))) {
+            ordered.ids[ordered.count++] = wanted_algos.ids[i];
+        }
     }
 
     if (ssh_fips_mode()) {
         /* Filter out algorithms not allowed in FIPS mode */
-        fips_hostkeys = ssh_keep_fips_algos(SSH_HOSTKEYS, new_hostkeys);
-        SAFE_FREE(new_hostkeys);
-        if (fips_hostkeys == NULL) {
+        keep &= r->fips;
+        if (keep == 0) {
             SSH_LOG(SSH_LOG_WARNING,
                     "None of the wanted host keys or keys in known_hosts files "
                     "is allowed in FIPS mode.");
             return NULL;
         }
-        new_hostkeys = fips_hostkeys;
+    }
+
+    new_hostkeys = kex_algo_list_join(r, &ordered, keep);
+    if (new_hostkeys == NULL) {
+        ssh_set_error_oom(session);
+        return NULL;
     }
 
     SSH_LOG(SSH_LOG_DEBUG,
@@ -778,8 +994,16 @@ int ssh_kex_select_methods (ssh_session session)
         ext_start[0] = '\0';
     }
 
+    ssh_kex_registry_init();
     for (i = 0; i < SSH_KEX_METHODS; i++) {
-        session->next_crypto->kex_methods[i]=ssh_find_matching(server->methods[i],client->methods[i]);
+        if (i < SSH_LANG_C_S) {
+            session->next_crypto->kex_methods[i] = kex_match(i,
+                                                             server->methods[i],
+                                                             client->methods[i]);
+        } else {
+            session->next_crypto->kex_methods[i] = ssh_find_matching(server->methods[i],
+                                                                     client->methods[i]);
+        }
 
         if (i == SSH_MAC_C_S || i == SSH_MAC_S_C) {
             aead_hmac = ssh_find_aead_hmac(session->next_crypto->kex_methods[i-2]);
@@ -939,6 +1163,22 @@ int ssh_send_rekex(ssh_session session)
 #endif /* WITH_SERVER */
     }
 
+#ifdef HAVE_CURVE25519
+    /*
+     * A rekey nearly always settles on the method of the last exchange.
+     * Make its key before our KEXINIT starts holding packets back; should
+     * this fail, the key is made when the exchange needs it, as usual.
+     */
+    switch (session->current_crypto->kex_type) {
+    case SSH_KEX_CURVE25519_SHA256:
+    case SSH_KEX_CURVE25519_SHA256_LIBSSH_ORG:
+        ssh_curve25519_precompute(session);
+        break;
+    default:
+        break;
+    }
+#endif /* HAVE_CURVE25519 */
+
     session->dh_handshake_state = DH_STATE_INIT;
     rc = ssh_send_kex(session, session->server);
     if (rc < 0) {
@@ -955,11 +1195,19 @@ int ssh_send_rekex(ssh_session session)
  * otherwise a new list of the supported algorithms */
 char *ssh_keep_known_algos(enum ssh_kex_types_e algo, const char *list)
 {
+    struct kex_algo_list parsed;
+
     if (algo > SSH_LANG_S_C) {
         return NULL;
     }
+    if (algo >= SSH_LANG_C_S) {
+        return ssh_find_all_matching(supported_methods[algo], list);
+    }
 
-    return ssh_find_all_matching(supported_methods[algo], list);
+    ssh_kex_registry_init();
+    kex_algo_list_parse(&kex_registry[algo], list, &parsed);
+
+    return kex_algo_list_join(&kex_registry[algo], &parsed, parsed.mask);
 }
 
 /**
@@ -976,11 +1224,21 @@ char *ssh_keep_known_algos(enum ssh_kex_types_e algo, const char *list)
  */
 char *ssh_keep_fips_algos(enum ssh_kex_types_e algo, const char *list)
 {
+    struct kex_algo_list parsed;
+
     if (algo > SSH_LANG_S_C) {
         return NULL;
     }
+    if (algo >= SSH_LANG_C_S) {
+        return ssh_find_all_matching(fips_methods[algo], list);
+    }
+
+    ssh_kex_registry_init();
+    kex_algo_list_parse(&kex_registry[algo], list, &parsed);
 
-    return ssh_find_all_matching(fips_methods[algo], list);
+    return kex_algo_list_join(&kex_registry[algo],
+                              &parsed,
+                              kex_registry[algo].fips);
 }
 
 int ssh_make_sessionid(ssh_session session)
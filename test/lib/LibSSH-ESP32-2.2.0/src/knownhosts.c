@@ -28,6 +28,7 @@
 #include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <sys/stat.h>
 
 #ifndef _WIN32
 #include <lwip/inet.h>
@@ -43,11 +44,20 @@
 #include "libssh/dh.h"
 #include "libssh/knownhosts.h"
 #include "libssh/token.h"
+#include "libssh/threads.h"
 
 #ifndef MAX_LINE_SIZE
 #define MAX_LINE_SIZE 8192
 #endif
 
+/*
+ * Number of (file, host) pairs whose parsed entries are kept between
+ * lookups, see ssh_known_hosts_read_entries().
+ */
+#ifndef KNOWN_HOSTS_CACHE_SIZE
+#define KNOWN_HOSTS_CACHE_SIZE 4
+#endif
+
 /**
  * @addtogroup libssh_session
  *
@@ -210,15 +220,48 @@ ssh_known_hosts_entries_compare(struct ssh_knownhosts_entry *k1,
     return 0;
 }
 
-/* This method reads the known_hosts file referenced by the path
- * in  filename  argument, and entries matching the  match  argument
- * will be added to the list in  entries  argument.
- * If the  entries  list is NULL, it will allocate a new list. Caller
- * is responsible to free it even if an error occurs.
- */
-static int ssh_known_hosts_read_entries(const char *match,
-                                        const char *filename,
-                                        struct ssh_list **entries)
+/* Appends entry to entries unless an equal one is already there, in which
+ * case it is freed */
+static void known_hosts_add_entry(struct ssh_list *entries,
+                                  struct ssh_knownhosts_entry *entry)
+{
+    struct ssh_iterator *it = NULL;
+
+    for (it = ssh_list_get_iterator(entries); it != NULL; it = it->next) {
+        struct ssh_knownhosts_entry *entry2;
+        int cmp;
+        entry2 = ssh_iterator_value(struct ssh_knownhosts_entry *, it);
+        cmp = ssh_known_hosts_entries_compare(entry, entry2);
+        if (cmp == 0) {
+            ssh_knownhosts_entry_free(entry);
+            return;
+        }
+    }
+
+    ssh_list_append(entries, entry);
+}
+
+static void known_hosts_entries_free(struct ssh_list *entries)
+{
+    struct ssh_knownhosts_entry *entry = NULL;
+
+    if (entries == NULL) {
+        return;
+    }
+
+    for (entry = ssh_list_pop_head(struct ssh_knownhosts_entry *, entries);
+         entry != NULL;
+         entry = ssh_list_pop_head(struct ssh_knownhosts_entry *, entries)) {
+        ssh_knownhosts_entry_free(entry);
+    }
+    ssh_list_free(entries);
+}
+
+/* Parses the entries of filename matching match into *entries, without
+ * going through the cache */
+static int known_hosts_parse_file(const char *match,
+                                  const char *filename,
+                                  struct ssh_list **entries)
 {
     char line[MAX_LINE_SIZE];
     size_t lineno = 0;
@@ -246,7 +289,6 @@ static int ssh_known_hosts_read_entries(const char *match,
          rc == 0;
          rc = known_hosts_read_line(fp, line, sizeof(line), &len, &lineno)) {
         struct ssh_knownhosts_entry *entry = NULL;
-        struct ssh_iterator *it = NULL;
         char *p = NULL;
 
         if (line[len] != '\n') {
@@ -277,23 +319,7 @@ static int ssh_known_hosts_read_entries(const char *match,
             goto error;
         }
 
-        /* Check for duplicates */
-        for (it = ssh_list_get_iterator(*entries);
-             it != NULL;
-             it = it->next) {
-            struct ssh_knownhosts_entry *entry2;
-            int cmp;
-            entry2 = ssh_iterator_value(struct ssh_knownhosts_entry *, it);
-            cmp = ssh_known_hosts_entries_compare(entry, entry2);
-            if (cmp == 0) {
-                ssh_knownhosts_entry_free(entry);
-                entry = NULL;
-                break;
-            }
-        }
-        if (entry != NULL) {
-            ssh_list_append(*entries, entry);
-        }
+        known_hosts_add_entry(*entries, entry);
     }
 
     fclose(fp);
@@ -303,6 +329,247 @@ error:
     return SSH_ERROR;
 }
 
+/*
+ * A connect looks the server up in known_hosts several times (algorithm
+ * preference, key check), and a device reconnecting to the same server does
+ * it again each time. The entries parsed for a file and host are kept here
+ * and reused for as long as the file's size and modification time don't
+ * change. Callers own and free what they get, so they get copies.
+ */
+struct known_hosts_cache_slot {
+    uint32_t hash;
+    char *filename;
+    char *match;
+    time_t mtime;
+    off_t size;
+    struct ssh_list *entries;
+    unsigned int used;
+};
+
+static struct known_hosts_cache_slot known_hosts_cache[KNOWN_HOSTS_CACHE_SIZE];
+static unsigned int known_hosts_cache_clock;
+static SSH_MUTEX known_hosts_cache_mutex = SSH_MUTEX_STATIC_INIT;
+
+/* FNV-1a over both keys, so a lookup compares strings only on a hit */
+static uint32_t known_hosts_cache_hash(const char *filename, const char *match)
+{
+    uint32_t h = 2166136261u;
+    const char *p = NULL;
+
+    for (p = filename; *p != '\0'; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+    h = (h ^ '\n') * 16777619u;
+    for (p = match; *p != '\0'; p++) {
+        h = (h ^ (uint8_t)*p) * 16777619u;
+    }
+
+    return h;
+}
+
+static void known_hosts_cache_slot_clear(struct known_hosts_cache_slot *slot)
+{
+    known_hosts_entries_free(slot->entries);
+    SAFE_FREE(slot->filename);
+    SAFE_FREE(slot->match);
+    ZERO_STRUCTP(slot);
+}
+
+static struct ssh_knownhosts_entry *
+known_hosts_entry_dup(const struct ssh_knownhosts_entry *entry)
+{
+    struct ssh_knownhosts_entry *copy = NULL;
+
+    copy = calloc(1, sizeof(struct ssh_knownhosts_entry));
+    if (copy == NULL) {
+        return NULL;
+    }
+
+    copy->hostname = strdup(entry->hostname);
+    copy->unparsed = strdup(entry->unparsed);
+    copy->publickey = ssh_key_dup(entry->publickey);
+    if (copy->hostname == NULL ||
+        copy->unparsed == NULL ||
+        copy->publickey == NULL) {
+        ssh_knownhosts_entry_free(copy);
+        return NULL;
+    }
+    if (entry->comment != NULL) {
+        copy->comment = strdup(entry->comment);
+        if (copy->comment == NULL) {
+            ssh_knownhosts_entry_free(copy);
+            return NULL;
+        }
+    }
+
+    return copy;
+}
+
+static int known_hosts_entries_copy(struct ssh_list *src,
+                                    struct ssh_list **entries)
+{
+    struct ssh_iterator *it = NULL;
+
+    if (*entries == NULL) {
+        *entries = ssh_list_new();
+        if (*entries == NULL) {
+            return SSH_ERROR;
+        }
+    }
+
+    for (it = ssh_list_get_iterator(src); it != NULL; it = it->next) {
+        struct ssh_knownhosts_entry *entry = NULL;
+
+        entry = known_hosts_entry_dup(
+            ssh_iterator_value(struct ssh_knownhosts_entry *, it));
+        if (entry == NULL) {
+            return SSH_ERROR;
+        }
+        known_hosts_add_entry(*entries, entry);
+    }
+
+    return SSH_OK;
+}
+
+/* Called with the cache mutex held */
+static struct known_hosts_cache_slot *
+known_hosts_cache_lookup(uint32_t hash, const char *filename, const char *match)
+{
+    size_t i;
+
+    for (i = 0; i < KNOWN_HOSTS_CACHE_SIZE; i++) {
+        struct known_hosts_cache_slot *slot = &known_hosts_cache[i];
+
+        if (slot->filename != NULL &&
+            slot->hash == hash &&
+            strcmp(slot->filename, filename) == 0 &&
+            strcmp(slot->match, match) == 0) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/* Called with the cache mutex held, returns an emptied slot */
+static struct known_hosts_cache_slot *known_hosts_cache_victim(void)
+{
+    struct known_hosts_cache_slot *victim = &known_hosts_cache[0];
+    size_t i;
+
+    for (i = 0; i < KNOWN_HOSTS_CACHE_SIZE; i++) {
+        struct known_hosts_cache_slot *slot = &known_hosts_cache[i];
+
+        if (slot->filename == NULL) {
+            return slot;
+        }
+        if (slot->used < victim->used) {
+            victim = slot;
+        }
+    }
+    known_hosts_cache_slot_clear(victim);
+
+    return victim;
+}
+
+/* Drops the cached entries of filename, or of every file if it is NULL */
+static void known_hosts_cache_invalidate(const char *filename)
+{
+    size_t i;
+
+    ssh_mutex_lock(&known_hosts_cache_mutex);
+    for (i = 0; i < KNOWN_HOSTS_CACHE_SIZE; i++) {
+        struct known_hosts_cache_slot *slot = &known_hosts_cache[i];
+
+        if (slot->filename == NULL) {
+            continue;
+        }
+        if (filename == NULL || strcmp(slot->filename, filename) == 0) {
+            known_hosts_cache_slot_clear(slot);
+        }
+    }
+    ssh_mutex_unlock(&known_hosts_cache_mutex);
+}
+
+void ssh_known_hosts_cache_flush(void)
+{
+    known_hosts_cache_invalidate(NULL);
+}
+
+/* This method reads the known_hosts file referenced by the path
+ * in  filename  argument, and entries matching the  match  argument
+ * will be added to the list in  entries  argument.
+ * If the  entries  list is NULL, it will allocate a new list. Caller
+ * is responsible to free it even if an error occurs.
+ */
+static int ssh_known_hosts_read_entries(const char *match,
+                                        const char *filename,
+                                        struct ssh_list **entries)
+{
+    struct known_hosts_cache_slot *slot = NULL;
+    struct ssh_list *parsed = NULL;
+    struct stat sb;
+    uint32_t hash;
+    int rc;
+
+    rc = stat(filename, &sb);
+    if (rc != 0) {
+        /* Let the parser report the missing file */
+        return known_hosts_parse_file(match, filename, entries);
+    }
+
+    hash = known_hosts_cache_hash(filename, match);
+
+    ssh_mutex_lock(&known_hosts_cache_mutex);
+    slot = known_hosts_cache_lookup(hash, filename, match);
+    if (slot != NULL) {
+        if (slot->mtime == sb.st_mtime && slot->size == sb.st_size) {
+            slot->used = ++known_hosts_cache_clock;
+            rc = known_hosts_entries_copy(slot->entries, entries);
+            ssh_mutex_unlock(&known_hosts_cache_mutex);
+            return rc;
+        }
+        known_hosts_cache_slot_clear(slot);
+    }
+    ssh_mutex_unlock(&known_hosts_cache_mutex);
+
+    rc = known_hosts_parse_file(match, filename, &parsed);
+    if (rc != SSH_OK || parsed == NULL) {
+        known_hosts_entries_free(parsed);
+        return rc;
+    }
+
+    rc = known_hosts_entries_copy(parsed, entries);
+    if (rc != SSH_OK) {
+        known_hosts_entries_free(parsed);
+        return rc;
+    }
+
+    ssh_mutex_lock(&known_hosts_cache_mutex);
+    /* another thread may have filled it in the meantime */
+    slot = known_hosts_cache_lookup(hash, filename, match);
+    if (slot != NULL) {
+        known_hosts_cache_slot_clear(slot);
+    } else {
+        slot = known_hosts_cache_victim();
+    }
+    slot->filename = strdup(filename);
+    slot->match = strdup(match);
+    if (slot->filename == NULL || slot->match == NULL) {
+        known_hosts_cache_slot_clear(slot);
+        known_hosts_entries_free(parsed);
+    } else {
+        slot->hash = hash;
+        slot->mtime = sb.st_mtime;
+        slot->size = sb.st_size;
+        slot->entries = parsed;
+        slot->used = ++known_hosts_cache_clock;
+    }
+    ssh_mutex_unlock(&known_hosts_cache_mutex);
+
+    return SSH_OK;
+}
+
 static char *ssh_session_get_host_port(ssh_session session)
 {
     char *host_port;
@@ -1035,10 +1302,12 @@ int ssh_session_update_known_hosts(ssh_session session)
                       "Couldn't append to known_hosts file %s: %s",
                       session->opts.knownhosts, strerror(errno));
         fclose(fp);
+        known_hosts_cache_invalidate(session->opts.knownhosts);
         return SSH_ERROR;
     }
 
     fclose(fp);
+    known_hosts_cache_invalidate(session->opts.knownhosts);
     return SSH_OK;
 }
 
@@ -27,6 +27,8 @@
 #include "libssh/crypto.h"
 #include "libssh/priv.h"
 #include "libssh/misc.h"
+#include "libssh/crypto_provider.h"
+#include "libssh/threads.h"
 #if defined(MBEDTLS_CHACHA20_C) && defined(MBEDTLS_POLY1305_C)
 #include "libssh/bytearray.h"
 #include "libssh/chacha20-poly1305-common.h"
@@ -40,14 +42,237 @@
 #include <mbedtls/gcm.h>
 #endif /* MBEDTLS_GCM_C */
 
+/*
+ * Random numbers come from one CTR_DRBG per thread, each seeded from the
+ * shared entropy source, so threads sending packets don't serialize on a
+ * single DRBG. Builds without HAVE_PTHREAD have one instance.
+ */
+#ifndef SSH_RANDOM_POOL_SIZE
+#define SSH_RANDOM_POOL_SIZE 256
+#endif
+
+#if defined(MBEDTLS_CTR_DRBG_MAX_REQUEST) && \
+    SSH_RANDOM_POOL_SIZE > MBEDTLS_CTR_DRBG_MAX_REQUEST
+#error "SSH_RANDOM_POOL_SIZE must be filled by a single DRBG request"
+#endif
+
+struct ssh_mbedtls_rng {
+    mbedtls_ctr_drbg_context drbg;
+    int seeded;
+    /* packet padding is served from here, refilled with one DRBG call */
+    unsigned char pool[SSH_RANDOM_POOL_SIZE];
+    size_t pool_left;
+};
+
 static mbedtls_entropy_context ssh_mbedtls_entropy;
-static mbedtls_ctr_drbg_context ssh_mbedtls_ctr_drbg;
+static SSH_MUTEX ssh_mbedtls_entropy_mutex = SSH_MUTEX_STATIC_INIT;
+#if HAVE_PTHREAD
+static pthread_key_t ssh_mbedtls_rng_key;
+#else
+static struct ssh_mbedtls_rng ssh_mbedtls_rng;
+#endif /* HAVE_PTHREAD */
 
 static int libmbedcrypto_initialized = 0;
 
+/* Portable path, serves every primitive the accelerated provider doesn't */
+static struct ssh_crypto_provider_struct ssh_crypto_software = {
+    .name = "mbedtls",
+    .caps = SSH_CRYPTO_CAP_ALL,
+    .hmac_update = mbedtls_md_hmac_update,
+    .hmac_finish = mbedtls_md_hmac_finish,
+    .cipher_update = mbedtls_cipher_update,
+    .cipher_finish = mbedtls_cipher_finish,
+#ifdef MBEDTLS_GCM_C
+    .gcm_crypt_and_tag = mbedtls_gcm_crypt_and_tag,
+    .gcm_auth_decrypt = mbedtls_gcm_auth_decrypt,
+#endif /* MBEDTLS_GCM_C */
+};
+
+static struct ssh_crypto_provider_struct *ssh_crypto_accel = NULL;
+static uint32_t ssh_crypto_enabled_caps = SSH_CRYPTO_CAP_ALL;
+
+void ssh_crypto_provider_register(struct ssh_crypto_provider_struct *provider)
+{
+    ssh_crypto_accel = provider;
+}
+
+void ssh_crypto_provider_set_caps(uint32_t caps)
+{
+    ssh_crypto_enabled_caps = caps;
+}
+
+const struct ssh_crypto_provider_struct *ssh_crypto_provider_get(int accelerated)
+{
+    return accelerated ? ssh_crypto_accel : &ssh_crypto_software;
+}
+
+static struct ssh_crypto_provider_struct *crypto_provider(uint32_t cap)
+{
+    if (cap != 0 && ssh_crypto_accel != NULL &&
+        (ssh_crypto_accel->caps & ssh_crypto_enabled_caps & cap) == cap) {
+        return ssh_crypto_accel;
+    }
+
+    return &ssh_crypto_software;
+}
+
+/* Sessions on different threads update the same provider */
+static void crypto_stats_add(struct ssh_crypto_provider_struct *p,
+                             uint64_t *counter,
+                             uint64_t bytes)
+{
+    __atomic_fetch_add(counter, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&p->stats.bytes, bytes, __ATOMIC_RELAXED);
+}
+
+int ssh_crypto_provider_get_stats(int accelerated,
+                                  struct ssh_crypto_provider_stats *stats)
+{
+    const struct ssh_crypto_provider_struct *p;
+
+    p = ssh_crypto_provider_get(accelerated);
+    if (p == NULL || stats == NULL) {
+        return SSH_ERROR;
+    }
+
+    stats->hmac_packets = __atomic_load_n(&p->stats.hmac_packets,
+                                          __ATOMIC_RELAXED);
+    stats->cipher_calls = __atomic_load_n(&p->stats.cipher_calls,
+                                          __ATOMIC_RELAXED);
+    stats->aead_packets = __atomic_load_n(&p->stats.aead_packets,
+                                          __ATOMIC_RELAXED);
+    stats->bytes = __atomic_load_n(&p->stats.bytes, __ATOMIC_RELAXED);
+
+    return SSH_OK;
+}
+
+static uint32_t md_caps(const mbedtls_md_context_t *ctx)
+{
+    switch (mbedtls_md_get_type(ctx->md_info)) {
+        case MBEDTLS_MD_SHA1:
+            return SSH_CRYPTO_CAP_SHA1;
+        case MBEDTLS_MD_SHA256:
+            return SSH_CRYPTO_CAP_SHA256;
+        case MBEDTLS_MD_SHA512:
+            return SSH_CRYPTO_CAP_SHA512;
+        default:
+            return 0;
+    }
+}
+
+static uint32_t cipher_caps(mbedtls_cipher_type_t type)
+{
+    switch (type) {
+        case MBEDTLS_CIPHER_AES_128_CBC:
+        case MBEDTLS_CIPHER_AES_192_CBC:
+        case MBEDTLS_CIPHER_AES_256_CBC:
+        case MBEDTLS_CIPHER_AES_128_CTR:
+        case MBEDTLS_CIPHER_AES_192_CTR:
+        case MBEDTLS_CIPHER_AES_256_CTR:
+            return SSH_CRYPTO_CAP_AES;
+        default:
+            return 0;
+    }
+}
+
+/* Seeding and prediction resistance both pull from the shared source */
+static int ssh_mbedtls_entropy_func(void *data,
+                                    unsigned char *output,
+                                    size_t len)
+{
+    int rc;
+
+    ssh_mutex_lock(&ssh_mbedtls_entropy_mutex);
+    rc = mbedtls_entropy_func(data, output, len);
+    ssh_mutex_unlock(&ssh_mbedtls_entropy_mutex);
+
+    return rc;
+}
+
+static int ssh_mbedtls_rng_seed(struct ssh_mbedtls_rng *rng)
+{
+    int rc;
+
+    mbedtls_ctr_drbg_init(&rng->drbg);
+
+    /* the address tells the instances apart should the entropy repeat */
+    rc = mbedtls_ctr_drbg_seed(&rng->drbg,
+                               ssh_mbedtls_entropy_func,
+                               &ssh_mbedtls_entropy,
+                               (const unsigned char *)&rng,
+                               sizeof(rng));
+    if (rc != 0) {
+        mbedtls_ctr_drbg_free(&rng->drbg);
+        return SSH_ERROR;
+    }
+
+    rng->seeded = 1;
+    rng->pool_left = 0;
+
+    return SSH_OK;
+}
+
+static void ssh_mbedtls_rng_free(void *data)
+{
+    struct ssh_mbedtls_rng *rng = data;
+
+    if (rng->seeded) {
+        mbedtls_ctr_drbg_free(&rng->drbg);
+    }
+    explicit_bzero(rng->pool, sizeof(rng->pool));
+    rng->pool_left = 0;
+    rng->seeded = 0;
+#if HAVE_PTHREAD
+    free(rng);
+#endif /* HAVE_PTHREAD */
+}
+
+/* The calling thread's instance, seeded on first use */
+static struct ssh_mbedtls_rng *ssh_mbedtls_rng_get(void)
+{
+#if HAVE_PTHREAD
+    struct ssh_mbedtls_rng *rng = NULL;
+    int rc;
+
+    rng = pthread_getspecific(ssh_mbedtls_rng_key);
+    if (rng != NULL) {
+        return rng;
+    }
+
+    rng = calloc(1, sizeof(struct ssh_mbedtls_rng));
+    if (rng == NULL) {
+        return NULL;
+    }
+    rc = ssh_mbedtls_rng_seed(rng);
+    if (rc != SSH_OK) {
+        SAFE_FREE(rng);
+        return NULL;
+    }
+    rc = pthread_setspecific(ssh_mbedtls_rng_key, rng);
+    if (rc != 0) {
+        ssh_mbedtls_rng_free(rng);
+        return NULL;
+    }
+
+    return rng;
+#else
+    if (!ssh_mbedtls_rng.seeded) {
+        return NULL;
+    }
+
+    return &ssh_mbedtls_rng;
+#endif /* HAVE_PTHREAD */
+}
+
 void ssh_reseed(void)
 {
-    mbedtls_ctr_drbg_reseed(&ssh_mbedtls_ctr_drbg, NULL, 0);
+    struct ssh_mbedtls_rng *rng = ssh_mbedtls_rng_get();
+
+    if (rng == NULL) {
+        return;
+    }
+    mbedtls_ctr_drbg_reseed(&rng->drbg, NULL, 0);
+    rng->pool_left = 0;
 }
 
 int ssh_get_random(void *where, int len, int strong)
@@ -449,13 +674,24 @@ error:
 
 void hmac_update(HMACCTX c, const void *data, unsigned long len)
 {
-    mbedtls_md_hmac_update(c, data, len);
+    struct ssh_crypto_provider_struct *p = crypto_provider(md_caps(c));
+
+    p->hmac_update(c, data, len);
+}
+
+void ssh_crypto_provider_count_hmac(HMACCTX c, size_t len)
+{
+    struct ssh_crypto_provider_struct *p = crypto_provider(md_caps(c));
+
+    crypto_stats_add(p, &p->stats.hmac_packets, len);
 }
 
 void hmac_final(HMACCTX c, unsigned char *hashmacbuf, unsigned int *len)
 {
+    struct ssh_crypto_provider_struct *p = crypto_provider(md_caps(c));
+
     *len = mbedtls_md_get_size(c->md_info);
-    mbedtls_md_hmac_finish(c, hashmacbuf);
+    p->hmac_finish(c, hashmacbuf);
     mbedtls_md_free(c);
     SAFE_FREE(c);
 }
@@ -660,10 +896,12 @@ static void cipher_encrypt(struct ssh_cipher_struct *cipher,
                            void *out,
                            size_t len)
 {
+    struct ssh_crypto_provider_struct *p = crypto_provider(cipher_caps(cipher->type));
     size_t outlen = 0;
     size_t total_len = 0;
     int rc = 0;
-    rc = mbedtls_cipher_update(&cipher->encrypt_ctx, in, len, out, &outlen);
+    crypto_stats_add(p, &p->stats.cipher_calls, len);
+    rc = p->cipher_update(&cipher->encrypt_ctx, in, len, out, &outlen);
     if (rc != 0) {
         SSH_LOG(SSH_LOG_WARNING, "mbedtls_cipher_update failed during encryption");
         return;
@@ -675,7 +913,7 @@ static void cipher_encrypt(struct ssh_cipher_struct *cipher,
         return;
     }
 
-    rc = mbedtls_cipher_finish(&cipher->encrypt_ctx, (unsigned char *) out + outlen,
+    rc = p->cipher_finish(&cipher->encrypt_ctx, (unsigned char *) out + outlen,
             &outlen);
 
     total_len += outlen;
@@ -701,9 +939,11 @@ static void cipher_encrypt(struct ssh_cipher_struct *cipher,
 static void cipher_encrypt_cbc(struct ssh_cipher_struct *cipher, void *in, void *out,
         size_t len)
 {
+    struct ssh_crypto_provider_struct *p = crypto_provider(cipher_caps(cipher->type));
     size_t outlen = 0;
     int rc = 0;
-    rc = mbedtls_cipher_update(&cipher->encrypt_ctx, in, len, out, &outlen);
+    crypto_stats_add(p, &p->stats.cipher_calls, len);
+    rc = p->cipher_update(&cipher->encrypt_ctx, in, len, out, &outlen);
     if (rc != 0) {
         SSH_LOG(SSH_LOG_WARNING, "mbedtls_cipher_update failed during encryption");
         return;
@@ -727,11 +967,13 @@ static void cipher_decrypt(struct ssh_cipher_struct *cipher,
                            void *out,
                            size_t len)
 {
+    struct ssh_crypto_provider_struct *p = crypto_provider(cipher_caps(cipher->type));
     size_t outlen = 0;
     int rc = 0;
     size_t total_len = 0;
 
-    rc = mbedtls_cipher_update(&cipher->decrypt_ctx, in, len, out, &outlen);
+    crypto_stats_add(p, &p->stats.cipher_calls, len);
+    rc = p->cipher_update(&cipher->decrypt_ctx, in, len, out, &outlen);
     if (rc != 0) {
         SSH_LOG(SSH_LOG_WARNING, "mbedtls_cipher_update failed during decryption");
         return;
@@ -743,7 +985,7 @@ static void cipher_decrypt(struct ssh_cipher_struct *cipher,
         return;
     }
 
-    rc = mbedtls_cipher_finish(&cipher->decrypt_ctx, (unsigned char *) out +
+    rc = p->cipher_finish(&cipher->decrypt_ctx, (unsigned char *) out +
             outlen, &outlen);
 
     if (rc != 0) {
@@ -769,9 +1011,11 @@ static void cipher_decrypt(struct ssh_cipher_struct *cipher,
 static void cipher_decrypt_cbc(struct ssh_cipher_struct *cipher, void *in, void *out,
         size_t len)
 {
+    struct ssh_crypto_provider_struct *p = crypto_provider(cipher_caps(cipher->type));
     size_t outlen = 0;
     int rc = 0;
-    rc = mbedtls_cipher_update(&cipher->decrypt_ctx, in, len, out, &outlen);
+    crypto_stats_add(p, &p->stats.cipher_calls, len);
+    rc = p->cipher_update(&cipher->decrypt_ctx, in, len, out, &outlen);
     if (rc != 0) {
         SSH_LOG(SSH_LOG_WARNING, "mbedtls_cipher_update failed during decryption");
         return;
@@ -783,11 +1027,11 @@ static void cipher_decrypt_cbc(struct ssh_cipher_struct *cipher, void *in, void
      * Calling mbedtls_cipher_reset resets the unprocessed data counter.
      */
     if (outlen == 0) {
-        rc = mbedtls_cipher_finish(&cipher->decrypt_ctx, out, &outlen);
+        rc = p->cipher_finish(&cipher->decrypt_ctx, out, &outlen);
     } else if (outlen == len) {
         return;
     } else {
-        rc = mbedtls_cipher_finish(&cipher->decrypt_ctx, (unsigned char *) out +
+        rc = p->cipher_finish(&cipher->decrypt_ctx, (unsigned char *) out +
                 outlen , &outlen);
     }
 
@@ -841,6 +1085,7 @@ cipher_encrypt_gcm(struct ssh_cipher_struct *cipher,
                    uint8_t *tag,
                    uint64_t seq)
 {
+    struct ssh_crypto_provider_struct *p = crypto_provider(SSH_CRYPTO_CAP_AES_GCM);
     size_t authlen, aadlen;
     int rc;
 
@@ -849,9 +1094,11 @@ cipher_encrypt_gcm(struct ssh_cipher_struct *cipher,
     aadlen = cipher->lenfield_blocksize;
     authlen = cipher->tag_size;
 
+    crypto_stats_add(p, &p->stats.aead_packets, len - aadlen);
+
     /* The length is not encrypted */
     memcpy(out, in, aadlen);
-    rc = mbedtls_gcm_crypt_and_tag(&cipher->gcm_ctx,
+    rc = p->gcm_crypt_and_tag(&cipher->gcm_ctx,
                                    MBEDTLS_GCM_ENCRYPT,
                                    len - aadlen, /* encrypted data len */
                                    cipher->last_iv, /* IV */
@@ -878,6 +1125,7 @@ cipher_decrypt_gcm(struct ssh_cipher_struct *cipher,
                    size_t encrypted_size,
                    uint64_t seq)
 {
+    struct ssh_crypto_provider_struct *p = crypto_provider(SSH_CRYPTO_CAP_AES_GCM);
     size_t authlen, aadlen;
     int rc;
 
@@ -886,7 +1134,9 @@ cipher_decrypt_gcm(struct ssh_cipher_struct *cipher,
     aadlen = cipher->lenfield_blocksize;
     authlen = cipher->tag_size;
 
-    rc = mbedtls_gcm_auth_decrypt(&cipher->gcm_ctx,
+    crypto_stats_add(p, &p->stats.aead_packets, encrypted_size);
+
+    rc = p->gcm_auth_decrypt(&cipher->gcm_ctx,
                                   encrypted_size, /* encrypted data len */
                                   cipher->last_iv, /* IV */
                                   AES_GCM_IVLEN,
@@ -1416,35 +1666,27 @@ struct ssh_cipher_struct *ssh_get_ciphertab(void)
 
 int ssh_crypto_init(void)
 {
-    UNUSED_VAR(size_t i);
+#if HAVE_PTHREAD
     int rc;
+#endif /* HAVE_PTHREAD */
 
     if (libmbedcrypto_initialized) {
         return SSH_OK;
     }
 
     mbedtls_entropy_init(&ssh_mbedtls_entropy);
-    mbedtls_ctr_drbg_init(&ssh_mbedtls_ctr_drbg);
 
-    rc = mbedtls_ctr_drbg_seed(&ssh_mbedtls_ctr_drbg, mbedtls_entropy_func,
-            &ssh_mbedtls_entropy, NULL, 0);
+#if HAVE_PTHREAD
+    rc = pthread_key_create(&ssh_mbedtls_rng_key, ssh_mbedtls_rng_free);
     if (rc != 0) {
-        mbedtls_ctr_drbg_free(&ssh_mbedtls_ctr_drbg);
-    }
-
-#if (defined(MBEDTLS_CHACHA20_C) && defined(MBEDTLS_POLY1305_C))
-    for (i = 0; ssh_ciphertab[i].name != NULL; i++) {
-        int cmp;
-
-        cmp = strcmp(ssh_ciphertab[i].name, "chacha20-poly1305@openssh.com");
-        if (cmp == 0) {
-            memcpy(&ssh_ciphertab[i],
-                   ssh_get_chacha20poly1305_cipher(),
-                   sizeof(struct ssh_cipher_struct));
-            break;
-        }
+        mbedtls_entropy_free(&ssh_mbedtls_entropy);
+        return SSH_ERROR;
     }
-#endif
+    /* other threads seed their own instance on first use */
+    ssh_mbedtls_rng_get();
+#else
+    ssh_mbedtls_rng_seed(&ssh_mbedtls_rng);
+#endif /* HAVE_PTHREAD */
 
     libmbedcrypto_initialized = 1;
 
@@ -1453,32 +1695,101 @@ int ssh_crypto_init(void)
 
 int ssh_mbedtls_random(void *where, int len, int strong)
 {
+    struct ssh_mbedtls_rng *rng = ssh_mbedtls_rng_get();
     int rc = 0;
+
+    if (rng == NULL) {
+        return 0;
+    }
+
     if (strong) {
-        mbedtls_ctr_drbg_set_prediction_resistance(&ssh_mbedtls_ctr_drbg,
+        mbedtls_ctr_drbg_set_prediction_resistance(&rng->drbg,
                 MBEDTLS_CTR_DRBG_PR_ON);
-        rc = mbedtls_ctr_drbg_random(&ssh_mbedtls_ctr_drbg, where, len);
-        mbedtls_ctr_drbg_set_prediction_resistance(&ssh_mbedtls_ctr_drbg,
+        rc = mbedtls_ctr_drbg_random(&rng->drbg, where, len);
+        mbedtls_ctr_drbg_set_prediction_resistance(&rng->drbg,
                 MBEDTLS_CTR_DRBG_PR_OFF);
     } else {
-        rc = mbedtls_ctr_drbg_random(&ssh_mbedtls_ctr_drbg, where, len);
+        rc = mbedtls_ctr_drbg_random(&rng->drbg, where, len);
     }
 
     return !rc;
 }
 
+/*
+ * Packet padding asks for a few bytes per packet. Drawing them from a pool
+ * refilled by one large request saves the fixed cost of a DRBG call (an
+ * update of its state) on nearly every packet. Nothing else uses the pool,
+ * so key material never comes from bytes generated ahead of time.
+ */
+int ssh_get_random_padding(void *where, int len)
+{
+    struct ssh_mbedtls_rng *rng = ssh_mbedtls_rng_get();
+    unsigned char *out = where;
+    size_t n;
+    int rc;
+
+    if (rng == NULL || len < 0) {
+        return 0;
+    }
+
+    if ((size_t)len > sizeof(rng->pool)) {
+        return ssh_mbedtls_random(where, len, 0);
+    }
+
+    while (len > 0) {
+        if (rng->pool_left == 0) {
+            rc = mbedtls_ctr_drbg_random(&rng->drbg,
+                                         rng->pool,
+                                         sizeof(rng->pool));
+            if (rc != 0) {
+                return 0;
+            }
+            rng->pool_left = sizeof(rng->pool);
+        }
+
+        n = MIN((size_t)len, rng->pool_left);
+        memcpy(out, rng->pool + sizeof(rng->pool) - rng->pool_left, n);
+        rng->pool_left -= n;
+        out += n;
+        len -= n;
+    }
+
+    return 1;
+}
+
+/* Instance of the calling thread, for the mbedTLS functions taking f_rng */
 mbedtls_ctr_drbg_context *ssh_get_mbedtls_ctr_drbg_context(void)
 {
-    return &ssh_mbedtls_ctr_drbg;
+    struct ssh_mbedtls_rng *rng = ssh_mbedtls_rng_get();
+
+    if (rng == NULL) {
+        return NULL;
+    }
+
+    return &rng->drbg;
 }
 
 void ssh_crypto_finalize(void)
 {
+#if HAVE_PTHREAD
+    struct ssh_mbedtls_rng *rng = NULL;
+#endif /* HAVE_PTHREAD */
+
     if (!libmbedcrypto_initialized) {
         return;
     }
 
-    mbedtls_ctr_drbg_free(&ssh_mbedtls_ctr_drbg);
+#if HAVE_PTHREAD
+    /* instances of threads that already exited were freed with them */
+    rng = pthread_getspecific(ssh_mbedtls_rng_key);
+    if (rng != NULL) {
+        pthread_setspecific(ssh_mbedtls_rng_key, NULL);
+        ssh_mbedtls_rng_free(rng);
+    }
+    pthread_key_delete(ssh_mbedtls_rng_key);
+#else
+    ssh_mbedtls_rng_free(&ssh_mbedtls_rng);
+#endif /* HAVE_PTHREAD */
     mbedtls_entropy_free(&ssh_mbedtls_entropy);
 
     libmbedcrypto_initialized = 0;
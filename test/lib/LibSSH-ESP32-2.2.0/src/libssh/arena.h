@@ -0,0 +1,95 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * arena.h - per session bump allocator for the temporaries parsed out of an
+ * incoming packet.
+ */
+
+#ifndef ARENA_H_
+#define ARENA_H_
+
+#include "libssh_esp32_config.h"
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "libssh/libssh.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+struct ssh_arena_stats {
+    /* allocations served from the arena block */
+    uint64_t allocs;
+    /* allocations that did not fit and went to the heap, not in allocs */
+    uint64_t overflows;
+    /* times the arena was emptied, about once per processed packet */
+    uint64_t resets;
+    /* current size of the arena block */
+    size_t size;
+    /* most bytes a single packet asked for */
+    size_t peak;
+};
+
+struct ssh_arena_block;
+
+/*
+ * Everything allocated from the arena is released at once by
+ * ssh_arena_reset(), which ssh_packet_process() calls when the handlers of a
+ * packet are done. The heap sees one long lived block instead of a
+ * malloc/free pair per string.
+ */
+struct ssh_arena_struct {
+    uint8_t *data;
+    size_t size;
+    size_t used;
+    /* heap allocations made while the arena was full */
+    struct ssh_arena_block *overflow;
+    /* bytes asked for since the last reset, overflows included */
+    size_t demand;
+    /* wipe the contents on reset */
+    int secure;
+    /* nested ssh_packet_process() calls, only the outermost one resets */
+    int depth;
+    struct ssh_arena_stats stats;
+};
+
+void ssh_arena_init(struct ssh_arena_struct *arena);
+void *ssh_arena_alloc(struct ssh_arena_struct *arena, size_t len);
+void ssh_arena_set_secure(struct ssh_arena_struct *arena);
+void ssh_arena_reset(struct ssh_arena_struct *arena);
+void ssh_arena_free(struct ssh_arena_struct *arena);
+
+/*
+ * Like ssh_buffer_get_ssh_string() but the string lives in the arena. It must
+ * not be passed to ssh_string_free(), it goes away on the next reset.
+ */
+ssh_string ssh_arena_get_ssh_string(struct ssh_arena_struct *arena,
+                                    ssh_buffer buffer);
+
+LIBSSH_API int ssh_get_packet_arena_stats(ssh_session session,
+                                          struct ssh_arena_stats *stats);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ARENA_H_ */
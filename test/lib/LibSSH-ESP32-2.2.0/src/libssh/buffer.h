@@ -22,8 +22,11 @@
 #define BUFFER_H_
 
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 
 #include "libssh/libssh.h"
+#include "libssh/bytearray.h"
 
 #define SSH_BUFFER_PACK_END ((uint32_t) 0x4f65feb3)
 
@@ -59,7 +62,97 @@ int _ssh_buffer_unpack(struct ssh_buffer_struct *buffer,
 #define ssh_buffer_unpack(buffer, format, ...) \
     _ssh_buffer_unpack((buffer), (format), __VA_NARG__(__VA_ARGS__), __VA_ARGS__, SSH_BUFFER_PACK_END)
 
+/*
+ * Specialized packers for the fixed formats sent on every channel packet.
+ * They behave like ssh_buffer_pack() with the format in their name, but the
+ * size is known up front so the message is reserved once and written in
+ * place, without interpreting a format string or checking capacity per
+ * field.
+ */
+static inline int ssh_buffer_pack_bd(ssh_buffer buffer,
+                                     uint8_t b,
+                                     uint32_t d)
+{
+    uint8_t *p = ssh_buffer_allocate(buffer, 1 + 4);
+
+    if (p == NULL) {
+        return SSH_ERROR;
+    }
+    PUSH_BE_U8(p, 0, b);
+    PUSH_BE_U32(p, 1, d);
+
+    return SSH_OK;
+}
+
+static inline int ssh_buffer_pack_bdd(ssh_buffer buffer,
+                                      uint8_t b,
+                                      uint32_t d1,
+                                      uint32_t d2)
+{
+    uint8_t *p = ssh_buffer_allocate(buffer, 1 + 4 + 4);
+
+    if (p == NULL) {
+        return SSH_ERROR;
+    }
+    PUSH_BE_U8(p, 0, b);
+    PUSH_BE_U32(p, 1, d1);
+    PUSH_BE_U32(p, 5, d2);
+
+    return SSH_OK;
+}
+
+static inline int ssh_buffer_pack_bddP(ssh_buffer buffer,
+                                       uint8_t b,
+                                       uint32_t d1,
+                                       uint32_t d2,
+                                       uint32_t len,
+                                       const void *data)
+{
+    uint8_t *p = NULL;
+
+    if (len > UINT32_MAX - (1 + 4 + 4)) {
+        return SSH_ERROR;
+    }
+    p = ssh_buffer_allocate(buffer, 1 + 4 + 4 + len);
+    if (p == NULL) {
+        return SSH_ERROR;
+    }
+    PUSH_BE_U8(p, 0, b);
+    PUSH_BE_U32(p, 1, d1);
+    PUSH_BE_U32(p, 5, d2);
+    memcpy(p + 9, data, len);
+
+    return SSH_OK;
+}
+
+static inline int ssh_buffer_pack_bdddP(ssh_buffer buffer,
+                                        uint8_t b,
+                                        uint32_t d1,
+                                        uint32_t d2,
+                                        uint32_t d3,
+                                        uint32_t len,
+                                        const void *data)
+{
+    uint8_t *p = NULL;
+
+    if (len > UINT32_MAX - (1 + 4 + 4 + 4)) {
+        return SSH_ERROR;
+    }
+    p = ssh_buffer_allocate(buffer, 1 + 4 + 4 + 4 + len);
+    if (p == NULL) {
+        return SSH_ERROR;
+    }
+    PUSH_BE_U8(p, 0, b);
+    PUSH_BE_U32(p, 1, d1);
+    PUSH_BE_U32(p, 5, d2);
+    PUSH_BE_U32(p, 9, d3);
+    memcpy(p + 13, data, len);
+
+    return SSH_OK;
+}
+
 int ssh_buffer_prepend_data(ssh_buffer buffer, const void *data, uint32_t len);
+int ssh_buffer_reserve_head(ssh_buffer buffer, uint32_t len);
 int ssh_buffer_add_buffer(ssh_buffer buffer, ssh_buffer source);
 
 /* buffer_read_*() returns the number of bytes read, except for ssh strings */
@@ -67,6 +160,19 @@ int ssh_buffer_get_u8(ssh_buffer buffer, uint8_t *data);
 int ssh_buffer_get_u32(ssh_buffer buffer, uint32_t *data);
 int ssh_buffer_get_u64(ssh_buffer buffer, uint64_t *data);
 
+/* Same as ssh_buffer_unpack(buffer, "d", data) */
+static inline int ssh_buffer_unpack_d(ssh_buffer buffer, uint32_t *data)
+{
+    uint8_t raw[4];
+
+    if (ssh_buffer_get_data(buffer, raw, sizeof(raw)) != sizeof(raw)) {
+        return SSH_ERROR;
+    }
+    *data = PULL_BE_U32(raw, 0);
+
+    return SSH_OK;
+}
+
 /* ssh_buffer_get_ssh_string() is an exception. if the String read is too large or invalid, it will answer NULL. */
 ssh_string ssh_buffer_get_ssh_string(ssh_buffer buffer);
 
@@ -79,6 +79,8 @@ struct ssh_channel_struct {
     int exit_status;
     enum ssh_channel_request_state_e request_state;
     struct ssh_list *callbacks; /* list of ssh_channel_callbacks */
+    /* next channel in the same session->channel_index bucket */
+    struct ssh_channel_struct *index_next;
 
     /* counters */
     ssh_counter counter;
@@ -102,6 +104,7 @@ int channel_default_bufferize(ssh_channel channel,
                               bool is_stderr);
 int ssh_channel_flush(ssh_channel channel);
 uint32_t ssh_channel_new_id(ssh_session session);
+int ssh_channel_index_add(ssh_channel channel);
 ssh_channel ssh_channel_from_local(ssh_session session, uint32_t id);
 void ssh_channel_do_free(ssh_channel channel);
 int ssh_global_request(ssh_session session,
@@ -124,6 +124,8 @@ struct ssh_crypto_struct {
     ssh_curve25519_privkey curve25519_privkey;
     ssh_curve25519_pubkey curve25519_client_pubkey;
     ssh_curve25519_pubkey curve25519_server_pubkey;
+    /* our keypair was made ahead, see ssh_curve25519_precompute() */
+    bool curve25519_ready;
 #endif
     ssh_string dh_server_signature; /* information used by dh_handshake. */
     size_t session_id_len;
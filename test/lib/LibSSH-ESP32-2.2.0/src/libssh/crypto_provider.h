@@ -0,0 +1,151 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * crypto_provider.h - dispatch of the per packet primitives (HMAC, block
+ * cipher, AES-GCM) between an accelerated provider and the portable mbedTLS
+ * software path.
+ */
+
+#ifndef CRYPTO_PROVIDER_H_
+#define CRYPTO_PROVIDER_H_
+
+#include "libssh_esp32_config.h"
+
+#ifdef HAVE_LIBMBEDCRYPTO
+
+#include <stdint.h>
+#include <mbedtls/md.h>
+#include <mbedtls/cipher.h>
+#ifdef MBEDTLS_GCM_C
+#include <mbedtls/gcm.h>
+#endif /* MBEDTLS_GCM_C */
+
+#include "libssh/libssh.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Capability flags, one per primitive a provider may accelerate */
+#define SSH_CRYPTO_CAP_SHA1     (1u << 0)
+#define SSH_CRYPTO_CAP_SHA256   (1u << 1)
+#define SSH_CRYPTO_CAP_SHA512   (1u << 2)
+#define SSH_CRYPTO_CAP_AES      (1u << 3)
+#define SSH_CRYPTO_CAP_AES_GCM  (1u << 4)
+#define SSH_CRYPTO_CAP_ALL      0x1fu
+
+/*
+ * Updated atomically by every session, read them with
+ * ssh_crypto_provider_get_stats()
+ */
+struct ssh_crypto_provider_stats {
+    /* packets MACed with a standalone HMAC, other HMACs aren't counted */
+    uint64_t hmac_packets;
+    /* cipher_update calls, one or two per packet */
+    uint64_t cipher_calls;
+    /* packets sealed or opened with AES-GCM */
+    uint64_t aead_packets;
+    /* payload bytes run through any of the above */
+    uint64_t bytes;
+};
+
+/*
+ * The operations have the same contract as the mbedTLS functions they
+ * replace, so the software provider is mbedTLS itself and an accelerated
+ * provider works on the same contexts libssh already sets up.
+ */
+struct ssh_crypto_provider_struct {
+    const char *name;
+    /* SSH_CRYPTO_CAP_* flags served by this provider, may be set at runtime */
+    uint32_t caps;
+
+    int (*hmac_update)(mbedtls_md_context_t *ctx,
+                       const unsigned char *input,
+                       size_t ilen);
+    int (*hmac_finish)(mbedtls_md_context_t *ctx, unsigned char *output);
+
+    int (*cipher_update)(mbedtls_cipher_context_t *ctx,
+                         const unsigned char *input,
+                         size_t ilen,
+                         unsigned char *output,
+                         size_t *olen);
+    int (*cipher_finish)(mbedtls_cipher_context_t *ctx,
+                         unsigned char *output,
+                         size_t *olen);
+
+#ifdef MBEDTLS_GCM_C
+    int (*gcm_crypt_and_tag)(mbedtls_gcm_context *ctx,
+                             int mode,
+                             size_t length,
+                             const unsigned char *iv,
+                             size_t iv_len,
+                             const unsigned char *add,
+                             size_t add_len,
+                             const unsigned char *input,
+                             unsigned char *output,
+                             size_t tag_len,
+                             unsigned char *tag);
+    int (*gcm_auth_decrypt)(mbedtls_gcm_context *ctx,
+                            size_t length,
+                            const unsigned char *iv,
+                            size_t iv_len,
+                            const unsigned char *add,
+                            size_t add_len,
+                            const unsigned char *tag,
+                            size_t tag_len,
+                            const unsigned char *input,
+                            unsigned char *output);
+#endif /* MBEDTLS_GCM_C */
+
+    struct ssh_crypto_provider_stats stats;
+};
+
+/*
+ * Installs the accelerated provider. Primitives it doesn't list in caps keep
+ * going to the software provider. Passing NULL removes it. Must not be
+ * called while sessions are exchanging packets.
+ *
+ * None is installed by default. On ESP32 the software provider already runs
+ * on the AES and SHA peripherals when sdkconfig enables them, the ESP-IDF
+ * mbedTLS port drives them from behind the mbedTLS entry points.
+ */
+LIBSSH_API void
+ssh_crypto_provider_register(struct ssh_crypto_provider_struct *provider);
+
+/* Restricts which capabilities may be dispatched to the accelerated provider */
+LIBSSH_API void ssh_crypto_provider_set_caps(uint32_t caps);
+
+LIBSSH_API const struct ssh_crypto_provider_struct *
+ssh_crypto_provider_get(int accelerated);
+
+/* Copies the counters of a provider, SSH_ERROR if none is installed */
+LIBSSH_API int
+ssh_crypto_provider_get_stats(int accelerated,
+                              struct ssh_crypto_provider_stats *stats);
+
+/* Counts one packet MAC of len payload bytes, before hmac_final() */
+void ssh_crypto_provider_count_hmac(mbedtls_md_context_t *ctx, size_t len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* HAVE_LIBMBEDCRYPTO */
+#endif /* CRYPTO_PROVIDER_H_ */
@@ -35,6 +35,7 @@ SSH_PACKET_CALLBACK(ssh_packet_kexinit);
 
 int ssh_send_kex(ssh_session session, int server_kex);
 void ssh_list_kex(struct ssh_kex_struct *kex);
+void ssh_kex_registry_init(void);
 int ssh_set_client_kex(ssh_session session);
 int ssh_kex_select_methods(ssh_session session);
 int ssh_verify_existing_algo(enum ssh_kex_types_e algo, const char *name);
@@ -29,4 +29,6 @@ ssh_session_get_known_hosts_entry_file(ssh_session session,
                                        const char *filename,
                                        struct ssh_knownhosts_entry **pentry);
 
+void ssh_known_hosts_cache_flush(void);
+
 #endif /* SSH_KNOWNHOSTS_H_ */
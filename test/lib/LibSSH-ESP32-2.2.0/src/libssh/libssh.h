@@ -101,6 +101,17 @@ struct ssh_counter_struct {
 };
 typedef struct ssh_counter_struct *ssh_counter;
 
+struct ssh_rekey_stats {
+    /* key re-exchanges done after authentication */
+    uint32_t rekeys;
+    /* milliseconds outgoing packets were delayed by the last rekey */
+    uint32_t stall_last;
+    /* longest such delay */
+    uint32_t stall_max;
+    /* all such delays */
+    uint64_t stall_total;
+};
+
 typedef struct ssh_agent_struct* ssh_agent;
 typedef struct ssh_buffer_struct* ssh_buffer;
 typedef struct ssh_channel_struct* ssh_channel;
@@ -408,6 +419,7 @@ enum ssh_options_e {
   SSH_OPTIONS_PROCESS_CONFIG,
   SSH_OPTIONS_REKEY_DATA,
   SSH_OPTIONS_REKEY_TIME,
+  SSH_OPTIONS_CHANNEL_WINDOW,
 };
 
 enum {
@@ -530,6 +542,8 @@ LIBSSH_API socket_t ssh_get_fd(ssh_session session);
 LIBSSH_API char *ssh_get_hexa(const unsigned char *what, size_t len);
 LIBSSH_API char *ssh_get_issue_banner(ssh_session session);
 LIBSSH_API int ssh_get_openssh_version(ssh_session session);
+LIBSSH_API int ssh_get_rekey_stats(ssh_session session,
+                                   struct ssh_rekey_stats *stats);
 
 LIBSSH_API int ssh_get_server_publickey(ssh_session session, ssh_key *key);
 
@@ -591,6 +605,8 @@ LIBSSH_API int ssh_set_log_level(int level);
 LIBSSH_API int ssh_get_log_level(void);
 LIBSSH_API void *ssh_get_log_userdata(void);
 LIBSSH_API int ssh_set_log_userdata(void *data);
+LIBSSH_API int ssh_set_log_buffer(void *buf, size_t size);
+LIBSSH_API size_t ssh_log_buffer_read(char *buf, size_t len);
 LIBSSH_API void ssh_vlog(int verbosity,
                          const char *function,
                          const char *format,
@@ -625,6 +641,7 @@ LIBSSH_API int ssh_options_get(ssh_session session, enum ssh_options_e type,
     char **value);
 LIBSSH_API int ssh_options_get_port(ssh_session session, unsigned int * port_target);
 LIBSSH_API int ssh_pcap_file_close(ssh_pcap_file pcap);
+LIBSSH_API int ssh_pcap_file_flush(ssh_pcap_file pcap);
 LIBSSH_API void ssh_pcap_file_free(ssh_pcap_file pcap);
 LIBSSH_API ssh_pcap_file ssh_pcap_file_new(void);
 LIBSSH_API int ssh_pcap_file_open(ssh_pcap_file pcap, const char *filename);
@@ -688,6 +705,21 @@ LIBSSH_API int ssh_pki_export_privkey_file(const ssh_key privkey,
                                            ssh_auth_callback auth_fn,
                                            void *auth_data,
                                            const char *filename);
+LIBSSH_API int ssh_pki_import_privkey_file_cached(const char *filename,
+                                                  const char *passphrase,
+                                                  ssh_auth_callback auth_fn,
+                                                  void *auth_data,
+                                                  ssh_key *pkey);
+LIBSSH_API void ssh_pki_key_cache_flush(void);
+
+/* private seed followed by the public key */
+#define SSH_PKI_ED25519_RAW_LEN 64
+LIBSSH_API int ssh_pki_import_privkey_ed25519_raw(const unsigned char *raw,
+                                                  size_t len,
+                                                  ssh_key *pkey);
+LIBSSH_API int ssh_pki_export_privkey_ed25519_raw(const ssh_key privkey,
+                                                  unsigned char *raw,
+                                                  size_t len);
 
 LIBSSH_API int ssh_pki_copy_cert_to_privkey(const ssh_key cert_key,
                                             ssh_key privkey);
@@ -173,8 +173,14 @@
 /* Define to 1 if you have the `select' function. */
 #define HAVE_SELECT 1
 
-/* Define to 1 if you have the `clock_gettime' function. */
-// #undef HAVE_CLOCK_GETTIME
+/* Define to 1 if you have the `socketpair' function. lwIP has no AF_UNIX,
+   so only hosted builds can join sessions in process with ssh_pair_new() */
+// #define HAVE_SOCKETPAIR 1
+
+/* Define to 1 if you have the `clock_gettime' function. ESP-IDF backs
+   CLOCK_MONOTONIC with the high resolution timer, unlike gettimeofday()
+   which follows the wall clock */
+#define HAVE_CLOCK_GETTIME 1
 
 /* Define to 1 if you have the `ntohll' function. */
 /* #undef HAVE_NTOHLL */
@@ -206,6 +212,12 @@
 /* Define to 1 if you have the `cmocka_set_test_filter' function. */
 /* #undef HAVE_CMOCKA_SET_TEST_FILTER */
 
+/* Define to 1 if you have the `posix_fallocate' function. */
+/* #undef HAVE_POSIX_FALLOCATE */
+
+/* Define to 1 if you have the `futimens' function. */
+/* #undef HAVE_FUTIMENS */
+
 /*************************** LIBRARIES ***************************/
 
 /* Define to 1 if you have the `crypto' library (-lcrypto). */
@@ -217,7 +229,9 @@
 /* Define to 1 if you have the 'mbedTLS' library (-lmbedtls). */
 #define HAVE_LIBMBEDCRYPTO 1
 
-/* Define to 1 if you have the `pthread' library (-lpthread). */
+/* Define to 1 if you have the `pthread' library (-lpthread). Hosted builds
+   serving sessions from several threads need it for real mutexes (see
+   threads/pthread.c); the ESP32 build runs libssh on one task. */
 // #undef HAVE_PTHREAD
 
 /* Define to 1 if you have the `cmocka' library (-lcmocka). */
@@ -247,6 +261,45 @@
 /* Define to 1 if you want to enable ZLIB */
 /* #undef WITH_ZLIB */
 
+/* zlib deflate window bits and memLevel for transport compression, sized
+   for the ESP32 heap (see gzip.c) */
+/* #define SSH_ZLIB_WINDOW_BITS 11 */
+/* #define SSH_ZLIB_MEM_LEVEL 4 */
+
+/* Initial and largest size of the arena holding the strings parsed out of
+   each incoming packet (see arena.c) */
+/* #define SSH_PACKET_ARENA_SIZE 1024 */
+/* #define SSH_PACKET_ARENA_MAX_SIZE 36864 */
+
+/* Number of (known_hosts file, host) pairs whose parsed entries are kept
+   between connects (see knownhosts.c) */
+/* #define KNOWN_HOSTS_CACHE_SIZE 4 */
+
+/* Number of private key files whose parsed keys are kept between connects
+   by ssh_pki_import_privkey_file_cached() (see pki.c) */
+/* #define SSH_KEY_CACHE_SIZE 2 */
+
+/* Longest control line and write coalescing size of the server side scp
+   sink (see scp.c) */
+/* #define SSH_SCP_SINK_LINE_MAX 1024 */
+/* #define SSH_SCP_SINK_WRITE_SIZE 16384 */
+
+/* Bytes of random data drawn at once to pad outgoing packets, at most
+   MBEDTLS_CTR_DRBG_MAX_REQUEST (see libmbedcrypto.c) */
+/* #define SSH_RANDOM_POOL_SIZE 256 */
+
+/* Most packets queued on a socket for one writev() before further output
+   is copied behind the last one (see socket.c) */
+/* #define SSH_SOCKET_TX_QUEUE_LEN 16 */
+
+/* Bytes of pcap records collected before they are written to the capture
+   file in one go (see pcap.c) */
+/* #define SSH_PCAP_BUFFER_SIZE 65536 */
+
+/* Events the trace ring keeps before the oldest are overwritten, a power of
+   two (see trace.c) */
+/* #define SSH_TRACE_RING_SIZE 1024 */
+
 /* Define to 1 if you want to enable SFTP */
 /* #undef WITH_SFTP */
 
@@ -271,6 +324,10 @@
 /* Define to 1 if you want to enable pcap output support (experimental) */
 /* #undef WITH_PCAP */
 
+/* Define to 1 to also record packet, socket and channel events in a binary
+   ring, see ssh_trace_dump() */
+/* #undef WITH_TRACE */
+
 /* Define to 1 if you want to enable calltrace debug output */
 #define DEBUG_CALLTRACE 1
 
@@ -294,6 +351,16 @@
 #define HAVE_COMPILER__FUNC__ 1
 #endif
 
+/* Hosted builds of this tree (the libssh target of the top level Makefile)
+   run on a POSIX system, which has what lwIP and newlib lack above. */
+#ifdef LIBSSH_HOSTED
+#define HAVE_SOCKETPAIR 1
+#define HAVE_PTHREAD 1
+#define WITH_ZLIB 1
+#define HAVE_POSIX_FALLOCATE 1
+#define HAVE_FUTIMENS 1
+#endif /* LIBSSH_HOSTED */
+
 // libssh-src-upstream/include/libssh/config.h
 
 /*
@@ -36,13 +36,24 @@ int ssh_is_ipaddr(const char *str);
 
 /* list processing */
 
+struct ssh_list_slab;
+
+/*
+ * Iterators are carved out of slabs owned by the list and recycled through
+ * its free list, so appending and removing elements doesn't go to the heap
+ * once the list has reached its working size.
+ */
 struct ssh_list {
   struct ssh_iterator *root;
   struct ssh_iterator *end;
+  struct ssh_iterator *free;
+  struct ssh_list_slab *slabs;
+  size_t count;
 };
 
 struct ssh_iterator {
   struct ssh_iterator *next;
+  struct ssh_iterator *prev;
   const void *data;
 };
 
@@ -51,6 +62,12 @@ struct ssh_timestamp {
   long useconds;
 };
 
+struct ssh_deadline {
+  /* only set when timeout > 0 */
+  struct ssh_timestamp end;
+  int timeout;
+};
+
 enum ssh_quote_state_e {
     NO_QUOTE,
     SINGLE_QUOTE,
@@ -83,8 +100,12 @@ const void *_ssh_list_pop_head(struct ssh_list *list);
 
 int ssh_make_milliseconds(long sec, long usec);
 void ssh_timestamp_init(struct ssh_timestamp *ts);
+int ssh_timestamp_difference(struct ssh_timestamp *old,
+                             struct ssh_timestamp *new);
 int ssh_timeout_elapsed(struct ssh_timestamp *ts, int timeout);
 int ssh_timeout_update(struct ssh_timestamp *ts, int timeout);
+void ssh_deadline_init(struct ssh_deadline *deadline, int timeout);
+int ssh_deadline_remaining(struct ssh_deadline *deadline);
 
 int ssh_match_group(const char *group, const char *object);
 
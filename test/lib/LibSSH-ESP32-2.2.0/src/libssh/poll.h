@@ -120,6 +120,12 @@ int ssh_poll(ssh_pollfd_t *fds, nfds_t nfds, int timeout);
 typedef struct ssh_poll_ctx_struct *ssh_poll_ctx;
 typedef struct ssh_poll_handle_struct *ssh_poll_handle;
 
+/*
+ * ssh_poll_ctx_dopoll() return for a callback that closed its socket, which
+ * in a context shared through an ssh_event may belong to another session
+ */
+#define SSH_POLL_CLOSED -3
+
 /**
  * @brief SSH poll callback. This callback will be used when an event
  *                      caught on the socket.
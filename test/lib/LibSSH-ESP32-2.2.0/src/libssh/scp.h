@@ -22,9 +22,13 @@
 #define _SCP_H
 
 #include "libssh/libssh.h"
+#include "libssh/callbacks.h"
 
 enum ssh_scp_states {
   SSH_SCP_NEW,          //Data structure just created
+  SSH_SCP_OPENING,      //Non-blocking init: channel being opened
+  SSH_SCP_EXECUTING,    //Non-blocking init: scp command being requested
+  SSH_SCP_WAITING,      //Non-blocking init: waiting for the remote ack
   SSH_SCP_WRITE_INITED, //Gave our intention to write
   SSH_SCP_WRITE_WRITING,//File was opened and currently writing
   SSH_SCP_READ_INITED,  //Gave our intention to read
@@ -49,6 +53,47 @@ struct ssh_scp_struct {
   int request_mode;
 };
 
+/* Longest control line the sink accepts, C and D lines carry a file name */
+#ifndef SSH_SCP_SINK_LINE_MAX
+#define SSH_SCP_SINK_LINE_MAX 1024
+#endif
+
+/* Smaller pieces of file data are gathered up to this size before writing */
+#ifndef SSH_SCP_SINK_WRITE_SIZE
+#define SSH_SCP_SINK_WRITE_SIZE 16384
+#endif
+
+enum ssh_scp_sink_states {
+  SSH_SCP_SINK_NEW,       //Created, waiting for the scp -t command
+  SSH_SCP_SINK_CONTROL,   //Reading a control line
+  SSH_SCP_SINK_DATA,      //Writing the contents of a file
+  SSH_SCP_SINK_DATA_END,  //Waiting for the \0 that ends the contents
+  SSH_SCP_SINK_ERROR      //Fatal error sent to the client
+};
+
+struct ssh_scp_sink_struct {
+  ssh_channel channel;
+  struct ssh_channel_callbacks_struct callbacks;
+  enum ssh_scp_sink_states state;
+  int recursive;
+  int preserve;
+  /* target directory followed by the directories the client entered */
+  char *path;
+  size_t root_len;
+  char line[SSH_SCP_SINK_LINE_MAX];
+  size_t line_len;
+  /* times from the last T line, applied to the next file */
+  int have_times;
+  long mtime;
+  long atime;
+  int fd;
+  uint64_t remaining;
+  uint8_t *wbuf;
+  size_t wlen;
+  uint64_t files;
+  uint64_t bytes;
+};
+
 int ssh_scp_read_string(ssh_scp scp, char *buffer, size_t len);
 int ssh_scp_integer_mode(const char *mode);
 char *ssh_scp_string_mode(int mode);
@@ -368,6 +368,32 @@ LIBSSH_API int ssh_channel_request_send_exit_signal(ssh_channel channel,
 
 LIBSSH_API int ssh_send_keepalive(ssh_session session);
 
+/* Server side of scp, receiving what a client sends with "scp -t" */
+typedef struct ssh_scp_sink_struct* ssh_scp_sink;
+
+LIBSSH_API ssh_scp_sink ssh_scp_sink_new(ssh_channel channel,
+                                         const char *directory);
+LIBSSH_API int ssh_scp_sink_start(ssh_scp_sink sink, const char *command);
+LIBSSH_API int ssh_scp_sink_get_status(ssh_scp_sink sink);
+LIBSSH_API uint64_t ssh_scp_sink_get_files(ssh_scp_sink sink);
+LIBSSH_API uint64_t ssh_scp_sink_get_bytes(ssh_scp_sink sink);
+LIBSSH_API void ssh_scp_sink_free(ssh_scp_sink sink);
+
+/*
+ * A client and a server session joined over a socketpair and driven from
+ * one thread, for tests and benchmarks without sshd or TCP. Only with
+ * HAVE_SOCKETPAIR.
+ */
+typedef struct ssh_pair_struct* ssh_pair;
+
+LIBSSH_API ssh_pair ssh_pair_new(ssh_bind sshbind, ssh_session client,
+                                 ssh_session server);
+LIBSSH_API int ssh_pair_handshake(ssh_pair pair);
+LIBSSH_API int ssh_pair_run(ssh_pair pair, int (*fn)(void *userdata),
+                            void *userdata);
+LIBSSH_API ssh_event ssh_pair_get_event(ssh_pair pair);
+LIBSSH_API void ssh_pair_free(ssh_pair pair);
+
 /* deprecated functions */
 SSH_DEPRECATED LIBSSH_API int ssh_accept(ssh_session session);
 SSH_DEPRECATED LIBSSH_API int channel_write_stderr(ssh_channel channel,
@@ -31,6 +31,7 @@
 #include "libssh/poll.h"
 #include "libssh/libssh_esp32_config.h"
 #include "libssh/misc.h"
+#include "libssh/arena.h"
 
 /* These are the different states a SSH session can be into its life */
 enum ssh_session_state_e {
@@ -137,9 +138,15 @@ struct ssh_session_struct {
                          the remote host */
     ssh_buffer in_buffer;
     PACKET in_packet;
+    /* temporaries of the packet being processed, see arena.c */
+    struct ssh_arena_struct packet_arena;
     ssh_buffer out_buffer;
     struct ssh_list *out_queue; /* This list is used for delaying packets
                                    when rekeying is required */
+    /* when the first packet of the current rekey was delayed */
+    struct ssh_timestamp rekey_stall_start;
+    bool rekey_stalled;
+    struct ssh_rekey_stats rekey_stats;
 
     /* the states are used by the nonblocking stuff to remember */
     /* where it was before being interrupted */
@@ -173,6 +180,10 @@ struct ssh_session_struct {
     struct ssh_crypto_struct *next_crypto;  /* next_crypto is going to be used after a SSH2_MSG_NEWKEYS */
 
     struct ssh_list *channels; /* linked list of channels */
+    /* channels hashed by local id, chained through index_next */
+    struct ssh_channel_struct **channel_index;
+    uint32_t channel_index_size;
+    uint32_t channel_index_count;
     int maxchannel;
     ssh_agent agent; /* ssh agent */
 
@@ -199,6 +210,10 @@ struct ssh_session_struct {
     void (*ssh_connection_callback)( struct ssh_session_struct *session);
     struct ssh_packet_callbacks_struct default_packet_callbacks;
     struct ssh_list *packet_callbacks;
+    /* first packet_callbacks entry handling each message type, rebuilt when
+     * the list changes */
+    struct ssh_iterator **packet_dispatch;
+    int packet_dispatch_valid;
     struct ssh_socket_callbacks_struct socket_callbacks;
     ssh_poll_ctx default_poll_ctx;
     /* options */
@@ -233,6 +248,7 @@ struct ssh_session_struct {
         uint8_t options_seen[SOC_MAX];
         uint64_t rekey_data;
         uint32_t rekey_time;
+        uint32_t channel_window;
     } opts;
     /* counters */
     ssh_counter socket_counter;
@@ -42,6 +42,10 @@ int ssh_socket_connect_proxycommand(ssh_socket s, const char *command);
 #endif
 void ssh_socket_close(ssh_socket s);
 int ssh_socket_write(ssh_socket s,const void *buffer, int len);
+int ssh_socket_write_buffer(ssh_socket s, ssh_buffer *buffer);
+void ssh_socket_cork(ssh_socket s);
+int ssh_socket_uncork(ssh_socket s);
+int ssh_socket_flush_corked(ssh_socket s);
 int ssh_socket_is_open(ssh_socket s);
 int ssh_socket_fd_isset(ssh_socket s, fd_set *set);
 void ssh_socket_fd_set(ssh_socket s, fd_set *set, socket_t *max_fd);
@@ -55,6 +59,7 @@ int ssh_socket_get_status(ssh_socket s);
 int ssh_socket_get_poll_flags(ssh_socket s);
 int ssh_socket_buffered_write_bytes(ssh_socket s);
 int ssh_socket_data_available(ssh_socket s);
+unsigned int ssh_socket_get_activity(ssh_socket s);
 int ssh_socket_data_writable(ssh_socket s);
 int ssh_socket_set_nonblocking(socket_t fd);
 int ssh_socket_set_blocking(socket_t fd);
@@ -0,0 +1,132 @@
+/*
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+/*
+ * trace.h - binary event ring for the packet and socket hot paths.
+ *
+ * With WITH_TRACE the log calls on those paths also record an event id,
+ * a timestamp and three numbers, which costs no formatting and survives a
+ * log level too low to see them. The ring is written out with
+ * ssh_trace_dump() and read with trace_decode.
+ */
+
+#ifndef TRACE_H_
+#define TRACE_H_
+
+#include "libssh_esp32_config.h"
+
+#include <stdint.h>
+
+#include "libssh/libssh.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* the ids are part of the dump format, only ever append */
+enum ssh_trace_id {
+    /* type, length on the wire, payload length */
+    SSH_TRACE_PACKET_SEND = 1,
+    SSH_TRACE_PACKET_RECV = 2,
+    /* type */
+    SSH_TRACE_PACKET_DISPATCH = 3,
+    /* fd, revents, bytes queued for writing */
+    SSH_TRACE_SOCKET_POLL = 4,
+    /* fd, bytes read */
+    SSH_TRACE_SOCKET_READ = 5,
+    /* fd, bytes written or -1, packets queued */
+    SSH_TRACE_SOCKET_WRITE = 6,
+    /* local channel, length, local window */
+    SSH_TRACE_CHANNEL_DATA_IN = 7,
+    /* local channel, length, remote window left */
+    SSH_TRACE_CHANNEL_DATA_OUT = 8,
+    /* local channel, bytes waiting to be written */
+    SSH_TRACE_CHANNEL_WINDOW_WAIT = 9,
+    /* local channel, bytes added, remote window before */
+    SSH_TRACE_CHANNEL_WINDOW_ADJUST = 10,
+    /* packet that hit the limit: 0 incoming, 1 outgoing, 2 queued */
+    SSH_TRACE_REKEY_START = 11,
+    /* milliseconds outgoing packets were held */
+    SSH_TRACE_REKEY_DONE = 12,
+};
+
+/*
+ * A dump is a header followed by the events, oldest first, in the byte
+ * order of the device (little endian on the ESP32 and x86).
+ */
+#define SSH_TRACE_MAGIC "SSHTRACE"
+#define SSH_TRACE_VERSION 1
+
+struct ssh_trace_header {
+    char magic[8];
+    uint32_t version;
+    uint32_t event_size;
+    uint32_t count;
+    /* events recorded since start, count is less when the ring wrapped */
+    uint32_t recorded;
+};
+
+struct ssh_trace_event {
+    /* position in the ring plus one, 0 while the slot is being written */
+    uint32_t seq;
+    uint16_t id;
+    uint16_t reserved;
+    /* monotonic microseconds, wraps after 71 minutes */
+    uint32_t time;
+    uint32_t args[3];
+};
+
+#ifdef WITH_TRACE
+void ssh_trace_record(enum ssh_trace_id id,
+                      uint32_t a0,
+                      uint32_t a1,
+                      uint32_t a2);
+#define SSH_TRACE(id, a0, a1, a2) \
+    ssh_trace_record((id), (uint32_t)(a0), (uint32_t)(a1), (uint32_t)(a2))
+#else
+#define SSH_TRACE(id, a0, a1, a2) do {} while (0)
+#endif
+
+/*
+ * An event for the ring and the usual log line, for the call sites that
+ * had a SSH_LOG before the ring existed. The SSH_LOG is the one from
+ * priv.h, the including file has it. With the ring the level is checked
+ * here, so a quiet session doesn't set up the varargs call on top of the
+ * event.
+ */
+#ifdef WITH_TRACE
+#define SSH_TRACE_LOG(id, a0, a1, a2, priority, ...) \
+    do { \
+        SSH_TRACE(id, a0, a1, a2); \
+        if (ssh_get_log_level() >= (priority)) { \
+            SSH_LOG(priority, __VA_ARGS__); \
+        } \
+    } while (0)
+#else
+#define SSH_TRACE_LOG(id, a0, a1, a2, priority, ...) \
+    SSH_LOG(priority, __VA_ARGS__)
+#endif
+
+LIBSSH_API int ssh_trace_dump(const char *filename);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* TRACE_H_ */
@@ -112,6 +112,7 @@ struct ssh_crypto_struct *crypto_new(void);
 void crypto_free(struct ssh_crypto_struct *crypto);
 
 void ssh_reseed(void);
+int ssh_get_random_padding(void *where, int len);
 int ssh_crypto_init(void);
 void ssh_crypto_finalize(void);
 
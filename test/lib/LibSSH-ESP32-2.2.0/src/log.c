@@ -42,6 +42,10 @@
 #define LOG_SIZE 1024
 #endif
 
+/* the time, level and function in front of a message */
+#define LOG_PREFIX_SIZE 128
+#define LOG_LINE_SIZE (LOG_SIZE + LOG_PREFIX_SIZE)
+
 static LIBSSH_THREAD int ssh_log_level;
 static LIBSSH_THREAD ssh_logging_callback ssh_log_cb;
 static LIBSSH_THREAD void *ssh_log_userdata;
@@ -55,47 +59,212 @@ static LIBSSH_THREAD void *ssh_log_userdata;
  * @{
  */
 
+/*
+ * The date and time down to the second only changes once a second, so it is
+ * rendered once and reused for the following lines, only the microseconds
+ * are filled in every time. The second it belongs to is stored plus one, so
+ * 0 means empty. On the ESP32 LIBSSH_THREAD is only volatile and the cache
+ * is shared by all tasks: readers check the second again after the copy,
+ * and a task refreshing it first swaps the second to TIMESTRING_WRITING.
+ * Only the task that made that swap writes the text, one that finds the
+ * cache claimed uses what it rendered without storing it.
+ */
+#define TIMESTRING_LEN 19 /* 2020/04/18 12:34:56 */
+#define TIMESTRING_WRITING UINT32_MAX
+
+static LIBSSH_THREAD uint32_t ssh_log_time_sec;
+static LIBSSH_THREAD char ssh_log_time_text[TIMESTRING_LEN + 1];
+
+static int cached_timestring(time_t t, char *tbuf)
+{
+    uint32_t key = (uint32_t)t + 1;
+
+    if (__atomic_load_n(&ssh_log_time_sec, __ATOMIC_ACQUIRE) != key) {
+        return -1;
+    }
+    memcpy(tbuf, (const char *)ssh_log_time_text, TIMESTRING_LEN + 1);
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&ssh_log_time_sec, __ATOMIC_RELAXED) != key) {
+        return -1;
+    }
+
+    return 0;
+}
+
 static int current_timestring(int hires, char *buf, size_t len)
 {
-    char tbuf[64];
+    char tbuf[TIMESTRING_LEN + 1];
     struct timeval tv;
     struct tm *tm;
     time_t t;
+    uint32_t cached;
+    long usec;
+    int i;
 
     gettimeofday(&tv, NULL);
     t = (time_t) tv.tv_sec;
 
-    tm = localtime(&t);
-    if (tm == NULL) {
-        return -1;
+    if (cached_timestring(t, tbuf) < 0) {
+        tm = localtime(&t);
+        if (tm == NULL) {
+            return -1;
+        }
+        if (strftime(tbuf, sizeof(tbuf), "%Y/%m/%d %H:%M:%S", tm) == 0) {
+            return -1;
+        }
+
+        cached = __atomic_load_n(&ssh_log_time_sec, __ATOMIC_RELAXED);
+        if (cached != TIMESTRING_WRITING &&
+            __atomic_compare_exchange_n(&ssh_log_time_sec, &cached,
+                                        TIMESTRING_WRITING, 0,
+                                        __ATOMIC_ACQUIRE,
+                                        __ATOMIC_RELAXED)) {
+            memcpy((char *)ssh_log_time_text, tbuf, sizeof(tbuf));
+            __atomic_store_n(&ssh_log_time_sec, (uint32_t)t + 1,
+                             __ATOMIC_RELEASE);
+        }
     }
 
-    if (hires) {
-        strftime(tbuf, sizeof(tbuf) - 1, "%Y/%m/%d %H:%M:%S", tm);
-        snprintf(buf, len, "%s.%06ld", tbuf, (long)tv.tv_usec);
-    } else {
-        strftime(tbuf, sizeof(tbuf) - 1, "%Y/%m/%d %H:%M:%S", tm);
+    if (!hires) {
         snprintf(buf, len, "%s", tbuf);
+        return 0;
+    }
+    if (len < sizeof(tbuf) + 7) {
+        snprintf(buf, len, "%s.%06ld", tbuf, (long)tv.tv_usec);
+        return 0;
+    }
+
+    memcpy(buf, tbuf, TIMESTRING_LEN);
+    buf[TIMESTRING_LEN] = '.';
+    usec = (long)tv.tv_usec;
+    for (i = TIMESTRING_LEN + 6; i > TIMESTRING_LEN; i--) {
+        buf[i] = '0' + usec % 10;
+        usec /= 10;
     }
+    buf[TIMESTRING_LEN + 7] = '\0';
 
     return 0;
 }
 
+/*
+ * ssh_vlog() already holds the message in a LOG_SIZE buffer on the stack,
+ * the line is never put together in another one. stderr gets it in one
+ * call, the log buffer piece by piece straight into the record.
+ */
+static size_t ssh_log_prefix(int verbosity,
+                             const char *function,
+                             char *prefix,
+                             size_t len)
+{
+    char date[32];
+    int rc;
+
+    rc = current_timestring(1, date, sizeof(date));
+    if (rc == 0) {
+        rc = snprintf(prefix, len, "[%s, %d] %s:  ", date, verbosity, function);
+    } else {
+        rc = snprintf(prefix, len, "[%d] %s  ", verbosity, function);
+    }
+    if (rc < 0) {
+        return 0;
+    }
+    if ((size_t)rc >= len) {
+        rc = len - 1;
+    }
+
+    return rc;
+}
+
 static void ssh_log_stderr(int verbosity,
                            const char *function,
                            const char *buffer)
 {
-    char date[128] = {0};
+    char date[32];
     int rc;
 
     rc = current_timestring(1, date, sizeof(date));
     if (rc == 0) {
-        fprintf(stderr, "[%s, %d] %s:", date, verbosity, function);
+        fprintf(stderr, "[%s, %d] %s:  %s\n", date, verbosity, function, buffer);
+    } else {
+        fprintf(stderr, "[%d] %s  %s\n", verbosity, function, buffer);
+    }
+}
+
+/*
+ * Log buffer
+ *
+ * Lines are kept as records of a 32 bit length followed by the line, padded
+ * to 4 bytes, so a length never wraps around the end of the ring. Writers
+ * reserve a record by moving head forward and publish it by storing its
+ * length last. The single reader stops at the first length that is still
+ * 0, clears what it took and only then moves tail, so a record is always
+ * zeroed when it is reserved again. A line that doesn't fit is dropped and
+ * counted, nothing ever waits for the reader.
+ */
+static unsigned char *ssh_log_buffer;
+static uint32_t ssh_log_buffer_mask;
+static uint32_t ssh_log_buffer_head;
+static uint32_t ssh_log_buffer_tail;
+static uint32_t ssh_log_buffer_dropped;
+
+#define LOG_RECORD_SIZE(len) (4 + (((len) + 3) & ~3U))
+
+static void ssh_log_buffer_copy(unsigned char *dst,
+                                uint32_t pos,
+                                const unsigned char *src,
+                                size_t len,
+                                int to_ring)
+{
+    size_t size = (size_t)ssh_log_buffer_mask + 1;
+    size_t first;
+
+    pos &= ssh_log_buffer_mask;
+    first = size - pos;
+    if (first > len) {
+        first = len;
+    }
+
+    if (to_ring) {
+        memcpy(dst + pos, src, first);
+        memcpy(dst, src + first, len - first);
     } else {
-        fprintf(stderr, "[%d] %s", verbosity, function);
+        memcpy(dst, src + pos, first);
+        memcpy(dst + first, src, len - first);
     }
+}
 
-    fprintf(stderr, "  %s\n", buffer);
+static void ssh_log_buffered(unsigned char *ring,
+                             int verbosity,
+                             const char *function,
+                             const char *buffer)
+{
+    char prefix[LOG_PREFIX_SIZE];
+    uint32_t head, tail, need;
+    size_t plen, mlen, len;
+
+    plen = ssh_log_prefix(verbosity, function, prefix, sizeof(prefix));
+    mlen = strnlen(buffer, LOG_SIZE - 1);
+    len = plen + mlen + 1;
+
+    need = LOG_RECORD_SIZE(len);
+    head = __atomic_load_n(&ssh_log_buffer_head, __ATOMIC_RELAXED);
+    do {
+        tail = __atomic_load_n(&ssh_log_buffer_tail, __ATOMIC_ACQUIRE);
+        if (head - tail + need > ssh_log_buffer_mask + 1) {
+            __atomic_fetch_add(&ssh_log_buffer_dropped, 1, __ATOMIC_RELAXED);
+            return;
+        }
+    } while (!__atomic_compare_exchange_n(&ssh_log_buffer_head, &head,
+                                          head + need, 1,
+                                          __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+    ssh_log_buffer_copy(ring, head + 4, (const unsigned char *)prefix, plen, 1);
+    ssh_log_buffer_copy(ring, head + 4 + plen,
+                        (const unsigned char *)buffer, mlen, 1);
+    ssh_log_buffer_copy(ring, head + 4 + plen + mlen,
+                        (const unsigned char *)"\n", 1, 1);
+    __atomic_store_n((uint32_t *)(ring + (head & ssh_log_buffer_mask)),
+                     (uint32_t)len, __ATOMIC_RELEASE);
 }
 
 static void ssh_log_custom(ssh_logging_callback log_fn,
@@ -115,11 +284,19 @@ void ssh_log_function(int verbosity,
 {
     ssh_logging_callback log_fn = ssh_get_log_callback();
 
+    unsigned char *ring = NULL;
+
     if (log_fn) {
         ssh_log_custom(log_fn, verbosity, function, buffer);
         return;
     }
 
+    ring = __atomic_load_n(&ssh_log_buffer, __ATOMIC_ACQUIRE);
+    if (ring != NULL) {
+        ssh_log_buffered(ring, verbosity, function, buffer);
+        return;
+    }
+
     ssh_log_stderr(verbosity, function, buffer);
 }
 
@@ -253,4 +430,126 @@ int ssh_set_log_userdata(void *data)
     return 0;
 }
 
+/**
+ * @brief Collect log lines in a buffer instead of writing them to stderr.
+ *
+ * Logging then only formats the line and copies it, another thread or
+ * task takes the lines out with ssh_log_buffer_read() and writes them
+ * wherever it likes, in batches. Lines that don't fit because the reader
+ * falls behind are dropped and counted. A logging callback set with
+ * ssh_set_log_callback() still takes precedence.
+ *
+ * Unlike the log level and callback, the buffer is shared by all threads.
+ * It is still used by lines logged while it is replaced or removed, so
+ * only do that when no other thread is logging.
+ *
+ * @param[in]  buf      The buffer, aligned to 4 bytes, or NULL to go back
+ *                      to stderr. It is owned by the caller and must stay
+ *                      valid while it is set.
+ *
+ * @param[in]  size     The size of the buffer, a power of two of at least
+ *                      2048 bytes so the longest line fits.
+ *
+ * @return              SSH_OK on success, SSH_ERROR if the buffer is
+ *                      unsuitable.
+ */
+int ssh_set_log_buffer(void *buf, size_t size)
+{
+    if (buf == NULL) {
+        __atomic_store_n(&ssh_log_buffer, NULL, __ATOMIC_RELEASE);
+        return SSH_OK;
+    }
+
+    if (((uintptr_t)buf & 3) != 0 ||
+        size < LOG_RECORD_SIZE(LOG_LINE_SIZE) ||
+        size > 0x80000000UL ||
+        (size & (size - 1)) != 0) {
+        return SSH_ERROR;
+    }
+
+    memset(buf, 0, size);
+    ssh_log_buffer_mask = (uint32_t)(size - 1);
+    ssh_log_buffer_head = 0;
+    ssh_log_buffer_tail = 0;
+    ssh_log_buffer_dropped = 0;
+    __atomic_store_n(&ssh_log_buffer, (unsigned char *)buf, __ATOMIC_RELEASE);
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Take complete log lines out of the log buffer.
+ *
+ * Only one thread may read at a time. The lines are copied as they would
+ * have been written to stderr, each ending with a newline, and when lines
+ * were dropped a note saying how many comes first. A line longer than len
+ * is cut short.
+ *
+ * @param[out] buf      Where to copy the lines to, not NUL terminated.
+ *
+ * @param[in]  len      The size of buf.
+ *
+ * @return              The number of bytes copied, 0 if there was nothing
+ *                      to read or no log buffer is set.
+ *
+ * @see ssh_set_log_buffer()
+ */
+size_t ssh_log_buffer_read(char *buf, size_t len)
+{
+    unsigned char *ring = NULL;
+    uint32_t tail, pos, hdr, need;
+    uint32_t dropped;
+    size_t out = 0;
+    size_t n;
+    int rc;
+
+    ring = __atomic_load_n(&ssh_log_buffer, __ATOMIC_ACQUIRE);
+    if (ring == NULL || buf == NULL || len == 0) {
+        return 0;
+    }
+
+    dropped = __atomic_exchange_n(&ssh_log_buffer_dropped, 0, __ATOMIC_RELAXED);
+    if (dropped > 0) {
+        rc = snprintf(buf, len, "[%u log lines dropped]\n", dropped);
+        if (rc > 0 && (size_t)rc < len) {
+            out = rc;
+        } else {
+            __atomic_fetch_add(&ssh_log_buffer_dropped, dropped,
+                               __ATOMIC_RELAXED);
+        }
+    }
+
+    tail = __atomic_load_n(&ssh_log_buffer_tail, __ATOMIC_RELAXED);
+    for (;;) {
+        pos = tail & ssh_log_buffer_mask;
+        hdr = __atomic_load_n((uint32_t *)(ring + pos), __ATOMIC_ACQUIRE);
+        if (hdr == 0) {
+            break;
+        }
+
+        n = hdr;
+        if (out + n > len) {
+            if (out > 0) {
+                break;
+            }
+            n = len;
+        }
+        ssh_log_buffer_copy((unsigned char *)buf + out, tail + 4, ring, n, 0);
+        out += n;
+
+        /* leave it zeroed for the writer that reserves it next */
+        need = LOG_RECORD_SIZE(hdr);
+        n = ssh_log_buffer_mask + 1 - pos;
+        if (n > need) {
+            n = need;
+        }
+        memset(ring + pos, 0, n);
+        memset(ring, 0, need - n);
+        tail += need;
+        __atomic_store_n(&ssh_log_buffer_tail, tail, __ATOMIC_RELEASE);
+    }
+
+    return out;
+}
+
 /** @} */
@@ -817,7 +817,7 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
     ssh_string submethods = NULL;
 
     msg->auth_request.method = SSH_AUTH_METHOD_INTERACTIVE;
-    lang = ssh_buffer_get_ssh_string(packet);
+    lang = ssh_arena_get_ssh_string(&session->packet_arena, packet);
     if (lang == NULL) {
       goto error;
     }
@@ -825,9 +825,8 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
      * 3.1.  Initial Exchange
      * "The language tag is deprecated and SHOULD be the empty string."
      */
-    SSH_STRING_FREE(lang);
 
-    submethods = ssh_buffer_get_ssh_string(packet);
+    submethods = ssh_arena_get_ssh_string(&session->packet_arena, packet);
     if (submethods == NULL) {
       goto error;
     }
@@ -837,7 +836,6 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
      *  server is that, unless the user may use multiple different
      *  submethods, the server ignores this field."
      */
-    SSH_STRING_FREE(submethods);
 
     goto end;
   }
@@ -873,7 +871,7 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
         ssh_string sig_blob = NULL;
         ssh_buffer digest = NULL;
 
-        sig_blob = ssh_buffer_get_ssh_string(packet);
+        sig_blob = ssh_arena_get_ssh_string(&session->packet_arena, packet);
         if(sig_blob == NULL) {
             SSH_LOG(SSH_LOG_PACKET, "Invalid signature packet from peer");
             msg->auth_request.signature_state = SSH_PUBLICKEY_STATE_ERROR;
@@ -886,7 +884,6 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
         SSH_STRING_FREE(algo);
         algo = NULL;
         if (digest == NULL) {
-            SSH_STRING_FREE(sig_blob);
             SSH_LOG(SSH_LOG_PACKET, "Failed to get digest");
             msg->auth_request.signature_state = SSH_PUBLICKEY_STATE_WRONG;
             goto error;
@@ -919,7 +916,6 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_request){
                                               ssh_buffer_get_len(digest));
             }
         }
-        SSH_STRING_FREE(sig_blob);
         SSH_BUFFER_FREE(digest);
         ssh_signature_free(sig);
         if (rc < 0) {
@@ -1111,8 +1107,10 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_info_response){
     goto error;
   }
 
+  /* the answers are passwords, wipe their copies with the packet */
+  ssh_arena_set_secure(&session->packet_arena);
   for (i = 0; i < nanswers; i++) {
-    tmp = ssh_buffer_get_ssh_string(packet);
+    tmp = ssh_arena_get_ssh_string(&session->packet_arena, packet);
     if (tmp == NULL) {
       ssh_set_error(session, SSH_FATAL, "Short INFO_RESPONSE packet");
       session->kbdint->nanswers = i;
@@ -1122,7 +1120,6 @@ SSH_PACKET_CALLBACK(ssh_packet_userauth_info_response){
       goto error;
     }
     session->kbdint->answers[i] = ssh_string_to_char(tmp);
-    SSH_STRING_FREE(tmp);
     if (session->kbdint->answers[i] == NULL) {
       ssh_set_error_oom(session);
       session->kbdint->nanswers = i;
@@ -1288,6 +1285,12 @@ int ssh_message_channel_request_open_reply_accept_channel(ssh_message msg, ssh_c
         return SSH_ERROR;
     }
 
+    rc = ssh_channel_index_add(chan);
+    if (rc != SSH_OK) {
+        ssh_buffer_reinit(session->out_buffer);
+        return SSH_ERROR;
+    }
+
     SSH_LOG(SSH_LOG_PACKET,
             "Accepting a channel request_open for chan %d",
             chan->remote_channel);
@@ -662,23 +662,36 @@ const char *ssh_version(int req_version) {
   return NULL;
 }
 
+/* Slabs double in size up to this many iterators */
+#define SSH_LIST_SLAB_MIN 2
+#define SSH_LIST_SLAB_MAX 32
+
+struct ssh_list_slab {
+  struct ssh_list_slab *next;
+  size_t n;
+  struct ssh_iterator iterators[];
+};
+
 struct ssh_list *ssh_list_new(void) {
   struct ssh_list *ret=malloc(sizeof(struct ssh_list));
   if(!ret)
     return NULL;
   ret->root=ret->end=NULL;
+  ret->free=NULL;
+  ret->slabs=NULL;
+  ret->count=0;
   return ret;
 }
 
 void ssh_list_free(struct ssh_list *list){
-  struct ssh_iterator *ptr,*next;
+  struct ssh_list_slab *slab,*next;
   if(!list)
     return;
-  ptr=list->root;
-  while(ptr){
-    next=ptr->next;
-    SAFE_FREE(ptr);
-    ptr=next;
+  slab=list->slabs;
+  while(slab){
+    next=slab->next;
+    SAFE_FREE(slab);
+    slab=next;
   }
   SAFE_FREE(list);
 }
@@ -706,25 +719,56 @@ struct ssh_iterator *ssh_list_find(const struct ssh_list *list, void *value){
  */
 size_t ssh_list_count(const struct ssh_list *list)
 {
-  struct ssh_iterator *it = NULL;
-  int count = 0;
-
-  for (it = ssh_list_get_iterator(list); it != NULL ; it = it->next) {
-      count++;
+  if (list == NULL) {
+      return 0;
   }
 
-  return count;
+  return list->count;
 }
 
-static struct ssh_iterator *ssh_iterator_new(const void *data){
-  struct ssh_iterator *iterator=malloc(sizeof(struct ssh_iterator));
-  if(!iterator)
-    return NULL;
+static struct ssh_iterator *ssh_iterator_new(struct ssh_list *list,
+                                             const void *data){
+  struct ssh_iterator *iterator;
+  struct ssh_list_slab *slab;
+  size_t n, i;
+
+  if (list->free == NULL) {
+    n = list->slabs ? list->slabs->n * 2 : SSH_LIST_SLAB_MIN;
+    if (n > SSH_LIST_SLAB_MAX) {
+      n = SSH_LIST_SLAB_MAX;
+    }
+    slab = malloc(sizeof(struct ssh_list_slab) +
+                  n * sizeof(struct ssh_iterator));
+    if (slab == NULL) {
+      return NULL;
+    }
+    slab->n = n;
+    slab->next = list->slabs;
+    list->slabs = slab;
+    for (i = 0; i < n; i++) {
+      slab->iterators[i].next = list->free;
+      list->free = &slab->iterators[i];
+    }
+  }
+
+  iterator=list->free;
+  list->free=iterator->next;
   iterator->next=NULL;
+  iterator->prev=NULL;
   iterator->data=data;
+  list->count++;
   return iterator;
 }
 
+static void ssh_iterator_release(struct ssh_list *list,
+                                 struct ssh_iterator *iterator){
+  iterator->data=NULL;
+  iterator->prev=NULL;
+  iterator->next=list->free;
+  list->free=iterator;
+  list->count--;
+}
+
 int ssh_list_append(struct ssh_list *list,const void *data){
   struct ssh_iterator *iterator = NULL;
 
@@ -732,7 +776,7 @@ int ssh_list_append(struct ssh_list *list,const void *data){
       return SSH_ERROR;
   }
 
-  iterator = ssh_iterator_new(data);
+  iterator = ssh_iterator_new(list, data);
   if (iterator == NULL) {
       return SSH_ERROR;
   }
@@ -742,6 +786,7 @@ int ssh_list_append(struct ssh_list *list,const void *data){
     list->root=list->end=iterator;
   } else {
     /* put it on end of list */
+    iterator->prev=list->end;
     list->end->next=iterator;
     list->end=iterator;
   }
@@ -755,7 +800,7 @@ int ssh_list_prepend(struct ssh_list *list, const void *data){
       return SSH_ERROR;
   }
 
-  it = ssh_iterator_new(data);
+  it = ssh_iterator_new(list, data);
   if (it == NULL) {
     return SSH_ERROR;
   }
@@ -766,39 +811,31 @@ int ssh_list_prepend(struct ssh_list *list, const void *data){
   } else {
     /* set as new root */
     it->next = list->root;
+    list->root->prev = it;
     list->root = it;
   }
 
   return SSH_OK;
 }
 
+/*
+ * Unlinks the element in constant time. The iterator must belong to the
+ * list and is recycled, so it can't be used once this returns.
+ */
 void ssh_list_remove(struct ssh_list *list, struct ssh_iterator *iterator){
-  struct ssh_iterator *ptr,*prev;
-
-  if (list == NULL) {
+  if (list == NULL || iterator == NULL) {
       return;
   }
 
-  prev=NULL;
-  ptr=list->root;
-  while(ptr && ptr != iterator){
-    prev=ptr;
-    ptr=ptr->next;
-  }
-  if(!ptr){
-    /* we did not find the element */
-    return;
-  }
-  /* unlink it */
-  if(prev)
-    prev->next=ptr->next;
-  /* if iterator was the head */
-  if(list->root == iterator)
+  if(iterator->prev)
+    iterator->prev->next=iterator->next;
+  else
     list->root=iterator->next;
-  /* if iterator was the tail */
-  if(list->end == iterator)
-    list->end = prev;
-  SAFE_FREE(iterator);
+  if(iterator->next)
+    iterator->next->prev=iterator->prev;
+  else
+    list->end=iterator->prev;
+  ssh_iterator_release(list, iterator);
 }
 
 /**
@@ -826,9 +863,11 @@ const void *_ssh_list_pop_head(struct ssh_list *list){
   }
   data=iterator->data;
   list->root=iterator->next;
+  if(list->root)
+    list->root->prev=NULL;
   if(list->end==iterator)
     list->end=NULL;
-  SAFE_FREE(iterator);
+  ssh_iterator_release(list, iterator);
   return data;
 }
 
@@ -1332,8 +1371,12 @@ done:
     return 0;
 }
 
-/* try the Monotonic clock if possible for perfs reasons */
-#ifdef _POSIX_MONOTONIC_CLOCK
+/*
+ * try the Monotonic clock if possible for perfs reasons, and so timeouts
+ * don't jump with the wall clock. Some libcs define the clock id without
+ * _POSIX_MONOTONIC_CLOCK.
+ */
+#if defined(_POSIX_MONOTONIC_CLOCK) || defined(CLOCK_MONOTONIC)
 #define CLOCK CLOCK_MONOTONIC
 #else
 #define CLOCK CLOCK_REALTIME
@@ -1367,7 +1410,7 @@ void ssh_timestamp_init(struct ssh_timestamp *ts){
  * @returns difference in milliseconds
  */
 
-static int ssh_timestamp_difference(struct ssh_timestamp *old,
+int ssh_timestamp_difference(struct ssh_timestamp *old,
     struct ssh_timestamp *new){
   long seconds, usecs, msecs;
   seconds = new->seconds - old->seconds;
@@ -1454,6 +1497,54 @@ int ssh_timeout_update(struct ssh_timestamp *ts, int timeout){
   return ret >= 0 ? ret: 0;
 }
 
+/**
+ * @internal
+ * @brief starts a wait that must end timeout milliseconds from now
+ *
+ * Unlike a timestamp checked with ssh_timeout_elapsed() and
+ * ssh_timeout_update(), the clock is read once per wakeup, and not at all
+ * for nonblocking and infinite waits.
+ *
+ * @param[out] deadline pointer to an allocated ssh_deadline structure
+ * @param[in] timeout timeout in milliseconds. Negative values mean infinite
+ *             timeout
+ */
+void ssh_deadline_init(struct ssh_deadline *deadline, int timeout)
+{
+    deadline->timeout = timeout;
+    if (timeout <= 0) {
+        return;
+    }
+
+    ssh_timestamp_init(&deadline->end);
+    deadline->end.seconds += timeout / 1000;
+    deadline->end.useconds += (timeout % 1000) * 1000;
+    if (deadline->end.useconds >= 1000000) {
+        deadline->end.seconds++;
+        deadline->end.useconds -= 1000000;
+    }
+}
+
+/**
+ * @internal
+ * @brief time left before a deadline
+ * @param[in] deadline pointer to a deadline set with ssh_deadline_init()
+ * @returns   remaining time in milliseconds, 0 if elapsed, -1 if never.
+ */
+int ssh_deadline_remaining(struct ssh_deadline *deadline)
+{
+    struct ssh_timestamp now;
+    int ms;
+
+    if (deadline->timeout <= 0) {
+        return deadline->timeout < 0 ? -1 : 0;
+    }
+    ssh_timestamp_init(&now);
+    ms = ssh_timestamp_difference(&now, &deadline->end);
+
+    return ms > 0 ? ms : 0;
+}
+
 
 int ssh_match_group(const char *group, const char *object)
 {
@@ -465,6 +465,13 @@ int ssh_options_set_algo(ssh_session session,
  *                in seconds. RFC 4253 Section 9 recommends one hour.
  *                (uint32_t, 0=off)
  *
+ *              - SSH_OPTIONS_CHANNEL_WINDOW
+ *                Set how many bytes the peer may send on a channel before
+ *                it has to wait for a window adjust. The window is topped
+ *                up once half of it is used. Larger windows cost memory
+ *                while the application is not reading.
+ *                (uint32_t, 0=default of 8000)
+ *
  * @param  value The value to set. This is a generic pointer and the
  *               datatype which is used should be set according to the
  *               type set.
@@ -1029,6 +1036,15 @@ int ssh_options_set(ssh_session session, enum ssh_options_e type,
                 session->opts.rekey_time = (*x) * 1000;
             }
             break;
+        case SSH_OPTIONS_CHANNEL_WINDOW:
+            if (value == NULL) {
+                ssh_set_error_invalid(session);
+                return -1;
+            } else {
+                uint32_t *x = (uint32_t *)value;
+                session->opts.channel_window = *x;
+            }
+            break;
         default:
             ssh_set_error(session, SSH_REQUEST_DENIED, "Unknown ssh option %d", type);
             return -1;
@@ -44,6 +44,7 @@
 #include "libssh/session.h"
 #include "libssh/messages.h"
 #include "libssh/pcap.h"
+#include "libssh/trace.h"
 #include "libssh/kex.h"
 #include "libssh/auth.h"
 #include "libssh/gssapi.h"
@@ -1323,9 +1324,11 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
              */
             session->packet_state = PACKET_STATE_PROCESSING;
             ssh_packet_parse_type(session);
-            SSH_LOG(SSH_LOG_PACKET,
-                    "packet: read type %hhd [len=%d,padding=%hhd,comp=%d,payload=%d]",
-                    session->in_packet.type, packet_len, padding, compsize, payloadsize);
+            SSH_TRACE_LOG(SSH_TRACE_PACKET_RECV,
+                          session->in_packet.type, packet_len, payloadsize,
+                          SSH_LOG_PACKET,
+                          "packet: read type %hhd [len=%d,padding=%hhd,comp=%d,payload=%d]",
+                          session->in_packet.type, packet_len, padding, compsize, payloadsize);
 
             /* Check if the packet is expected */
             filter_result = ssh_packet_incoming_filter(session);
@@ -1361,7 +1364,8 @@ int ssh_packet_socket_callback(const void *data, size_t receivedlen, void *user)
 
             ok = ssh_packet_need_rekey(session, 0);
             if (ok) {
-                SSH_LOG(SSH_LOG_PACKET, "Incoming packet triggered rekey");
+                SSH_TRACE_LOG(SSH_TRACE_REKEY_START, 0, 0, 0,
+                              SSH_LOG_PACKET, "Incoming packet triggered rekey");
                 rc = ssh_send_rekex(session);
                 if (rc != SSH_OK) {
                     SSH_LOG(SSH_LOG_PACKET, "Rekey failed: rc = %d", rc);
@@ -1430,6 +1434,7 @@ void ssh_packet_set_callbacks(ssh_session session, ssh_packet_callbacks callback
         }
     }
     ssh_list_append(session->packet_callbacks, callbacks);
+    session->packet_dispatch_valid = 0;
 }
 
 /** @internal
@@ -1440,6 +1445,7 @@ void ssh_packet_remove_callbacks(ssh_session session, ssh_packet_callbacks callb
     it = ssh_list_find(session->packet_callbacks, callbacks);
     if (it != NULL) {
         ssh_list_remove(session->packet_callbacks, it);
+        session->packet_dispatch_valid = 0;
     }
 }
 
@@ -1454,6 +1460,48 @@ void ssh_packet_set_default_callbacks(ssh_session session){
 	ssh_packet_set_callbacks(session, &session->default_packet_callbacks);
 }
 
+/*
+ * Records, for every message type, the first callbacks entry with a handler
+ * for it. Dispatch starts its walk of the list there instead of at the head.
+ */
+static int ssh_packet_dispatch_build(ssh_session session)
+{
+    struct ssh_iterator *i = NULL;
+    ssh_packet_callbacks cb;
+    unsigned int type;
+    unsigned int end;
+
+    if (session->packet_dispatch == NULL) {
+        session->packet_dispatch = calloc(256, sizeof(struct ssh_iterator *));
+        if (session->packet_dispatch == NULL) {
+            return SSH_ERROR;
+        }
+    } else {
+        memset(session->packet_dispatch, 0,
+               256 * sizeof(struct ssh_iterator *));
+    }
+
+    for (i = ssh_list_get_iterator(session->packet_callbacks);
+         i != NULL;
+         i = i->next) {
+        cb = ssh_iterator_value(ssh_packet_callbacks, i);
+        if (cb == NULL) {
+            continue;
+        }
+
+        end = MIN((unsigned int)cb->start + cb->n_callbacks, 256);
+        for (type = cb->start; type < end; type++) {
+            if (session->packet_dispatch[type] == NULL &&
+                cb->callbacks[type - cb->start] != NULL) {
+                session->packet_dispatch[type] = i;
+            }
+        }
+    }
+    session->packet_dispatch_valid = 1;
+
+    return SSH_OK;
+}
+
 /** @internal
  * @brief dispatch the call of packet handlers callbacks for a received packet
  * @param type type of packet
@@ -1464,13 +1512,24 @@ void ssh_packet_process(ssh_session session, uint8_t type)
     int rc = SSH_PACKET_NOT_USED;
     ssh_packet_callbacks cb;
 
-    SSH_LOG(SSH_LOG_PACKET, "Dispatching handler for packet type %d", type);
+    SSH_TRACE_LOG(SSH_TRACE_PACKET_DISPATCH, type, 0, 0,
+                  SSH_LOG_PACKET, "Dispatching handler for packet type %d", type);
     if (session->packet_callbacks == NULL) {
         SSH_LOG(SSH_LOG_RARE, "Packet callback is not initialized !");
         return;
     }
 
-    i = ssh_list_get_iterator(session->packet_callbacks);
+    if (!session->packet_dispatch_valid) {
+        ssh_packet_dispatch_build(session);
+    }
+
+    session->packet_arena.depth++;
+    if (session->packet_dispatch_valid) {
+        /* a handler returning SSH_PACKET_NOT_USED passes on down the list */
+        i = session->packet_dispatch[type];
+    } else {
+        i = ssh_list_get_iterator(session->packet_callbacks);
+    }
     while (i != NULL) {
         cb = ssh_iterator_value(ssh_packet_callbacks, i);
         i = i->next;
@@ -1498,6 +1557,12 @@ void ssh_packet_process(ssh_session session, uint8_t type)
         }
     }
 
+    /* a handler may process more packets while it still holds arena strings */
+    session->packet_arena.depth--;
+    if (session->packet_arena.depth == 0) {
+        ssh_arena_reset(&session->packet_arena);
+    }
+
     if (rc == SSH_PACKET_NOT_USED) {
         SSH_LOG(SSH_LOG_RARE, "Couldn't do anything with packet type %d", type);
         rc = ssh_packet_send_unimplemented(session, session->recv_seq - 1);
@@ -1517,10 +1582,9 @@ void ssh_packet_process(ssh_session session, uint8_t type)
 int ssh_packet_send_unimplemented(ssh_session session, uint32_t seqnum){
     int rc;
 
-    rc = ssh_buffer_pack(session->out_buffer,
-                         "bd",
-                         SSH2_MSG_UNIMPLEMENTED,
-                         seqnum);
+    rc = ssh_buffer_pack_bd(session->out_buffer,
+                            SSH2_MSG_UNIMPLEMENTED,
+                            seqnum);
     if (rc != SSH_OK) {
         ssh_set_error_oom(session);
         return SSH_ERROR;
@@ -1577,15 +1641,13 @@ int ssh_packet_parse_type(struct ssh_session_struct *session)
 }
 
 /*
- * This function places the outgoing packet buffer into an outgoing
- * socket buffer
+ * This function hands the outgoing packet buffer over to the socket, which
+ * queues it as is and gives an empty buffer back
  */
 static int ssh_packet_write(ssh_session session) {
   int rc = SSH_ERROR;
 
-  rc=ssh_socket_write(session->socket,
-      ssh_buffer_get(session->out_buffer),
-      ssh_buffer_get_len(session->out_buffer));
+  rc = ssh_socket_write_buffer(session->socket, &session->out_buffer);
 
   return rc;
 }
@@ -1647,7 +1709,7 @@ static int packet_send2(ssh_session session)
     if (crypto != NULL) {
         int ok;
 
-        ok = ssh_get_random(padding_data, padding_size, 0);
+        ok = ssh_get_random_padding(padding_data, padding_size);
         if (!ok) {
             ssh_set_error(session, SSH_FATAL, "PRNG error");
             goto error;
@@ -1713,20 +1775,27 @@ static int packet_send2(ssh_session session)
         session->raw_counter->out_packets++;
     }
 
-    SSH_LOG(SSH_LOG_PACKET,
-            "packet: wrote [type=%u, len=%u, padding_size=%hhd, comp=%u, "
-            "payload=%u]",
-            type,
-            finallen,
-            padding_size,
-            compsize,
-            payloadsize);
+    SSH_TRACE_LOG(SSH_TRACE_PACKET_SEND, type, finallen, payloadsize,
+                  SSH_LOG_PACKET,
+                  "packet: wrote [type=%u, len=%u, padding_size=%hhd, comp=%u, "
+                  "payload=%u]",
+                  type,
+                  finallen,
+                  padding_size,
+                  compsize,
+                  payloadsize);
 
     rc = ssh_buffer_reinit(session->out_buffer);
     if (rc < 0) {
         rc = SSH_ERROR;
         goto error;
     }
+    /* room for the header of the next packet, so prepending it is free */
+    rc = ssh_buffer_reserve_head(session->out_buffer, 5);
+    if (rc < 0) {
+        rc = SSH_ERROR;
+        goto error;
+    }
 
     /* We sent the NEWKEYS so any further packet needs to be encrypted
      * with the new keys. We can not switch both directions (need to decrypt
@@ -1761,6 +1830,60 @@ ssh_packet_in_rekey(ssh_session session)
            (session->dh_handshake_state != DH_STATE_FINISHED);
 }
 
+/* Our NEWKEYS is out, packets delayed by the rekey can leave now */
+static void ssh_packet_rekey_done(ssh_session session)
+{
+    struct ssh_rekey_stats *stats = &session->rekey_stats;
+    struct ssh_timestamp now;
+    int ms;
+
+    if ((session->flags & SSH_SESSION_FLAG_AUTHENTICATED) == 0) {
+        return;
+    }
+    stats->rekeys++;
+
+    if (!session->rekey_stalled) {
+        stats->stall_last = 0;
+        return;
+    }
+    session->rekey_stalled = false;
+
+    ssh_timestamp_init(&now);
+    ms = ssh_timestamp_difference(&session->rekey_stall_start, &now);
+    if (ms < 0) {
+        ms = 0;
+    }
+    stats->stall_last = ms;
+    stats->stall_max = MAX(stats->stall_max, stats->stall_last);
+    stats->stall_total += ms;
+
+    SSH_TRACE_LOG(SSH_TRACE_REKEY_DONE, ms, 0, 0,
+                  SSH_LOG_PACKET, "Rekey delayed outgoing packets for %d ms", ms);
+}
+
+/**
+ * @brief Get the rekey counters of a session.
+ *
+ * The stall is the time from the first packet a rekey delayed until our
+ * NEWKEYS let it go.
+ *
+ * @param[in]  session  The SSH session.
+ *
+ * @param[out] stats    Where to copy the counters.
+ *
+ * @return              SSH_OK, or SSH_ERROR on invalid arguments.
+ */
+int ssh_get_rekey_stats(ssh_session session, struct ssh_rekey_stats *stats)
+{
+    if (session == NULL || stats == NULL) {
+        return SSH_ERROR;
+    }
+
+    *stats = session->rekey_stats;
+
+    return SSH_OK;
+}
+
 int ssh_packet_send(ssh_session session)
 {
     uint32_t payloadsize;
@@ -1783,10 +1906,15 @@ int ssh_packet_send(ssh_session session)
      */
     if (need_rekey || (in_rekey && !ssh_packet_is_kex(type))) {
         if (need_rekey) {
-            SSH_LOG(SSH_LOG_PACKET, "Outgoing packet triggered rekey");
+            SSH_TRACE_LOG(SSH_TRACE_REKEY_START, 1, 0, 0,
+                          SSH_LOG_PACKET, "Outgoing packet triggered rekey");
         }
         /* Queue the current packet -- we will send it after the rekey */
         SSH_LOG(SSH_LOG_PACKET, "Queuing packet type %d", type);
+        if (!session->rekey_stalled) {
+            ssh_timestamp_init(&session->rekey_stall_start);
+            session->rekey_stalled = true;
+        }
         rc = ssh_list_append(session->out_queue, session->out_buffer);
         if (rc != SSH_OK) {
             return SSH_ERROR;
@@ -1816,6 +1944,7 @@ int ssh_packet_send(ssh_session session)
     if (rc == SSH_OK && type == SSH2_MSG_NEWKEYS) {
         struct ssh_iterator *it;
 
+        ssh_packet_rekey_done(session);
         for (it = ssh_list_get_iterator(session->out_queue);
              it != NULL;
              it = ssh_list_get_iterator(session->out_queue)) {
@@ -1826,7 +1955,8 @@ int ssh_packet_send(ssh_session session)
             payloadsize = ssh_buffer_get_len(next_buffer);
             if (ssh_packet_need_rekey(session, payloadsize)) {
                 /* Sigh ... we still can not send this packet. Repeat. */
-                SSH_LOG(SSH_LOG_PACKET, "Queued packet triggered rekey");
+                SSH_TRACE_LOG(SSH_TRACE_REKEY_START, 2, 0, 0,
+                              SSH_LOG_PACKET, "Queued packet triggered rekey");
                 return ssh_send_rekex(session);
             }
             SSH_BUFFER_FREE(session->out_buffer);
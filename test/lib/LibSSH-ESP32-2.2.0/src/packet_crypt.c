@@ -43,6 +43,25 @@
 #include "libssh/crypto.h"
 #include "libssh/buffer.h"
 #include "libssh/bytearray.h"
+#ifdef HAVE_LIBMBEDCRYPTO
+#include "libssh/crypto_provider.h"
+#endif /* HAVE_LIBMBEDCRYPTO */
+
+/* MAC of a packet with sequence number seq, already in network order */
+static void packet_hmac(HMACCTX ctx,
+                        uint32_t seq,
+                        const void *data,
+                        size_t len,
+                        unsigned char *hmacbuf,
+                        unsigned int *hmaclen)
+{
+    hmac_update(ctx, (unsigned char *)&seq, sizeof(uint32_t));
+    hmac_update(ctx, data, len);
+#ifdef HAVE_LIBMBEDCRYPTO
+    ssh_crypto_provider_count_hmac(ctx, len);
+#endif /* HAVE_LIBMBEDCRYPTO */
+    hmac_final(ctx, hmacbuf, hmaclen);
+}
 
 /** @internal
  * @brief decrypt the packet length from a raw encrypted packet, and store the first decrypted
@@ -185,9 +204,7 @@ unsigned char *ssh_packet_encrypt(ssh_session session, void *data, uint32_t len)
           }
 
           if (!etm) {
-              hmac_update(ctx, (unsigned char *)&seq, sizeof(uint32_t));
-              hmac_update(ctx, data, len);
-              hmac_final(ctx, crypto->hmacbuf, &finallen);
+              packet_hmac(ctx, seq, data, len, crypto->hmacbuf, &finallen);
           }
       }
 
@@ -197,9 +214,7 @@ unsigned char *ssh_packet_encrypt(ssh_session session, void *data, uint32_t len)
       if (type != SSH_HMAC_NONE) {
           if (etm) {
               PUSH_BE_U32(data, 0, len - etm_packet_offset);
-              hmac_update(ctx, (unsigned char *)&seq, sizeof(uint32_t));
-              hmac_update(ctx, data, len);
-              hmac_final(ctx, crypto->hmacbuf, &finallen);
+              packet_hmac(ctx, seq, data, len, crypto->hmacbuf, &finallen);
           }
 #ifdef DEBUG_CRYPTO
           ssh_log_hexdump("mac: ", data, len);
@@ -259,9 +274,7 @@ int ssh_packet_hmac_verify(ssh_session session,
 
   seq = htonl(session->recv_seq);
 
-  hmac_update(ctx, (unsigned char *) &seq, sizeof(uint32_t));
-  hmac_update(ctx, data, len);
-  hmac_final(ctx, hmacbuf, &hmaclen);
+  packet_hmac(ctx, seq, data, len, hmacbuf, &hmaclen);
 
 #ifdef DEBUG_CRYPTO
   ssh_log_hexdump("received mac",mac,hmaclen);
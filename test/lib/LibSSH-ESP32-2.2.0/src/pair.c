@@ -0,0 +1,295 @@
+/*
+ * pair.c - a client and a server session joined in process
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "libssh_esp32_config.h"
+
+#if defined(WITH_SERVER) && defined(HAVE_SOCKETPAIR)
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "libssh/priv.h"
+#include "libssh/server.h"
+#include "libssh/session.h"
+#include "libssh/socket.h"
+
+/*
+ * Both sessions are non-blocking and share one ssh_event, so whichever side
+ * polls also moves the other one along. Nothing waits on a clock: a round
+ * polls with a zero timeout, and when neither socket saw any activity in a
+ * round, both sides are waiting on each other.
+ */
+
+/* rounds without activity before ssh_pair_run() gives up */
+#define SSH_PAIR_MAX_IDLE 2
+
+struct ssh_pair_struct {
+    ssh_session client;
+    ssh_session server;
+    ssh_event event;
+    bool connected;
+    bool kex_done;
+    bool in_event;
+};
+
+/**
+ * @addtogroup libssh_server
+ *
+ * @{
+ */
+
+/**
+ * @brief Join a client and a server session over a socketpair.
+ *
+ * The server session is accepted on one end with ssh_bind_accept_fd(), the
+ * client is given the other one as SSH_OPTIONS_FD. Both are made
+ * non-blocking. Options, including the server callbacks, can still be set
+ * until ssh_pair_handshake() is called. A client without a host name does
+ * not read the OpenSSH configuration files.
+ *
+ * The sessions stay owned by the caller and must outlive the pair. Each
+ * closes its end of the socketpair when it is freed.
+ *
+ * @param[in]  sshbind  The bind holding the server's host keys.
+ *
+ * @param[in]  client   A new session to become the client.
+ *
+ * @param[in]  server   A new session to become the server.
+ *
+ * @return              The pair, or NULL on error.
+ */
+ssh_pair ssh_pair_new(ssh_bind sshbind, ssh_session client, ssh_session server)
+{
+    ssh_pair pair = NULL;
+    socket_t fds[2];
+    bool process_config = false;
+    int rc;
+
+    if (sshbind == NULL || client == NULL || server == NULL) {
+        return NULL;
+    }
+
+    pair = calloc(1, sizeof(struct ssh_pair_struct));
+    if (pair == NULL) {
+        ssh_set_error_oom(sshbind);
+        return NULL;
+    }
+
+    pair->event = ssh_event_new();
+    if (pair->event == NULL) {
+        ssh_set_error_oom(sshbind);
+        SAFE_FREE(pair);
+        return NULL;
+    }
+
+    rc = socketpair(AF_UNIX, SOCK_STREAM, 0, fds);
+    if (rc < 0) {
+        ssh_set_error(sshbind, SSH_FATAL,
+                      "Creating socketpair: %s", strerror(errno));
+        goto error;
+    }
+
+    rc = ssh_bind_accept_fd(sshbind, server, fds[1]);
+    if (rc != SSH_OK) {
+        close(fds[0]);
+        /* the server session owns its end once the socket was set */
+        if (ssh_get_fd(server) != fds[1]) {
+            close(fds[1]);
+        }
+        goto error;
+    }
+
+    ssh_options_set(client, SSH_OPTIONS_FD, &fds[0]);
+    if (client->opts.host == NULL) {
+        ssh_options_set(client, SSH_OPTIONS_PROCESS_CONFIG, &process_config);
+    }
+
+    ssh_set_blocking(client, 0);
+    ssh_set_blocking(server, 0);
+
+    pair->client = client;
+    pair->server = server;
+
+    return pair;
+
+error:
+    ssh_event_free(pair->event);
+    SAFE_FREE(pair);
+    return NULL;
+}
+
+static unsigned int ssh_pair_activity(ssh_pair pair)
+{
+    return ssh_socket_get_activity(pair->client->socket) +
+           ssh_socket_get_activity(pair->server->socket);
+}
+
+/**
+ * @brief Call a function until it is done, polling both sessions in between.
+ *
+ * This is how a pair is driven once ssh_pair_handshake() succeeded: fn
+ * calls the non-blocking API of either session, for example
+ * ssh_userauth_password() or ssh_channel_write(), and reports whether it
+ * needs to be called again.
+ *
+ * @param[in]  pair     The pair to drive.
+ *
+ * @param[in]  fn       Returns SSH_OK when done, SSH_AGAIN to be called
+ *                      again after a poll or SSH_ERROR.
+ *
+ * @param[in]  userdata Passed to fn.
+ *
+ * @return              SSH_OK once fn returned it, SSH_ERROR if fn failed
+ *                      or neither session made any progress. The error is
+ *                      set on the client session.
+ */
+int ssh_pair_run(ssh_pair pair, int (*fn)(void *userdata), void *userdata)
+{
+    unsigned int activity;
+    int idle = 0;
+    int rc;
+
+    if (pair == NULL || fn == NULL) {
+        return SSH_ERROR;
+    }
+
+    for (;;) {
+        activity = ssh_pair_activity(pair);
+
+        rc = fn(userdata);
+        if (rc != SSH_AGAIN) {
+            return rc == SSH_OK ? SSH_OK : SSH_ERROR;
+        }
+
+        rc = ssh_event_dopoll(pair->event, 0);
+        if (rc == SSH_ERROR) {
+            ssh_set_error(pair->client, SSH_FATAL,
+                          "Polling the session pair failed");
+            return SSH_ERROR;
+        }
+
+        if (ssh_pair_activity(pair) != activity) {
+            idle = 0;
+        } else if (++idle > SSH_PAIR_MAX_IDLE) {
+            ssh_set_error(pair->client, SSH_FATAL,
+                          "Session pair stalled, neither side can progress");
+            return SSH_ERROR;
+        }
+    }
+}
+
+static int ssh_pair_handshake_step(void *userdata)
+{
+    ssh_pair pair = userdata;
+    int rc;
+
+    if (!pair->connected) {
+        rc = ssh_connect(pair->client);
+        if (rc == SSH_ERROR) {
+            return SSH_ERROR;
+        }
+        pair->connected = rc == SSH_OK;
+    }
+
+    if (!pair->kex_done) {
+        rc = ssh_handle_key_exchange(pair->server);
+        if (rc == SSH_ERROR) {
+            ssh_set_error(pair->client, SSH_FATAL,
+                          "Server side of the key exchange failed: %s",
+                          ssh_get_error(pair->server));
+            return SSH_ERROR;
+        }
+        pair->kex_done = rc == SSH_OK;
+    }
+
+    /* the sockets only have poll handles once both calls ran */
+    if (!pair->in_event) {
+        if (ssh_event_add_session(pair->event, pair->client) != SSH_OK ||
+            ssh_event_add_session(pair->event, pair->server) != SSH_OK) {
+            ssh_set_error(pair->client, SSH_FATAL,
+                          "Adding the session pair to its event failed");
+            return SSH_ERROR;
+        }
+        pair->in_event = true;
+    }
+
+    return pair->connected && pair->kex_done ? SSH_OK : SSH_AGAIN;
+}
+
+/**
+ * @brief Run the banner exchange and the key exchange of both sessions.
+ *
+ * @param[in]  pair     The pair to connect.
+ *
+ * @return              SSH_OK when the client is ready to authenticate,
+ *                      SSH_ERROR otherwise, with the error set on the
+ *                      client session.
+ */
+int ssh_pair_handshake(ssh_pair pair)
+{
+    return ssh_pair_run(pair, ssh_pair_handshake_step, pair);
+}
+
+/**
+ * @brief Get the event both sessions of a pair are polled from.
+ *
+ * More fds or connectors can be added to it. Blocking calls on either
+ * session also poll it, so they don't deadlock waiting for the other side.
+ *
+ * @param[in]  pair     The pair.
+ *
+ * @return              The event, or NULL.
+ */
+ssh_event ssh_pair_get_event(ssh_pair pair)
+{
+    if (pair == NULL) {
+        return NULL;
+    }
+
+    return pair->event;
+}
+
+/**
+ * @brief Free a pair, leaving its sessions alone.
+ *
+ * @param[in]  pair     The pair to free.
+ */
+void ssh_pair_free(ssh_pair pair)
+{
+    if (pair == NULL) {
+        return;
+    }
+
+    if (pair->in_event) {
+        ssh_event_remove_session(pair->event, pair->client);
+        ssh_event_remove_session(pair->event, pair->server);
+    }
+    ssh_event_free(pair->event);
+    SAFE_FREE(pair);
+}
+
+/** @} */
+
+#endif /* WITH_SERVER && HAVE_SOCKETPAIR */
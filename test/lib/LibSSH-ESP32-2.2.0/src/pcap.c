@@ -0,0 +1,634 @@
+/*
+ * pcap.c - capture of the cleartext packets of a session
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "libssh_esp32_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifndef _WIN32
+#include <sys/socket.h>
+#include <netinet/in.h>
+#endif
+
+#include "libssh/priv.h"
+#include "libssh/bytearray.h"
+#include "libssh/misc.h"
+#include "libssh/pcap.h"
+#include "libssh/session.h"
+
+#ifdef WITH_PCAP
+
+/*
+ * Every SSH packet is written as the payload of a made up IPv4/TCP segment,
+ * so Wireshark and tcptrace take the file as it is. The file is big endian
+ * throughout, the magic number tells readers so.
+ *
+ * Records are assembled in a buffer of SSH_PCAP_BUFFER_SIZE bytes, which is
+ * written out with one fwrite() when the next record doesn't fit, on
+ * ssh_pcap_file_flush() and on close. The packet path only pays for a
+ * memcpy, not for a write to the file system.
+ */
+#ifndef SSH_PCAP_BUFFER_SIZE
+#define SSH_PCAP_BUFFER_SIZE (64 * 1024)
+#endif
+
+#define PCAP_MAGIC 0xa1b2c3d4
+#define PCAP_VERSION_MAJOR 2
+#define PCAP_VERSION_MINOR 4
+#define PCAP_SNAPLEN 262144
+#define PCAP_HEADER_LEN 24
+#define PCAP_RECORD_HEADER_LEN 16
+
+#define DLT_RAW 12 /* raw IP */
+
+#define IP_HEADER_LEN 20
+#define TCP_HEADER_LEN 20
+/* largest payload of one made up segment */
+#define SEGMENT_MAX (0xffff - IP_HEADER_LEN - TCP_HEADER_LEN)
+
+/* TCP flags */
+#define TH_PUSH 0x08
+#define TH_ACK 0x10
+
+struct ssh_pcap_file_struct {
+    FILE *output;
+    uint8_t *buffer;
+    size_t used;
+    uint16_t ipsequence;
+    /*
+     * Records are stamped with the wall clock of the open plus the
+     * monotonic time since, so a clock step during a capture can't reorder
+     * them.
+     */
+    time_t base_sec;
+    long base_usec;
+    struct ssh_timestamp base;
+};
+
+struct ssh_pcap_context_struct {
+    ssh_session session;
+    ssh_pcap_file file;
+    int connected;
+    /* the made up endpoints, in network byte order */
+    uint8_t ipsource[4];
+    uint8_t ipdest[4];
+    uint8_t portsource[2];
+    uint8_t portdest[2];
+    uint32_t outsequence;
+    uint32_t insequence;
+};
+
+/**
+ * @addtogroup libssh_misc
+ *
+ * @{
+ */
+
+/**
+ * @brief Allocate a pcap file, to be opened with ssh_pcap_file_open().
+ *
+ * @return              The new pcap file, or NULL on error.
+ */
+ssh_pcap_file ssh_pcap_file_new(void)
+{
+    struct ssh_pcap_file_struct *pcap = NULL;
+
+    pcap = calloc(1, sizeof(struct ssh_pcap_file_struct));
+    if (pcap == NULL) {
+        return NULL;
+    }
+
+    return pcap;
+}
+
+static int ssh_pcap_file_write(ssh_pcap_file pcap, const void *data,
+                               size_t len)
+{
+    if (len > 0 && fwrite(data, len, 1, pcap->output) != 1) {
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Write what is buffered to the file.
+ *
+ * Long running captures can call this now and then, so a crash loses
+ * little of the file.
+ *
+ * @param[in]  pcap     The pcap file.
+ *
+ * @return              SSH_OK, SSH_ERROR if it isn't open or the write
+ *                      failed.
+ */
+int ssh_pcap_file_flush(ssh_pcap_file pcap)
+{
+    int rc;
+
+    if (pcap == NULL || pcap->output == NULL) {
+        return SSH_ERROR;
+    }
+
+    rc = ssh_pcap_file_write(pcap, pcap->buffer, pcap->used);
+    pcap->used = 0;
+    if (rc != SSH_OK) {
+        return rc;
+    }
+
+    return fflush(pcap->output) == 0 ? SSH_OK : SSH_ERROR;
+}
+
+/**
+ * @brief Create a file and write the pcap header to it.
+ *
+ * An already open file is closed first.
+ *
+ * @param[in]  pcap     The pcap file.
+ *
+ * @param[in]  filename The file to create or truncate.
+ *
+ * @return              SSH_OK, or SSH_ERROR.
+ */
+int ssh_pcap_file_open(ssh_pcap_file pcap, const char *filename)
+{
+    uint8_t header[PCAP_HEADER_LEN];
+    struct timespec now;
+
+    if (pcap == NULL || filename == NULL) {
+        return SSH_ERROR;
+    }
+    if (pcap->output != NULL) {
+        ssh_pcap_file_close(pcap);
+    }
+
+    pcap->buffer = malloc(SSH_PCAP_BUFFER_SIZE);
+    if (pcap->buffer == NULL) {
+        return SSH_ERROR;
+    }
+    pcap->output = fopen(filename, "wb");
+    if (pcap->output == NULL) {
+        SAFE_FREE(pcap->buffer);
+        return SSH_ERROR;
+    }
+    /* our buffer is the only one */
+    setvbuf(pcap->output, NULL, _IONBF, 0);
+
+    clock_gettime(CLOCK_REALTIME, &now);
+    pcap->base_sec = now.tv_sec;
+    pcap->base_usec = now.tv_nsec / 1000;
+    ssh_timestamp_init(&pcap->base);
+    pcap->ipsequence = 0;
+
+    PUSH_BE_U32(header, 0, PCAP_MAGIC);
+    PUSH_BE_U16(header, 4, PCAP_VERSION_MAJOR);
+    PUSH_BE_U16(header, 6, PCAP_VERSION_MINOR);
+    /* GMT to local correction and accuracy of the timestamps */
+    PUSH_BE_U32(header, 8, 0);
+    PUSH_BE_U32(header, 12, 0);
+    PUSH_BE_U32(header, 16, PCAP_SNAPLEN);
+    PUSH_BE_U32(header, 20, DLT_RAW);
+    memcpy(pcap->buffer, header, sizeof(header));
+    pcap->used = sizeof(header);
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Flush and close a pcap file. It can be opened again.
+ *
+ * @param[in]  pcap     The pcap file.
+ *
+ * @return              SSH_OK, or SSH_ERROR if it wasn't open or the last
+ *                      write failed.
+ */
+int ssh_pcap_file_close(ssh_pcap_file pcap)
+{
+    int rc;
+
+    if (pcap == NULL || pcap->output == NULL) {
+        return SSH_ERROR;
+    }
+
+    rc = ssh_pcap_file_flush(pcap);
+    if (fclose(pcap->output) != 0) {
+        rc = SSH_ERROR;
+    }
+    pcap->output = NULL;
+    SAFE_FREE(pcap->buffer);
+
+    return rc;
+}
+
+/**
+ * @brief Close and free a pcap file.
+ *
+ * The sessions it was given to must be freed first.
+ *
+ * @param[in]  pcap     The pcap file.
+ */
+void ssh_pcap_file_free(ssh_pcap_file pcap)
+{
+    if (pcap == NULL) {
+        return;
+    }
+
+    ssh_pcap_file_close(pcap);
+    SAFE_FREE(pcap);
+}
+
+/** @} */
+
+static void ssh_pcap_file_stamp(ssh_pcap_file pcap, uint8_t *record)
+{
+    struct ssh_timestamp now;
+    long usec;
+    time_t sec;
+
+    ssh_timestamp_init(&now);
+    sec = pcap->base_sec + (now.seconds - pcap->base.seconds);
+    usec = pcap->base_usec + (now.useconds - pcap->base.useconds);
+    while (usec < 0) {
+        usec += 1000000;
+        sec--;
+    }
+    while (usec >= 1000000) {
+        usec -= 1000000;
+        sec++;
+    }
+
+    PUSH_BE_U32(record, 0, (uint32_t)sec);
+    PUSH_BE_U32(record, 4, (uint32_t)usec);
+}
+
+/*
+ * Reserves room for a record of len bytes after its record header. Records
+ * too large for the buffer get NULL and have to be written directly.
+ */
+static uint8_t *ssh_pcap_file_reserve(ssh_pcap_file pcap, size_t len)
+{
+    uint8_t *record = NULL;
+
+    len += PCAP_RECORD_HEADER_LEN;
+    if (SSH_PCAP_BUFFER_SIZE - pcap->used < len) {
+        if (ssh_pcap_file_write(pcap, pcap->buffer, pcap->used) != SSH_OK) {
+            return NULL;
+        }
+        pcap->used = 0;
+    }
+    if (len > SSH_PCAP_BUFFER_SIZE) {
+        return NULL;
+    }
+
+    record = pcap->buffer + pcap->used;
+    pcap->used += len;
+
+    return record;
+}
+
+/**
+ * @internal
+ * @brief Write the contents of a buffer as one record.
+ */
+int ssh_pcap_file_write_packet(ssh_pcap_file pcap,
+                               ssh_buffer packet,
+                               uint32_t original_len)
+{
+    uint8_t header[PCAP_RECORD_HEADER_LEN];
+    uint32_t len;
+    uint8_t *record = NULL;
+
+    if (pcap == NULL || pcap->output == NULL) {
+        return SSH_ERROR;
+    }
+
+    len = ssh_buffer_get_len(packet);
+    ssh_pcap_file_stamp(pcap, header);
+    PUSH_BE_U32(header, 8, len);
+    PUSH_BE_U32(header, 12, original_len);
+
+    record = ssh_pcap_file_reserve(pcap, len);
+    if (record == NULL) {
+        if (ssh_pcap_file_write(pcap, header, sizeof(header)) != SSH_OK ||
+            ssh_pcap_file_write(pcap, ssh_buffer_get(packet), len) != SSH_OK) {
+            return SSH_ERROR;
+        }
+        return SSH_OK;
+    }
+    memcpy(record, header, sizeof(header));
+    memcpy(record + sizeof(header), ssh_buffer_get(packet), len);
+
+    return SSH_OK;
+}
+
+ssh_pcap_context ssh_pcap_context_new(ssh_session session)
+{
+    ssh_pcap_context ctx = NULL;
+
+    ctx = calloc(1, sizeof(struct ssh_pcap_context_struct));
+    if (ctx == NULL) {
+        ssh_set_error_oom(session);
+        return NULL;
+    }
+    ctx->session = session;
+
+    return ctx;
+}
+
+void ssh_pcap_context_free(ssh_pcap_context ctx)
+{
+    SAFE_FREE(ctx);
+}
+
+void ssh_pcap_context_set_file(ssh_pcap_context ctx, ssh_pcap_file pcap)
+{
+    ctx->file = pcap;
+}
+
+/*
+ * Takes the endpoints from the socket when it is IPv4. Anything else is
+ * written as 127.0.0.1:1 talking to 127.0.0.2:22, the same for every
+ * session.
+ */
+static void ssh_pcap_context_connect(ssh_pcap_context ctx)
+{
+    static const uint8_t local[4] = {127, 0, 0, 1};
+    static const uint8_t remote[4] = {127, 0, 0, 2};
+#ifndef _WIN32
+    struct sockaddr_in addr;
+    socklen_t len;
+    socket_t fd;
+#endif
+
+    memcpy(ctx->ipsource, local, sizeof(ctx->ipsource));
+    memcpy(ctx->ipdest, remote, sizeof(ctx->ipdest));
+    PUSH_BE_U16(ctx->portsource, 0, 1);
+    PUSH_BE_U16(ctx->portdest, 0, 22);
+
+#ifndef _WIN32
+    fd = ssh_get_fd(ctx->session);
+    if (fd != SSH_INVALID_SOCKET) {
+        len = sizeof(addr);
+        if (getsockname(fd, (struct sockaddr *)&addr, &len) == 0 &&
+            addr.sin_family == AF_INET) {
+            memcpy(ctx->ipsource, &addr.sin_addr.s_addr, 4);
+            memcpy(ctx->portsource, &addr.sin_port, 2);
+        }
+        len = sizeof(addr);
+        if (getpeername(fd, (struct sockaddr *)&addr, &len) == 0 &&
+            addr.sin_family == AF_INET) {
+            memcpy(ctx->ipdest, &addr.sin_addr.s_addr, 4);
+            memcpy(ctx->portdest, &addr.sin_port, 2);
+        }
+    }
+#endif
+
+    /* both sequences start at 1, as after a handshake from 0 */
+    ctx->outsequence = 1;
+    ctx->insequence = 1;
+    ctx->connected = 1;
+}
+
+static uint16_t ssh_pcap_ip_checksum(const uint8_t *header)
+{
+    uint32_t sum = 0;
+    int i;
+
+    for (i = 0; i < IP_HEADER_LEN; i += 2) {
+        sum += PULL_BE_U16(header, i);
+    }
+    while (sum >> 16) {
+        sum = (sum & 0xffff) + (sum >> 16);
+    }
+
+    return (uint16_t)~sum;
+}
+
+static void ssh_pcap_context_headers(ssh_pcap_context ctx,
+                                     enum ssh_pcap_direction direction,
+                                     uint8_t *ip,
+                                     uint32_t len)
+{
+    uint8_t *tcp = ip + IP_HEADER_LEN;
+    uint32_t *sequence = NULL;
+    uint32_t ack;
+    uint16_t id;
+
+    /* IPv4, no options */
+    PUSH_BE_U8(ip, 0, 0x45);
+    PUSH_BE_U8(ip, 1, 0);
+    PUSH_BE_U16(ip, 2, IP_HEADER_LEN + TCP_HEADER_LEN + len);
+    /* PUSH_BE_U16 evaluates its value twice */
+    id = ctx->file->ipsequence++;
+    PUSH_BE_U16(ip, 4, id);
+    /* don't fragment */
+    PUSH_BE_U16(ip, 6, 0x4000);
+    PUSH_BE_U8(ip, 8, 64);
+    PUSH_BE_U8(ip, 9, 6);
+    PUSH_BE_U16(ip, 10, 0);
+
+    /* TCP, without checksum */
+    if (direction == SSH_PCAP_DIR_OUT) {
+        memcpy(ip + 12, ctx->ipsource, 4);
+        memcpy(ip + 16, ctx->ipdest, 4);
+        memcpy(tcp, ctx->portsource, 2);
+        memcpy(tcp + 2, ctx->portdest, 2);
+        sequence = &ctx->outsequence;
+        ack = ctx->insequence;
+    } else {
+        memcpy(ip + 12, ctx->ipdest, 4);
+        memcpy(ip + 16, ctx->ipsource, 4);
+        memcpy(tcp, ctx->portdest, 2);
+        memcpy(tcp + 2, ctx->portsource, 2);
+        sequence = &ctx->insequence;
+        ack = ctx->outsequence;
+    }
+    PUSH_BE_U16(ip, 10, ssh_pcap_ip_checksum(ip));
+
+    PUSH_BE_U32(tcp, 4, *sequence);
+    PUSH_BE_U32(tcp, 8, ack);
+    PUSH_BE_U8(tcp, 12, (TCP_HEADER_LEN / 4) << 4);
+    PUSH_BE_U8(tcp, 13, TH_PUSH | TH_ACK);
+    PUSH_BE_U16(tcp, 14, 65535);
+    PUSH_BE_U16(tcp, 16, 0);
+    PUSH_BE_U16(tcp, 18, 0);
+
+    *sequence += len;
+}
+
+/**
+ * @internal
+ * @brief Write a cleartext packet as one or more TCP segments.
+ *
+ * Packets larger than an IPv4 datagram are split, every segment is a
+ * record of its own with the same timestamp.
+ *
+ * @param[in]  ctx      The session's pcap context.
+ *
+ * @param[in]  direction Whether the packet was sent or received.
+ *
+ * @param[in]  data     The packet.
+ *
+ * @param[in]  len      Bytes of it to write.
+ *
+ * @param[in]  origlen  Length of the whole packet.
+ *
+ * @return              SSH_OK, or SSH_ERROR.
+ */
+int ssh_pcap_context_write(ssh_pcap_context ctx,
+                           enum ssh_pcap_direction direction,
+                           void *data,
+                           uint32_t len,
+                           uint32_t origlen)
+{
+    uint8_t header[PCAP_RECORD_HEADER_LEN + IP_HEADER_LEN + TCP_HEADER_LEN];
+    ssh_pcap_file pcap = NULL;
+    uint8_t *payload = data;
+    uint8_t *record = NULL;
+    uint32_t seglen;
+    uint32_t segorig;
+    uint32_t done = 0;
+
+    if (ctx == NULL || ctx->file == NULL || ctx->file->output == NULL) {
+        return SSH_ERROR;
+    }
+    pcap = ctx->file;
+    if (!ctx->connected) {
+        ssh_pcap_context_connect(ctx);
+    }
+
+    ssh_pcap_file_stamp(pcap, header);
+    do {
+        seglen = len - done > SEGMENT_MAX ? SEGMENT_MAX : len - done;
+        /* what wasn't captured belongs to the last segment */
+        segorig = seglen;
+        if (done + seglen == len && origlen > len) {
+            segorig = origlen - done > SEGMENT_MAX ? SEGMENT_MAX
+                                                   : origlen - done;
+        }
+
+        PUSH_BE_U32(header, 8, IP_HEADER_LEN + TCP_HEADER_LEN + seglen);
+        PUSH_BE_U32(header, 12, IP_HEADER_LEN + TCP_HEADER_LEN + segorig);
+        ssh_pcap_context_headers(ctx,
+                                 direction,
+                                 header + PCAP_RECORD_HEADER_LEN,
+                                 segorig);
+
+        record = ssh_pcap_file_reserve(pcap,
+                                       IP_HEADER_LEN + TCP_HEADER_LEN + seglen);
+        if (record == NULL) {
+            if (ssh_pcap_file_write(pcap, header, sizeof(header)) != SSH_OK ||
+                ssh_pcap_file_write(pcap, payload + done, seglen) != SSH_OK) {
+                return SSH_ERROR;
+            }
+        } else {
+            memcpy(record, header, sizeof(header));
+            memcpy(record + sizeof(header), payload + done, seglen);
+        }
+        done += seglen;
+    } while (done < len);
+
+    return SSH_OK;
+}
+
+/**
+ * @addtogroup libssh_session
+ *
+ * @{
+ */
+
+/**
+ * @brief Capture the cleartext packets of a session into a pcap file.
+ *
+ * Several sessions of one thread can share a file. It must be open and
+ * must outlive the sessions.
+ *
+ * @param[in]  session  The session to capture.
+ *
+ * @param[in]  pcap     An open pcap file.
+ *
+ * @return              SSH_OK, or SSH_ERROR.
+ */
+int ssh_set_pcap_file(ssh_session session, ssh_pcap_file pcap)
+{
+    ssh_pcap_context ctx = NULL;
+
+    ctx = ssh_pcap_context_new(session);
+    if (ctx == NULL) {
+        return SSH_ERROR;
+    }
+    ssh_pcap_context_set_file(ctx, pcap);
+
+    if (session->pcap_ctx != NULL) {
+        ssh_pcap_context_free(session->pcap_ctx);
+    }
+    session->pcap_ctx = ctx;
+
+    return SSH_OK;
+}
+
+/** @} */
+
+#else /* WITH_PCAP */
+
+/* the API is always there, it fails without WITH_PCAP */
+
+ssh_pcap_file ssh_pcap_file_new(void)
+{
+    return NULL;
+}
+
+int ssh_pcap_file_open(ssh_pcap_file pcap, const char *filename)
+{
+    (void)pcap;
+    (void)filename;
+    return SSH_ERROR;
+}
+
+int ssh_pcap_file_flush(ssh_pcap_file pcap)
+{
+    (void)pcap;
+    return SSH_ERROR;
+}
+
+int ssh_pcap_file_close(ssh_pcap_file pcap)
+{
+    (void)pcap;
+    return SSH_ERROR;
+}
+
+void ssh_pcap_file_free(ssh_pcap_file pcap)
+{
+    (void)pcap;
+}
+
+int ssh_set_pcap_file(ssh_session session, ssh_pcap_file pcap)
+{
+    (void)pcap;
+    ssh_set_error(session, SSH_REQUEST_DENIED,
+                  "Built without pcap support (WITH_PCAP)");
+    return SSH_ERROR;
+}
+
+#endif /* WITH_PCAP */
@@ -70,6 +70,11 @@
 #include "libssh/buffer.h"
 #include "libssh/misc.h"
 #include "libssh/agent.h"
+#include "libssh/threads.h"
+
+#ifndef SSH_KEY_CACHE_SIZE
+#define SSH_KEY_CACHE_SIZE 2
+#endif
 
 #ifndef MAX_LINE_SIZE
 #define MAX_LINE_SIZE 4096
@@ -990,6 +995,287 @@ int ssh_pki_import_privkey_file(const char *filename,
     return rc;
 }
 
+/*
+ * Private keys imported with ssh_pki_import_privkey_file_cached(). A client
+ * that authenticates with the same key on every connect would otherwise
+ * read, base64 decode and parse the file each time, and run bcrypt_pbkdf
+ * over it when it is encrypted. Like the known_hosts cache, a slot is
+ * reused for as long as the file's size and modification time don't
+ * change, and callers get copies.
+ */
+struct pki_key_cache_slot {
+    char *filename;
+    time_t mtime;
+    off_t size;
+    ssh_key key;
+    unsigned int used;
+};
+
+static struct pki_key_cache_slot pki_key_cache[SSH_KEY_CACHE_SIZE];
+static unsigned int pki_key_cache_clock;
+static SSH_MUTEX pki_key_cache_mutex = SSH_MUTEX_STATIC_INIT;
+
+static void pki_key_cache_slot_clear(struct pki_key_cache_slot *slot)
+{
+    ssh_key_free(slot->key);
+    SAFE_FREE(slot->filename);
+    ZERO_STRUCTP(slot);
+}
+
+/* Called with the cache mutex held */
+static struct pki_key_cache_slot *pki_key_cache_lookup(const char *filename)
+{
+    size_t i;
+
+    for (i = 0; i < SSH_KEY_CACHE_SIZE; i++) {
+        struct pki_key_cache_slot *slot = &pki_key_cache[i];
+
+        if (slot->filename != NULL && strcmp(slot->filename, filename) == 0) {
+            return slot;
+        }
+    }
+
+    return NULL;
+}
+
+/* Called with the cache mutex held, returns an emptied slot */
+static struct pki_key_cache_slot *pki_key_cache_victim(void)
+{
+    struct pki_key_cache_slot *victim = &pki_key_cache[0];
+    size_t i;
+
+    for (i = 0; i < SSH_KEY_CACHE_SIZE; i++) {
+        struct pki_key_cache_slot *slot = &pki_key_cache[i];
+
+        if (slot->filename == NULL) {
+            return slot;
+        }
+        if (slot->used < victim->used) {
+            victim = slot;
+        }
+    }
+    pki_key_cache_slot_clear(victim);
+
+    return victim;
+}
+
+/**
+ * @brief Import a private key from a file, keeping it for the next call.
+ *
+ * Works like ssh_pki_import_privkey_file(), but the parsed key is kept in
+ * memory and later calls for the same file only check its size and
+ * modification time and copy the key. The passphrase and auth function are
+ * only used when the file has to be read again, so anyone who can call this
+ * gets the key once it is cached. PKCS #11 URIs are never cached.
+ *
+ * @param[in]  filename The filename of the private key.
+ *
+ * @param[in]  passphrase The passphrase to decrypt the private key. Set to NULL
+ *                        if none is needed or it is unknown.
+ *
+ * @param[in]  auth_fn  An auth function you may want to use or NULL.
+ *
+ * @param[in]  auth_data Private data passed to the auth function.
+ *
+ * @param[out] pkey     A pointer to store the allocated ssh_key. You need to
+ *                      free the key.
+ *
+ * @returns SSH_OK on success, SSH_EOF if the file doesn't exist or permission
+ *          denied, SSH_ERROR otherwise.
+ *
+ * @see ssh_pki_key_cache_flush()
+ **/
+int ssh_pki_import_privkey_file_cached(const char *filename,
+                                       const char *passphrase,
+                                       ssh_auth_callback auth_fn,
+                                       void *auth_data,
+                                       ssh_key *pkey)
+{
+    struct pki_key_cache_slot *slot = NULL;
+    ssh_key key = NULL;
+    struct stat sb;
+    int rc;
+
+    if (pkey == NULL || filename == NULL || *filename == '\0') {
+        return SSH_ERROR;
+    }
+
+#ifdef WITH_PKCS11_URI
+    if (ssh_pki_is_uri(filename)) {
+        return ssh_pki_import_privkey_file(filename, passphrase, auth_fn,
+                                           auth_data, pkey);
+    }
+#endif
+
+    rc = stat(filename, &sb);
+    if (rc != 0) {
+        /* Let the import report the missing file */
+        return ssh_pki_import_privkey_file(filename, passphrase, auth_fn,
+                                           auth_data, pkey);
+    }
+
+    ssh_mutex_lock(&pki_key_cache_mutex);
+    slot = pki_key_cache_lookup(filename);
+    if (slot != NULL) {
+        if (slot->mtime == sb.st_mtime && slot->size == sb.st_size) {
+            slot->used = ++pki_key_cache_clock;
+            *pkey = ssh_key_dup(slot->key);
+            ssh_mutex_unlock(&pki_key_cache_mutex);
+            return *pkey != NULL ? SSH_OK : SSH_ERROR;
+        }
+        pki_key_cache_slot_clear(slot);
+    }
+    ssh_mutex_unlock(&pki_key_cache_mutex);
+
+    rc = ssh_pki_import_privkey_file(filename, passphrase, auth_fn,
+                                     auth_data, &key);
+    if (rc != SSH_OK) {
+        return rc;
+    }
+
+    *pkey = ssh_key_dup(key);
+    if (*pkey == NULL) {
+        ssh_key_free(key);
+        return SSH_ERROR;
+    }
+
+    ssh_mutex_lock(&pki_key_cache_mutex);
+    /* another thread may have filled it in the meantime */
+    slot = pki_key_cache_lookup(filename);
+    if (slot != NULL) {
+        pki_key_cache_slot_clear(slot);
+    } else {
+        slot = pki_key_cache_victim();
+    }
+    slot->filename = strdup(filename);
+    if (slot->filename == NULL) {
+        /* the caller still got its key */
+        ssh_key_free(key);
+    } else {
+        slot->mtime = sb.st_mtime;
+        slot->size = sb.st_size;
+        slot->key = key;
+        slot->used = ++pki_key_cache_clock;
+    }
+    ssh_mutex_unlock(&pki_key_cache_mutex);
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Drop the private keys kept by ssh_pki_import_privkey_file_cached().
+ *
+ * The keys are wiped from memory. ssh_finalize() does this as well.
+ */
+void ssh_pki_key_cache_flush(void)
+{
+    size_t i;
+
+    ssh_mutex_lock(&pki_key_cache_mutex);
+    for (i = 0; i < SSH_KEY_CACHE_SIZE; i++) {
+        if (pki_key_cache[i].filename != NULL) {
+            pki_key_cache_slot_clear(&pki_key_cache[i]);
+        }
+    }
+    ssh_mutex_unlock(&pki_key_cache_mutex);
+}
+
+/**
+ * @brief Build an ed25519 private key from its raw form.
+ *
+ * The raw form is the 32 byte private seed followed by the 32 byte public
+ * key, as it is stored inside an OpenSSH private key file. It is small
+ * enough to keep in flash or NVS and turning it back into a key is a copy,
+ * with no decoding or parsing.
+ *
+ * @param[in]  raw      The SSH_PKI_ED25519_RAW_LEN bytes of the key.
+ *
+ * @param[in]  len      The length of raw.
+ *
+ * @param[out] pkey     A pointer to store the allocated ssh_key. You need to
+ *                      free the key.
+ *
+ * @return              SSH_OK on success, SSH_ERROR otherwise.
+ *
+ * @see ssh_pki_export_privkey_ed25519_raw()
+ */
+int ssh_pki_import_privkey_ed25519_raw(const unsigned char *raw,
+                                       size_t len,
+                                       ssh_key *pkey)
+{
+    ssh_string pubkey = NULL;
+    ssh_string privkey = NULL;
+    ssh_key key = NULL;
+    int rc = SSH_ERROR;
+
+    if (raw == NULL || pkey == NULL || len != SSH_PKI_ED25519_RAW_LEN) {
+        return SSH_ERROR;
+    }
+
+    key = ssh_key_new();
+    if (key == NULL) {
+        return SSH_ERROR;
+    }
+    key->type = SSH_KEYTYPE_ED25519;
+    key->type_c = ssh_key_type_to_char(key->type);
+    key->flags = SSH_KEY_FLAG_PRIVATE | SSH_KEY_FLAG_PUBLIC;
+
+    privkey = ssh_string_new(2 * ED25519_KEY_LEN);
+    pubkey = ssh_string_new(ED25519_KEY_LEN);
+    if (privkey == NULL || pubkey == NULL) {
+        goto out;
+    }
+    ssh_string_fill(privkey, raw, 2 * ED25519_KEY_LEN);
+    ssh_string_fill(pubkey, raw + ED25519_KEY_LEN, ED25519_KEY_LEN);
+
+    rc = pki_privkey_build_ed25519(key, pubkey, privkey);
+
+out:
+    ssh_string_burn(privkey);
+    SSH_STRING_FREE(privkey);
+    SSH_STRING_FREE(pubkey);
+    if (rc != SSH_OK) {
+        ssh_key_free(key);
+        return SSH_ERROR;
+    }
+
+    *pkey = key;
+    return SSH_OK;
+}
+
+/**
+ * @brief Get the raw form of an ed25519 private key.
+ *
+ * @param[in]  privkey  The ed25519 private key.
+ *
+ * @param[out] raw      Where to store the SSH_PKI_ED25519_RAW_LEN bytes, the
+ *                      private seed followed by the public key.
+ *
+ * @param[in]  len      The size of raw.
+ *
+ * @return              SSH_OK on success, SSH_ERROR if the key isn't an
+ *                      ed25519 private key or raw is too small.
+ *
+ * @see ssh_pki_import_privkey_ed25519_raw()
+ */
+int ssh_pki_export_privkey_ed25519_raw(const ssh_key privkey,
+                                       unsigned char *raw,
+                                       size_t len)
+{
+    if (privkey == NULL || raw == NULL || len < SSH_PKI_ED25519_RAW_LEN ||
+        privkey->type != SSH_KEYTYPE_ED25519 ||
+        privkey->ed25519_privkey == NULL ||
+        privkey->ed25519_pubkey == NULL) {
+        return SSH_ERROR;
+    }
+
+    memcpy(raw, (const uint8_t *)privkey->ed25519_privkey, ED25519_KEY_LEN);
+    memcpy(raw + ED25519_KEY_LEN, (const uint8_t *)privkey->ed25519_pubkey,
+           ED25519_KEY_LEN);
+
+    return SSH_OK;
+}
+
 /**
  * @brief Export a private key to a pem file on disk, or OpenSSH format for
  *        keytype ssh-ed25519
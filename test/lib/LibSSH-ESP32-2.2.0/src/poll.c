@@ -658,6 +658,7 @@ void ssh_poll_ctx_remove(ssh_poll_ctx ctx, ssh_poll_handle p) {
  * @returns SSH_OK      No error.
  *          SSH_ERROR   Error happened during the poll.
  *          SSH_AGAIN   Timeout occured
+ *          SSH_POLL_CLOSED A callback closed its socket.
  */
 
 int ssh_poll_ctx_dopoll(ssh_poll_ctx ctx, int timeout)
@@ -701,14 +702,21 @@ int ssh_poll_ctx_dopoll(ssh_poll_ctx ctx, int timeout)
             p->lock = 1;
             if (p->cb && (ret = p->cb(p, fd, revents, p->cb_data)) < 0) {
                 if (ret == -2) {
-                    return -1;
+                    return SSH_POLL_CLOSED;
                 }
                 /* the poll was removed, reload the used counter and start again */
                 used = ctx->polls_used;
                 i = 0;
             } else {
-                ctx->pollfds[i].revents = 0;
-                ctx->pollfds[i].events = p->events;
+                /*
+                 * A callback polling the context again (a blocking write
+                 * waiting for the window) may have removed other handles
+                 * and moved p to another slot
+                 */
+                if (p->ctx == ctx) {
+                    ctx->pollfds[p->x.idx].revents = 0;
+                    ctx->pollfds[p->x.idx].events = p->events;
+                }
                 p->lock = 0;
                 i++;
             }
@@ -961,6 +969,9 @@ int ssh_event_dopoll(ssh_event event, int timeout) {
         return SSH_ERROR;
     }
     rc = ssh_poll_ctx_dopoll(event->ctx, timeout);
+    if (rc == SSH_POLL_CLOSED) {
+        rc = SSH_ERROR;
+    }
     return rc;
 }
 
@@ -23,13 +23,20 @@
 
 #include "libssh_esp32_config.h"
 
+#include <errno.h>
+#include <fcntl.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <sys/stat.h>
+#ifdef HAVE_UNISTD_H
+#include <unistd.h>
+#endif
 
 #include "libssh/priv.h"
 #include "libssh/scp.h"
 #include "libssh/misc.h"
+#include "libssh/server.h"
 
 /**
  * @defgroup libssh_scp The SSH scp functions
@@ -128,7 +135,10 @@ int ssh_scp_init(ssh_scp scp)
         return SSH_ERROR;
     }
 
-    if (scp->state != SSH_SCP_NEW) {
+    if (scp->state != SSH_SCP_NEW &&
+        scp->state != SSH_SCP_OPENING &&
+        scp->state != SSH_SCP_EXECUTING &&
+        scp->state != SSH_SCP_WAITING) {
         ssh_set_error(scp->session, SSH_FATAL,
                       "ssh_scp_init called under invalid state");
         return SSH_ERROR;
@@ -140,78 +150,107 @@ int ssh_scp_init(ssh_scp scp)
         return SSH_ERROR;
     }
 
-    SSH_LOG(SSH_LOG_PROTOCOL, "Initializing scp session %s %son location '%s'",
-            scp->mode == SSH_SCP_WRITE?"write":"read",
-            scp->recursive ? "recursive " : "",
-            scp->location);
+    if (scp->state == SSH_SCP_NEW) {
+        SSH_LOG(SSH_LOG_PROTOCOL,
+                "Initializing scp session %s %son location '%s'",
+                scp->mode == SSH_SCP_WRITE?"write":"read",
+                scp->recursive ? "recursive " : "",
+                scp->location);
 
-    scp->channel = ssh_channel_new(scp->session);
-    if (scp->channel == NULL) {
-        ssh_set_error(scp->session, SSH_FATAL,
-                      "Channel creation failed for scp");
-        scp->state = SSH_SCP_ERROR;
-        return SSH_ERROR;
+        scp->channel = ssh_channel_new(scp->session);
+        if (scp->channel == NULL) {
+            ssh_set_error(scp->session, SSH_FATAL,
+                          "Channel creation failed for scp");
+            scp->state = SSH_SCP_ERROR;
+            return SSH_ERROR;
+        }
+        scp->state = SSH_SCP_OPENING;
     }
 
-    rc = ssh_channel_open_session(scp->channel);
-    if (rc == SSH_ERROR) {
-        ssh_set_error(scp->session, SSH_FATAL,
-                      "Failed to open channel for scp");
-        scp->state = SSH_SCP_ERROR;
-        return SSH_ERROR;
+    if (scp->state == SSH_SCP_OPENING) {
+        rc = ssh_channel_open_session(scp->channel);
+        if (rc == SSH_AGAIN) {
+            return SSH_AGAIN;
+        }
+        if (rc == SSH_ERROR) {
+            ssh_set_error(scp->session, SSH_FATAL,
+                          "Failed to open channel for scp");
+            scp->state = SSH_SCP_ERROR;
+            return SSH_ERROR;
+        }
+        scp->state = SSH_SCP_EXECUTING;
     }
 
-    /* In the worst case, each character would be replaced by 3 plus the string
-     * terminator '\0' */
-    scp_location_len = strlen(scp->location);
-    quoted_location_len = ((size_t)3 * scp_location_len) + 1;
-    /* Paranoia check */
-    if (quoted_location_len < scp_location_len) {
-        ssh_set_error(scp->session, SSH_FATAL,
-                      "Buffer overflow detected");
-        scp->state = SSH_SCP_ERROR;
-        return SSH_ERROR;
-    }
+    if (scp->state == SSH_SCP_EXECUTING) {
+        /*
+         * In the worst case, each character would be replaced by 3 plus the
+         * string terminator '\0'
+         */
+        scp_location_len = strlen(scp->location);
+        quoted_location_len = ((size_t)3 * scp_location_len) + 1;
+        /* Paranoia check */
+        if (quoted_location_len < scp_location_len) {
+            ssh_set_error(scp->session, SSH_FATAL,
+                          "Buffer overflow detected");
+            scp->state = SSH_SCP_ERROR;
+            return SSH_ERROR;
+        }
 
-    quoted_location = (char *)calloc(1, quoted_location_len);
-    if (quoted_location == NULL) {
-        ssh_set_error(scp->session, SSH_FATAL,
-                      "Failed to allocate memory for quoted location");
-        scp->state = SSH_SCP_ERROR;
-        return SSH_ERROR;
-    }
+        quoted_location = (char *)calloc(1, quoted_location_len);
+        if (quoted_location == NULL) {
+            ssh_set_error(scp->session, SSH_FATAL,
+                          "Failed to allocate memory for quoted location");
+            scp->state = SSH_SCP_ERROR;
+            return SSH_ERROR;
+        }
 
-    rc = ssh_quote_file_name(scp->location, quoted_location,
-                             quoted_location_len);
-    if (rc <= 0) {
-        ssh_set_error(scp->session, SSH_FATAL,
-                      "Failed to single quote command location");
-        SAFE_FREE(quoted_location);
-        scp->state = SSH_SCP_ERROR;
-        return SSH_ERROR;
-    }
+        rc = ssh_quote_file_name(scp->location, quoted_location,
+                                 quoted_location_len);
+        if (rc <= 0) {
+            ssh_set_error(scp->session, SSH_FATAL,
+                          "Failed to single quote command location");
+            SAFE_FREE(quoted_location);
+            scp->state = SSH_SCP_ERROR;
+            return SSH_ERROR;
+        }
 
-    if (scp->mode == SSH_SCP_WRITE) {
-        snprintf(execbuffer, sizeof(execbuffer), "scp -t %s %s",
-                scp->recursive ? "-r" : "", quoted_location);
-    } else {
-        snprintf(execbuffer, sizeof(execbuffer), "scp -f %s %s",
-                scp->recursive ? "-r" : "", quoted_location);
-    }
+        if (scp->mode == SSH_SCP_WRITE) {
+            snprintf(execbuffer, sizeof(execbuffer), "scp -t %s %s",
+                    scp->recursive ? "-r" : "", quoted_location);
+        } else {
+            snprintf(execbuffer, sizeof(execbuffer), "scp -f %s %s",
+                    scp->recursive ? "-r" : "", quoted_location);
+        }
 
-    SAFE_FREE(quoted_location);
+        SAFE_FREE(quoted_location);
 
-    SSH_LOG(SSH_LOG_DEBUG, "Executing command: %s", execbuffer);
+        SSH_LOG(SSH_LOG_DEBUG, "Executing command: %s", execbuffer);
 
-    rc = ssh_channel_request_exec(scp->channel, execbuffer);
-    if (rc == SSH_ERROR){
-        ssh_set_error(scp->session, SSH_FATAL,
-                      "Failed executing command: %s", execbuffer);
-        scp->state = SSH_SCP_ERROR;
-        return SSH_ERROR;
+        /* A pending request is resumed, the command is only sent once */
+        rc = ssh_channel_request_exec(scp->channel, execbuffer);
+        if (rc == SSH_AGAIN) {
+            return SSH_AGAIN;
+        }
+        if (rc == SSH_ERROR){
+            ssh_set_error(scp->session, SSH_FATAL,
+                          "Failed executing command: %s", execbuffer);
+            scp->state = SSH_SCP_ERROR;
+            return SSH_ERROR;
+        }
+        scp->state = SSH_SCP_WAITING;
     }
 
     if (scp->mode == SSH_SCP_WRITE) {
+        if (!ssh_is_blocking(scp->session)) {
+            rc = ssh_channel_poll(scp->channel, 0);
+            if (rc == 0) {
+                return SSH_AGAIN;
+            }
+            if (rc == SSH_ERROR || rc == SSH_EOF) {
+                scp->state = SSH_SCP_ERROR;
+                return SSH_ERROR;
+            }
+        }
         rc = ssh_scp_response(scp, NULL);
         if (rc != 0) {
             return SSH_ERROR;
@@ -1124,4 +1163,621 @@ const char *ssh_scp_request_get_warning(ssh_scp scp)
     return scp->warning;
 }
 
+#ifdef WITH_SERVER
+
+#ifndef O_CLOEXEC
+#define O_CLOEXEC 0
+#endif
+
+static int scp_sink_reply(ssh_scp_sink sink, int code, const char *msg)
+{
+    char buffer[128];
+    int len;
+    int rc;
+
+    if (msg == NULL) {
+        buffer[0] = (char)code;
+        len = 1;
+    } else {
+        len = snprintf(buffer, sizeof(buffer), "%c%s\n", code, msg);
+        if (len < 0 || (size_t)len >= sizeof(buffer)) {
+            len = sizeof(buffer) - 1;
+            buffer[len - 1] = '\n';
+        }
+    }
+
+    rc = ssh_channel_write(sink->channel, buffer, len);
+    if (rc == SSH_ERROR) {
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+static void scp_sink_close_file(ssh_scp_sink sink)
+{
+    if (sink->fd >= 0) {
+        close(sink->fd);
+        sink->fd = -1;
+    }
+    sink->wlen = 0;
+}
+
+/* Reports a fatal error, the client gives up on the whole transfer */
+static void scp_sink_fail(ssh_scp_sink sink, const char *msg)
+{
+    SSH_LOG(SSH_LOG_WARN, "scp sink: %s", msg);
+    scp_sink_reply(sink, 2, msg);
+    scp_sink_close_file(sink);
+    sink->state = SSH_SCP_SINK_ERROR;
+}
+
+/*
+ * Reports an error on a single file or directory. As with OpenSSH the
+ * client skips that one and goes on with the rest of the transfer.
+ */
+static void scp_sink_warn(ssh_scp_sink sink, const char *name, int err)
+{
+    char msg[128];
+
+    snprintf(msg, sizeof(msg), "scp: %s: %s", name, strerror(err));
+    SSH_LOG(SSH_LOG_WARN, "scp sink: %s", msg);
+    scp_sink_reply(sink, 1, msg);
+    sink->have_times = 0;
+}
+
+static int scp_sink_write_fd(int fd, const uint8_t *data, size_t len)
+{
+    ssize_t w;
+
+    while (len > 0) {
+        w = write(fd, data, len);
+        if (w < 0 && errno == EINTR) {
+            continue;
+        }
+        if (w <= 0) {
+            return SSH_ERROR;
+        }
+        data += w;
+        len -= w;
+    }
+
+    return SSH_OK;
+}
+
+static int scp_sink_flush(ssh_scp_sink sink)
+{
+    int rc;
+
+    if (sink->wlen == 0) {
+        return SSH_OK;
+    }
+    rc = scp_sink_write_fd(sink->fd, sink->wbuf, sink->wlen);
+    sink->wlen = 0;
+
+    return rc;
+}
+
+/*
+ * Pieces as large as the write buffer go to the file as they are, smaller
+ * ones are gathered first so the file sees few large writes.
+ */
+static int scp_sink_write(ssh_scp_sink sink, const uint8_t *data, size_t len)
+{
+    size_t n;
+    int rc;
+
+    if (sink->wlen == 0 && len >= SSH_SCP_SINK_WRITE_SIZE) {
+        return scp_sink_write_fd(sink->fd, data, len);
+    }
+
+    while (len > 0) {
+        n = SSH_SCP_SINK_WRITE_SIZE - sink->wlen;
+        if (n > len) {
+            n = len;
+        }
+        memcpy(sink->wbuf + sink->wlen, data, n);
+        sink->wlen += n;
+        data += n;
+        len -= n;
+
+        if (sink->wlen == SSH_SCP_SINK_WRITE_SIZE) {
+            rc = scp_sink_flush(sink);
+            if (rc != SSH_OK) {
+                return rc;
+            }
+        }
+    }
+
+    return SSH_OK;
+}
+
+/* Builds the path of name in the current directory, name can't leave it */
+static char *scp_sink_path(ssh_scp_sink sink, const char *name)
+{
+    size_t len;
+    char *path = NULL;
+
+    if (name[0] == '\0' ||
+        strchr(name, '/') != NULL ||
+        strcmp(name, ".") == 0 ||
+        strcmp(name, "..") == 0) {
+        return NULL;
+    }
+
+    len = strlen(sink->path) + strlen(name) + 2;
+    path = malloc(len);
+    if (path == NULL) {
+        return NULL;
+    }
+    snprintf(path, len, "%s/%s", sink->path, name);
+
+    return path;
+}
+
+/* Parses "<mode> <size> <name>" following the C or D of a control line */
+static int scp_sink_parse_line(char *line,
+                               int *mode,
+                               uint64_t *size,
+                               char **name)
+{
+    char *p = NULL;
+    char *end = NULL;
+
+    p = strchr(line, ' ');
+    if (p == NULL) {
+        return SSH_ERROR;
+    }
+    *p++ = '\0';
+    *mode = ssh_scp_integer_mode(line);
+
+    *size = strtoull(p, &end, 10);
+    if (end == p || *end != ' ') {
+        return SSH_ERROR;
+    }
+    *name = end + 1;
+
+    return SSH_OK;
+}
+
+static void scp_sink_file(ssh_scp_sink sink)
+{
+    char *path = NULL;
+    char *name = NULL;
+    uint64_t size;
+    int mode;
+    int rc;
+
+    rc = scp_sink_parse_line(sink->line + 1, &mode, &size, &name);
+    if (rc != SSH_OK) {
+        scp_sink_fail(sink, "scp: protocol error: bad file line");
+        return;
+    }
+
+    path = scp_sink_path(sink, name);
+    if (path == NULL) {
+        scp_sink_fail(sink, "scp: invalid file name");
+        return;
+    }
+
+    sink->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+                    mode & 0666);
+    if (sink->fd < 0) {
+        scp_sink_warn(sink, name, errno);
+        SAFE_FREE(path);
+        return;
+    }
+    SAFE_FREE(path);
+
+#ifdef HAVE_POSIX_FALLOCATE
+    /* reserve the whole file now rather than growing it write by write */
+    if (size > 0) {
+        posix_fallocate(sink->fd, 0, (off_t)size);
+    }
+#endif /* HAVE_POSIX_FALLOCATE */
+
+    sink->remaining = size;
+    sink->wlen = 0;
+    sink->state = size > 0 ? SSH_SCP_SINK_DATA : SSH_SCP_SINK_DATA_END;
+    scp_sink_reply(sink, 0, NULL);
+}
+
+static void scp_sink_file_done(ssh_scp_sink sink)
+{
+    int rc;
+
+    rc = scp_sink_flush(sink);
+    if (rc != SSH_OK) {
+        scp_sink_fail(sink, "scp: write failed");
+        return;
+    }
+
+#ifdef HAVE_FUTIMENS
+    if (sink->preserve && sink->have_times) {
+        struct timespec times[2];
+
+        times[0].tv_sec = sink->atime;
+        times[0].tv_nsec = 0;
+        times[1].tv_sec = sink->mtime;
+        times[1].tv_nsec = 0;
+        futimens(sink->fd, times);
+    }
+#endif /* HAVE_FUTIMENS */
+    sink->have_times = 0;
+
+    scp_sink_close_file(sink);
+    sink->files++;
+    sink->state = SSH_SCP_SINK_CONTROL;
+    scp_sink_reply(sink, 0, NULL);
+}
+
+static void scp_sink_enter(ssh_scp_sink sink)
+{
+    char *path = NULL;
+    char *name = NULL;
+    uint64_t size;
+    int mode;
+    int rc;
+
+    if (!sink->recursive) {
+        scp_sink_fail(sink, "scp: received directory without -r");
+        return;
+    }
+
+    rc = scp_sink_parse_line(sink->line + 1, &mode, &size, &name);
+    if (rc != SSH_OK) {
+        scp_sink_fail(sink, "scp: protocol error: bad directory line");
+        return;
+    }
+
+    path = scp_sink_path(sink, name);
+    if (path == NULL) {
+        scp_sink_fail(sink, "scp: invalid directory name");
+        return;
+    }
+
+    rc = mkdir(path, (mode & 0777) | 0700);
+    if (rc < 0 && errno != EEXIST) {
+        scp_sink_warn(sink, name, errno);
+        SAFE_FREE(path);
+        return;
+    }
+
+    SAFE_FREE(sink->path);
+    sink->path = path;
+    sink->have_times = 0;
+    scp_sink_reply(sink, 0, NULL);
+}
+
+static void scp_sink_leave(ssh_scp_sink sink)
+{
+    char *slash = NULL;
+
+    if (strlen(sink->path) <= sink->root_len) {
+        scp_sink_fail(sink, "scp: protocol error: unexpected E line");
+        return;
+    }
+
+    slash = strrchr(sink->path, '/');
+    if (slash != NULL) {
+        *slash = '\0';
+    }
+    scp_sink_reply(sink, 0, NULL);
+}
+
+/* T<mtime> 0 <atime> 0 */
+static void scp_sink_times(ssh_scp_sink sink)
+{
+    char *p = NULL;
+
+    sink->mtime = strtol(sink->line + 1, &p, 10);
+    if (p == NULL || *p != ' ') {
+        scp_sink_fail(sink, "scp: protocol error: bad time line");
+        return;
+    }
+    strtol(p + 1, &p, 10);
+    if (p == NULL || *p != ' ') {
+        scp_sink_fail(sink, "scp: protocol error: bad time line");
+        return;
+    }
+    sink->atime = strtol(p + 1, NULL, 10);
+    sink->have_times = 1;
+
+    scp_sink_reply(sink, 0, NULL);
+}
+
+static void scp_sink_control(ssh_scp_sink sink)
+{
+    SSH_LOG(SSH_LOG_PROTOCOL, "scp sink: %s", sink->line);
+
+    switch (sink->line[0]) {
+    case 'C':
+        scp_sink_file(sink);
+        break;
+    case 'D':
+        scp_sink_enter(sink);
+        break;
+    case 'E':
+        scp_sink_leave(sink);
+        break;
+    case 'T':
+        scp_sink_times(sink);
+        break;
+    case 1:
+    case 2:
+        /* the client reports its own error, nothing to acknowledge */
+        SSH_LOG(SSH_LOG_WARN, "scp sink: client error: %s", sink->line + 1);
+        if (sink->line[0] == 2) {
+            sink->state = SSH_SCP_SINK_ERROR;
+        }
+        break;
+    default:
+        scp_sink_fail(sink, "scp: protocol error: unknown control line");
+        break;
+    }
+}
+
+/*
+ * Channel data callback. Data arrives straight from the decrypted packet in
+ * most cases, so file contents are written to disk without another copy.
+ */
+static int scp_sink_data(ssh_session session,
+                         ssh_channel channel,
+                         void *data,
+                         uint32_t len,
+                         int is_stderr,
+                         void *userdata)
+{
+    ssh_scp_sink sink = userdata;
+    const uint8_t *p = data;
+    uint32_t off = 0;
+    size_t n;
+    int rc;
+
+    (void)session;
+    (void)channel;
+
+    if (is_stderr || sink->state == SSH_SCP_SINK_NEW) {
+        return 0;
+    }
+
+    while (off < len && sink->state != SSH_SCP_SINK_ERROR) {
+        switch (sink->state) {
+        case SSH_SCP_SINK_CONTROL:
+            if (p[off] != '\n') {
+                if (sink->line_len + 1 >= sizeof(sink->line)) {
+                    scp_sink_fail(sink, "scp: protocol error: line too long");
+                    break;
+                }
+                sink->line[sink->line_len++] = p[off++];
+                break;
+            }
+            off++;
+            sink->line[sink->line_len] = '\0';
+            sink->line_len = 0;
+            scp_sink_control(sink);
+            break;
+        case SSH_SCP_SINK_DATA:
+            n = len - off;
+            if (n > sink->remaining) {
+                n = sink->remaining;
+            }
+            rc = scp_sink_write(sink, p + off, n);
+            if (rc != SSH_OK) {
+                scp_sink_fail(sink, "scp: write failed");
+                break;
+            }
+            off += n;
+            sink->remaining -= n;
+            sink->bytes += n;
+            if (sink->remaining == 0) {
+                sink->state = SSH_SCP_SINK_DATA_END;
+            }
+            break;
+        case SSH_SCP_SINK_DATA_END:
+            if (p[off++] != '\0') {
+                scp_sink_fail(sink, "scp: protocol error: missing end of file");
+                break;
+            }
+            scp_sink_file_done(sink);
+            break;
+        default:
+            break;
+        }
+    }
+
+    /* after a fatal error whatever follows is dropped */
+    return len;
+}
+
+/**
+ * @brief Create the server side of an scp upload.
+ *
+ * The sink receives what a client sends with "scp -t" on an exec channel and
+ * writes it below directory. The path the client asked for is ignored, names
+ * in the stream can't leave directory. A file or directory that can't be
+ * created is reported to the client, which skips it and sends the rest.
+ *
+ * @param[in]  channel   The channel the exec request arrived on.
+ *
+ * @param[in]  directory The directory uploads are written to.
+ *
+ * @returns              A ssh_scp_sink handle, NULL on error.
+ *
+ * @see ssh_scp_sink_start()
+ */
+ssh_scp_sink ssh_scp_sink_new(ssh_channel channel, const char *directory)
+{
+    ssh_scp_sink sink = NULL;
+
+    if (channel == NULL || directory == NULL) {
+        return NULL;
+    }
+
+    sink = calloc(1, sizeof(struct ssh_scp_sink_struct));
+    if (sink == NULL) {
+        ssh_set_error_oom(ssh_channel_get_session(channel));
+        return NULL;
+    }
+
+    sink->path = strdup(directory);
+    sink->wbuf = malloc(SSH_SCP_SINK_WRITE_SIZE);
+    if (sink->path == NULL || sink->wbuf == NULL) {
+        ssh_set_error_oom(ssh_channel_get_session(channel));
+        SAFE_FREE(sink->path);
+        SAFE_FREE(sink->wbuf);
+        SAFE_FREE(sink);
+        return NULL;
+    }
+    sink->root_len = strlen(sink->path);
+    sink->channel = channel;
+    sink->fd = -1;
+    sink->state = SSH_SCP_SINK_NEW;
+
+    return sink;
+}
+
+/**
+ * @brief Start receiving on the channel.
+ *
+ * Meant to be called from the exec request handler. It installs a data
+ * callback on the channel and tells the client to start sending.
+ *
+ * @param[in]  sink     The sink handle.
+ *
+ * @param[in]  command  The exec command, "scp [-r] [-p] [-d] -t <path>".
+ *
+ * @returns             SSH_OK on success, SSH_ERROR if the command is not an
+ *                      scp upload or the acknowledgement couldn't be sent.
+ */
+int ssh_scp_sink_start(ssh_scp_sink sink, const char *command)
+{
+    const char *p = NULL;
+    int to = 0;
+    int rc;
+
+    if (sink == NULL || command == NULL || sink->state != SSH_SCP_SINK_NEW) {
+        return SSH_ERROR;
+    }
+
+    if (strncmp(command, "scp ", 4) != 0) {
+        return SSH_ERROR;
+    }
+
+    for (p = command + 3; *p == ' '; ) {
+        p++;
+        if (p[0] != '-') {
+            break;
+        }
+        for (p++; *p != '\0' && *p != ' '; p++) {
+            switch (*p) {
+            case 't':
+                to = 1;
+                break;
+            case 'r':
+                sink->recursive = 1;
+                break;
+            case 'p':
+                sink->preserve = 1;
+                break;
+            default:
+                break;
+            }
+        }
+    }
+    if (!to) {
+        return SSH_ERROR;
+    }
+
+    sink->callbacks.userdata = sink;
+    sink->callbacks.channel_data_function = scp_sink_data;
+    ssh_callbacks_init(&sink->callbacks);
+    rc = ssh_add_channel_callbacks(sink->channel, &sink->callbacks);
+    if (rc != SSH_OK) {
+        return SSH_ERROR;
+    }
+
+    sink->state = SSH_SCP_SINK_CONTROL;
+
+    return scp_sink_reply(sink, 0, NULL);
+}
+
+/**
+ * @brief Get the state of a sink.
+ *
+ * @param[in]  sink     The sink handle.
+ *
+ * @returns             SSH_OK while the transfer is fine, SSH_ERROR once a
+ *                      fatal error was reported to the client. Use it as the
+ *                      exit status when the client sends EOF.
+ */
+int ssh_scp_sink_get_status(ssh_scp_sink sink)
+{
+    if (sink == NULL || sink->state == SSH_SCP_SINK_ERROR) {
+        return SSH_ERROR;
+    }
+
+    return SSH_OK;
+}
+
+/**
+ * @brief Get the number of files a sink received completely.
+ *
+ * @param[in]  sink     The sink handle.
+ *
+ * @returns             The number of files.
+ */
+uint64_t ssh_scp_sink_get_files(ssh_scp_sink sink)
+{
+    if (sink == NULL) {
+        return 0;
+    }
+
+    return sink->files;
+}
+
+/**
+ * @brief Get the number of file bytes a sink wrote.
+ *
+ * @param[in]  sink     The sink handle.
+ *
+ * @returns             The number of bytes.
+ */
+uint64_t ssh_scp_sink_get_bytes(ssh_scp_sink sink)
+{
+    if (sink == NULL) {
+        return 0;
+    }
+
+    return sink->bytes;
+}
+
+/**
+ * @brief Free a sink.
+ *
+ * A partly received file is left as it is. This has to be called before the
+ * channel is freed.
+ *
+ * @param[in]  sink     The sink handle.
+ */
+void ssh_scp_sink_free(ssh_scp_sink sink)
+{
+    if (sink == NULL) {
+        return;
+    }
+
+    if (sink->state != SSH_SCP_SINK_NEW) {
+        ssh_remove_channel_callbacks(sink->channel, &sink->callbacks);
+    }
+    if (sink->fd >= 0) {
+        scp_sink_flush(sink);
+        scp_sink_close_file(sink);
+    }
+    SAFE_FREE(sink->path);
+    SAFE_FREE(sink->wbuf);
+    SAFE_FREE(sink);
+}
+
+#endif /* WITH_SERVER */
+
 /** @} */
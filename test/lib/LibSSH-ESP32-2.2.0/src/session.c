@@ -86,6 +86,7 @@ ssh_session ssh_new(void)
     if (session->in_buffer == NULL) {
         goto err;
     }
+    ssh_arena_init(&session->packet_arena);
 
     session->out_queue = ssh_list_new();
     if (session->out_queue == NULL) {
@@ -208,11 +209,12 @@ void ssh_free(ssh_session session)
   for (it = ssh_list_get_iterator(session->channels);
        it != NULL;
        it = ssh_list_get_iterator(session->channels)) {
+      /* ssh_channel_do_free() takes the channel off the list */
       ssh_channel_do_free(ssh_iterator_value(ssh_channel,it));
-      ssh_list_remove(session->channels, it);
   }
   ssh_list_free(session->channels);
   session->channels = NULL;
+  SAFE_FREE(session->channel_index);
 
 #ifdef WITH_PCAP
   if (session->pcap_ctx) {
@@ -231,6 +233,7 @@ void ssh_free(ssh_session session)
   SSH_BUFFER_FREE(session->in_buffer);
   SSH_BUFFER_FREE(session->out_buffer);
   session->in_buffer = session->out_buffer = NULL;
+  ssh_arena_free(&session->packet_arena);
 
   if (session->in_hashbuf != NULL) {
       SSH_BUFFER_FREE(session->in_hashbuf);
@@ -273,6 +276,7 @@ void ssh_free(ssh_session session)
   if (session->packet_callbacks) {
     ssh_list_free(session->packet_callbacks);
   }
+  SAFE_FREE(session->packet_dispatch);
 
   /* options */
   if (session->opts.identity) {
@@ -659,9 +663,24 @@ int ssh_handle_packets(ssh_session session, int timeout) {
         else
           tm = 0;
     }
-    rc = ssh_poll_ctx_dopoll(ctx, tm);
+    /* packets held back by a cork must not wait for the peer's answer */
+    rc = ssh_socket_flush_corked(session->socket);
     if (rc == SSH_ERROR) {
         session->session_state = SSH_SESSION_STATE_ERROR;
+        return rc;
+    }
+
+    rc = ssh_poll_ctx_dopoll(ctx, tm);
+    if (rc == SSH_POLL_CLOSED && ssh_socket_is_open(session->socket)) {
+        /*
+         * The context may be shared with other sessions through an
+         * ssh_event, and the socket closed another session's. A failing
+         * poll() is an error for all of them.
+         */
+        rc = SSH_AGAIN;
+    } else if (rc == SSH_POLL_CLOSED || rc == SSH_ERROR) {
+        session->session_state = SSH_SESSION_STATE_ERROR;
+        rc = SSH_ERROR;
     }
 
     return rc;
@@ -698,11 +717,17 @@ int ssh_handle_packets_termination(ssh_session session,
                                    ssh_termination_function fct,
                                    void *user)
 {
-    struct ssh_timestamp ts;
+    struct ssh_deadline deadline;
     long timeout_ms = SSH_TIMEOUT_INFINITE;
     long tm;
+    unsigned int activity, last;
     int ret = SSH_OK;
 
+    /* without a socket there is no activity to wait for */
+    if (session->socket == NULL) {
+        return SSH_ERROR;
+    }
+
     /* If a timeout has been provided, use it */
     if (timeout >= 0) {
         timeout_ms = timeout;
@@ -721,23 +746,29 @@ int ssh_handle_packets_termination(ssh_session session,
         }
     }
 
-    /* avoid unnecessary syscall for the SSH_TIMEOUT_NONBLOCKING case */
-    if (timeout_ms != SSH_TIMEOUT_NONBLOCKING) {
-        ssh_timestamp_init(&ts);
-    }
+    /* no clock read for the nonblocking and infinite cases */
+    ssh_deadline_init(&deadline, timeout_ms);
 
     tm = timeout_ms;
-    while(!fct(user)) {
-        ret = ssh_handle_packets(session, tm);
-        if (ret == SSH_ERROR) {
-            break;
-        }
-        if (ssh_timeout_elapsed(&ts, timeout_ms)) {
-            ret = fct(user) ? SSH_OK : SSH_AGAIN;
-            break;
-        }
-
-        tm = ssh_timeout_update(&ts, timeout_ms);
+    activity = ssh_socket_get_activity(session->socket);
+    while (!fct(user)) {
+        /*
+         * What fct() looks at is only changed by packets and events on our
+         * socket, wakeups for other fds of a shared poll context go back
+         * to sleep without asking it again
+         */
+        do {
+            ret = ssh_handle_packets(session, tm);
+            if (ret == SSH_ERROR) {
+                return ret;
+            }
+            tm = ssh_deadline_remaining(&deadline);
+            if (tm == 0) {
+                return fct(user) ? SSH_OK : SSH_AGAIN;
+            }
+            last = activity;
+            activity = ssh_socket_get_activity(session->socket);
+        } while (activity == last);
     }
 
     return ret;
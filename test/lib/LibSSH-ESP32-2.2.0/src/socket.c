@@ -45,6 +45,7 @@
 #include <sys/wait.h>
 #include <sys/socket.h>
 #include <sys/un.h>
+#include <sys/uio.h>
 #include <signal.h>
 #endif /* _WIN32 */
 
@@ -54,6 +55,7 @@
 #include "libssh/buffer.h"
 #include "libssh/poll.h"
 #include "libssh/session.h"
+#include "libssh/trace.h"
 
 /**
  * @internal
@@ -66,6 +68,19 @@
  * @{
  */
 
+/*
+ * Outgoing packets are queued as the buffers they were built in and sent
+ * with one writev() covering the whole queue, instead of being copied into
+ * a single socket buffer first. When the queue is full, further data is
+ * copied behind the last entry. A couple of sent buffers are kept to hand
+ * back to the session in exchange for the next packet.
+ */
+#ifndef SSH_SOCKET_TX_QUEUE_LEN
+#define SSH_SOCKET_TX_QUEUE_LEN 16
+#endif
+
+#define SSH_SOCKET_TX_SPARE 2
+
 enum ssh_socket_states_e {
 	SSH_SOCKET_NONE,
 	SSH_SOCKET_CONNECTING,
@@ -84,7 +99,17 @@ struct ssh_socket_struct {
   int write_wontblock;
   int data_except;
   enum ssh_socket_states_e state;
-  ssh_buffer out_buffer;
+  /* pending output, oldest first, tx_bytes in total */
+  ssh_buffer tx_queue[SSH_SOCKET_TX_QUEUE_LEN];
+  int tx_head;
+  int tx_count;
+  uint32_t tx_bytes;
+  ssh_buffer tx_spare[SSH_SOCKET_TX_SPARE];
+  int tx_spare_count;
+  /* nested ssh_socket_cork() calls, writes don't flush while nonzero */
+  int corked;
+  /* bumped by every event handled on the socket */
+  unsigned int activity;
   ssh_buffer in_buffer;
   ssh_session session;
   ssh_socket_callbacks callbacks;
@@ -99,9 +124,7 @@ static int sockets_initialized = 0;
 static ssize_t ssh_socket_unbuffered_read(ssh_socket s,
                                           void *buffer,
                                           uint32_t len);
-static ssize_t ssh_socket_unbuffered_write(ssh_socket s,
-                                           const void *buffer,
-                                           uint32_t len);
+static ssize_t ssh_socket_unbuffered_write(ssh_socket s);
 
 /**
  * \internal
@@ -141,6 +164,63 @@ void ssh_socket_cleanup(void)
 }
 
 
+/* Keep an emptied buffer for ssh_socket_write_buffer() to hand out */
+static void ssh_socket_tx_recycle(ssh_socket s, ssh_buffer buffer)
+{
+    if (s->tx_spare_count == SSH_SOCKET_TX_SPARE) {
+        SSH_BUFFER_FREE(buffer);
+        return;
+    }
+    ssh_buffer_reinit(buffer);
+    s->tx_spare[s->tx_spare_count++] = buffer;
+}
+
+static ssh_buffer ssh_socket_tx_get_spare(ssh_socket s)
+{
+    if (s->tx_spare_count > 0) {
+        return s->tx_spare[--s->tx_spare_count];
+    }
+
+    return ssh_buffer_new();
+}
+
+static void ssh_socket_tx_push(ssh_socket s, ssh_buffer buffer)
+{
+    int i = (s->tx_head + s->tx_count) % SSH_SOCKET_TX_QUEUE_LEN;
+
+    s->tx_queue[i] = buffer;
+    s->tx_count++;
+    s->tx_bytes += ssh_buffer_get_len(buffer);
+}
+
+/* Drop the first len bytes of the queue, they have been sent */
+static void ssh_socket_tx_consume(ssh_socket s, uint32_t len)
+{
+    ssh_buffer buffer = NULL;
+    uint32_t buflen;
+
+    s->tx_bytes -= len;
+    while (len > 0 && s->tx_count > 0) {
+        buffer = s->tx_queue[s->tx_head];
+        buflen = ssh_buffer_get_len(buffer);
+        if (len < buflen) {
+            ssh_buffer_pass_bytes(buffer, len);
+            return;
+        }
+        len -= buflen;
+        s->tx_queue[s->tx_head] = NULL;
+        s->tx_head = (s->tx_head + 1) % SSH_SOCKET_TX_QUEUE_LEN;
+        s->tx_count--;
+        ssh_socket_tx_recycle(s, buffer);
+    }
+}
+
+static void ssh_socket_tx_clear(ssh_socket s)
+{
+    ssh_socket_tx_consume(s, s->tx_bytes);
+    s->tx_head = 0;
+}
+
 /**
  * \internal
  * \brief creates a new Socket object
@@ -164,13 +244,6 @@ ssh_socket ssh_socket_new(ssh_session session)
         SAFE_FREE(s);
         return NULL;
     }
-    s->out_buffer=ssh_buffer_new();
-    if (s->out_buffer == NULL) {
-        ssh_set_error_oom(session);
-        SSH_BUFFER_FREE(s->in_buffer);
-        SAFE_FREE(s);
-        return NULL;
-    }
     s->read_wontblock = 0;
     s->write_wontblock = 0;
     s->data_except = 0;
@@ -190,10 +263,11 @@ void ssh_socket_reset(ssh_socket s)
     s->last_errno = -1;
     s->fd_is_socket = 1;
     ssh_buffer_reinit(s->in_buffer);
-    ssh_buffer_reinit(s->out_buffer);
+    ssh_socket_tx_clear(s);
     s->read_wontblock = 0;
     s->write_wontblock = 0;
     s->data_except = 0;
+    s->corked = 0;
     s->poll_handle = NULL;
     s->state=SSH_SOCKET_NONE;
 #ifndef _WIN32
@@ -239,15 +313,18 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p,
     int err = 0;
     socklen_t errlen = sizeof(err);
 
+    s->activity++;
+
     /* Do not do anything if this socket was already closed */
     if (!ssh_socket_is_open(s)) {
         return -1;
     }
-    SSH_LOG(SSH_LOG_TRACE, "Poll callback on socket %d (%s%s%s), out buffer %d",fd,
-            (revents & POLLIN) ? "POLLIN ":"",
-            (revents & POLLOUT) ? "POLLOUT ":"",
-            (revents & POLLERR) ? "POLLERR":"",
-            ssh_buffer_get_len(s->out_buffer));
+    SSH_TRACE_LOG(SSH_TRACE_SOCKET_POLL, fd, revents, s->tx_bytes,
+                  SSH_LOG_TRACE, "Poll callback on socket %d (%s%s%s), out buffer %d",fd,
+                  (revents & POLLIN) ? "POLLIN ":"",
+                  (revents & POLLOUT) ? "POLLOUT ":"",
+                  (revents & POLLERR) ? "POLLERR":"",
+                  s->tx_bytes);
     if ((revents & POLLERR) || (revents & POLLHUP)) {
         /* Check if we are in a connecting state */
         if (s->state == SSH_SOCKET_CONNECTING) {
@@ -311,15 +388,19 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p,
         if (s->session->socket_counter != NULL) {
             s->session->socket_counter->in_bytes += nread;
         }
+        SSH_TRACE(SSH_TRACE_SOCKET_READ, fd, nread, 0);
 
         /* Call the callback */
         if (s->callbacks != NULL && s->callbacks->data != NULL) {
+            /* what the packets read here make us send goes out together */
+            ssh_socket_cork(s);
             do {
                 nread = s->callbacks->data(ssh_buffer_get(s->in_buffer),
                                        ssh_buffer_get_len(s->in_buffer),
                                        s->callbacks->userdata);
                 ssh_buffer_pass_bytes(s->in_buffer, nread);
             } while ((nread > 0) && (s->state == SSH_SOCKET_CONNECTED));
+            ssh_socket_uncork(s);
 
             /* p may have been freed, so don't use it
              * anymore in this function */
@@ -331,8 +412,6 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p,
 #else
     if (revents & POLLOUT) {
 #endif
-        uint32_t len;
-
         /* First, POLLOUT is a sign we may be connected */
         if (s->state == SSH_SOCKET_CONNECTING) {
             SSH_LOG(SSH_LOG_PACKET, "Received POLLOUT in connecting state");
@@ -362,8 +441,7 @@ int ssh_socket_pollcallback(struct ssh_poll_handle_struct *p,
         }
 
         /* If buffered data is pending, write it */
-        len = ssh_buffer_get_len(s->out_buffer);
-        if (len > 0) {
+        if (s->tx_bytes > 0) {
             ssh_socket_nonblocking_flush(s);
         } else if (s->callbacks != NULL && s->callbacks->controlflow != NULL) {
             /* Otherwise advertise the upper level that write can be done */
@@ -406,7 +484,11 @@ void ssh_socket_free(ssh_socket s)
     }
     ssh_socket_close(s);
     SSH_BUFFER_FREE(s->in_buffer);
-    SSH_BUFFER_FREE(s->out_buffer);
+    ssh_socket_tx_clear(s);
+    while (s->tx_spare_count > 0) {
+        s->tx_spare_count--;
+        SSH_BUFFER_FREE(s->tx_spare[s->tx_spare_count]);
+    }
     SAFE_FREE(s);
 }
 
@@ -450,6 +532,8 @@ int ssh_socket_unix(ssh_socket s, const char *path)
  */
 void ssh_socket_close(ssh_socket s)
 {
+    s->activity++;
+
     if (ssh_socket_is_open(s)) {
 #ifdef _WIN32
         CLOSE_SOCKET(s->fd);
@@ -563,14 +647,20 @@ static ssize_t ssh_socket_unbuffered_read(ssh_socket s,
 }
 
 /** \internal
- * \brief writes len bytes from buffer to socket
+ * \brief writes as much of the output queue as possible to the socket
  */
-static ssize_t ssh_socket_unbuffered_write(ssh_socket s,
-                                           const void *buffer,
-                                           uint32_t len)
+static ssize_t ssh_socket_unbuffered_write(ssh_socket s)
 {
     ssize_t w = -1;
     int flags = 0;
+#ifdef _WIN32
+    ssh_buffer buffer = s->tx_queue[s->tx_head];
+#else
+    struct iovec iov[SSH_SOCKET_TX_QUEUE_LEN];
+    struct msghdr msg;
+    ssh_buffer buffer = NULL;
+    int i;
+#endif
 
 #ifdef MSG_NOSIGNAL
     flags |= MSG_NOSIGNAL;
@@ -580,17 +670,43 @@ static ssize_t ssh_socket_unbuffered_write(ssh_socket s,
         return -1;
     }
 
+#ifdef _WIN32
+    /* no gathering here, the packets go out one send() at a time */
     if (s->fd_is_socket) {
-        w = send(s->fd, buffer, len, flags);
+        w = send(s->fd,
+                 ssh_buffer_get(buffer),
+                 ssh_buffer_get_len(buffer),
+                 flags);
     } else {
-        w = write(s->fd, buffer, len);
+        w = write(s->fd, ssh_buffer_get(buffer), ssh_buffer_get_len(buffer));
+    }
+#else
+    for (i = 0; i < s->tx_count; i++) {
+        buffer = s->tx_queue[(s->tx_head + i) % SSH_SOCKET_TX_QUEUE_LEN];
+        iov[i].iov_base = ssh_buffer_get(buffer);
+        iov[i].iov_len = ssh_buffer_get_len(buffer);
     }
+
+    if (s->fd_is_socket) {
+        ZERO_STRUCT(msg);
+        msg.msg_iov = iov;
+        msg.msg_iovlen = s->tx_count;
+        w = sendmsg(s->fd, &msg, flags);
+    } else {
+        w = writev(s->fd, iov, s->tx_count);
+    }
+#endif /* _WIN32 */
 #ifdef _WIN32
     s->last_errno = WSAGetLastError();
 #else
     s->last_errno = errno;
 #endif
     s->write_wontblock = 0;
+#ifdef _WIN32
+    SSH_TRACE(SSH_TRACE_SOCKET_WRITE, s->fd, w, 1);
+#else
+    SSH_TRACE(SSH_TRACE_SOCKET_WRITE, s->fd, w, s->tx_count);
+#endif
     /* Reactive the POLLOUT detector in the poll multiplexer system */
     if (s->poll_handle) {
         SSH_LOG(SSH_LOG_PACKET, "Enabling POLLOUT for socket");
@@ -640,17 +756,121 @@ void ssh_socket_fd_set(ssh_socket s, fd_set *set, socket_t *max_fd)
  */
 int ssh_socket_write(ssh_socket s, const void *buffer, int len)
 {
+    ssh_buffer tail = NULL;
+    int i;
+
     if (len > 0) {
-        if (ssh_buffer_add_data(s->out_buffer, buffer, len) < 0) {
-            ssh_set_error_oom(s->session);
-            return SSH_ERROR;
+        if (s->tx_count == 0) {
+            tail = ssh_socket_tx_get_spare(s);
+            if (tail == NULL) {
+                ssh_set_error_oom(s->session);
+                return SSH_ERROR;
+            }
+            /* only queue the buffer once it holds the data, an empty entry
+             * would never be consumed */
+            if (ssh_buffer_add_data(tail, buffer, len) < 0) {
+                ssh_socket_tx_recycle(s, tail);
+                ssh_set_error_oom(s->session);
+                return SSH_ERROR;
+            }
+            ssh_socket_tx_push(s, tail);
+        } else {
+            i = (s->tx_head + s->tx_count - 1) % SSH_SOCKET_TX_QUEUE_LEN;
+            tail = s->tx_queue[i];
+            if (ssh_buffer_add_data(tail, buffer, len) < 0) {
+                ssh_set_error_oom(s->session);
+                return SSH_ERROR;
+            }
+            s->tx_bytes += len;
+        }
+        if (!s->corked) {
+            ssh_socket_nonblocking_flush(s);
         }
+    }
+
+    return SSH_OK;
+}
+
+/** \internal
+ * \brief queues a whole buffer for writing without copying it
+ *
+ * The socket takes *buffer and replaces it with an empty one.
+ * \returns SSH_OK, or SSH_ERROR
+ * \warning has no effect on socket before a flush
+ */
+int ssh_socket_write_buffer(ssh_socket s, ssh_buffer *buffer)
+{
+    ssh_buffer empty = NULL;
+
+    if (ssh_buffer_get_len(*buffer) == 0) {
+        return SSH_OK;
+    }
+
+    if (s->tx_count == SSH_SOCKET_TX_QUEUE_LEN && s->corked) {
+        ssh_socket_nonblocking_flush(s);
+    }
+
+    /* the peer is not reading, stop growing the writev */
+    if (s->tx_count == SSH_SOCKET_TX_QUEUE_LEN) {
+        return ssh_socket_write(s,
+                                ssh_buffer_get(*buffer),
+                                ssh_buffer_get_len(*buffer));
+    }
+
+    empty = ssh_socket_tx_get_spare(s);
+    if (empty == NULL) {
+        ssh_set_error_oom(s->session);
+        return SSH_ERROR;
+    }
+    ssh_socket_tx_push(s, *buffer);
+    *buffer = empty;
+    if (!s->corked) {
         ssh_socket_nonblocking_flush(s);
     }
 
     return SSH_OK;
 }
 
+/** \internal
+ * \brief holds back the flush of written data until ssh_socket_uncork()
+ *
+ * Packets produced in a row are then encrypted back to back and leave in a
+ * single writev(). Calls nest. ssh_handle_packets() flushes whatever is
+ * held back before it waits, so a corked sender can't stall the peer.
+ */
+void ssh_socket_cork(ssh_socket s)
+{
+    s->corked++;
+}
+
+/** \internal
+ * \brief ends a ssh_socket_cork(), flushing when it was the outermost one
+ * \returns SSH_OK, SSH_AGAIN or SSH_ERROR like ssh_socket_nonblocking_flush()
+ */
+int ssh_socket_uncork(ssh_socket s)
+{
+    if (s->corked > 0) {
+        s->corked--;
+    }
+    if (s->corked > 0) {
+        return SSH_OK;
+    }
+
+    return ssh_socket_flush_corked(s);
+}
+
+/** \internal
+ * \brief flushes the data a cork is holding back, before blocking
+ */
+int ssh_socket_flush_corked(ssh_socket s)
+{
+    if (s->tx_bytes == 0 || !ssh_socket_is_open(s)) {
+        return SSH_OK;
+    }
+
+    return ssh_socket_nonblocking_flush(s);
+}
+
 
 /** \internal
  * \brief starts a nonblocking flush of the output buffer
@@ -678,7 +898,7 @@ int ssh_socket_nonblocking_flush(ssh_socket s)
         return SSH_ERROR;
     }
 
-    len = ssh_buffer_get_len(s->out_buffer);
+    len = s->tx_bytes;
     if (!s->write_wontblock && s->poll_handle && len > 0) {
         /* force the poll system to catch pollout events */
         ssh_poll_add_events(s->poll_handle, POLLOUT);
@@ -689,9 +909,8 @@ int ssh_socket_nonblocking_flush(ssh_socket s)
     if (s->write_wontblock && len > 0) {
         ssize_t bwritten;
 
-        bwritten = ssh_socket_unbuffered_write(s,
-                                               ssh_buffer_get(s->out_buffer),
-                                               len);
+        bwritten = ssh_socket_unbuffered_write(s);
+        s->activity++;
         if (bwritten < 0) {
             session->alive = 0;
             ssh_socket_close(s);
@@ -711,14 +930,14 @@ int ssh_socket_nonblocking_flush(ssh_socket s)
             return SSH_ERROR;
         }
 
-        ssh_buffer_pass_bytes(s->out_buffer, bwritten);
+        ssh_socket_tx_consume(s, bwritten);
         if (s->session->socket_counter != NULL) {
             s->session->socket_counter->out_bytes += bwritten;
         }
     }
 
     /* Is there some data pending? */
-    len = ssh_buffer_get_len(s->out_buffer);
+    len = s->tx_bytes;
     if (s->poll_handle && len > 0) {
         /* force the poll system to catch pollout events */
         ssh_poll_add_events(s->poll_handle, POLLOUT);
@@ -745,6 +964,20 @@ void ssh_socket_set_except(ssh_socket s)
     s->data_except = 1;
 }
 
+/** @internal
+ * @brief counts the events handled on the socket
+ *
+ * Whatever a wait is for can only have happened when the count moved.
+ */
+unsigned int ssh_socket_get_activity(ssh_socket s)
+{
+    if (s == NULL) {
+        return 0;
+    }
+
+    return s->activity;
+}
+
 int ssh_socket_data_available(ssh_socket s)
 {
     return s->read_wontblock;
@@ -762,11 +995,11 @@ int ssh_socket_data_writable(ssh_socket s)
  */
 int ssh_socket_buffered_write_bytes(ssh_socket s)
 {
-    if (s==NULL || s->out_buffer == NULL) {
+    if (s==NULL) {
         return 0;
     }
 
-    return ssh_buffer_get_len(s->out_buffer);
+    return s->tx_bytes;
 }
 
 
@@ -778,7 +1011,7 @@ int ssh_socket_get_status(ssh_socket s)
         r |= SSH_READ_PENDING;
     }
 
-    if (ssh_buffer_get_len(s->out_buffer) > 0) {
+    if (s->tx_bytes > 0) {
         r |= SSH_WRITE_PENDING;
     }
 
@@ -0,0 +1,162 @@
+/*
+ * trace.c - binary event ring for the hot paths
+ *
+ * This file is part of the SSH Library
+ *
+ * The SSH Library is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU Lesser General Public License as published by
+ * the Free Software Foundation; either version 2.1 of the License, or (at your
+ * option) any later version.
+ *
+ * The SSH Library is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+ * or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU Lesser General Public
+ * License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public License
+ * along with the SSH Library; see the file COPYING.  If not, write to
+ * the Free Software Foundation, Inc., 59 Temple Place - Suite 330, Boston,
+ * MA 02111-1307, USA.
+ */
+
+#include "libssh_esp32_config.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "libssh/priv.h"
+#include "libssh/trace.h"
+
+#ifdef WITH_TRACE
+
+/*
+ * Events the ring holds before the oldest are overwritten, a power of two.
+ * Each takes sizeof(struct ssh_trace_event), 24 bytes.
+ */
+#ifndef SSH_TRACE_RING_SIZE
+#define SSH_TRACE_RING_SIZE 1024
+#endif
+
+#if (SSH_TRACE_RING_SIZE & (SSH_TRACE_RING_SIZE - 1)) != 0
+#error "SSH_TRACE_RING_SIZE must be a power of two"
+#endif
+
+/*
+ * Writers claim a slot by incrementing head and publish it by storing its
+ * sequence number last. Nothing is locked: a writer that laps a slower one
+ * on the same slot can garble that event, the dump then skips it because
+ * the sequence number doesn't match.
+ */
+static struct ssh_trace_event ssh_trace_ring[SSH_TRACE_RING_SIZE];
+static uint32_t ssh_trace_head;
+
+static uint32_t ssh_trace_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000);
+}
+
+void ssh_trace_record(enum ssh_trace_id id,
+                      uint32_t a0,
+                      uint32_t a1,
+                      uint32_t a2)
+{
+    struct ssh_trace_event *event = NULL;
+    uint32_t idx;
+
+    idx = __atomic_fetch_add(&ssh_trace_head, 1, __ATOMIC_RELAXED);
+    event = &ssh_trace_ring[idx & (SSH_TRACE_RING_SIZE - 1)];
+
+    __atomic_store_n(&event->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    event->id = (uint16_t)id;
+    event->time = ssh_trace_now();
+    event->args[0] = a0;
+    event->args[1] = a1;
+    event->args[2] = a2;
+    __atomic_store_n(&event->seq, idx + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Write the events in the trace ring to a file.
+ *
+ * Recording goes on while the ring is read. Events overwritten during the
+ * dump are left out.
+ *
+ * @param[in]  filename The file to create, decoded with trace_decode.
+ *
+ * @return              SSH_OK, or SSH_ERROR if the file couldn't be
+ *                      written or tracing isn't compiled in (WITH_TRACE).
+ */
+int ssh_trace_dump(const char *filename)
+{
+    struct ssh_trace_header header;
+    struct ssh_trace_event event;
+    uint32_t head, idx, seq;
+    FILE *file = NULL;
+    int rc = SSH_ERROR;
+
+    file = fopen(filename, "wb");
+    if (file == NULL) {
+        return SSH_ERROR;
+    }
+
+    ZERO_STRUCT(header);
+    memcpy(header.magic, SSH_TRACE_MAGIC, sizeof(header.magic));
+    header.version = SSH_TRACE_VERSION;
+    header.event_size = sizeof(struct ssh_trace_event);
+
+    head = __atomic_load_n(&ssh_trace_head, __ATOMIC_ACQUIRE);
+    header.recorded = head;
+    if (fwrite(&header, sizeof(header), 1, file) != 1) {
+        goto out;
+    }
+
+    idx = head > SSH_TRACE_RING_SIZE ? head - SSH_TRACE_RING_SIZE : 0;
+    for (; idx != head; idx++) {
+        struct ssh_trace_event *slot =
+            &ssh_trace_ring[idx & (SSH_TRACE_RING_SIZE - 1)];
+
+        seq = __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE);
+        if (seq != idx + 1) {
+            continue;
+        }
+        memcpy(&event, slot, sizeof(event));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != seq) {
+            continue;
+        }
+
+        if (fwrite(&event, sizeof(event), 1, file) != 1) {
+            goto out;
+        }
+        header.count++;
+    }
+
+    /* the count is only known now */
+    if (fseek(file, 0, SEEK_SET) != 0 ||
+        fwrite(&header, sizeof(header), 1, file) != 1) {
+        goto out;
+    }
+    rc = SSH_OK;
+
+out:
+    if (fclose(file) != 0) {
+        rc = SSH_ERROR;
+    }
+    return rc;
+}
+
+#else /* WITH_TRACE */
+
+int ssh_trace_dump(const char *filename)
+{
+    (void)filename;
+    return SSH_ERROR;
+}
+
+#endif /* WITH_TRACE */
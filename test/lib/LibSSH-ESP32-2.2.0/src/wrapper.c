@@ -368,13 +368,25 @@ static int crypt_set_algorithms2(ssh_session session)
     if (cmp == 0) {
         session->next_crypto->do_compress_in = 1;
     }
+    /*
+     * Delayed compression starts once the user is authenticated, keys
+     * negotiated by a later rekey must pick it up straight away.
+     */
     cmp = strcmp(session->next_crypto->kex_methods[SSH_COMP_C_S], "zlib@openssh.com");
     if (cmp == 0) {
-        session->next_crypto->delayed_compress_out = 1;
+        if (session->flags & SSH_SESSION_FLAG_AUTHENTICATED) {
+            session->next_crypto->do_compress_out = 1;
+        } else {
+            session->next_crypto->delayed_compress_out = 1;
+        }
     }
     cmp = strcmp(session->next_crypto->kex_methods[SSH_COMP_S_C], "zlib@openssh.com");
     if (cmp == 0) {
-        session->next_crypto->delayed_compress_in = 1;
+        if (session->flags & SSH_SESSION_FLAG_AUTHENTICATED) {
+            session->next_crypto->do_compress_in = 1;
+        } else {
+            session->next_crypto->delayed_compress_in = 1;
+        }
     }
 
     return SSH_OK;
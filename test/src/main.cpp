@@ -3,12 +3,38 @@
 
 #include "FS.h"
 #include "SPIFFS.h"
+#include "libssh/arena.h"
+#include "libssh/crypto_provider.h"
 #include "libssh/libssh.h"
 #include "libssh/scp.h"
 #include "libssh_esp32.h"
+#include "segment_compress.h"
+#include "ssh_pipeline.h"
 
 #define FORMAT_SPIFFS_IF_FAILED false
 
+// startup runs as concurrent stages, setup() waits for all of them
+#define STAGE_WIFI (1 << 0)      // associated and got an address
+#define STAGE_STORAGE (1 << 1)   // SPIFFS mounted and segments scanned
+#define STAGE_RESOLVED (1 << 2)  // ssh_host looked up
+#define STAGE_FAILED (1 << 3)
+#define STAGES_READY (STAGE_WIFI | STAGE_STORAGE | STAGE_RESOLVED)
+#define STARTUP_TIMEOUT_MS 30000
+
+#define MAX_SEGMENTS 16
+#define UPLOAD_CHUNK 1024
+
+#define UART_BAUD 115200
+#define UART_LOG_PATH "/current.log"
+
+// raise for troubleshooting in the field, libssh only formats the lines
+// and log_task writes them out in batches
+#define SSH_LOG_LEVEL SSH_LOG_NOLOG
+#define SSH_LOG_BUFFER_SIZE 8192  // a power of two
+#define SSH_LOG_FLUSH_MS 200
+#define SSH_LOG_TO_SPIFFS false  // else to Serial
+#define SSH_LOG_PATH "/ssh.log"
+
 const char *ssid = "nah no free wifi here";
 const char *password = "no you don't";
 
@@ -17,75 +43,96 @@ const char *ssh_user = "username";
 const char *ssh_password = "password";
 int ssh_port = 22;
 
+// ed25519 key to authenticate with before the password, if present. It's
+// parsed once and saved raw next to it, later boots just read the 64 bytes
+// as long as the size and hash of the key file saved with them still match.
+// The raw file is the private key in the clear, as is the key file itself
+// (no passphrase is given for it): both are only as safe as the flash, so
+// enable flash encryption on devices that leave the bench
+const char *ssh_key_path = "/id_ed25519";
+const char *ssh_key_raw_path = "/id_ed25519.raw";
+
 const char *scp_path = ".";  // this is temporary
 SET_LOOP_TASK_STACK_SIZE(16 * 1024); // try 16k stack
 
+static EventGroupHandle_t startup_stages;
+static unsigned long stage_done_ms[3];
+
+static char ssh_host_addr[40];  // ssh_host, resolved once the radio is up
+
+static uint32_t ssh_log_buffer[SSH_LOG_BUFFER_SIZE / 4];
+
+static unsigned char ssh_key_raw[SSH_PKI_ED25519_RAW_LEN];
+static uint32_t ssh_key_stamp[2];  // size and hash of ssh_key_path
+static bool ssh_key_raw_read;
+static ssh_key ssh_auth_key;
+
+static char segments[MAX_SEGMENTS][32];  // compressed segments to upload
+static int segment_count;
+
+static ssh_session my_ssh_session;
+static struct ssh_pipeline pipeline;
+static bool session_done;
+static unsigned long wake_ms;
+
+void stage_done(EventBits_t stage, int index) {
+    stage_done_ms[index] = millis();
+    xEventGroupSetBits(startup_stages, stage);
+}
+
+void wifi_event(WiFiEvent_t event) {
+    if (event == ARDUINO_EVENT_WIFI_STA_GOT_IP) {
+        Serial.println(WiFi.localIP());
+        stage_done(STAGE_WIFI, 0);
+    }
+}
+
+// only starts association, STAGE_WIFI is set from the event handler
 void wifi_setup(const char *ssid, const char *password) {
+    WiFi.onEvent(wifi_event);
     WiFi.mode(WIFI_STA);
     WiFi.begin(ssid, password);
     Serial.println("Connecting...");
-    while (WiFi.status() != WL_CONNECTED) {
-        Serial.print(".");
-        delay(500);
-    }
-    Serial.println(WiFi.localIP());
 }
 
-int ssh_setup(ssh_session session, const char *ssh_host, int ssh_port) {
-    int rc;
-
+void ssh_setup(ssh_session session, const char *ssh_host, int ssh_port,
+               const char *ssh_user) {
     ssh_options_set(session, SSH_OPTIONS_HOST, ssh_host);
     ssh_options_set(session, SSH_OPTIONS_PORT, &ssh_port);
+    ssh_options_set(session, SSH_OPTIONS_USER, ssh_user);
 
     Serial.println("SSH options set");
-
-    rc = ssh_connect(session);
-    Serial.println("ssh_connect run");
-    if (rc != SSH_OK) {
-        Serial.printf("Error connecting to %s: %s\n", ssh_host,
-                      ssh_get_error(session));
-        return rc;
-    }
-    Serial.println("SSH connected");
-    return 0;
 }
 
-int ssh_authenticate(ssh_session session, const char *host, const char *user,
-                     const char *password) {
-    int rc;
-
-    rc = ssh_userauth_password(session, user, password);
-    if (rc != SSH_OK) {
-        Serial.printf("Error authenticating to %s: %s\n", host,
-                      ssh_get_error(session));
-        return rc;
+// show which crypto provider ended up serving the packets of this session
+void printCryptoStats() {
+    for (int accelerated = 1; accelerated >= 0; accelerated--) {
+        const struct ssh_crypto_provider_struct *p =
+            ssh_crypto_provider_get(accelerated);
+        struct ssh_crypto_provider_stats stats;
+        if (p == NULL ||
+            ssh_crypto_provider_get_stats(accelerated, &stats) != SSH_OK) {
+            continue;
+        }
+        Serial.printf("crypto %s: %llu hmac, %llu cipher, %llu aead, %llu bytes\n",
+                      p->name, stats.hmac_packets, stats.cipher_calls,
+                      stats.aead_packets, stats.bytes);
     }
-    Serial.println("SSH authenticated");
-    return 0;
 }
 
-ssh_scp scp_setup(int *rc, ssh_session session, const char *scp_path) {
-    ssh_scp scp;
-
-    scp = ssh_scp_new(session, SSH_SCP_WRITE | SSH_SCP_RECURSIVE, scp_path);
-    if (scp == NULL) {
-        Serial.printf("Error creating SCP session: %s\n",
-                      ssh_get_error(session));
-        *rc = -1;
-        return NULL;
+// arena counters plus how broken up the heap is; a largest free block far
+// below the free total means fragmentation
+void printHeapStats(ssh_session session) {
+    struct ssh_arena_stats arena;
+    if (ssh_get_packet_arena_stats(session, &arena) == SSH_OK) {
+        Serial.printf("packet arena: %llu allocs, %llu overflows, %llu resets, "
+                      "%u bytes (peak %u)\n",
+                      arena.allocs, arena.overflows, arena.resets,
+                      (unsigned)arena.size, (unsigned)arena.peak);
     }
-    Serial.println("Created SCP session");
-
-    *rc = ssh_scp_init(scp);
-    if (*rc != SSH_OK) {
-        Serial.printf("Error initializing SCP session: %s\n",
-                      ssh_get_error(session));
-        ssh_scp_free(scp);
-        return NULL;
-    }
-    Serial.println("Initialized SCP session");
-
-    return scp;
+    Serial.printf("heap: %u free, %u largest block, %u min free\n",
+                  ESP.getFreeHeap(), ESP.getMaxAllocHeap(),
+                  ESP.getMinFreeHeap());
 }
 
 void reset() {
@@ -188,95 +235,420 @@ void deleteFile(fs::FS &fs, const char *path) {
     }
 }
 
-void setup() {
-    int rc;
-    Serial.begin(115200);
-    wifi_setup(ssid, password);
+// compress a log segment at rest so it only has to be done once, not on
+// every upload attempt. returns the compressed size, or -1 on failure
+int compressFile(fs::FS &fs, const char *src_path, const char *dst_path) {
+    Serial.printf("Compressing file %s to %s\r\n", src_path, dst_path);
 
-    Serial.println("wifi connected");
+    File src = fs.open(src_path);
+    if (!src || src.isDirectory()) {
+        Serial.println("- failed to open file for reading");
+        return -1;
+    }
+    File dst = fs.open(dst_path, FILE_WRITE);
+    if (!dst) {
+        Serial.println("- failed to open file for writing");
+        return -1;
+    }
 
-    libssh_begin();
-    ssh_session my_ssh_session = ssh_new();
-    if (my_ssh_session == NULL) {
-        // something went very wrong
-        Serial.println("something broke, failed to create ssh session");
-        reset();
+    // heap rather than stack, the loop task only has 16k
+    struct segment_compressor *c =
+        (struct segment_compressor *)malloc(sizeof(*c));
+    uint8_t *in = (uint8_t *)malloc(SEGMENT_BLOCK_SIZE);
+    uint8_t *out = (uint8_t *)malloc(SEGMENT_BLOCK_BOUND(SEGMENT_BLOCK_SIZE));
+    int total = -1;
+    size_t m;
+
+    if (c == NULL || in == NULL || out == NULL) {
+        Serial.println("- out of memory");
+        goto done;
     }
-    Serial.println("ssh session created");
 
-    ssh_setup(my_ssh_session, ssh_host, ssh_port);
+    total = segment_frame_header(out);
+    if (dst.write(out, total) != (size_t)total) {
+        Serial.println("- write failed");
+        total = -1;
+        goto done;
+    }
+    while (src.available()) {
+        size_t n = src.read(in, SEGMENT_BLOCK_SIZE);
+        m = segment_compress_block(c, in, n, out);
+        if (dst.write(out, m) != m) {
+            Serial.println("- write failed");
+            total = -1;
+            goto done;
+        }
+        total += m;
+    }
+    m = segment_frame_footer(out);
+    if (dst.write(out, m) != m) {
+        Serial.println("- write failed");
+        total = -1;
+        goto done;
+    }
+    total += m;
+    Serial.printf("- %d bytes compressed to %d\r\n", src.size(), total);
+
+done:
+    free(c);
+    free(in);
+    free(out);
+    return total;
+}
 
-    // Serial.println("let's get a ssh connection");
+// collect the compressed segments waiting in the root of the fs
+void scanSegments(fs::FS &fs) {
+    File root = fs.open("/");
+    if (!root || !root.isDirectory()) {
+        Serial.println("- failed to open directory");
+        return;
+    }
 
-    ssh_authenticate(my_ssh_session, ssh_host, ssh_user, ssh_password);
+    segment_count = 0;
+    File file = root.openNextFile();
+    while (file && segment_count < MAX_SEGMENTS) {
+        const char *name = file.name();
+        size_t len = strlen(name);
+        if (!file.isDirectory() && len > 4 &&
+            strcmp(name + len - 4, ".lz4") == 0) {
+            // older cores give the full path, newer ones just the name
+            snprintf(segments[segment_count], sizeof(segments[0]), "%s%s",
+                     name[0] == '/' ? "" : "/", name);
+            segment_count++;
+        }
+        file = root.openNextFile();
+    }
+    Serial.printf("%d segments to upload\r\n", segment_count);
+}
 
-    // Serial.println("ssh should be ready");
+// size and FNV-1a hash of the key file, to tell when it was replaced
+bool keyStamp(fs::FS &fs, uint32_t stamp[2]) {
+    File file = fs.open(ssh_key_path);
+    if (!file || file.isDirectory()) {
+        return false;
+    }
 
-    // now let's send a file via scp (is this actually an option or do i need to
-    // find a sftp implementation?)
+    uint32_t hash = 2166136261u;
+    uint8_t buf[64];
+    size_t n;
+    while ((n = file.read(buf, sizeof(buf))) > 0) {
+        for (size_t i = 0; i < n; i++) {
+            hash = (hash ^ buf[i]) * 16777619u;
+        }
+    }
+    stamp[0] = file.size();
+    stamp[1] = hash;
+    return true;
+}
+
+// part of the storage stage so the flash read overlaps with WiFi
+void readRawKey(fs::FS &fs) {
+    uint32_t stamp[2];
+
+    if (!keyStamp(fs, ssh_key_stamp)) {
+        // the key was taken away, so goes its copy
+        if (fs.exists(ssh_key_raw_path)) {
+            deleteFile(fs, ssh_key_raw_path);
+        }
+        return;
+    }
 
-    // first write a file to the fs
+    File file = fs.open(ssh_key_raw_path);
+    if (!file) {
+        return;
+    }
+    ssh_key_raw_read =
+        file.read(ssh_key_raw, sizeof(ssh_key_raw)) == sizeof(ssh_key_raw) &&
+        file.read((uint8_t *)stamp, sizeof(stamp)) == sizeof(stamp) &&
+        memcmp(stamp, ssh_key_stamp, sizeof(stamp)) == 0;
+    file.close();
+    if (!ssh_key_raw_read) {
+        // made from an older key, loadKey() parses the new one
+        memset(ssh_key_raw, 0, sizeof(ssh_key_raw));
+    }
+}
+
+// NULL means password auth
+ssh_key loadKey(fs::FS &fs) {
+    ssh_key key = NULL;
+    char path[64];
+
+    if (ssh_key_raw_read) {
+        int rc = ssh_pki_import_privkey_ed25519_raw(
+            ssh_key_raw, sizeof(ssh_key_raw), &key);
+        memset(ssh_key_raw, 0, sizeof(ssh_key_raw));
+        if (rc == SSH_OK) {
+            return key;
+        }
+    }
+
+    // libssh opens files through the VFS, which has SPIFFS at /spiffs
+    snprintf(path, sizeof(path), "/spiffs%s", ssh_key_path);
+    if (ssh_pki_import_privkey_file_cached(path, NULL, NULL, NULL, &key) !=
+        SSH_OK) {
+        Serial.println("No ssh key, using the password");
+        return NULL;
+    }
+    if (ssh_pki_export_privkey_ed25519_raw(key, ssh_key_raw,
+                                           sizeof(ssh_key_raw)) == SSH_OK) {
+        File file = fs.open(ssh_key_raw_path, FILE_WRITE);
+        if (file) {
+            file.write(ssh_key_raw, sizeof(ssh_key_raw));
+            file.write((const uint8_t *)ssh_key_stamp, sizeof(ssh_key_stamp));
+            file.close();
+        }
+        memset(ssh_key_raw, 0, sizeof(ssh_key_raw));
+    }
+    return key;
+}
+
+void storage_task(void *arg) {
     if (!SPIFFS.begin(FORMAT_SPIFFS_IF_FAILED)) {
         Serial.println("SPIFFS Mount Failed");
+        xEventGroupSetBits(startup_stages, STAGE_FAILED);
+        vTaskDelete(NULL);
         return;
-    } else {
-        Serial.println("SPIFFS Mount Succeeded");
     }
+    Serial.println("SPIFFS Mount Succeeded");
 
     writeFile(SPIFFS, "/test.txt", "test file\r\n");  // write a test file to fs
     readFile(SPIFFS, "/test.txt");
+    if (compressFile(SPIFFS, "/test.txt", "/test.txt.lz4") < 0) {
+        // don't leave a cut off segment for scanSegments to upload
+        deleteFile(SPIFFS, "/test.txt.lz4");
+    }
+    scanSegments(SPIFFS);
+    readRawKey(SPIFFS);
 
-    ssh_scp scp;
-    int length;
-    int scp_rc = 0;
+    stage_done(STAGE_STORAGE, 1);
+    vTaskDelete(NULL);
+}
 
-    scp = scp_setup(&scp_rc, my_ssh_session, scp_path);
-    if (scp == NULL) {
-        return;
+// drains the libssh log buffer; to SPIFFS only once it's mounted, falls
+// back to Serial if that fails
+void log_task(void *arg) {
+    static char chunk[2048];  // more than the longest libssh log line
+    bool to_spiffs = SSH_LOG_TO_SPIFFS;
+
+    if (to_spiffs) {
+        EventBits_t stages = xEventGroupWaitBits(
+            startup_stages, STAGE_STORAGE | STAGE_FAILED, pdFALSE, pdFALSE,
+            portMAX_DELAY);
+        to_spiffs = (stages & STAGE_STORAGE) != 0;
     }
 
-    Serial.print(scp_rc);
-    Serial.print("\n");
+    for (;;) {
+        size_t len = ssh_log_buffer_read(chunk, sizeof(chunk));
+        if (len == 0) {
+            vTaskDelay(pdMS_TO_TICKS(SSH_LOG_FLUSH_MS));
+            continue;
+        }
 
-    File file;
-    file = SPIFFS.open("/test.txt");
+        if (!to_spiffs) {
+            Serial.write((const uint8_t *)chunk, len);
+            continue;
+        }
+        File file = SPIFFS.open(SSH_LOG_PATH, FILE_APPEND);
+        if (!file) {
+            continue;
+        }
+        do {
+            file.write((const uint8_t *)chunk, len);
+            len = ssh_log_buffer_read(chunk, sizeof(chunk));
+        } while (len > 0);
+        file.close();
+    }
+}
 
-    length = file.size();
-    file.close();
+// resolve the server as soon as the radio is up so ssh_connect doesn't
+// have to; falls back to letting libssh resolve it
+void resolve_task(void *arg) {
+    IPAddress addr;
 
-    Serial.printf("%d\n", length);
-    rc = ssh_scp_push_file(scp, "test.txt", length, S_IRUSR | S_IWUSR);
-    if (rc != SSH_OK) {
-        Serial.printf("Can't open remote file: %s\n",
-                      ssh_get_error(my_ssh_session));
-        delay(2000);
-        return;
+    xEventGroupWaitBits(startup_stages, STAGE_WIFI, pdFALSE, pdTRUE,
+                        portMAX_DELAY);
+    if (WiFi.hostByName(ssh_host, addr)) {
+        strncpy(ssh_host_addr, addr.toString().c_str(),
+                sizeof(ssh_host_addr) - 1);
+    } else {
+        Serial.printf("Failed to resolve %s\n", ssh_host);
+        strncpy(ssh_host_addr, ssh_host, sizeof(ssh_host_addr) - 1);
     }
-    Serial.println("Opened remote file");
 
-    char contents[length];
-    File file1 = SPIFFS.open("/test.txt");
-    int i = 0;
-    while (file1.available()) {
-        contents[i] = file1.read();
-        i++;
+    stage_done(STAGE_RESOLVED, 2);
+    vTaskDelete(NULL);
+}
+
+// one step of the upload per call, opening a segment or sending a chunk of
+// it, so loop() gets back to the UART in between. returns false once all
+// segments are sent or one of them failed
+bool uploadStep(ssh_scp scp, ssh_session session, fs::FS &fs) {
+    static File file;
+    static int index;
+
+    if (index == segment_count) {
+        return false;
     }
-    file1.close();
+    const char *path = segments[index];
 
-    rc = ssh_scp_write(scp, contents, length);
-    if (rc != SSH_OK) {
-        Serial.printf("Can't write to remote file: %s\n",
-                      ssh_get_error(my_ssh_session));
-        return;
+    if (!file) {
+        file = fs.open(path);
+        if (!file || file.isDirectory()) {
+            Serial.println("- failed to open file for reading");
+            return false;
+        }
+        int rc = ssh_scp_push_file(scp, path + 1, file.size(),
+                                   S_IRUSR | S_IWUSR);
+        if (rc != SSH_OK) {
+            Serial.printf("Can't open remote file: %s\n",
+                          ssh_get_error(session));
+            file.close();
+            return false;
+        }
+        Serial.printf("Opened remote file %s\n", path + 1);
+        return true;
+    }
+
+    if (file.available()) {
+        char chunk[UPLOAD_CHUNK];
+        size_t n = file.read((uint8_t *)chunk, sizeof(chunk));
+        if (ssh_scp_write(scp, chunk, n) != SSH_OK) {
+            Serial.printf("Can't write to remote file: %s\n",
+                          ssh_get_error(session));
+            file.close();
+            return false;
+        }
+        return true;
     }
+
+    file.close();
     Serial.println("Wrote to remote file");
-    ssh_scp_close(scp);
-    ssh_scp_free(scp);
-    ssh_disconnect(my_ssh_session);
-    ssh_free(my_ssh_session);
-    ssh_finalize();
+    if (++index == segment_count) {
+        Serial.printf("uploads done %lu ms after wake\n", millis() - wake_ms);
+        return false;
+    }
+    return true;
+}
+
+void on_connected(struct ssh_pipeline *p, void *userdata) {
+    Serial.println("SSH connected");
+}
+
+void on_authenticated(struct ssh_pipeline *p, void *userdata) {
+    Serial.println("SSH authenticated");
+}
+
+// the segments go out from loop(), see uploadStep()
+void on_scp_ready(struct ssh_pipeline *p, ssh_scp scp, void *userdata) {
+    Serial.println("Initialized SCP session");
+}
+
+void on_failed(struct ssh_pipeline *p, enum ssh_pipeline_state failed_state,
+               void *userdata) {
+    Serial.printf("SSH failed in stage %d: %s\n", failed_state,
+                  ssh_get_error(p->session));
+}
+
+static struct ssh_pipeline_callbacks pipeline_callbacks = {
+    NULL, on_connected, on_authenticated, on_scp_ready, on_failed};
+
+// keep taking in what the Mega sends, also while the handshake is running;
+// buffered so SPIFFS sees a write per line rather than per byte
+void ingestSerial() {
+    static uint8_t buf[256];
+    static size_t len;
+
+    while (Serial2.available() && len < sizeof(buf)) {
+        buf[len++] = Serial2.read();
+        if (buf[len - 1] == '\n') {
+            break;
+        }
+    }
+    if (len == sizeof(buf) || (len > 0 && buf[len - 1] == '\n')) {
+        File file = SPIFFS.open(UART_LOG_PATH, FILE_APPEND);
+        if (file) {
+            file.write(buf, len);
+        }
+        len = 0;
+    }
+}
+
+void setup() {
+    unsigned long start = millis();
+    wake_ms = start;
+    Serial.begin(115200);
+    Serial2.begin(UART_BAUD);
+
+    startup_stages = xEventGroupCreate();
+    wifi_setup(ssid, password);
+    xTaskCreate(storage_task, "storage", 8192, NULL, 1, NULL);
+    xTaskCreate(resolve_task, "resolve", 4096, NULL, 1, NULL);
+
+    ssh_set_log_buffer(ssh_log_buffer, sizeof(ssh_log_buffer));
+    ssh_set_log_level(SSH_LOG_LEVEL);
+    xTaskCreate(log_task, "log", 4096, NULL, 1, NULL);
+
+    // libssh doesn't need the network yet, get it ready in the meantime
+    libssh_begin();
+    my_ssh_session = ssh_new();
+    if (my_ssh_session == NULL) {
+        // something went very wrong
+        Serial.println("something broke, failed to create ssh session");
+        reset();
+    }
+    Serial.println("ssh session created");
+
+    EventBits_t stages = 0;
+    while ((stages & STAGES_READY) != STAGES_READY) {
+        stages = xEventGroupWaitBits(startup_stages, STAGES_READY, pdFALSE,
+                                     pdTRUE, pdMS_TO_TICKS(100));
+        if ((stages & STAGE_FAILED) || millis() - start > STARTUP_TIMEOUT_MS) {
+            Serial.println("startup failed");
+            reset();
+        }
+    }
+    Serial.printf("ready after %lu ms (wifi %lu, storage %lu, dns %lu)\n",
+                  millis() - start, stage_done_ms[0] - start,
+                  stage_done_ms[1] - start, stage_done_ms[2] - start);
+
+    ssh_setup(my_ssh_session, ssh_host_addr, ssh_port, ssh_user);
+    ssh_auth_key = loadKey(SPIFFS);
+    if (ssh_auth_key != NULL) {
+        ssh_pipeline_start_publickey(&pipeline, my_ssh_session, ssh_auth_key,
+                                     ssh_password, scp_path,
+                                     SSH_SCP_WRITE | SSH_SCP_RECURSIVE,
+                                     &pipeline_callbacks);
+    } else {
+        ssh_pipeline_start(&pipeline, my_ssh_session, ssh_password, scp_path,
+                           SSH_SCP_WRITE | SSH_SCP_RECURSIVE,
+                           &pipeline_callbacks);
+    }
 }
 
 void loop() {
-    // put your main code here, to run repeatedly:
+    ingestSerial();
+
+    if (session_done) {
+        return;
+    }
+
+    enum ssh_pipeline_state state = ssh_pipeline_poll(&pipeline, 10);
+    if (state == SSH_PIPELINE_READY &&
+        uploadStep(pipeline.scp, my_ssh_session, SPIFFS)) {
+        return;
+    }
+    if (state == SSH_PIPELINE_READY || state == SSH_PIPELINE_FAILED) {
+        if (pipeline.scp != NULL) {
+            ssh_scp_close(pipeline.scp);
+            ssh_scp_free(pipeline.scp);
+        }
+        ssh_pipeline_free(&pipeline);
+        printCryptoStats();
+        printHeapStats(my_ssh_session);
+        ssh_disconnect(my_ssh_session);
+        ssh_free(my_ssh_session);
+        ssh_key_free(ssh_auth_key);
+        ssh_finalize();
+        session_done = true;
+    }
 }
@@ -0,0 +1,246 @@
+#include "segment_compress.h"
+
+#include <string.h>
+
+#if SEGMENT_BLOCK_SIZE > 65536
+#error "SEGMENT_BLOCK_SIZE must fit in the 16 bit match table"
+#endif
+
+#define MINMATCH 4
+#define LASTLITERALS 5  // the format requires the block to end in literals
+#define MFLIMIT 12      // and the last match to start this far from the end
+
+#define FRAME_MAGIC 0x184D2204U
+#define FRAME_FLG 0x60  // version 01, independent blocks, no checksums
+#define FRAME_BD 0x40   // 64KB max block size, the smallest one allowed
+
+#define BLOCK_UNCOMPRESSED 0x80000000U
+
+#define PRIME32_1 2654435761U
+#define PRIME32_2 2246822519U
+#define PRIME32_3 3266489917U
+#define PRIME32_4 668265263U
+#define PRIME32_5 374761393U
+
+static uint32_t read32(const uint8_t *p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static void write_le32(uint8_t *p, uint32_t v) {
+    p[0] = (uint8_t)v;
+    p[1] = (uint8_t)(v >> 8);
+    p[2] = (uint8_t)(v >> 16);
+    p[3] = (uint8_t)(v >> 24);
+}
+
+static uint32_t rotl32(uint32_t v, int r) { return (v << r) | (v >> (32 - r)); }
+
+// xxh32 with seed 0, only valid for inputs shorter than 16 bytes which is all
+// the frame descriptor checksum ever needs
+static uint32_t short_xxh32(const uint8_t *p, size_t len) {
+    uint32_t h = PRIME32_5 + (uint32_t)len;
+
+    while (len >= 4) {
+        h += (p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24) * PRIME32_3;
+        h = rotl32(h, 17) * PRIME32_4;
+        p += 4;
+        len -= 4;
+    }
+    while (len > 0) {
+        h += *p * PRIME32_5;
+        h = rotl32(h, 11) * PRIME32_1;
+        p++;
+        len--;
+    }
+
+    h ^= h >> 15;
+    h *= PRIME32_2;
+    h ^= h >> 13;
+    h *= PRIME32_3;
+    h ^= h >> 16;
+    return h;
+}
+
+static uint32_t hash_sequence(uint32_t seq) {
+    return (seq * PRIME32_1) >> (32 - SEGMENT_HASH_LOG);
+}
+
+// writes the continuation bytes of a length that overflowed its token nibble
+static uint8_t *write_length(uint8_t *op, size_t len) {
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = (uint8_t)len;
+    return op;
+}
+
+static uint8_t *write_literals(uint8_t *op, uint8_t *token, const uint8_t *lit,
+                               size_t len) {
+    if (len >= 15) {
+        *token = 15 << 4;
+        op = write_length(op, len - 15);
+    } else {
+        *token = (uint8_t)(len << 4);
+    }
+    memcpy(op, lit, len);
+    return op + len;
+}
+
+size_t segment_frame_header(uint8_t *dst) {
+    write_le32(dst, FRAME_MAGIC);
+    dst[4] = FRAME_FLG;
+    dst[5] = FRAME_BD;
+    dst[6] = (uint8_t)(short_xxh32(dst + 4, 2) >> 8);
+    return SEGMENT_FRAME_HEADER_SIZE;
+}
+
+size_t segment_frame_footer(uint8_t *dst) {
+    write_le32(dst, 0);  // end mark
+    return SEGMENT_FRAME_FOOTER_SIZE;
+}
+
+size_t segment_compress_block(struct segment_compressor *c, const uint8_t *src,
+                              size_t len, uint8_t *dst) {
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst + 4;
+    uint8_t *token;
+    size_t out_len;
+
+    if (len > SEGMENT_BLOCK_SIZE) {
+        return 0;
+    }
+
+    if (len > MFLIMIT) {
+        const uint8_t *mflimit = iend - MFLIMIT;
+        const uint8_t *matchlimit = iend - LASTLITERALS;
+
+        memset(c->table, 0, sizeof(c->table));
+        ip++;
+
+        while (ip < mflimit) {
+            uint32_t seq = read32(ip);
+            uint32_t h = hash_sequence(seq);
+            const uint8_t *ref = src + c->table[h];
+            const uint8_t *mp;
+            size_t match_len;
+
+            c->table[h] = (uint16_t)(ip - src);
+            if (read32(ref) != seq) {
+                ip++;
+                continue;
+            }
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            mp = ip + MINMATCH;
+            ref += MINMATCH;
+            while (mp < matchlimit && *mp == *ref) {
+                mp++;
+                ref++;
+            }
+            match_len = (size_t)(mp - ip) - MINMATCH;
+
+            token = op++;
+            op = write_literals(op, token, anchor, (size_t)(ip - anchor));
+            *op++ = (uint8_t)(mp - ref);
+            *op++ = (uint8_t)((mp - ref) >> 8);
+            if (match_len >= 15) {
+                *token |= 15;
+                op = write_length(op, match_len - 15);
+            } else {
+                *token |= (uint8_t)match_len;
+            }
+
+            anchor = ip = mp;
+        }
+    }
+
+    token = op++;
+    op = write_literals(op, token, anchor, (size_t)(iend - anchor));
+
+    out_len = (size_t)(op - dst) - 4;
+    if (out_len >= len) {
+        // incompressible, store it raw so the block never grows
+        write_le32(dst, (uint32_t)len | BLOCK_UNCOMPRESSED);
+        memcpy(dst + 4, src, len);
+        return len + 4;
+    }
+
+    write_le32(dst, (uint32_t)out_len);
+    return out_len + 4;
+}
+
+long segment_decompress_block(const uint8_t *src, size_t len, uint8_t *dst,
+                              size_t cap) {
+    const uint8_t *ip = src;
+    const uint8_t *iend = src + len;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + cap;
+
+    while (ip < iend) {
+        uint8_t token = *ip++;
+        size_t lit_len = token >> 4;
+        size_t match_len = token & 15;
+        size_t offset;
+        uint8_t b;
+
+        if (lit_len == 15) {
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                lit_len += b;
+            } while (b == 255);
+        }
+        if (lit_len > (size_t)(iend - ip) || lit_len > (size_t)(oend - op)) {
+            return -1;
+        }
+        memcpy(op, ip, lit_len);
+        op += lit_len;
+        ip += lit_len;
+
+        if (ip == iend) {
+            break;  // the last sequence has no match part
+        }
+
+        if (iend - ip < 2) {
+            return -1;
+        }
+        offset = ip[0] | (size_t)ip[1] << 8;
+        ip += 2;
+        if (offset == 0 || offset > (size_t)(op - dst)) {
+            return -1;
+        }
+
+        if (match_len == 15) {
+            do {
+                if (ip >= iend) {
+                    return -1;
+                }
+                b = *ip++;
+                match_len += b;
+            } while (b == 255);
+        }
+        match_len += MINMATCH;
+        if (match_len > (size_t)(oend - op)) {
+            return -1;
+        }
+
+        // byte by byte, the match may overlap the bytes it produces
+        while (match_len--) {
+            *op = *(op - offset);
+            op++;
+        }
+    }
+
+    return (long)(op - dst);
+}
@@ -0,0 +1,162 @@
+#include "ssh_pipeline.h"
+
+#include <string.h>
+
+#include "libssh/scp.h"
+
+static void pipeline_fail(struct ssh_pipeline *p) {
+    enum ssh_pipeline_state failed_state = p->state;
+
+    p->state = SSH_PIPELINE_FAILED;
+    if (p->event != NULL) {
+        ssh_event_remove_session(p->event, p->session);
+    }
+    if (p->callbacks != NULL && p->callbacks->failed != NULL) {
+        p->callbacks->failed(p, failed_state, p->callbacks->userdata);
+    }
+}
+
+// calls back into libssh until a stage would block
+static void pipeline_step(struct ssh_pipeline *p) {
+    struct ssh_pipeline_callbacks *cb = p->callbacks;
+    int rc;
+
+    if (p->state == SSH_PIPELINE_CONNECTING) {
+        rc = ssh_connect(p->session);
+        if (rc == SSH_AGAIN) {
+            // the socket only exists once the first ssh_connect() call
+            // started the connection
+            if (p->event == NULL) {
+                p->event = ssh_event_new();
+                if (p->event == NULL ||
+                    ssh_event_add_session(p->event, p->session) != SSH_OK) {
+                    pipeline_fail(p);
+                }
+            }
+            return;
+        }
+        if (rc != SSH_OK) {
+            pipeline_fail(p);
+            return;
+        }
+        p->state = SSH_PIPELINE_AUTHENTICATING;
+        if (cb != NULL && cb->connected != NULL) {
+            cb->connected(p, cb->userdata);
+        }
+    }
+
+    if (p->state == SSH_PIPELINE_AUTHENTICATING) {
+        if (p->privkey != NULL) {
+            rc = ssh_userauth_publickey(p->session, NULL, p->privkey);
+            if (rc == SSH_AUTH_DENIED && p->password != NULL) {
+                // not this key, fall back to the password from here on
+                p->privkey = NULL;
+                rc = ssh_userauth_password(p->session, NULL, p->password);
+            }
+        } else {
+            rc = ssh_userauth_password(p->session, NULL, p->password);
+        }
+        if (rc == SSH_AUTH_AGAIN) {
+            return;
+        }
+        if (rc != SSH_AUTH_SUCCESS) {
+            pipeline_fail(p);
+            return;
+        }
+        p->state = SSH_PIPELINE_OPENING_SCP;
+        if (cb != NULL && cb->authenticated != NULL) {
+            cb->authenticated(p, cb->userdata);
+        }
+    }
+
+    if (p->state == SSH_PIPELINE_OPENING_SCP) {
+        if (p->scp == NULL) {
+            p->scp = ssh_scp_new(p->session, p->scp_mode, p->scp_path);
+            if (p->scp == NULL) {
+                pipeline_fail(p);
+                return;
+            }
+        }
+        rc = ssh_scp_init(p->scp);
+        if (rc == SSH_AGAIN) {
+            return;
+        }
+        if (rc != SSH_OK) {
+            pipeline_fail(p);
+            return;
+        }
+
+        p->state = SSH_PIPELINE_READY;
+        if (p->event != NULL) {
+            ssh_event_remove_session(p->event, p->session);
+        }
+        ssh_set_blocking(p->session, 1);
+        if (cb != NULL && cb->scp_ready != NULL) {
+            cb->scp_ready(p, p->scp, cb->userdata);
+        }
+    }
+}
+
+static int pipeline_start(struct ssh_pipeline *p, ssh_session session,
+                          const char *password, ssh_key privkey,
+                          const char *scp_path, int scp_mode,
+                          struct ssh_pipeline_callbacks *callbacks) {
+    memset(p, 0, sizeof(*p));
+    p->session = session;
+    p->password = password;
+    p->privkey = privkey;
+    p->scp_path = scp_path;
+    p->scp_mode = scp_mode;
+    p->callbacks = callbacks;
+    p->state = SSH_PIPELINE_CONNECTING;
+
+    ssh_set_blocking(session, 0);
+    pipeline_step(p);
+
+    return p->state == SSH_PIPELINE_FAILED ? SSH_ERROR : SSH_OK;
+}
+
+int ssh_pipeline_start(struct ssh_pipeline *p, ssh_session session,
+                       const char *password, const char *scp_path,
+                       int scp_mode, struct ssh_pipeline_callbacks *callbacks) {
+    return pipeline_start(p, session, password, NULL, scp_path, scp_mode,
+                          callbacks);
+}
+
+int ssh_pipeline_start_publickey(struct ssh_pipeline *p, ssh_session session,
+                                 ssh_key privkey, const char *password,
+                                 const char *scp_path, int scp_mode,
+                                 struct ssh_pipeline_callbacks *callbacks) {
+    return pipeline_start(p, session, password, privkey, scp_path, scp_mode,
+                          callbacks);
+}
+
+enum ssh_pipeline_state ssh_pipeline_poll(struct ssh_pipeline *p,
+                                          int timeout_ms) {
+    if (p->state == SSH_PIPELINE_READY || p->state == SSH_PIPELINE_FAILED) {
+        return p->state;
+    }
+
+    if (p->event != NULL &&
+        ssh_event_dopoll(p->event, timeout_ms) == SSH_ERROR) {
+        // nothing to poll on is fine, a dead session is not
+        if (ssh_get_status(p->session) & (SSH_CLOSED | SSH_CLOSED_ERROR)) {
+            pipeline_fail(p);
+            return p->state;
+        }
+    }
+
+    pipeline_step(p);
+    return p->state;
+}
+
+void ssh_pipeline_free(struct ssh_pipeline *p) {
+    if (p->event != NULL) {
+        if (p->state != SSH_PIPELINE_READY &&
+            p->state != SSH_PIPELINE_FAILED) {
+            ssh_event_remove_session(p->event, p->session);
+        }
+        ssh_event_free(p->event);
+        p->event = NULL;
+    }
+}
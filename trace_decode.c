@@ -0,0 +1,155 @@
+#include <libssh/trace.h>
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+// prints a dump written by ssh_trace_dump() on a libssh built with
+// WITH_TRACE
+//
+// usage: trace_decode [-s] file
+//
+// one line per event with the time since the first one in microseconds and
+// the arguments by name. With -s only the number of events of each kind is
+// printed. The dump has to come from a device with the byte order of the
+// host, both the ESP32 and x86 are little endian
+
+#define MAX_ARGS 3
+
+struct event_kind {
+    const char *name;
+    const char *args[MAX_ARGS];
+};
+
+// indexed by enum ssh_trace_id
+static const struct event_kind kinds[] = {
+    [SSH_TRACE_PACKET_SEND] = {"packet_send", {"type", "len", "payload"}},
+    [SSH_TRACE_PACKET_RECV] = {"packet_recv", {"type", "len", "payload"}},
+    [SSH_TRACE_PACKET_DISPATCH] = {"packet_dispatch", {"type"}},
+    [SSH_TRACE_SOCKET_POLL] = {"socket_poll", {"fd", "revents", "queued"}},
+    [SSH_TRACE_SOCKET_READ] = {"socket_read", {"fd", "len"}},
+    [SSH_TRACE_SOCKET_WRITE] = {"socket_write", {"fd", "len", "packets"}},
+    [SSH_TRACE_CHANNEL_DATA_IN] = {"channel_data_in",
+                                   {"channel", "len", "window"}},
+    [SSH_TRACE_CHANNEL_DATA_OUT] = {"channel_data_out",
+                                    {"channel", "len", "window"}},
+    [SSH_TRACE_CHANNEL_WINDOW_WAIT] = {"channel_window_wait",
+                                       {"channel", "pending"}},
+    [SSH_TRACE_CHANNEL_WINDOW_ADJUST] = {"channel_window_adjust",
+                                         {"channel", "added", "window"}},
+    [SSH_TRACE_REKEY_START] = {"rekey_start", {"trigger"}},
+    [SSH_TRACE_REKEY_DONE] = {"rekey_done", {"stall_ms"}},
+};
+
+#define NUM_KINDS (sizeof(kinds) / sizeof(kinds[0]))
+
+int summary = 0;
+
+static void print_event(const struct ssh_trace_event *ev, uint64_t time) {
+    int i;
+
+    printf("%10llu %8u ", (unsigned long long)time, ev->seq - 1);
+    if (ev->id < NUM_KINDS && kinds[ev->id].name != NULL) {
+        const struct event_kind *k = &kinds[ev->id];
+
+        printf("%-22s", k->name);
+        for (i = 0; i < MAX_ARGS && k->args[i] != NULL; i++) {
+            // fd and len can be -1
+            printf(" %s=%d", k->args[i], (int32_t)ev->args[i]);
+        }
+    } else {
+        printf("unknown(%u)             ", ev->id);
+        for (i = 0; i < MAX_ARGS; i++) {
+            printf(" %u", ev->args[i]);
+        }
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv) {
+    struct ssh_trace_header header;
+    struct ssh_trace_event ev;
+    unsigned long counts[NUM_KINDS + 1];
+    uint32_t last = 0;
+    uint64_t time = 0;
+    uint32_t n;
+    FILE *file;
+    int opt;
+    size_t i;
+
+    while ((opt = getopt(argc, argv, "s")) != -1) {
+        switch (opt) {
+        case 's':
+            summary = 1;
+            break;
+        default:
+            fprintf(stderr, "usage: %s [-s] file\n", argv[0]);
+            return 1;
+        }
+    }
+    if (optind != argc - 1) {
+        fprintf(stderr, "usage: %s [-s] file\n", argv[0]);
+        return 1;
+    }
+
+    file = fopen(argv[optind], "rb");
+    if (file == NULL) {
+        perror(argv[optind]);
+        return 1;
+    }
+
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, SSH_TRACE_MAGIC, sizeof(header.magic)) != 0) {
+        fprintf(stderr, "%s: not a trace dump\n", argv[optind]);
+        return 1;
+    }
+    if (header.version != SSH_TRACE_VERSION ||
+        header.event_size != sizeof(struct ssh_trace_event)) {
+        fprintf(stderr, "%s: version %u with %u byte events, expected %u "
+                "with %zu\n", argv[optind], header.version, header.event_size,
+                SSH_TRACE_VERSION, sizeof(struct ssh_trace_event));
+        return 1;
+    }
+
+    memset(counts, 0, sizeof(counts));
+    for (n = 0; n < header.count; n++) {
+        if (fread(&ev, sizeof(ev), 1, file) != 1) {
+            fprintf(stderr, "%s: truncated after %u events\n", argv[optind],
+                    n);
+            break;
+        }
+
+        // the device clock is 32 bits of microseconds, unsigned subtraction
+        // carries over a wrap as long as events are less than 71 minutes
+        // apart
+        if (n > 0) {
+            time += (uint32_t)(ev.time - last);
+        }
+        last = ev.time;
+
+        counts[ev.id < NUM_KINDS ? ev.id : NUM_KINDS]++;
+        if (!summary) {
+            print_event(&ev, time);
+        }
+    }
+    fclose(file);
+
+    if (summary) {
+        for (i = 0; i < NUM_KINDS; i++) {
+            if (kinds[i].name != NULL) {
+                printf("%-22s %lu\n", kinds[i].name, counts[i]);
+            }
+        }
+        if (counts[NUM_KINDS] > 0) {
+            printf("%-22s %lu\n", "unknown", counts[NUM_KINDS]);
+        }
+        printf("%-22s %llu us\n", "span", (unsigned long long)time);
+    }
+    if (header.recorded > header.count) {
+        fprintf(stderr, "%u of %u recorded events in the dump\n",
+                header.count, header.recorded);
+    }
+    return 0;
+}